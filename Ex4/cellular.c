@@ -19,6 +19,7 @@ bool splitOpTokensToOPINFO(unsigned char * op_token, OPERATOR_INFO *opInfo);
 #define MAX_AT_CMD_LEN 100
 #define GENERAL_RECV_TIMEOUT_MS 100
 #define GENERAL_RECV_DLY_TIMEOUT_MS 150
+#define MODEM_STARTUP_WAIT_MS 2000      // between looking for the modem at every rate
 #define GET_OPS_TIMEOUT_MS 120000
 #define MAX_conProfileId 5
 //#define MAX_srvProfileId 9
@@ -39,6 +40,7 @@ unsigned char command_to_send_buffer[MAX_AT_CMD_LEN] = "";
 unsigned char AT_CMD_SUFFIX[] = "\r\n";
 // AT_COMMANDS
 unsigned char AT_CMD_ECHO_OFF[] = "ATE0\r\n";
+unsigned char AT_CMD_FLOW_RTS_CTS[] = "AT\\Q3\r\n";
 unsigned char AT_CMD_AT[] = "AT\r\n";
 unsigned char AT_CMD_COPS_TEST[] = "AT+COPS=?\r\n";
 const unsigned char AT_CMD_COPS_WRITE_PREFIX[] = "AT+COPS=";
@@ -62,6 +64,10 @@ unsigned char AT_RES_SYSSTART[] = "^SYSSTART";
 unsigned char AT_RES_PBREADY[] = "+PBREADY";
 unsigned char AT_URC_SHUTDOWN[] = "^SHUTDOWN";
 
+// Final result codes, a response is complete once one of them arrives.
+#define NUM_FINAL_RESPONSES 3
+const char * AT_FINAL_RESPONSES[NUM_FINAL_RESPONSES] = {"OK", "ERROR", "+CME ERROR"};
+
 // Internet connection profile identifier. 0..5
 // The <conProfileId> identifies all parameters of a connection profile,
 // and, when a service profile is created with AT^SISS the <conProfileId>
@@ -74,6 +80,9 @@ int conProfileId = -1;
 //<srvProfileId> is needed to select a specific service profile.
 int srvProfileId = -1;
 
+// rate the link runs at, CellularInit negotiates it up from MODEM_BAUD_RATE
+static unsigned int modem_baud = MODEM_BAUD_RATE;
+
 
 /**
  * Initialize whatever is needed to start working with the cellular modem (e.g. the serial port).
@@ -83,15 +92,20 @@ void CellularInit(char *port){
     printf("Initializing Cellular modem... ");
 
     if (!CELLULAR_INITIALIZED) {
-        CELLULAR_INITIALIZED = SerialInitCellular(port, MODEM_BAUD_RATE);
+        CELLULAR_INITIALIZED = SerialInitCellular(port, MODEM_BAUD_RATE, MODEM_FLOW_CONTROL);
         if (!CELLULAR_INITIALIZED) {
             printf("Initialization FAILED\n");
             exit(EXIT_FAILURE);
         }
 
-        // check modem responded with ^+PBREADY
-        unsigned char * token_array[10] = {};
-        waitForATresponse(token_array, AT_RES_PBREADY, sizeof(AT_RES_PBREADY) - 1, 10, GENERAL_RECV_TIMEOUT_MS);
+        // the modem keeps its AT+IPR rate over a reset and says +PBREADY only
+        // after power up, so it is looked for at every rate
+        while (SerialFindBaudCellular() == 0) {
+            // still starting up, +PBREADY ends the wait if it comes at MODEM_BAUD_RATE
+            unsigned char * token_array[10] = {};
+            printf("no answer from the modem, waiting... ");
+            waitForATresponse(token_array, AT_RES_PBREADY, sizeof(AT_RES_PBREADY) - 1, 10, MODEM_STARTUP_WAIT_MS);
+        }
 
         bool echo_off = false;
         printf("\nturning echo off... ");
@@ -104,6 +118,12 @@ void CellularInit(char *port){
         }
 
         printf("successfully.\n");
+
+        if (MODEM_FLOW_CONTROL) {
+            while (!sendATcommand(AT_CMD_FLOW_RTS_CTS, sizeof(AT_CMD_FLOW_RTS_CTS) - 1));
+            waitForOK();
+        }
+        modem_baud = SerialNegotiateBaudCellular(MODEM_MAX_BAUD_RATE);
         printf("\nCellular modem initialized successfully.\n");
     }
 }
@@ -114,6 +134,14 @@ void CellularInit(char *port){
  */
 void CellularDisable(){
     if (CELLULAR_INITIALIZED) {
+        // the modem keeps its rate, it has to be the one CellularInit starts at
+        if (modem_baud != MODEM_BAUD_RATE) {
+            int cmd_size = sprintf(command_to_send_buffer, "AT+IPR=%d\r\n", MODEM_BAUD_RATE);
+            while (!sendATcommand(command_to_send_buffer, cmd_size));
+            waitForOK();
+            modem_baud = MODEM_BAUD_RATE;
+        }
+
         // shut down modem
         while (!sendATcommand(AT_CMD_SHUTDOWN, sizeof(AT_CMD_SHUTDOWN) - 1));
 
@@ -312,8 +340,10 @@ bool waitForOK() {
     int num_of_tokens = 0;
 
     do {
+        unsigned int time_left_ms = GENERAL_RECV_TIMEOUT_MS;
         memset(incoming_buffer, '\0', MAX_INCOMING_BUF_SIZE);
-        bytes_received = SerialRecvCellular(incoming_buffer, MAX_INCOMING_BUF_SIZE, GENERAL_RECV_TIMEOUT_MS);
+        bytes_received = SerialRecvCellularUntil(incoming_buffer, MAX_INCOMING_BUF_SIZE, &time_left_ms,
+                                                 AT_FINAL_RESPONSES, NUM_FINAL_RESPONSES);
         strncat(temp_buffer, (const char *) incoming_buffer, bytes_received);
         num_of_tokens = splitBufferToResponses(temp_buffer, token_array, 10);
 
@@ -333,10 +363,17 @@ bool waitForATresponse(unsigned char ** token_array, unsigned char * expected_re
     unsigned int bytes_received = 0;
     int num_of_tokens = 0;
 
+    // stop on the expected response or on any final result code
+    char expected[MAX_AT_CMD_LEN] = "";
+    memcpy(expected, expected_response, response_size < MAX_AT_CMD_LEN ? response_size : MAX_AT_CMD_LEN - 1);
+    const char * terminators[NUM_FINAL_RESPONSES + 1] = {expected};
+    memcpy(&terminators[1], AT_FINAL_RESPONSES, sizeof(AT_FINAL_RESPONSES));
 
     do {
+        unsigned int time_left_ms = timeout_ms;
         memset(incoming_buffer, '\0', bytes_received);
-        bytes_received = SerialRecvCellular(incoming_buffer, MAX_INCOMING_BUF_SIZE, timeout_ms);
+        bytes_received = SerialRecvCellularUntil(incoming_buffer, MAX_INCOMING_BUF_SIZE, &time_left_ms,
+                                                 terminators, NUM_FINAL_RESPONSES + 1);
         strncat(temp_buffer, (const char *) incoming_buffer, bytes_received);
         num_of_tokens = splitBufferToResponses(temp_buffer, token_array, max_responses);
 
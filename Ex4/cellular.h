@@ -22,7 +22,9 @@ typedef struct __OPERATOR_INFO {
     int  csq;
 } OPERATOR_INFO;
 
-#define MODEM_BAUD_RATE 115200
+#define MODEM_BAUD_RATE 115200         // the modem's rate at power up, negotiated up from there
+#define MODEM_MAX_BAUD_RATE 921600
+#define MODEM_FLOW_CONTROL true         // RTS/CTS are wired to the modem
 #define ICCID_BUFFER_SIZE 23
 #define CELL_PAYLOAD_FORMAT "--data-binary cellular,name=NetanelFayoumi_SapirElyovitch,ICCID=%s %s %s"
 
@@ -6,6 +6,7 @@
 #include "gps.h"
 #include "string.h"
 #include "time.h"
+#include <windows.h>
 
 /*****************************************************************************
  * 								DEFS
@@ -23,6 +24,58 @@ static char* MODEM_PORT = "5";
 
 #define MAX_IL_CELL_OPS 20
 #define TRANSMIT_URL "https://en8wtnrvtnkt5.x.pipedream.net/write?db=mydb"
+#define NUM_OF_FIXES 10
+
+/* GPS fixes are acquired by a thread while the modem attaches */
+typedef struct _FIX_ACQUISITION {
+    GPS_LOCATION_INFO* location;
+    int fixes_needed;
+    DWORD started_ms;   // GetTickCount when the acquisition started
+    DWORD done_ms;      // GetTickCount when the last fix was received
+    HANDLE thread;
+} FIX_ACQUISITION;
+
+
+/**
+ * Thread procedure, reads GPS until acquisition->fixes_needed fixes were received.
+ * @param param - the FIX_ACQUISITION.
+ * @return 0.
+ */
+DWORD WINAPI acquireFixes(LPVOID param) {
+    FIX_ACQUISITION* acquisition = (FIX_ACQUISITION*) param;
+    while (acquisition->fixes_needed > 0) {
+        if (GPSGetFixInformation(acquisition->location)) {
+            acquisition->fixes_needed--;
+        }
+    }
+    acquisition->done_ms = GetTickCount();
+    return 0;
+}
+
+/**
+ * Starts acquiring fixes next to the caller, GPS and modem use separate ports.
+ * @param acquisition - the acquisition, location must be set.
+ * @return true if the thread was started.
+ */
+bool startFixAcquisition(FIX_ACQUISITION* acquisition) {
+    acquisition->fixes_needed = NUM_OF_FIXES;
+    acquisition->started_ms = GetTickCount();
+    acquisition->done_ms = 0;
+    acquisition->thread = CreateThread(NULL, 0, acquireFixes, acquisition, 0, NULL);
+    return acquisition->thread != NULL;
+}
+
+/**
+ * Waits until the fixes were acquired. Does nothing if already joined.
+ * @param acquisition - the acquisition.
+ */
+void joinFixAcquisition(FIX_ACQUISITION* acquisition) {
+    if (acquisition->thread != NULL) {
+        WaitForSingleObject(acquisition->thread, INFINITE);
+        CloseHandle(acquisition->thread);
+        acquisition->thread = NULL;
+    }
+}
 
 
 int main() {
@@ -70,19 +123,15 @@ int main() {
     while (BTN_flag) {
 
 
+        // GPS time to fix and the modem attach are independent, run them together
+        // and join before the first POST.
         //https://moodle2.cs.huji.ac.il/nu18/mod/forum/discuss.php?d=56363
         // if no GPS data could be retrieved, don't send anything.
-        int fixed_gps_info_loop = 10;
-        while (fixed_gps_info_loop > 0) {//todo while (lastloc.tim != null)?
-            if (GPSGetFixInformation(last_location)) {
-                fixed_gps_info_loop--;
-            }
-        }
-
-        if (last_location->valid_fix == 0) {
-            BTN_flag = false;
-            printf("validfix = 0\n");
-            break;
+        FIX_ACQUISITION acquisition = {0};
+        acquisition.location = last_location;
+        if (!startFixAcquisition(&acquisition)) {
+            // no thread, acquire the fixes first
+            acquireFixes(&acquisition);
         }
 
         // Initialize the cellular modems.
@@ -183,6 +232,17 @@ int main() {
                 char iccid[ICCID_BUFFER_SIZE] = "";
                 CellularGetICCID(iccid);
 
+                // modem is ready, wait for the fixes
+                DWORD modem_ready_ms = GetTickCount();
+                joinFixAcquisition(&acquisition);
+                printf("GPS ready after %lu ms, modem ready after %lu ms.\n",
+                       acquisition.done_ms - acquisition.started_ms, modem_ready_ms - acquisition.started_ms);
+                if (last_location->valid_fix == 0) {
+                    BTN_flag = false;
+                    printf("validfix = 0\n");
+                    break;
+                }
+
                 // transmit GPS dataover HTTP
                 char gps_payload[1000] = "";
                 int gps_payload_len = GPSGetPayload(last_location, iccid, gps_payload);
@@ -201,6 +261,9 @@ int main() {
             }
         }
 
+        // no operator could be used, do not leave the GPS thread behind
+        joinFixAcquisition(&acquisition);
+
         // todo BTN false
 
 
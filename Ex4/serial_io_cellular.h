@@ -6,6 +6,10 @@
 #define IOT_SERIAL_IO_CELLULAR_H
 
 #define SERIAL_TIMEOUT -1
+#define BAUD_SETTLE_MS 100              // after AT+IPR, before the first command at the new rate
+#define BAUD_PROBE_TIMEOUT_MS 300       // for the OK of an AT at a new rate
+#define BAUD_PROBE_TRIES 3
+#define BAUD_RESPONSE_SIZE 64
 
 #include <stdbool.h>
 #include <stdio.h>
@@ -17,9 +21,39 @@ volatile uint32_t msTicks;
  * @brief Initates the serial connection.
  * @param port - input port.
  * @param baud - baud rate
+ * @param flow_control - true for RTS/CTS hardware flow control.
  * @return true if succesful.
  *****************************************************************************/
-bool SerialInitCellular(char* port, unsigned int baud);
+bool SerialInitCellular(char* port, unsigned int baud, bool flow_control);
+
+/**************************************************************************//**
+ * @brief Looks for the modem at each rate of SerialNegotiateBaudCellular,
+ * slowest first, with AT. The modem keeps the rate of AT+IPR over a reset
+ * of either side, so it is not always at the one it powers up with.
+ * @return the rate it answered at, the port stays there. 0 if it did not
+ * answer at any, the port is then back at the slowest rate.
+ *****************************************************************************/
+unsigned int SerialFindBaudCellular(void);
+
+/**************************************************************************//**
+ * @brief Moves the link to the fastest rate of up to max_baud both sides
+ * manage: the rates above the current one, slowest first, are each set with
+ * AT+IPR from the last rate that answered and checked with AT. A rate the
+ * port does not take is skipped before the modem is asked. The first rate
+ * the link does not carry ends the climb, the link goes back to the last
+ * good rate if the modem is still there.
+ * @param max_baud - highest rate to try, e.g. 921600.
+ * @return the rate the link runs at.
+ *****************************************************************************/
+unsigned int SerialNegotiateBaudCellular(unsigned int max_baud);
+
+/**************************************************************************//**
+ * @brief Changes the rate of the port only, the modem has to be there
+ * already (AT+IPR).
+ * @param baud - baud rate.
+ * @return true if successful.
+ *****************************************************************************/
+bool SerialSetBaudCellular(unsigned int baud);
 
 /**************************************************************************//**
  * @brief Receive data from serial connection.
@@ -29,6 +63,21 @@ bool SerialInitCellular(char* port, unsigned int baud);
  *****************************************************************************/
 unsigned int SerialRecvCellular(unsigned char* buf, unsigned int maxlen, unsigned int timeout_ms);
 
+/**************************************************************************//**
+ * @brief Receive data from serial connection until a terminating line arrives.
+ * A line is complete once its '\n' was received. Reception stops on the first
+ * complete line starting with one of the terminators, or on the first complete
+ * non-empty line when terminators is NULL.
+ * @param buf - buffer to be filled (NUL terminated on return).
+ * @param maxlen - size of buf.
+ * @param timeout_ms - in: length of the timeout in ms. out: time left in ms.
+ * @param terminators - line prefixes that end the reception, or NULL.
+ * @param num_terminators - number of items in terminators.
+ * @return number of bytes received.
+ *****************************************************************************/
+unsigned int SerialRecvCellularUntil(unsigned char* buf, unsigned int maxlen, unsigned int* timeout_ms,
+                                     const char** terminators, int num_terminators);
+
 /**
  * writing buf string to serial port
  * @param buf
@@ -2,18 +2,25 @@
 #include "serial_io_cellular.h"
 #include <windows.h>
 #include <time.h>
+#include <string.h>
 
 static HANDLE hComm;
 static COMMTIMEOUTS original_timeouts;
 static COMMTIMEOUTS timeouts;
+static unsigned int current_baud;
+
+// rates SerialNegotiateBaudCellular steps up through, slowest first
+static const unsigned int BAUD_RATES[] = {115200, 230400, 460800, 921600};
+#define NUM_BAUD_RATES (sizeof(BAUD_RATES) / sizeof(BAUD_RATES[0]))
 
 /**************************************************************************//**
  * @brief Initiates the serial connection.
  * @param port - input port
  * @param baud - baud rate
+ * @param flow_control - true for RTS/CTS.
  * @return true if successful.
  *****************************************************************************/
-bool SerialInitCellular(char* port, unsigned int baud)
+bool SerialInitCellular(char* port, unsigned int baud, bool flow_control)
 {
     char fullPort[20];
     DCB state;
@@ -41,21 +48,17 @@ bool SerialInitCellular(char* port, unsigned int baud)
         return FALSE;
     }
 
-    if (baud == 9600) {
-        // Quectel GPS rate
-        state.BaudRate = CBR_9600;
-    } else if (baud == 115200){
-        // Gemalto Cellular modem rate
-        state.BaudRate = CBR_115200;
-    } else {
-        printf("Wrong baud rate\n");
-        return FALSE;
-    }
+    // Gemalto Cellular modem rate, 115200 at power up
+    state.BaudRate = baud;
+    current_baud = baud;
 
     state.ByteSize = 8;
     state.Parity = NOPARITY;
     state.StopBits = ONESTOPBIT;
     state.EvtChar = '\n';
+    // the modem holds off while the port's buffer is full, and so do we
+    state.fOutxCtsFlow = flow_control;
+    state.fRtsControl = flow_control ? RTS_CONTROL_HANDSHAKE : RTS_CONTROL_ENABLE;
     if (!SetCommState(hComm, &state)) {
         printf("SetCommState failed!\n");
         return FALSE;
@@ -111,6 +114,82 @@ unsigned int SerialRecvCellular(unsigned char* buf, unsigned int maxlen, unsigne
     return dwBytes > 0 ? dwBytes : SERIAL_TIMEOUT;
 }
 
+/**************************************************************************//**
+ * @brief Checks whether a received line ends the reception.
+ * @param line - start of the line.
+ * @param len - length of the line, including its "\r\n".
+ * @param terminators - line prefixes that end the reception, or NULL.
+ * @param num_terminators - number of items in terminators.
+ * @return true if the line is a terminating line.
+ *****************************************************************************/
+static bool isTerminatingLine(const unsigned char *line, DWORD len, const char **terminators, int num_terminators) {
+    // strip "\r\n", empty lines never terminate
+    while (len > 0 && (line[len - 1] == '\n' || line[len - 1] == '\r')) {
+        len--;
+    }
+    if (len == 0) {
+        return false;
+    }
+    if (terminators == NULL) {
+        return true;
+    }
+    for (int i = 0; i < num_terminators; i++) {
+        size_t term_len = strlen(terminators[i]);
+        if (term_len <= len && memcmp(line, terminators[i], term_len) == 0) {
+            return true;
+        }
+    }
+    return false;
+}
+
+/**************************************************************************//**
+ * @brief Receive data from serial connection until a terminating line arrives.
+ * @param buf - buffer to be filled (NUL terminated on return).
+ * @param maxlen - size of buf.
+ * @param timeout_ms - in: length of the timeout in ms. out: time left in ms.
+ * @param terminators - line prefixes that end the reception, or NULL.
+ * @param num_terminators - number of items in terminators.
+ * @return number of bytes received.
+ *****************************************************************************/
+unsigned int SerialRecvCellularUntil(unsigned char* buf, unsigned int maxlen, unsigned int* timeout_ms,
+                                     const char** terminators, int num_terminators) {
+    DWORD received = 0;
+    DWORD line_start = 0;
+    DWORD start_ticks = GetTickCount();
+    DWORD elapsed = 0;
+    bool terminated = false;
+
+    if (maxlen == 0) {
+        return 0;
+    }
+
+    while (!terminated && elapsed < *timeout_ms && received < maxlen - 1) {
+        // returns as soon as any byte is available, or after the time left
+        DWORD dwBytes = 0;
+        timeouts.ReadTotalTimeoutConstant = *timeout_ms - elapsed;
+        SetCommTimeouts(hComm, &timeouts);
+        if (!ReadFile(hComm, &buf[received], maxlen - 1 - received, &dwBytes, NULL)) {
+            printf("Error reading from serial port.\n");
+            break;
+        }
+
+        for (DWORD i = received; i < received + dwBytes; i++) {
+            if (buf[i] == '\n') {
+                if (isTerminatingLine(&buf[line_start], i + 1 - line_start, terminators, num_terminators)) {
+                    terminated = true;
+                }
+                line_start = i + 1;
+            }
+        }
+        received += dwBytes;
+        elapsed = GetTickCount() - start_ticks;
+    }
+    buf[received] = '\0';
+
+    *timeout_ms = (elapsed < *timeout_ms) ? *timeout_ms - elapsed : 0;
+    return received;
+}
+
 /**
  * will send first size bytes of buf to serial socket
  * @param buf
@@ -123,6 +202,105 @@ bool SerialSendCellular(unsigned char *buf, unsigned int size) {
     return WriteFile(hComm, buf, size, &numOfBytesWritten, NULL);
 }
 
+bool SerialSetBaudCellular(unsigned int baud) {
+    DCB state;
+
+    if (!GetCommState(hComm, &state)) {
+        return FALSE;
+    }
+    state.BaudRate = baud;
+    if (!SetCommState(hComm, &state)) {
+        printf("SetCommState failed!\n");
+        return FALSE;
+    }
+    current_baud = baud;
+    PurgeComm(hComm, PURGE_RXCLEAR);
+    return TRUE;
+}
+
+/**************************************************************************//**
+ * @brief Sends a command and waits for its result.
+ * @param command - NUL terminated, with "\r\n".
+ * @return true on OK.
+ *****************************************************************************/
+static bool commandOK(const char *command) {
+    unsigned char response[BAUD_RESPONSE_SIZE];
+    unsigned int time_left_ms = BAUD_PROBE_TIMEOUT_MS;
+    const char *results[] = {"OK", "ERROR", "+CME ERROR"};
+
+    PurgeComm(hComm, PURGE_RXCLEAR);
+    SerialSendCellular((unsigned char *) command, strlen(command));
+    SerialRecvCellularUntil(response, sizeof(response), &time_left_ms, results, 3);
+    return strstr((char *) response, "OK") != NULL;
+}
+
+/**************************************************************************//**
+ * @brief Checks the modem answers at the current rate.
+ *****************************************************************************/
+static bool probeBaud(void) {
+    for (int i = 0; i < BAUD_PROBE_TRIES; i++) {
+        if (commandOK("AT\r\n")) {
+            return TRUE;
+        }
+    }
+    return FALSE;
+}
+
+/**************************************************************************//**
+ * @brief Asks the modem to change its rate, it answers at the old one.
+ *****************************************************************************/
+static bool setModemBaud(unsigned int baud) {
+    char command[BAUD_RESPONSE_SIZE];
+    sprintf(command, "AT+IPR=%u\r\n", baud);
+    return commandOK(command);
+}
+
+unsigned int SerialFindBaudCellular(void) {
+    for (unsigned int i = 0; i < NUM_BAUD_RATES; i++) {
+        if (SerialSetBaudCellular(BAUD_RATES[i]) && probeBaud()) {
+            printf("modem found at %u baud\n", BAUD_RATES[i]);
+            return BAUD_RATES[i];
+        }
+    }
+    SerialSetBaudCellular(BAUD_RATES[0]);
+    return 0;
+}
+
+unsigned int SerialNegotiateBaudCellular(unsigned int max_baud) {
+    unsigned int good = current_baud;
+
+    for (unsigned int i = 0; i < NUM_BAUD_RATES; i++) {
+        unsigned int baud = BAUD_RATES[i];
+        if (baud > max_baud || baud <= good) {
+            continue;
+        }
+        // the port has to take the rate before the modem is moved to it
+        if (!SerialSetBaudCellular(baud) || !SerialSetBaudCellular(good) || !setModemBaud(baud)) {
+            SerialSetBaudCellular(good);
+            continue;
+        }
+        Sleep(BAUD_SETTLE_MS);
+        SerialSetBaudCellular(baud);
+        if (probeBaud()) {
+            good = baud;
+            continue;
+        }
+
+        // an AT+IPR sent at a rate that does not answer is not understood either,
+        // the modem is only found again if it stayed at the last good rate
+        printf("no answer at %u baud, stopping at %u\n", baud, good);
+        SerialSetBaudCellular(good);
+        if (!probeBaud()) {
+            // it did move, the link stays where the modem is
+            printf("modem lost at %u baud\n", baud);
+            SerialSetBaudCellular(baud);
+        }
+        break;
+    }
+    printf("modem link at %u baud\n", current_baud);
+    return current_baud;
+}
+
 /**************************************************************************//**
  * @brief Empties the input buffer.
  *****************************************************************************/
@@ -0,0 +1,219 @@
+/**************************************************************************//**
+ * @cellular_posix.c
+ * @brief CellularSocket* on POSIX sockets, "socktcp://host:port" as a TCP
+ * connection and "sockudp://host:port" as a connected UDP socket. Time is the
+ * monotonic clock plus what the tests skipped. Timers only keep their expiry,
+ * the clients that need more are polled by the tests.
+ * @version 0.0.1
+ *  ***************************************************************************/
+#define _DEFAULT_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <poll.h>
+#include <signal.h>
+#include <time.h>
+#include <unistd.h>
+#include <netdb.h>
+#include <sys/socket.h>
+#include <sys/wait.h>
+#include "cellular.h"
+#include "scheduler.h"
+#include "timer.h"
+#include "cellular_posix.h"
+
+#define NUM_SOCKETS 10           // service profiles 0..9
+#define MAX_LOG_LINE 256
+#define FIRST_PORT 20000
+#define NUM_PORTS 20000
+#define STARTUP_TIMEOUT_MS 5000
+
+static int sockets[NUM_SOCKETS] = {-1, -1, -1, -1, -1, -1, -1, -1, -1, -1};
+static uint64_t skipped_ms = 0;
+static pid_t stand_in = -1;
+static int log_fd = -1;
+static char log_line[MAX_LOG_LINE];
+static size_t log_len = 0;
+
+/******************************************************************************
+ * 							    TIME
+*****************************************************************************/
+
+uint64_t TimebaseGetMs(void) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (uint64_t) now.tv_sec * 1000 + (uint64_t) now.tv_nsec / 1000000 + skipped_ms;
+}
+
+uint64_t TimebaseGetTicks(void) {
+    return TimebaseGetMs() * 32768 / 1000;
+}
+
+void PosixSkipMs(uint32_t ms) {
+    skipped_ms += ms;
+}
+
+void TimerStart(TIMER * timer, uint32_t delay_ms, uint32_t period_ms, TIMER_CALLBACK callback, void * arg) {
+    timer->expiry_ms = TimebaseGetMs() + delay_ms;
+    timer->period_ms = period_ms;
+    timer->callback = callback;
+    timer->arg = arg;
+    timer->active = true;
+}
+
+void TimerStop(TIMER * timer) {
+    timer->active = false;
+}
+
+bool TimerIsActive(TIMER * timer) {
+    return timer->active;
+}
+
+bool SchedulerPostOnce(EVENT_PRIORITY priority, EVENT_TYPE type, uint32_t data) {
+    return true;
+}
+
+/******************************************************************************
+ * 							    SOCKETS
+*****************************************************************************/
+
+bool CellularSocketOpen(int srvProfileId, const char *address) {
+    char host[64];
+    char port[8];
+    char kind[4];
+    struct addrinfo hints = {0};
+    struct addrinfo *result;
+
+    if (srvProfileId < 0 || srvProfileId >= NUM_SOCKETS ||
+        sscanf(address, "sock%3[a-z]://%63[^:]:%7s", kind, host, port) != 3) {
+        return false;
+    }
+    CellularSocketClose(srvProfileId);
+    hints.ai_family = AF_INET;
+    hints.ai_socktype = (strcmp(kind, "udp") == 0) ? SOCK_DGRAM : SOCK_STREAM;
+    if (getaddrinfo(host, port, &hints, &result) != 0) {
+        return false;
+    }
+    int fd = socket(result->ai_family, result->ai_socktype, 0);
+    if (fd >= 0 && connect(fd, result->ai_addr, result->ai_addrlen) != 0) {
+        close(fd);
+        fd = -1;
+    }
+    freeaddrinfo(result);
+    sockets[srvProfileId] = fd;
+    return fd >= 0;
+}
+
+bool CellularSocketIsOpen(int srvProfileId) {
+    return srvProfileId >= 0 && srvProfileId < NUM_SOCKETS && sockets[srvProfileId] >= 0;
+}
+
+bool CellularSocketWrite(int srvProfileId, const uint8_t *data, int len) {
+    if (!CellularSocketIsOpen(srvProfileId)) {
+        return false;
+    }
+    return send(sockets[srvProfileId], data, (size_t) len, MSG_NOSIGNAL) == len;
+}
+
+int CellularSocketRead(int srvProfileId, uint8_t *buf, int maxlen, unsigned int timeout_ms) {
+    if (!CellularSocketIsOpen(srvProfileId)) {
+        return -1;
+    }
+    struct pollfd pfd = {sockets[srvProfileId], POLLIN, 0};
+    if (poll(&pfd, 1, (int) timeout_ms) <= 0) {
+        return 0;
+    }
+    ssize_t received = recv(sockets[srvProfileId], buf, (size_t) maxlen, 0);
+    if (received <= 0) {
+        // the peer closed, like ^SIS: <id>,0 on the modem
+        CellularSocketClose(srvProfileId);
+        return -1;
+    }
+    return (int) received;
+}
+
+void CellularSocketClose(int srvProfileId) {
+    if (CellularSocketIsOpen(srvProfileId)) {
+        close(sockets[srvProfileId]);
+        sockets[srvProfileId] = -1;
+    }
+}
+
+/******************************************************************************
+ * 							    STAND-INS
+*****************************************************************************/
+
+int PosixPickPort(void) {
+    return FIRST_PORT + (int) (getpid() % NUM_PORTS);
+}
+
+bool StandInStart(char * const argv[]) {
+    int pipe_fds[2];
+
+    if (pipe(pipe_fds) != 0) {
+        return false;
+    }
+    // or the child writes what is buffered once more
+    fflush(stdout);
+    stand_in = fork();
+    if (stand_in == 0) {
+        dup2(pipe_fds[1], STDERR_FILENO);
+        close(pipe_fds[0]);
+        close(pipe_fds[1]);
+        // the payloads it prints are not needed
+        freopen("/dev/null", "w", stdout);
+        execv(argv[0], argv);
+        _exit(127);
+    }
+    close(pipe_fds[1]);
+    log_fd = pipe_fds[0];
+    log_len = 0;
+    if (stand_in < 0 || !StandInExpect("listening", STARTUP_TIMEOUT_MS)) {
+        printf("%s did not start\n", argv[0]);
+        StandInStop();
+        return false;
+    }
+    return true;
+}
+
+bool StandInExpect(const char * text, uint32_t timeout_ms) {
+    uint64_t deadline = TimebaseGetMs() + timeout_ms;
+
+    while (log_fd >= 0) {
+        uint64_t now = TimebaseGetMs();
+        struct pollfd pfd = {log_fd, POLLIN, 0};
+        char byte;
+
+        if (now >= deadline || poll(&pfd, 1, (int) (deadline - now)) <= 0) {
+            return false;
+        }
+        if (read(log_fd, &byte, 1) != 1) {
+            return false;
+        }
+        if (byte != '\n') {
+            if (log_len < MAX_LOG_LINE - 1) {
+                log_line[log_len++] = byte;
+            }
+            continue;
+        }
+        log_line[log_len] = '\0';
+        log_len = 0;
+        if (DEBUG) { printf("  | %s\n", log_line); }
+        if (strstr(log_line, text) != NULL) {
+            return true;
+        }
+    }
+    return false;
+}
+
+void StandInStop(void) {
+    if (stand_in > 0) {
+        kill(stand_in, SIGTERM);
+        waitpid(stand_in, NULL, 0);
+    }
+    if (log_fd >= 0) {
+        close(log_fd);
+    }
+    stand_in = -1;
+    log_fd = -1;
+}
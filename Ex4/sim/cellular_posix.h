@@ -0,0 +1,44 @@
+/**************************************************************************//**
+ * @cellular_posix.h
+ * @brief The socket part of the cellular API over POSIX sockets, for running
+ * the protocol clients (mqtt.c, coap.c) on a PC against the stand-ins.
+ * Also the time and timer functions they use, and starting a stand-in as a
+ * child process whose log the tests read.
+ * @version 0.0.1
+ *  ***************************************************************************/
+#ifndef SIM_CELLULAR_POSIX_H_
+#define SIM_CELLULAR_POSIX_H_
+
+#include <stdbool.h>
+#include <stdint.h>
+
+/**
+ * Moves TimebaseGetMs ahead, for timeouts longer than a test should wait.
+ */
+void PosixSkipMs(uint32_t ms);
+
+/**
+ * @return a port for a stand-in, different between processes.
+ */
+int PosixPickPort(void);
+
+/**
+ * Starts a stand-in and waits until it logs that it is listening.
+ * @param argv - program and arguments, NULL terminated.
+ * @return false if it did not start.
+ */
+bool StandInStart(char * const argv[]);
+
+/**
+ * Reads the log (stderr) of the stand-in until a line that contains text.
+ * @param timeout_ms - time to wait for it.
+ * @return true if the line came.
+ */
+bool StandInExpect(const char * text, uint32_t timeout_ms);
+
+/**
+ * Stops the stand-in.
+ */
+void StandInStop(void);
+
+#endif /* SIM_CELLULAR_POSIX_H_ */
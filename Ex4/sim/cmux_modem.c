@@ -0,0 +1,197 @@
+/**************************************************************************//**
+ * @cmux_modem.c
+ * @brief Local stand-in for the modem side of the CMUX link (MODEM_MUX).
+ * Opens a pseudo terminal and prints its path, connect the cellular driver
+ * to it as the modem port. It answers AT commands line by line until
+ * AT+CMUX=0, then speaks 27.010 with the same cmux.c as the MCU and answers
+ * the commands of each channel on that channel:
+ * AT+CSQ and AT+CREG? with fixed values, AT^SISR=<id>,<len> with binary data
+ * that holds 0x00 and flag bytes, everything else with OK. A +CREG URC goes
+ * out on the AT channel every few seconds. CLD ends multiplexing, the stand-in
+ * then takes AT commands again.
+ * Usage: cmux_modem [urc_interval_s] (5 by default, 0 for none).
+ * @version 0.0.1
+ *  ***************************************************************************/
+#define _XOPEN_SOURCE 600
+#define _DEFAULT_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <termios.h>
+#include <time.h>
+#include <unistd.h>
+#include "cmux.h"
+
+#define DEFAULT_URC_INTERVAL_S 5
+#define MAX_LINE_LEN 256
+#define MAX_READ_LEN 1500
+#define POLL_MS 100
+
+#define CSQ_RESPONSE "\r\n+CSQ: 20,99\r\n\r\nOK\r\n"
+#define CREG_RESPONSE "\r\n+CREG: 2,1,\"00C3\",\"A1B2C3\",7\r\n\r\nOK\r\n"
+#define CREG_URC "\r\n+CREG: 1,\"00C3\",\"A1B2C3\",7\r\n"
+
+typedef struct _LINE {
+    char buf[MAX_LINE_LEN];
+    size_t len;
+} LINE;
+
+static int master_fd = -1;
+static LINE lines[CMUX_NUM_CHANNELS];   // line 0 is the link before multiplexing
+
+static void writeMaster(const uint8_t *data, uint32_t len) {
+    while (len > 0) {
+        ssize_t n = write(master_fd, data, len);
+        if (n <= 0) {
+            return;
+        }
+        data += n;
+        len -= (uint32_t) n;
+    }
+}
+
+/**
+ * Sends an answer on a channel, or on the plain link for channel 0.
+ */
+static void reply(uint8_t channel, const void *data, size_t len) {
+    if (channel == CMUX_CHANNEL_CONTROL) {
+        writeMaster(data, (uint32_t) len);
+    } else {
+        CmuxWrite(channel, data, (uint32_t) len);
+    }
+}
+
+static void replyText(uint8_t channel, const char *text) {
+    reply(channel, text, strlen(text));
+}
+
+/**
+ * Answers AT^SISR with len bytes of a pattern that has the bytes the link
+ * must carry untouched.
+ */
+static void replySISR(uint8_t channel, int id, int len) {
+    uint8_t data[MAX_READ_LEN];
+    char header[32];
+
+    if (len > MAX_READ_LEN) {
+        len = MAX_READ_LEN;
+    }
+    for (int i = 0; i < len; i++) {
+        static const uint8_t special[] = {0x00, 0xF9, '\r', '\n'};
+        data[i] = (i % 8 == 0) ? special[(i / 8) % sizeof(special)] : (uint8_t) i;
+    }
+    snprintf(header, sizeof(header), "\r\n^SISR: %d,%d\r\n", id, len);
+    replyText(channel, header);
+    reply(channel, data, (size_t) len);
+    replyText(channel, "\r\nOK\r\n");
+}
+
+static void command(uint8_t channel, const char *cmd) {
+    int id, len;
+
+    printf("[%d] %s\n", channel, cmd);
+    if (channel == CMUX_CHANNEL_CONTROL && strncmp(cmd, "AT+CMUX=0", 9) == 0) {
+        replyText(channel, "\r\nOK\r\n");
+        CmuxStart(writeMaster);
+        memset(lines, 0, sizeof(lines));
+        printf("multiplexing\n");
+    } else if (strcmp(cmd, "AT+CSQ") == 0) {
+        replyText(channel, CSQ_RESPONSE);
+    } else if (strcmp(cmd, "AT+CREG?") == 0) {
+        replyText(channel, CREG_RESPONSE);
+    } else if (sscanf(cmd, "AT^SISR=%d,%d", &id, &len) == 2) {
+        replySISR(channel, id, len);
+    } else {
+        replyText(channel, "\r\nOK\r\n");
+    }
+}
+
+/**
+ * Collects the bytes of a channel into lines and answers each one.
+ */
+static void addBytes(uint8_t channel, const uint8_t *data, size_t len) {
+    LINE *line = &lines[channel];
+    for (size_t i = 0; i < len; i++) {
+        if (data[i] == '\r' || data[i] == '\n') {
+            if (line->len > 0) {
+                line->buf[line->len] = '\0';
+                command(channel, line->buf);
+                line->len = 0;
+            }
+        } else if (line->len < MAX_LINE_LEN - 1) {
+            line->buf[line->len++] = (char) data[i];
+        }
+    }
+}
+
+int main(int argc, char **argv) {
+    int urc_interval_s = (argc > 1) ? atoi(argv[1]) : DEFAULT_URC_INTERVAL_S;
+    time_t last_urc = time(NULL);
+    bool muxed = false;
+
+    master_fd = posix_openpt(O_RDWR | O_NOCTTY);
+    if (master_fd < 0 || grantpt(master_fd) != 0 || unlockpt(master_fd) != 0) {
+        perror("posix_openpt");
+        return 1;
+    }
+    // raw, frames are binary. Kept open so the master does not see a hangup
+    // while the driver reconnects.
+    int slave_fd = open(ptsname(master_fd), O_RDWR | O_NOCTTY);
+    struct termios tio;
+    if (slave_fd < 0 || tcgetattr(slave_fd, &tio) != 0) {
+        perror("slave");
+        return 1;
+    }
+    cfmakeraw(&tio);
+    tcsetattr(slave_fd, TCSANOW, &tio);
+    printf("modem on %s\n", ptsname(master_fd));
+    fflush(stdout);
+
+    while (1) {
+        struct pollfd pfd = {master_fd, POLLIN, 0};
+        uint8_t buf[512];
+
+        if (poll(&pfd, 1, POLL_MS) > 0) {
+            ssize_t n = read(master_fd, buf, sizeof(buf));
+            if (n <= 0) {
+                continue;
+            }
+            for (ssize_t i = 0; i < n; i++) {
+                if (CmuxIsActive()) {
+                    CmuxReceive(buf[i]);
+                } else {
+                    addBytes(CMUX_CHANNEL_CONTROL, &buf[i], 1);
+                }
+            }
+        }
+
+        // the answers of the frames, then the commands that came in
+        for (uint8_t channel = CMUX_CHANNEL_AT; channel < CMUX_NUM_CHANNELS && CmuxIsActive(); channel++) {
+            uint32_t len;
+            while ((len = CmuxRead(channel, buf, sizeof(buf))) > 0) {
+                addBytes(channel, buf, len);
+            }
+        }
+        if (muxed && !CmuxIsActive()) {
+            CMUX_STATS stats;
+            CmuxGetStats(&stats);
+            printf("multiplexer closed, %u frames in, %u out, %u bad\n",
+                   stats.frames_received, stats.frames_sent, stats.bad_frames);
+        }
+        muxed = CmuxIsActive();
+
+        if (urc_interval_s > 0 && time(NULL) - last_urc >= urc_interval_s) {
+            last_urc = time(NULL);
+            if (!CmuxIsActive()) {
+                replyText(CMUX_CHANNEL_CONTROL, CREG_URC);
+            } else if (CmuxIsOpen(CMUX_CHANNEL_AT)) {
+                replyText(CMUX_CHANNEL_AT, CREG_URC);
+            }
+        }
+        fflush(stdout);
+    }
+    return 0;
+}
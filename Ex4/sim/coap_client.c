@@ -0,0 +1,140 @@
+/**************************************************************************//**
+ * @coap_client.c
+ * @brief Test of the CoAP client (coap.c) against the server stand-in, over
+ * POSIX sockets. POSTs binary payloads with zero bytes, confirmable and not,
+ * a block-wise payload to a server that asks for smaller blocks after the
+ * first one, and a request the server ignores once so it is retransmitted.
+ * The server log must show every payload at its size.
+ * Usage: coap_client <path of coap_server>. Exits with 1 if a test fails.
+ * @version 0.0.1
+ *  ***************************************************************************/
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include "coap.h"
+#include "cellular_posix.h"
+
+#define SRV_PROFILE_ID 3
+#define PATH "ex4/test"
+#define SMALL_SZX "2"               // 64 byte blocks after the first
+#define BLOCKWISE_LEN 1300
+#define DROP_EVERY "3"
+#define LOG_TIMEOUT_MS 2000
+
+bool DEBUG = false;
+
+static COAP_CLIENT client;
+static char address[64];
+static char port[8];
+
+/**
+ * Fills a payload that holds zeros and payload markers (0xFF).
+ */
+static void fillPayload(uint8_t *data, uint32_t len, uint32_t seed) {
+    for (uint32_t i = 0; i < len; i++) {
+        data[i] = (i % 4 == 0) ? 0x00 : (i % 4 == 1) ? 0xFF : (uint8_t) (i + seed);
+    }
+}
+
+static bool fail(const char *what) {
+    printf("%s\n", what);
+    return false;
+}
+
+/**
+ * Starts the server with its options and a client for it.
+ */
+static bool start(const char *server, const char *drop_every, const char *max_szx) {
+    char *argv[] = {(char *) server, port, (char *) drop_every, (char *) max_szx, NULL};
+    if (!StandInStart(argv)) {
+        return false;
+    }
+    CoapInit(&client, SRV_PROFILE_ID, address);
+    return true;
+}
+
+static void stop(void) {
+    CoapClose(&client);
+    StandInStop();
+}
+
+/**
+ * POSTs len bytes and checks the response code and the size at the server.
+ */
+static bool post(uint32_t len, bool confirmable, int expected_code) {
+    static uint8_t payload[BLOCKWISE_LEN];
+    char expected[64];
+
+    fillPayload(payload, len, len);
+    int code = CoapPost(&client, PATH, COAP_FORMAT_OCTET_STREAM, payload, len, confirmable);
+    snprintf(expected, sizeof(expected), "POST /" PATH " format %d, %lu bytes", COAP_FORMAT_OCTET_STREAM,
+             (unsigned long) len);
+    if (code != expected_code || !StandInExpect(expected, LOG_TIMEOUT_MS)) {
+        printf("%lu bytes: response %d, expected %d\n", (unsigned long) len, code, expected_code);
+        return false;
+    }
+    return true;
+}
+
+static bool testPost(const char *server) {
+    bool ok = start(server, "0", "6") &&
+              post(1, true, COAP_CHANGED) &&
+              post(100, true, COAP_CHANGED) &&
+              post(COAP_BLOCK_SIZE, true, COAP_CHANGED) &&
+              post(20, false, 0);
+    stop();
+    if (ok) {
+        printf("post: ok\n");
+    }
+    return ok;
+}
+
+static bool testBlockwise(const char *server) {
+    // 512, then 64 byte blocks from offset 512 on
+    bool ok = start(server, "0", SMALL_SZX) &&
+              post(BLOCKWISE_LEN, true, COAP_CHANGED);
+    uint32_t expected_requests = 1 + (BLOCKWISE_LEN - COAP_BLOCK_SIZE + 63) / 64;
+    if (ok && client.stats.requests != expected_requests) {
+        printf("%lu requests, expected %lu\n", (unsigned long) client.stats.requests,
+               (unsigned long) expected_requests);
+        ok = false;
+    }
+    stop();
+    if (ok) {
+        printf("blockwise: ok\n");
+    }
+    return ok;
+}
+
+static bool testRetransmit(const char *server) {
+    // the third request is ignored
+    bool ok = start(server, DROP_EVERY, "6") &&
+              post(10, true, COAP_CHANGED) &&
+              post(11, true, COAP_CHANGED) &&
+              post(12, true, COAP_CHANGED);
+    if (ok && client.stats.retransmits != 1) {
+        ok = fail("no retransmission");
+    }
+    stop();
+    if (ok) {
+        printf("retransmit: ok\n");
+    }
+    return ok;
+}
+
+int main(int argc, char *argv[]) {
+    bool ok;
+
+    if (argc < 2) {
+        printf("usage: coap_client <path of coap_server>\n");
+        return 1;
+    }
+    snprintf(port, sizeof(port), "%d", PosixPickPort());
+    snprintf(address, sizeof(address), "sockudp://127.0.0.1:%s", port);
+
+    ok = testPost(argv[1]) && testBlockwise(argv[1]) && testRetransmit(argv[1]);
+
+    printf(ok ? "ok\n" : "FAILED\n");
+    return ok ? 0 : 1;
+}
@@ -0,0 +1,216 @@
+/**************************************************************************//**
+ * @coap_server.c
+ * @brief Local stand-in for the CoAP endpoint (COAP_PAYLOADS). Takes POSTs,
+ * reassembles Block1 transfers and prints the payloads, text as it is and
+ * binary as its size. Confirmable requests get a piggybacked ACK, 2.31
+ * Continue for a block with more to come and 2.04 Changed at the end.
+ * Usage: coap_server [port] [drop_every] [max_szx] (5683 by default).
+ * drop_every: ignore every n-th request, to test retransmissions.
+ * max_szx: ask for smaller blocks than the client sends.
+ * @version 0.0.1
+ *  ***************************************************************************/
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+#define DEFAULT_PORT 5683
+#define MAX_DATAGRAM 2048
+#define MAX_TRANSFER 65536
+#define MAX_PATH 64
+
+#define TYPE_CON 0
+#define TYPE_ACK 2
+#define CODE_POST 2
+#define CODE_CHANGED ((2 << 5) | 4)
+#define CODE_CONTINUE ((2 << 5) | 31)
+#define CODE_BAD_REQUEST ((4 << 5) | 0)
+#define OPTION_URI_PATH 11
+#define OPTION_CONTENT_FORMAT 12
+#define OPTION_BLOCK1 27
+
+typedef struct {
+    uint8_t type;
+    uint8_t code;
+    uint16_t message_id;
+    uint8_t token[8];
+    uint8_t token_len;
+    char path[MAX_PATH];
+    uint32_t content_format;
+    int has_block1;
+    uint32_t block1;
+    const uint8_t *payload;
+    uint32_t payload_len;
+} REQUEST;
+
+static uint32_t readUint(const uint8_t *value, uint32_t len) {
+    uint32_t result = 0;
+    for (uint32_t i = 0; i < len; i++) {
+        result = result << 8 | value[i];
+    }
+    return result;
+}
+
+static int parseRequest(const uint8_t *buf, uint32_t len, REQUEST *request) {
+    memset(request, 0, sizeof(*request));
+    if (len < 4 || (buf[0] >> 6) != 1) {
+        return 0;
+    }
+    request->type = (buf[0] >> 4) & 0x03;
+    request->token_len = buf[0] & 0x0F;
+    request->code = buf[1];
+    request->message_id = (uint16_t) (buf[2] << 8 | buf[3]);
+    if (request->token_len > 8 || 4U + request->token_len > len) {
+        return 0;
+    }
+    memcpy(request->token, &buf[4], request->token_len);
+
+    uint32_t pos = 4 + request->token_len;
+    uint32_t number = 0;
+    while (pos < len && buf[pos] != 0xFF) {
+        uint32_t fields[2] = {buf[pos] >> 4, buf[pos] & 0x0F};
+        pos++;
+        for (int i = 0; i < 2; i++) {
+            if (fields[i] == 13) {
+                fields[i] = 13 + buf[pos++];
+            } else if (fields[i] == 14) {
+                fields[i] = 269 + (buf[pos] << 8 | buf[pos + 1]);
+                pos += 2;
+            }
+        }
+        number += fields[0];
+        if (pos + fields[1] > len) {
+            return 0;
+        }
+        if (number == OPTION_URI_PATH) {
+            size_t path_len = strlen(request->path);
+            snprintf(&request->path[path_len], MAX_PATH - path_len, "/%.*s", (int) fields[1], (const char *) &buf[pos]);
+        } else if (number == OPTION_CONTENT_FORMAT) {
+            request->content_format = readUint(&buf[pos], fields[1]);
+        } else if (number == OPTION_BLOCK1) {
+            request->has_block1 = 1;
+            request->block1 = readUint(&buf[pos], fields[1]);
+        }
+        pos += fields[1];
+    }
+    if (pos < len) {
+        request->payload = &buf[pos + 1];
+        request->payload_len = len - pos - 1;
+    }
+    return 1;
+}
+
+/**
+ * Sends the piggybacked response, with a Block1 option if block1 >= 0.
+ */
+static void respond(int fd, const struct sockaddr_in *peer, const REQUEST *request, uint8_t code, long block1) {
+    uint8_t response[32];
+    uint32_t len = 0;
+    response[len++] = (uint8_t) (1 << 6 | TYPE_ACK << 4 | request->token_len);
+    response[len++] = code;
+    response[len++] = (uint8_t) (request->message_id >> 8);
+    response[len++] = (uint8_t) request->message_id;
+    memcpy(&response[len], request->token, request->token_len);
+    len += request->token_len;
+    if (block1 >= 0) {
+        // option 27 as delta 13 + 14, value in up to 3 bytes
+        uint8_t value[3];
+        uint32_t value_len = 0;
+        for (int shift = 16; shift >= 0; shift -= 8) {
+            if (value_len > 0 || (block1 >> shift) != 0) {
+                value[value_len++] = (uint8_t) (block1 >> shift);
+            }
+        }
+        response[len++] = (uint8_t) (13 << 4 | value_len);
+        response[len++] = OPTION_BLOCK1 - 13;
+        memcpy(&response[len], value, value_len);
+        len += value_len;
+    }
+    sendto(fd, response, len, 0, (const struct sockaddr *) peer, sizeof(*peer));
+}
+
+static void printPayload(const REQUEST *request, const uint8_t *payload, uint32_t len) {
+    fprintf(stderr, "POST %s format %lu, %lu bytes\n", request->path,
+            (unsigned long) request->content_format, (unsigned long) len);
+    if (request->content_format == 0) {
+        fwrite(payload, 1, len, stdout);
+        fputc('\n', stdout);
+        fflush(stdout);
+    }
+}
+
+int main(int argc, char *argv[]) {
+    static uint8_t datagram[MAX_DATAGRAM];
+    static uint8_t transfer[MAX_TRANSFER];
+    uint32_t transfer_len = 0;
+    int port = (argc > 1) ? atoi(argv[1]) : DEFAULT_PORT;
+    int drop_every = (argc > 2) ? atoi(argv[2]) : 0;
+    uint32_t max_szx = (argc > 3) ? (uint32_t) atoi(argv[3]) : 6;
+    unsigned long requests = 0;
+
+    int fd = socket(AF_INET, SOCK_DGRAM, 0);
+    struct sockaddr_in address = {0};
+    address.sin_family = AF_INET;
+    address.sin_addr.s_addr = htonl(INADDR_ANY);
+    address.sin_port = htons((uint16_t) port);
+    if (fd < 0 || bind(fd, (struct sockaddr *) &address, sizeof(address)) < 0) {
+        perror("bind");
+        return 1;
+    }
+    fprintf(stderr, "listening on udp port %d\n", port);
+
+    while (1) {
+        struct sockaddr_in peer;
+        socklen_t peer_len = sizeof(peer);
+        ssize_t len = recvfrom(fd, datagram, sizeof(datagram), 0, (struct sockaddr *) &peer, &peer_len);
+        REQUEST request;
+        if (len <= 0 || !parseRequest(datagram, (uint32_t) len, &request) || request.code != CODE_POST) {
+            continue;
+        }
+        requests++;
+        if (drop_every > 0 && requests % drop_every == 0) {
+            fprintf(stderr, "message %04X dropped\n", request.message_id);
+            continue;
+        }
+
+        if (!request.has_block1) {
+            printPayload(&request, request.payload, request.payload_len);
+            if (request.type == TYPE_CON) {
+                respond(fd, &peer, &request, CODE_CHANGED, -1);
+            }
+            continue;
+        }
+
+        // Block1: store the whole block, smaller blocks are asked for from the
+        // next one on (RFC 7959 figure 7)
+        uint32_t szx = request.block1 & 0x07;
+        uint32_t more = (request.block1 >> 3) & 0x01;
+        uint32_t offset = (request.block1 >> 4) * (16U << szx);
+        uint32_t taken = request.payload_len;
+        if (szx > max_szx) {
+            szx = max_szx;
+        }
+        if (offset == 0) {
+            transfer_len = 0;
+        }
+        if (offset != transfer_len || offset + taken > MAX_TRANSFER) {
+            fprintf(stderr, "block at %lu out of order\n", (unsigned long) offset);
+            respond(fd, &peer, &request, CODE_BAD_REQUEST, -1);
+            continue;
+        }
+        memcpy(&transfer[offset], request.payload, taken);
+        transfer_len = offset + taken;
+        long block1 = (long) ((offset / (16U << szx)) << 4 | more << 3 | szx);
+        if (more) {
+            respond(fd, &peer, &request, CODE_CONTINUE, block1);
+        } else {
+            printPayload(&request, transfer, transfer_len);
+            respond(fd, &peer, &request, CODE_CHANGED, block1);
+        }
+    }
+    return 0;
+}
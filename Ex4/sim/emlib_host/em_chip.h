@@ -0,0 +1,11 @@
+/**************************************************************************//**
+ * @em_chip.h
+ * @brief Host stand-in for the emlib chip errata header.
+ * @version 0.0.1
+ *  ***************************************************************************/
+#ifndef EM_CHIP_H_
+#define EM_CHIP_H_
+
+#include "em_device.h"
+
+#endif /* EM_CHIP_H_ */
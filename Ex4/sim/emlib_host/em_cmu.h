@@ -0,0 +1,17 @@
+/**************************************************************************//**
+ * @em_cmu.h
+ * @brief Host stand-in for the emlib clock management unit header.
+ * @version 0.0.1
+ *  ***************************************************************************/
+#ifndef EM_CMU_H_
+#define EM_CMU_H_
+
+#include "em_device.h"
+
+typedef enum {cmuClock_HFLE, cmuClock_LFB, cmuClock_USART2} CMU_Clock_TypeDef;
+typedef enum {cmuSelect_LFXO} CMU_Select_TypeDef;
+
+void CMU_ClockEnable(CMU_Clock_TypeDef clock, bool enable);
+void CMU_ClockSelectSet(CMU_Clock_TypeDef clock, CMU_Select_TypeDef ref);
+
+#endif /* EM_CMU_H_ */
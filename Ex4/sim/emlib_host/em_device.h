@@ -0,0 +1,46 @@
+/**************************************************************************//**
+ * @em_device.h
+ * @brief Host stand-in for the EFM32PG12 device header, only what the host
+ * tests of serial_io_usart.c use. USART2 is a plain struct, the test feeds
+ * RXDATA and calls USART2_RX_IRQHandler itself.
+ * @version 0.0.1
+ *  ***************************************************************************/
+#ifndef EM_DEVICE_H_
+#define EM_DEVICE_H_
+
+#include <stdint.h>
+#include <stdbool.h>
+
+typedef struct _USART_TypeDef {
+    volatile uint32_t CMD;
+    volatile uint32_t CTRLX;
+    volatile uint32_t RXDATA;
+    volatile uint32_t IEN;
+    volatile uint32_t ROUTEPEN;
+    volatile uint32_t ROUTELOC0;
+    volatile uint32_t ROUTELOC1;
+} USART_TypeDef;
+
+extern USART_TypeDef *USART2;
+
+typedef enum {USART2_RX_IRQn} IRQn_Type;
+
+void NVIC_EnableIRQ(IRQn_Type irq);
+void NVIC_DisableIRQ(IRQn_Type irq);
+void NVIC_ClearPendingIRQ(IRQn_Type irq);
+
+#define USART_CMD_RXEN 0x1UL
+#define USART_CMD_TXEN 0x4UL
+#define USART_CTRLX_CTSEN 0x2UL
+#define USART_IF_RXDATAV 0x4UL
+#define USART_IEN_RXDATAV 0x4UL
+#define USART_ROUTEPEN_RXPEN 0x1UL
+#define USART_ROUTEPEN_TXPEN 0x2UL
+#define USART_ROUTEPEN_CTSPEN 0x8UL
+#define USART_ROUTEPEN_RTSPEN 0x10UL
+#define USART_ROUTELOC0_RXLOC_LOC1 0x1UL
+#define USART_ROUTELOC0_TXLOC_LOC1 0x100UL
+#define USART_ROUTELOC1_CTSLOC_LOC1 0x1UL
+#define USART_ROUTELOC1_RTSLOC_LOC1 0x100UL
+
+#endif /* EM_DEVICE_H_ */
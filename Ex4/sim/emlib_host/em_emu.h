@@ -0,0 +1,11 @@
+/**************************************************************************//**
+ * @em_emu.h
+ * @brief Host stand-in for the emlib energy management unit header.
+ * @version 0.0.1
+ *  ***************************************************************************/
+#ifndef EM_EMU_H_
+#define EM_EMU_H_
+
+#include "em_device.h"
+
+#endif /* EM_EMU_H_ */
@@ -0,0 +1,16 @@
+/**************************************************************************//**
+ * @em_gpio.h
+ * @brief Host stand-in for the emlib GPIO header.
+ * @version 0.0.1
+ *  ***************************************************************************/
+#ifndef EM_GPIO_H_
+#define EM_GPIO_H_
+
+#include "em_device.h"
+
+typedef enum {gpioPortA} GPIO_Port_TypeDef;
+typedef enum {gpioModeInput, gpioModePushPull} GPIO_Mode_TypeDef;
+
+void GPIO_PinModeSet(GPIO_Port_TypeDef port, unsigned int pin, GPIO_Mode_TypeDef mode, unsigned int out);
+
+#endif /* EM_GPIO_H_ */
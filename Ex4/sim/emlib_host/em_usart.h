@@ -0,0 +1,31 @@
+/**************************************************************************//**
+ * @em_usart.h
+ * @brief Host stand-in for the emlib USART header.
+ * @version 0.0.1
+ *  ***************************************************************************/
+#ifndef EM_USART_H_
+#define EM_USART_H_
+
+#include "em_device.h"
+
+typedef enum {usartDisable, usartEnable} USART_Enable_TypeDef;
+typedef enum {usartOVS16} USART_OVS_TypeDef;
+
+typedef struct _USART_InitAsync_TypeDef {
+    USART_Enable_TypeDef enable;
+    uint32_t refFreq;
+    uint32_t baudrate;
+} USART_InitAsync_TypeDef;
+
+#define USART_INITASYNC_DEFAULT {usartEnable, 0, 115200}
+
+void USART_InitAsync(USART_TypeDef *usart, const USART_InitAsync_TypeDef *init);
+void USART_BaudrateAsyncSet(USART_TypeDef *usart, uint32_t refFreq, uint32_t baudrate, USART_OVS_TypeDef ovs);
+void USART_Enable(USART_TypeDef *usart, USART_Enable_TypeDef enable);
+void USART_IntClear(USART_TypeDef *usart, uint32_t flags);
+void USART_IntEnable(USART_TypeDef *usart, uint32_t flags);
+void USART_IntDisable(USART_TypeDef *usart, uint32_t flags);
+uint32_t USART_IntGet(USART_TypeDef *usart);
+void USART_Tx(USART_TypeDef *usart, uint8_t data);
+
+#endif /* EM_USART_H_ */
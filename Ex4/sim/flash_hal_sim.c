@@ -0,0 +1,109 @@
+/**************************************************************************//**
+ * @flash_hal_sim.c
+ * @brief flash_hal.h in RAM, with NOR flash semantics and power loss
+ * injection, so the flash log can be stress tested on a PC.
+ * @version 0.0.1
+ *  ***************************************************************************/
+#include <string.h>
+#include "flash_hal_sim.h"
+
+#define WORDS_PER_PAGE (FLASH_HAL_PAGE_SIZE / 4)
+
+static uint32_t flash[FLASH_HAL_NUM_PAGES][WORDS_PER_PAGE];
+static uint32_t erase_counts[FLASH_HAL_NUM_PAGES];
+static uint32_t word_writes = 0;
+static uint32_t operations_until_failure = 0;
+static bool POWER_LOST = false;
+static bool INITIALIZED = false;
+
+/**
+ * Counts an operation towards the injected power loss.
+ * @return false if the power is lost at this operation.
+ */
+static bool powerHolds() {
+    if (POWER_LOST) {
+        return false;
+    }
+    if (operations_until_failure > 0 && --operations_until_failure == 0) {
+        POWER_LOST = true;
+        return false;
+    }
+    return true;
+}
+
+void FlashSimReset() {
+    memset(flash, 0xFF, sizeof(flash));
+    memset(erase_counts, 0, sizeof(erase_counts));
+    word_writes = 0;
+    operations_until_failure = 0;
+    POWER_LOST = false;
+    INITIALIZED = true;
+}
+
+void FlashSimFailAfter(uint32_t count) {
+    operations_until_failure = count;
+}
+
+void FlashSimPowerOn() {
+    POWER_LOST = false;
+}
+
+bool FlashSimIsPowerLost() {
+    return POWER_LOST;
+}
+
+uint32_t FlashSimGetEraseCount(uint32_t page) {
+    return (page < FLASH_HAL_NUM_PAGES) ? erase_counts[page] : 0;
+}
+
+uint32_t FlashSimGetWordWrites() {
+    return word_writes;
+}
+
+bool FlashHalInit(void) {
+    if (!INITIALIZED) {
+        FlashSimReset();
+    }
+    return !POWER_LOST;
+}
+
+bool FlashHalErasePage(uint32_t page) {
+    if (page >= FLASH_HAL_NUM_PAGES) {
+        return false;
+    }
+    if (!powerHolds()) {
+        // cut in the middle, the second half keeps its old contents
+        memset(flash[page], 0xFF, sizeof(flash[page]) / 2);
+        return false;
+    }
+    memset(flash[page], 0xFF, sizeof(flash[page]));
+    erase_counts[page]++;
+    return true;
+}
+
+bool FlashHalWrite(uint32_t page, uint32_t offset, const uint32_t * words, uint32_t num_words) {
+    if (page >= FLASH_HAL_NUM_PAGES || (offset & 3) != 0
+            || offset + num_words * 4 > FLASH_HAL_PAGE_SIZE) {
+        return false;
+    }
+    for (uint32_t i = 0; i < num_words; i++) {
+        uint32_t * word = &flash[page][offset / 4 + i];
+        if (!powerHolds()) {
+            // cut in the middle, only the low half of the bits was programmed
+            *word &= words[i] | 0xFFFF0000UL;
+            return false;
+        }
+        // programming only clears bits
+        *word &= words[i];
+        word_writes++;
+    }
+    return true;
+}
+
+void FlashHalRead(uint32_t page, uint32_t offset, void * buf, uint32_t len) {
+    if (page >= FLASH_HAL_NUM_PAGES || offset + len > FLASH_HAL_PAGE_SIZE) {
+        memset(buf, 0xFF, len);
+        return;
+    }
+    memcpy(buf, (const uint8_t *) flash[page] + offset, len);
+}
@@ -0,0 +1,49 @@
+/**************************************************************************//**
+ * @flash_hal_sim.h
+ * @brief Controls of the host flash simulator, for stress testing the flash
+ * log on a PC. The simulator implements flash_hal.h in RAM.
+ * @version 0.0.1
+ *  ***************************************************************************/
+#ifndef FLASH_HAL_SIM_H_
+#define FLASH_HAL_SIM_H_
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "flash_hal.h"
+
+/**************************************************************************//**
+ * @brief Erases the whole simulated flash and clears the counters.
+*****************************************************************************/
+void FlashSimReset();
+
+/**************************************************************************//**
+ * @brief Simulates a power loss after count more word writes or page erases.
+ * The write that is cut leaves a word with only some of its bits cleared,
+ * a cut erase leaves the page half erased. Afterwards every operation fails
+ * until FlashSimPowerOn.
+ * @param count - operations until the power loss, 0 to disable.
+*****************************************************************************/
+void FlashSimFailAfter(uint32_t count);
+
+/**************************************************************************//**
+ * @brief Restores power after a simulated power loss.
+*****************************************************************************/
+void FlashSimPowerOn();
+
+/**************************************************************************//**
+ * @return true if a simulated power loss happened and power is still off.
+*****************************************************************************/
+bool FlashSimIsPowerLost();
+
+/**************************************************************************//**
+ * @param page - page index.
+ * @return how often the page was erased since FlashSimReset.
+*****************************************************************************/
+uint32_t FlashSimGetEraseCount(uint32_t page);
+
+/**************************************************************************//**
+ * @return the number of words written since FlashSimReset.
+*****************************************************************************/
+uint32_t FlashSimGetWordWrites();
+
+#endif /* FLASH_HAL_SIM_H_ */
@@ -0,0 +1,225 @@
+/**************************************************************************//**
+ * @flash_log_stress.c
+ * @brief Power loss stress test of the flash log on the flash simulator.
+ * Appends numbered records of random length, flushes, reads and releases them
+ * like the upload does, and cuts the power at a random flash operation in
+ * every cycle. After each cut the log is recovered and checked: every record
+ * flushed and not released is still there, intact and in order, and no
+ * released record comes back. At the end the erase counts of the pages must
+ * be even.
+ * Usage: flash_log_stress [cycles] [seed]. Exits with 1 on the first failure.
+ * @version 0.0.1
+ *  ***************************************************************************/
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include "flash_log.h"
+#include "flash_hal_sim.h"
+
+#define DEFAULT_CYCLES 500
+#define DEFAULT_SEED 1
+#define MAX_OPERATIONS_TO_CUT 3000   // flash operations before the power loss
+#define FLUSH_EVERY 8                // appends per explicit flush, on average
+#define UPLOAD_EVERY 40              // appends per upload, less than a power cycle
+#define MAX_WEAR_SPREAD 2            // erase count difference between pages, plus 5%
+#define MAX_SERIALS (1UL << 22)      // records of the longest run
+
+bool DEBUG = false;
+
+static uint8_t flushed[MAX_SERIALS];  // set for the records a successful flush wrote
+static uint32_t next_serial = 1;      // serial of the next record to append
+static uint32_t unflushed_serial = 1; // first record appended after the last flush
+static uint32_t appended_serial = 0;  // last record appended
+static uint32_t released_serial = 0;  // last record released by a successful flush
+static uint32_t pending_release = 0;  // released, but not flushed yet
+
+/**
+ * Fills a record: the serial, then bytes that follow from it.
+ * @return payload length.
+ */
+static uint32_t buildRecord(uint32_t serial, uint8_t *data) {
+    uint32_t len = sizeof(serial) + (serial * 2654435761UL) % (FLASH_LOG_MAX_RECORD_LEN - sizeof(serial) + 1);
+    memcpy(data, &serial, sizeof(serial));
+    for (uint32_t i = sizeof(serial); i < len; i++) {
+        data[i] = (uint8_t) (serial + i * 31);
+    }
+    return len;
+}
+
+static bool fail(uint32_t cycle, const char *what, uint32_t serial) {
+    printf("cycle %lu: %s (record %lu, released %lu)\n", (unsigned long) cycle, what,
+           (unsigned long) serial, (unsigned long) released_serial);
+    return false;
+}
+
+/**
+ * Checks that no flushed record between two records read is missing.
+ */
+static bool checkGap(uint32_t cycle, uint32_t from, uint32_t to) {
+    for (uint32_t serial = from; serial < to; serial++) {
+        if (flushed[serial]) {
+            return fail(cycle, "flushed record lost", serial);
+        }
+    }
+    return true;
+}
+
+/**
+ * Reads the whole log after a recovery and checks it against what was
+ * flushed and released. A release that was not flushed yet may or may not
+ * have reached the flash, up to maybe_released records may be gone.
+ */
+static bool checkLog(uint32_t cycle, uint32_t maybe_released) {
+    uint8_t data[FLASH_LOG_MAX_RECORD_LEN];
+    uint8_t expected[FLASH_LOG_MAX_RECORD_LEN];
+    FLASH_LOG_CURSOR cursor;
+    uint32_t last = released_serial;
+    uint8_t type;
+    uint32_t len;
+    uint32_t serial;
+
+    FlashLogOldest(&cursor);
+    while (FlashLogReadNext(&cursor, &type, data, sizeof(data), &len)) {
+        memcpy(&serial, data, sizeof(serial));
+        if (type != FLASH_LOG_TYPE_TELEMETRY || len != buildRecord(serial, expected)
+                || memcmp(data, expected, len) != 0) {
+            return fail(cycle, "bad record", serial);
+        }
+        if (serial <= released_serial) {
+            return fail(cycle, "released record is back", serial);
+        }
+        if (last == released_serial && maybe_released > last && serial > maybe_released) {
+            released_serial = last = maybe_released;
+        }
+        if (serial <= last || serial > appended_serial) {
+            return fail(cycle, "record out of order", serial);
+        }
+        if (!checkGap(cycle, last + 1, serial)) {
+            return false;
+        }
+        last = serial;
+    }
+    if (last == released_serial && maybe_released > last) {
+        released_serial = last = maybe_released;
+    }
+    return checkGap(cycle, last + 1, next_serial);
+}
+
+/**
+ * Flushes and keeps track of what is safe in flash.
+ */
+static void flush(void) {
+    // the MCU stops with the power, nothing after the cut counts
+    if (FlashLogFlush() && !FlashSimIsPowerLost()) {
+        for (; unflushed_serial <= appended_serial; unflushed_serial++) {
+            flushed[unflushed_serial] = 1;
+        }
+        unflushed_serial = next_serial;
+        if (pending_release > released_serial) {
+            released_serial = pending_release;
+        }
+    }
+}
+
+/**
+ * Reads up to the newest record and releases what was read, like an upload.
+ * The batch is flushed first and the release right after it.
+ */
+static void upload(void) {
+    uint8_t data[FLASH_LOG_MAX_RECORD_LEN];
+    FLASH_LOG_CURSOR cursor;
+    uint32_t last = 0;
+    uint8_t type;
+    uint32_t len;
+
+    flush();
+    FlashLogOldest(&cursor);
+    while (FlashLogReadNext(&cursor, &type, data, sizeof(data), &len)) {
+        memcpy(&last, data, sizeof(last));
+    }
+    if (last > 0 && FlashLogRelease(&cursor)) {
+        pending_release = last;
+        flush();
+    }
+}
+
+/**
+ * Uses the log until the power is cut.
+ */
+static void runUntilPowerLoss(void) {
+    uint8_t data[FLASH_LOG_MAX_RECORD_LEN];
+
+    FlashSimFailAfter(1 + (uint32_t) rand() % MAX_OPERATIONS_TO_CUT);
+    while (!FlashSimIsPowerLost()) {
+        uint32_t len = buildRecord(next_serial, data);
+        if (FlashLogAppend(FLASH_LOG_TYPE_TELEMETRY, data, len)) {
+            appended_serial = next_serial;
+        }
+        next_serial++;
+        if (next_serial == MAX_SERIALS) {
+            break;
+        }
+
+        if (next_serial % UPLOAD_EVERY == 0) {
+            upload();
+        } else if (rand() % FLUSH_EVERY == 0) {
+            flush();
+        }
+    }
+}
+
+int main(int argc, char *argv[]) {
+    uint32_t cycles = (argc > 1) ? (uint32_t) strtoul(argv[1], NULL, 0) : DEFAULT_CYCLES;
+    unsigned int seed = (argc > 2) ? (unsigned int) strtoul(argv[2], NULL, 0) : DEFAULT_SEED;
+    uint32_t recovered = 0, corrupt_pages = 0;
+    FLASH_LOG_STATS stats;
+
+    srand(seed);
+    FlashSimReset();
+    if (!FlashLogInit()) {
+        printf("init failed\n");
+        return 1;
+    }
+    for (uint32_t cycle = 1; cycle <= cycles && next_serial < MAX_SERIALS; cycle++) {
+        runUntilPowerLoss();
+        FlashLogGetStats(&stats);
+        if (stats.pages_dropped > 0) {
+            fail(cycle, "log full, pages dropped", 0);
+            return 1;
+        }
+
+        FlashSimPowerOn();
+        // whatever was only in RAM is gone
+        unflushed_serial = next_serial;
+        if (!FlashLogInit()) {
+            fail(cycle, "recovery failed", 0);
+            return 1;
+        }
+        FlashLogGetStats(&stats);
+        recovered += stats.records_recovered;
+        corrupt_pages += stats.corrupt_pages;
+        if (!checkLog(cycle, pending_release)) {
+            return 1;
+        }
+        pending_release = released_serial;
+    }
+
+    uint32_t min_erases = UINT32_MAX, max_erases = 0;
+    for (uint32_t page = 0; page < FLASH_HAL_NUM_PAGES; page++) {
+        uint32_t erases = FlashSimGetEraseCount(page);
+        min_erases = (erases < min_erases) ? erases : min_erases;
+        max_erases = (erases > max_erases) ? erases : max_erases;
+    }
+    printf("%lu power cuts, %lu records appended, %lu recovered, %lu corrupt pages seen\n",
+           (unsigned long) cycles, (unsigned long) appended_serial, (unsigned long) recovered,
+           (unsigned long) corrupt_pages);
+    printf("%lu words written, page erases %lu..%lu\n", (unsigned long) FlashSimGetWordWrites(),
+           (unsigned long) min_erases, (unsigned long) max_erases);
+    if (max_erases > min_erases + min_erases / 20 + MAX_WEAR_SPREAD) {
+        printf("uneven wear\n");
+        return 1;
+    }
+    printf("ok\n");
+    return 0;
+}
@@ -0,0 +1,170 @@
+/**************************************************************************//**
+ * @lz_fuzz.c
+ * @brief Round trip test of the LZ compressor with random inputs.
+ * Every run builds an input of one kind (random bytes, repeated runs, a few
+ * repeated blocks, text-like telemetry lines), cuts it into random pieces,
+ * compresses them one after the other into a stream and checks that the
+ * stream decompresses to the input. Repeated blocks longer than the pieces
+ * make the sequences refer back across pieces, up to the window size.
+ * Truncated and damaged streams must be rejected or stay within the output
+ * buffer.
+ * Usage: lz_fuzz [runs] [seed]. Exits with 1 on the first failure.
+ * @version 0.0.1
+ *  ***************************************************************************/
+#include <stdio.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include "lz.h"
+
+#define DEFAULT_RUNS 5000
+#define DEFAULT_SEED 1
+#define MAX_INPUT_LEN 8192
+#define MAX_PIECES 64
+#define MAX_PIECE_LEN 600   // shorter than the window, matches span pieces
+#define NUM_KINDS 4
+#define GUARD_LEN 64
+#define GUARD_BYTE 0xA5
+
+enum INPUT_KIND{KIND_RANDOM, KIND_RUNS, KIND_BLOCKS, KIND_LINES};
+
+static uint8_t input[MAX_INPUT_LEN];
+static uint8_t stream[MAX_PIECES * LZ_BOUND(0) + LZ_BOUND(MAX_INPUT_LEN)];
+static uint8_t output[MAX_INPUT_LEN + GUARD_LEN];
+
+/**
+ * Fills len bytes of input of a kind.
+ */
+static void buildInput(int kind, uint32_t len) {
+    uint32_t i = 0;
+
+    switch (kind) {
+    case KIND_RANDOM:
+        for (; i < len; i++) {
+            input[i] = (uint8_t) rand();
+        }
+        break;
+    case KIND_RUNS:
+        // runs of one byte, overlapping matches with offset 1
+        while (i < len) {
+            uint8_t byte = (uint8_t) rand();
+            uint32_t run = 1 + (uint32_t) rand() % 300;
+            for (; run > 0 && i < len; run--) {
+                input[i++] = byte;
+            }
+        }
+        break;
+    case KIND_BLOCKS: {
+        // a few random blocks, repeated at distances around the window size
+        uint8_t blocks[4][96];
+        for (uint32_t b = 0; b < sizeof(blocks); b++) {
+            blocks[b / sizeof(blocks[0])][b % sizeof(blocks[0])] = (uint8_t) rand();
+        }
+        while (i < len) {
+            uint32_t gap = (uint32_t) rand() % (LZ_WINDOW_SIZE + 64);
+            const uint8_t * block = blocks[rand() % 4];
+            for (uint32_t b = 0; b < sizeof(blocks[0]) && i < len; b++) {
+                input[i++] = block[b];
+            }
+            for (; gap > 0 && i < len; gap--) {
+                input[i++] = (uint8_t) rand();
+            }
+        }
+        break;
+    }
+    default:
+        // telemetry lines, what the uploads look like
+        while (i < len) {
+            char line[96];
+            int n = snprintf(line, sizeof(line), "gps,device=ex4 lat=%d.%04d,lon=%d.%04d,sats=%di %lu\n",
+                             31 + rand() % 2, rand() % 10000, 34 + rand() % 2, rand() % 10000,
+                             rand() % 12, 1560000000UL + (unsigned long) rand() % 1000);
+            for (int c = 0; c < n && i < len; c++) {
+                input[i++] = (uint8_t) line[c];
+            }
+        }
+        break;
+    }
+}
+
+/**
+ * Compresses the input in random pieces.
+ * @return stream length, -1 on failure.
+ */
+static int compressPieces(uint32_t len) {
+    static LZ_COMPRESSOR lz;
+    uint32_t stream_len = 0;
+    uint32_t done = 0;
+    int pieces = 0;
+
+    LzInit(&lz);
+    do {
+        uint32_t piece = (uint32_t) rand() % (MAX_PIECE_LEN + 1);
+        if (piece > len - done || pieces == MAX_PIECES - 1) {
+            piece = len - done;
+        }
+        int chunk = LzCompress(&lz, &input[done], piece, &stream[stream_len], LZ_BOUND(piece));
+        if (chunk < 0) {
+            printf("%lu bytes did not fit LZ_BOUND\n", (unsigned long) piece);
+            return -1;
+        }
+        stream_len += (uint32_t) chunk;
+        done += piece;
+        pieces++;
+    } while (done < len);
+    return (int) stream_len;
+}
+
+int main(int argc, char *argv[]) {
+    uint32_t runs = (argc > 1) ? (uint32_t) strtoul(argv[1], NULL, 0) : DEFAULT_RUNS;
+    unsigned int seed = (argc > 2) ? (unsigned int) strtoul(argv[2], NULL, 0) : DEFAULT_SEED;
+    unsigned long in_total[NUM_KINDS] = {0}, out_total[NUM_KINDS] = {0};
+
+    srand(seed);
+    for (uint32_t run = 1; run <= runs; run++) {
+        int kind = (int) (run % NUM_KINDS);
+        uint32_t len = (uint32_t) rand() % (MAX_INPUT_LEN + 1);
+
+        buildInput(kind, len);
+        int stream_len = compressPieces(len);
+        if (stream_len < 0) {
+            printf("run %lu: compression failed\n", (unsigned long) run);
+            return 1;
+        }
+        int out_len = LzDecompress(stream, (uint32_t) stream_len, output, sizeof(output));
+        if (out_len != (int) len || memcmp(output, input, len) != 0) {
+            printf("run %lu: kind %d, %lu bytes, round trip gave %d bytes\n",
+                   (unsigned long) run, kind, (unsigned long) len, out_len);
+            return 1;
+        }
+        // an output buffer one byte short must be refused
+        if (len > 0 && LzDecompress(stream, (uint32_t) stream_len, output, len - 1) != -1) {
+            printf("run %lu: output overflow not detected\n", (unsigned long) run);
+            return 1;
+        }
+        // a damaged or cut stream may decode to garbage, never past the buffer
+        if (stream_len > 0) {
+            stream[rand() % stream_len] ^= (uint8_t) (1 + rand() % 255);
+            memset(&output[len], GUARD_BYTE, GUARD_LEN);
+            out_len = LzDecompress(stream, (uint32_t) (rand() % (stream_len + 1)), output, len);
+            bool guard_ok = true;
+            for (uint32_t i = len; i < len + GUARD_LEN; i++) {
+                guard_ok = guard_ok && output[i] == GUARD_BYTE;
+            }
+            if (out_len > (int) len || !guard_ok) {
+                printf("run %lu: damaged stream decoded to %d bytes\n", (unsigned long) run, out_len);
+                return 1;
+            }
+        }
+        in_total[kind] += len;
+        out_total[kind] += (unsigned long) stream_len;
+    }
+
+    static const char * const names[NUM_KINDS] = {"random", "runs", "blocks", "lines"};
+    for (int kind = 0; kind < NUM_KINDS; kind++) {
+        printf("%-6s %8lu -> %8lu bytes\n", names[kind], in_total[kind], out_total[kind]);
+    }
+    printf("%lu round trips ok\n", (unsigned long) runs);
+    return 0;
+}
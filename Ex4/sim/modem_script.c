@@ -0,0 +1,636 @@
+/**************************************************************************//**
+ * @modem_script.c
+ * @brief Host test of the cellular driver down to the USART interrupt.
+ * cellular.c and serial_io_usart.c run unchanged on top of the emlib
+ * stand-ins in emlib_host/. The USART2 registers feed a scripted modem that
+ * answers the AT commands, takes AT^SISW data and hands it to a peer, and
+ * serves AT^SISR from what the peer sent back. Received bytes go through
+ * USART2_RX_IRQHandler one by one, with RTS/CTS: while the receive buffer is
+ * full the modem holds the rest back. Time is simulated.
+ * The peers: an echo for socket data, a broker for the MQTT client that
+ * answers with CONNACK and PUBACK and a CoAP server that answers piggybacked
+ * or with an empty ACK and a separate response, all full of zero bytes.
+ * A "sockudp://" service keeps the datagrams apart, one per AT^SISR.
+ * A long reply comes in parts, each after the reads emptied the service and
+ * behind a +CREG URC, and ends with ^SISR: <id>,2.
+ * Bytes sent while the two sides are at different rates are lost. The modem
+ * keeps its AT+IPR rate when the driver starts again, and is found there.
+ * Without flow control, what does not fit the receive buffer is counted
+ * and lost, what is in it stays. A URC nobody reads posts EVENT_CELLULAR_RX.
+ * Usage: modem_script. Exits with 1 if a test fails.
+ * @version 0.0.1
+ *  ***************************************************************************/
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include "em_device.h"
+#include "em_cmu.h"
+#include "em_gpio.h"
+#include "em_usart.h"
+#include "cellular.h"
+#include "serial_io_usart.h"
+#include "mqtt.h"
+#include "coap.h"
+#include "scheduler.h"
+#include "energy.h"
+#include "timebase.h"
+
+#define MODEM_TX_SIZE 65536          // bytes on their way to the MCU
+#define MODEM_LINE_SIZE 512
+#define MODEM_DATA_SIZE 8192         // what a service holds for AT^SISR
+#define MODEM_NUM_SERVICES 10
+#define MODEM_MAX_DATAGRAMS 16
+#define SOCKET_PROFILE 1
+#define SOCKET_ADDRESS "socktcp://127.0.0.1:9000"
+#define READ_TIMEOUT_MS 5000
+#define INACT_TIME_SEC 20
+#define MQTT_ADDRESS "socktcp://127.0.0.1:1883"
+#define MQTT_PUBLISHES 4
+#define COAP_ADDRESS "sockudp://127.0.0.1:5683"
+#define COAP_POSTS 4
+#define REPLY_PARTS 3
+#define CREG_URC "\r\n+CREG: 1,\"00C3\",\"A1B2C3\",7\r\n"
+
+bool DEBUG = false;
+
+typedef void (*PEER_HANDLER)(int srvProfileId, const uint8_t *data, uint32_t len);
+
+typedef struct _MODEM_SERVICE {
+    uint8_t data[MODEM_DATA_SIZE];   // arrived, not read yet
+    uint32_t len;
+    bool notified;                   // ^SISR: <id>,1 sent, no short read since
+    uint32_t sizes[MODEM_MAX_DATAGRAMS];   // of the datagrams in data, UDP only
+    uint32_t num_datagrams;
+} MODEM_SERVICE;
+
+static USART_TypeDef usart2;
+USART_TypeDef *USART2 = &usart2;
+void USART2_RX_IRQHandler(void);
+
+static uint64_t now_ms = 0;
+static uint8_t to_mcu[MODEM_TX_SIZE];
+static uint32_t to_mcu_head = 0, to_mcu_tail = 0;
+static char line[MODEM_LINE_SIZE];
+static uint32_t line_len = 0;
+static uint8_t write_data[MODEM_DATA_SIZE];
+static uint32_t write_len = 0, write_expected = 0;
+static int write_profile = -1;
+static MODEM_SERVICE services[MODEM_NUM_SERVICES];
+static bool udp[MODEM_NUM_SERVICES];
+static PEER_HANDLER peer = NULL;
+static void (*service_emptied)(int srvProfileId) = NULL;   // called when a read emptied a service
+static uint32_t stalls = 0;
+static uint32_t modem_baud = 115200;
+static uint32_t mcu_baud = 115200;
+static uint32_t rx_events = 0;
+
+/******************************************************************************
+ * 							    MODEM SIDE
+*****************************************************************************/
+
+static void modemDeliver(void);
+
+static void modemSend(const void *data, uint32_t len) {
+    const uint8_t *bytes = data;
+    for (uint32_t i = 0; i < len; i++) {
+        to_mcu[to_mcu_tail] = bytes[i];
+        to_mcu_tail = (to_mcu_tail + 1) % MODEM_TX_SIZE;
+    }
+}
+
+static void modemSendText(const char *text) {
+    modemSend(text, (uint32_t) strlen(text));
+}
+
+/**
+ * Data from the peer arrives at a service, the first since the last read
+ * that emptied it raises the ^SISR URC.
+ */
+static void modemArrive(int srvProfileId, const void *data, uint32_t len) {
+    MODEM_SERVICE *service = &services[srvProfileId];
+    char urc[32];
+
+    memcpy(&service->data[service->len], data, len);
+    service->len += len;
+    if (udp[srvProfileId]) {
+        service->sizes[service->num_datagrams++] = len;
+    }
+    if (!service->notified) {
+        service->notified = true;
+        snprintf(urc, sizeof(urc), "\r\n^SISR: %d,1\r\n", srvProfileId);
+        modemSendText(urc);
+    }
+}
+
+/**
+ * AT^SISR=<id>,<len>: the answer line, the data and OK. A UDP read takes one
+ * datagram, what does not fit is lost. Data left after a short read raises
+ * the URC again.
+ */
+static void modemRead(int srvProfileId, uint32_t maxlen) {
+    MODEM_SERVICE *service = &services[srvProfileId];
+    uint32_t available = service->len;
+    char answer[32];
+
+    if (udp[srvProfileId] && service->num_datagrams > 0) {
+        available = service->sizes[0];
+        service->num_datagrams--;
+        memmove(service->sizes, &service->sizes[1], service->num_datagrams * sizeof(service->sizes[0]));
+    }
+    uint32_t count = (available < maxlen) ? available : maxlen;
+    uint32_t consumed = udp[srvProfileId] ? available : count;
+    snprintf(answer, sizeof(answer), "\r\n^SISR: %d,%lu\r\n", srvProfileId, (unsigned long) count);
+    modemSendText(answer);
+    modemSend(service->data, count);
+    modemSendText("\r\nOK\r\n");
+    memmove(service->data, &service->data[consumed], service->len - consumed);
+    service->len -= consumed;
+    if (count < maxlen && service->len == 0 && service_emptied != NULL) {
+        service_emptied(srvProfileId);
+    }
+    if (count < maxlen) {
+        service->notified = service->len > 0;
+        if (service->notified) {
+            snprintf(answer, sizeof(answer), "\r\n^SISR: %d,1\r\n", srvProfileId);
+            modemSendText(answer);
+        }
+    }
+}
+
+static void modemCommand(const char *command) {
+    int id, len;
+    char answer[64];
+
+    if (sscanf(command, "AT+IPR=%d", &len) == 1) {
+        // answered at the old rate
+        modemSendText("\r\nOK\r\n");
+        modemDeliver();
+        modem_baud = (uint32_t) len;
+    } else if (sscanf(command, "AT^SISR=%d,%d", &id, &len) == 2) {
+        modemRead(id, (uint32_t) len);
+    } else if (sscanf(command, "AT^SISW=%d,%d", &id, &len) == 2) {
+        // the data follows, OK once all of it came
+        snprintf(answer, sizeof(answer), "\r\n^SISW: %d,%d,0\r\n", id, len);
+        modemSendText(answer);
+        write_profile = id;
+        write_expected = (uint32_t) len;
+        write_len = 0;
+    } else if (sscanf(command, "AT^SISS=%d", &id) == 1 && strstr(command, "\"address\"") != NULL) {
+        udp[id] = strstr(command, "sockudp://") != NULL;
+        modemSendText("\r\nOK\r\n");
+    } else if (sscanf(command, "AT^SISO=%d", &id) == 1) {
+        memset(&services[id], 0, sizeof(services[id]));
+        snprintf(answer, sizeof(answer), "\r\nOK\r\n\r\n^SISW: %d,1\r\n", id);
+        modemSendText(answer);
+    } else {
+        modemSendText("\r\nOK\r\n");
+    }
+}
+
+/**
+ * A byte the MCU sent: part of AT^SISW data or of a command line. The driver
+ * ends its commands with "\r\n", the modem takes the "\n" before it enters
+ * data mode.
+ */
+static void modemReceive(uint8_t byte) {
+    if (mcu_baud != modem_baud) {
+        return;
+    } else if (write_expected > 0) {
+        write_data[write_len++] = byte;
+        if (write_len == write_expected) {
+            write_expected = 0;
+            modemSendText("\r\nOK\r\n");
+            if (peer != NULL) {
+                peer(write_profile, write_data, write_len);
+            }
+        }
+    } else if (byte == '\n') {
+        if (line_len > 0) {
+            line[line_len] = '\0';
+            modemCommand(line);
+            line_len = 0;
+        }
+    } else if (byte != '\r' && line_len < MODEM_LINE_SIZE - 1) {
+        line[line_len++] = (char) byte;
+    }
+}
+
+/**
+ * Moves the bytes on their way into the RX interrupt, until the driver
+ * turns it off because its buffer is full.
+ */
+static void modemDeliver(void) {
+    while (to_mcu_head != to_mcu_tail) {
+        if (!(usart2.IEN & USART_IEN_RXDATAV)) {
+            stalls++;
+            return;
+        }
+        if (mcu_baud != modem_baud) {
+            to_mcu_head = (to_mcu_head + 1) % MODEM_TX_SIZE;
+            continue;
+        }
+        usart2.RXDATA = to_mcu[to_mcu_head];
+        USART2_RX_IRQHandler();
+        if (!(usart2.IEN & USART_IEN_RXDATAV)) {
+            // stalled, the byte was left in the USART
+            stalls++;
+            return;
+        }
+        to_mcu_head = (to_mcu_head + 1) % MODEM_TX_SIZE;
+    }
+}
+
+/******************************************************************************
+ * 						EMLIB, ENERGY AND TIMEBASE
+*****************************************************************************/
+
+void NVIC_EnableIRQ(IRQn_Type irq) {}
+void NVIC_DisableIRQ(IRQn_Type irq) {}
+void NVIC_ClearPendingIRQ(IRQn_Type irq) {}
+void CMU_ClockEnable(CMU_Clock_TypeDef clock, bool enable) {}
+void CMU_ClockSelectSet(CMU_Clock_TypeDef clock, CMU_Select_TypeDef ref) {}
+void GPIO_PinModeSet(GPIO_Port_TypeDef port, unsigned int pin, GPIO_Mode_TypeDef mode, unsigned int out) {}
+void USART_InitAsync(USART_TypeDef *usart, const USART_InitAsync_TypeDef *init) {}
+void USART_BaudrateAsyncSet(USART_TypeDef *usart, uint32_t refFreq, uint32_t baudrate, USART_OVS_TypeDef ovs) {
+    mcu_baud = baudrate;
+}
+void USART_Enable(USART_TypeDef *usart, USART_Enable_TypeDef enable) {}
+void USART_IntClear(USART_TypeDef *usart, uint32_t flags) {}
+
+void USART_IntEnable(USART_TypeDef *usart, uint32_t flags) {
+    usart->IEN |= flags;
+}
+
+void USART_IntDisable(USART_TypeDef *usart, uint32_t flags) {
+    usart->IEN &= ~flags;
+}
+
+uint32_t USART_IntGet(USART_TypeDef *usart) {
+    return USART_IF_RXDATAV;
+}
+
+void USART_Tx(USART_TypeDef *usart, uint8_t data) {
+    modemReceive(data);
+}
+
+void EnergyBlockMode(ENERGY_MODE mode) {}
+void EnergyUnblockMode(ENERGY_MODE mode) {}
+
+void EnergyDelay(uint32_t ms) {
+    now_ms += ms;
+}
+
+bool EnergyWaitFor(bool (*ready)(void), uint32_t timeout_ms) {
+    modemDeliver();
+    if (ready()) {
+        return true;
+    }
+    // nothing more comes before the timeout
+    now_ms += timeout_ms;
+    return false;
+}
+
+uint64_t TimebaseGetMs(void) {
+    return now_ms;
+}
+
+uint64_t TimebaseGetTicks(void) {
+    return now_ms * 32768 / 1000;
+}
+
+void TimerStart(TIMER * timer, uint32_t delay_ms, uint32_t period_ms, TIMER_CALLBACK callback, void * arg) {
+    timer->expiry_ms = now_ms + delay_ms;
+    timer->active = true;
+}
+
+void TimerStop(TIMER * timer) {
+    timer->active = false;
+}
+
+bool TimerIsActive(TIMER * timer) {
+    return timer->active;
+}
+
+bool SchedulerPostOnce(EVENT_PRIORITY priority, EVENT_TYPE type, uint32_t data) {
+    if (type == EVENT_CELLULAR_RX) {
+        rx_events++;
+    }
+    return true;
+}
+
+/******************************************************************************
+ * 							    TESTS
+*****************************************************************************/
+
+static void echoPeer(int srvProfileId, const uint8_t *data, uint32_t len) {
+    modemArrive(srvProfileId, data, len);
+}
+
+/**
+ * Fills binary data that holds zeros, line ends and result codes.
+ */
+static void fillBinary(uint8_t *data, uint32_t len, uint32_t seed) {
+    static const char special[] = "\0\r\nOK\r\n\0^SISR: 1,1\r\n\0\0";
+    for (uint32_t i = 0; i < len; i++) {
+        data[i] = (i % 5 == 0) ? (uint8_t) special[(i / 5 + seed) % (sizeof(special) - 1)]
+                               : (uint8_t) (i * 7 + seed);
+    }
+}
+
+/**
+ * Socket data with zero bytes goes out with AT^SISW and comes back through
+ * the RX interrupt and AT^SISR unchanged.
+ */
+static bool testSocketBinary(void) {
+    static const uint32_t sizes[] = {1, 2, 5, 64, 999, 1000, 1001, 1500};
+    uint8_t sent[1500];
+    uint8_t received[1500];
+
+    peer = echoPeer;
+    if (!CellularSocketOpen(SOCKET_PROFILE, SOCKET_ADDRESS)) {
+        printf("socket binary: open failed\n");
+        return false;
+    }
+    for (uint32_t i = 0; i < sizeof(sizes) / sizeof(sizes[0]); i++) {
+        uint32_t len = sizes[i];
+        fillBinary(sent, len, i);
+        if (!CellularSocketWrite(SOCKET_PROFILE, sent, (int) len)) {
+            printf("socket binary: write of %lu bytes failed\n", (unsigned long) len);
+            return false;
+        }
+        int count = CellularSocketRead(SOCKET_PROFILE, received, sizeof(received), READ_TIMEOUT_MS);
+        if (count != (int) len || memcmp(sent, received, len) != 0) {
+            printf("socket binary: %lu bytes sent, %d read back%s\n", (unsigned long) len, count,
+                   (count == (int) len) ? " but different" : "");
+            return false;
+        }
+    }
+    CellularSocketClose(SOCKET_PROFILE);
+    printf("socket binary: ok, %lu flow control stalls\n", (unsigned long) stalls);
+    return true;
+}
+
+/**
+ * The broker: CONNACK for CONNECT, PUBACK for a QoS 1 PUBLISH. Every write
+ * of the client is one packet with a one byte remaining length.
+ */
+static void brokerPeer(int srvProfileId, const uint8_t *data, uint32_t len) {
+    if (data[0] == 0x10) {
+        static const uint8_t connack[] = {0x20, 0x02, 0x00, 0x00};
+        modemArrive(srvProfileId, connack, sizeof(connack));
+    } else if ((data[0] & 0xF6) == 0x32) {
+        uint32_t topic_len = ((uint32_t) data[2] << 8) | data[3];
+        uint8_t puback[] = {0x40, 0x02, data[4 + topic_len], data[5 + topic_len]};
+        modemArrive(srvProfileId, puback, sizeof(puback));
+    }
+}
+
+/**
+ * MQTT acks are mostly zero bytes: CONNACK 20 02 00 00, PUBACK 40 02 00 01.
+ */
+static bool testMqttAcks(void) {
+    static MQTT_CLIENT client;
+    uint8_t message[] = {0x00, 0x01, 0x00};
+
+    peer = brokerPeer;
+    MqttInit(&client, SOCKET_PROFILE, MQTT_ADDRESS, "ex4-modem", 0);
+    if (!MqttConnect(&client)) {
+        printf("mqtt acks: no CONNACK\n");
+        return false;
+    }
+    for (int i = 0; i < MQTT_PUBLISHES; i++) {
+        if (!MqttPublish(&client, "ex4/test", message, sizeof(message), 1)) {
+            printf("mqtt acks: publish failed\n");
+            return false;
+        }
+        MqttPoll(&client);
+    }
+    if (MqttGetInflight(&client) != 0 || client.stats.acked != MQTT_PUBLISHES) {
+        printf("mqtt acks: %lu of %d PUBACKs\n", (unsigned long) client.stats.acked, MQTT_PUBLISHES);
+        return false;
+    }
+    MqttDisconnect(&client);
+    printf("mqtt acks: ok\n");
+    return true;
+}
+
+static const uint32_t reply_sizes[REPLY_PARTS] = {3700, 999, 1};
+static uint8_t reply[3700 + 999 + 1];
+static uint32_t reply_part = 0;
+static uint32_t reply_offset = 0;
+
+/**
+ * The next part of the reply, or its end.
+ */
+static void replyNextPart(int srvProfileId) {
+    char urc[32];
+
+    modemSendText(CREG_URC);
+    if (reply_part == REPLY_PARTS) {
+        snprintf(urc, sizeof(urc), "\r\n^SISR: %d,2\r\n", srvProfileId);
+        modemSendText(urc);
+        service_emptied = NULL;
+        return;
+    }
+    modemArrive(srvProfileId, &reply[reply_offset], reply_sizes[reply_part]);
+    reply_offset += reply_sizes[reply_part++];
+}
+
+/**
+ * A request starts the reply.
+ */
+static void replyPeer(int srvProfileId, const uint8_t *data, uint32_t len) {
+    reply_part = 0;
+    reply_offset = 0;
+    service_emptied = replyNextPart;
+    replyNextPart(srvProfileId);
+}
+
+typedef struct _COLLECTED {
+    uint8_t data[sizeof(reply)];
+    uint32_t len;
+    uint32_t chunks;
+} COLLECTED;
+
+static void collect(const uint8_t *data, int len, void *context) {
+    COLLECTED *collected = (COLLECTED *) context;
+    if (collected->len + (uint32_t) len <= sizeof(collected->data)) {
+        memcpy(&collected->data[collected->len], data, (size_t) len);
+    }
+    collected->len += (uint32_t) len;
+    collected->chunks++;
+}
+
+/**
+ * CellularServiceRead takes a reply longer than a read, in parts with URCs
+ * between, until ^SISR: <id>,2.
+ */
+static bool testServiceRead(void) {
+    static COLLECTED collected;
+    uint8_t request[] = "GET\r\n";
+
+    fillBinary(reply, sizeof(reply), 7);
+    peer = replyPeer;
+    if (!CellularSocketOpen(SOCKET_PROFILE, SOCKET_ADDRESS) ||
+        !CellularSocketWrite(SOCKET_PROFILE, request, sizeof(request) - 1)) {
+        printf("service read: request failed\n");
+        return false;
+    }
+    int total = CellularServiceRead(SOCKET_PROFILE, collect, &collected, READ_TIMEOUT_MS);
+    CellularSocketClose(SOCKET_PROFILE);
+    if (total != (int) sizeof(reply) || collected.len != sizeof(reply) ||
+        memcmp(collected.data, reply, sizeof(reply)) != 0) {
+        printf("service read: %d of %lu bytes\n", total, (unsigned long) sizeof(reply));
+        return false;
+    }
+    printf("service read: ok, %lu chunks\n", (unsigned long) collected.chunks);
+    return true;
+}
+
+static uint32_t coap_requests = 0;
+static bool coap_separate_acked = false;
+
+/**
+ * The CoAP server: 2.04 piggybacked on the ACK for every other POST, an
+ * empty ACK (code 0.00) and a separate response with message ID 0 for the
+ * others. Takes note of the client's ACK for the separate response.
+ */
+static void coapPeer(int srvProfileId, const uint8_t *data, uint32_t len) {
+    uint8_t type = (data[0] >> 4) & 0x03;
+    uint8_t token_len = data[0] & 0x0F;
+    uint8_t response[16] = {(uint8_t) (0x60 | token_len), COAP_CHANGED, data[2], data[3]};
+
+    if (type == 2) {
+        coap_separate_acked = coap_separate_acked || (len == 4 && data[1] == 0 && data[2] == 0 && data[3] == 0);
+        return;
+    }
+    memcpy(&response[4], &data[4], token_len);
+    if (coap_requests++ % 2 == 0) {
+        modemArrive(srvProfileId, response, 4U + token_len);
+        return;
+    }
+    uint8_t empty_ack[4] = {0x60, 0x00, data[2], data[3]};
+    modemArrive(srvProfileId, empty_ack, sizeof(empty_ack));
+    response[0] = (uint8_t) (0x40 | token_len);
+    response[2] = 0x00;
+    response[3] = 0x00;
+    modemArrive(srvProfileId, response, 4U + token_len);
+}
+
+/**
+ * CoAP over UDP with message IDs and tokens that start at 0x0000, and empty
+ * ACKs whose code is 0.00.
+ */
+static bool testCoapZeros(void) {
+    static COAP_CLIENT client;
+    uint8_t payload[] = {0x00, 0xFF, 0x00};
+
+    peer = coapPeer;
+    CoapInit(&client, SOCKET_PROFILE, COAP_ADDRESS);
+    client.message_id = 0xFFFF;
+    client.token = 0xFFFF;
+    for (int i = 0; i < COAP_POSTS; i++) {
+        int code = CoapPost(&client, "ex4/test", COAP_FORMAT_OCTET_STREAM, payload, sizeof(payload), true);
+        if (code != COAP_CHANGED) {
+            printf("coap zeros: POST %d answered %d\n", i, code);
+            return false;
+        }
+    }
+    if (!coap_separate_acked || client.stats.retransmits != 0) {
+        printf("coap zeros: separate response %s, %lu retransmits\n", coap_separate_acked ? "acked" : "not acked",
+               (unsigned long) client.stats.retransmits);
+        return false;
+    }
+    CoapClose(&client);
+    printf("coap zeros: ok\n");
+    return true;
+}
+
+/**
+ * The board restarts without CellularDisable, the modem stays at the rate
+ * it was moved to and does not say +PBREADY again.
+ */
+static bool testRestartAtRate(void) {
+    CellularDisable();
+    modem_baud = MODEM_MAX_BAUD_RATE;
+    CellularInit("0");
+    if (mcu_baud != modem_baud) {
+        printf("restart: modem at %lu baud, driver at %lu\n", (unsigned long) modem_baud, (unsigned long) mcu_baud);
+        return false;
+    }
+    printf("restart: ok\n");
+    return true;
+}
+
+/**
+ * A +CREG URC that arrives while no command runs posts EVENT_CELLULAR_RX
+ * once, and is unread until the registration is checked.
+ */
+static bool testUrcEvent(void) {
+    rx_events = 0;
+    modemSendText(CREG_URC);
+    modemDeliver();
+    if (rx_events != 1 || !CellularHasData()) {
+        printf("urc event: %lu events\n", (unsigned long) rx_events);
+        return false;
+    }
+    if (!CellularWaitForRegistration(0) || CellularHasData()) {
+        printf("urc event: URC not read\n");
+        return false;
+    }
+    printf("urc event: ok\n");
+    return true;
+}
+
+/**
+ * Without flow control the modem sends on into a full receive buffer.
+ */
+static bool testOverrun(void) {
+    uint8_t sent[RX_BUFFER_SIZE + 200];
+    uint8_t received[RX_BUFFER_SIZE];
+    SERIAL_STATS serial_stats;
+
+    SerialInitCellular("0", mcu_baud, false);
+    SerialFlushInputBuffCellular();
+    fillBinary(sent, sizeof(sent), 3);
+    modemSend(sent, sizeof(sent));
+    modemDeliver();
+    unsigned int count = SerialRecvCellular(received, sizeof(received), READ_TIMEOUT_MS);
+    SerialGetStatsCellular(&serial_stats);
+    if (count != RX_BUFFER_SIZE - 1 || memcmp(sent, received, count) != 0 ||
+        serial_stats.overruns != sizeof(sent) - count) {
+        printf("overrun: %u bytes read, %lu overruns\n", count, (unsigned long) serial_stats.overruns);
+        return false;
+    }
+    printf("overrun: ok\n");
+    return true;
+}
+
+int main(void) {
+    bool ok = true;
+
+    // the modem is up before the driver starts
+    modemSendText("\r\n^SYSSTART\r\n\r\n+PBREADY\r\n");
+    CellularInit("0");
+    if (mcu_baud != MODEM_MAX_BAUD_RATE || modem_baud != MODEM_MAX_BAUD_RATE) {
+        printf("link not moved to %d baud\n", MODEM_MAX_BAUD_RATE);
+        ok = false;
+    }
+    if (!CellularSetupInternetConnectionProfile(INACT_TIME_SEC)) {
+        printf("connection profile setup failed\n");
+        return 1;
+    }
+
+    ok = testSocketBinary() && ok;
+    ok = testServiceRead() && ok;
+    ok = testMqttAcks() && ok;
+    ok = testCoapZeros() && ok;
+    ok = testRestartAtRate() && ok;
+    ok = testUrcEvent() && ok;
+    ok = testOverrun() && ok;
+
+    CellularDisable();
+    printf(ok ? "ok\n" : "FAILED\n");
+    return ok ? 0 : 1;
+}
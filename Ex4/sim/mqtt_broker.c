@@ -0,0 +1,191 @@
+/**************************************************************************//**
+ * @mqtt_broker.c
+ * @brief Local stand-in for the MQTT broker (MQTT_PAYLOADS). Serves one
+ * connection at a time: CONNACK with the session present flag for client IDs
+ * seen before without a clean session, PUBACK for QoS 1, PINGRESP. Published
+ * messages are printed, text as it is, binary as its size.
+ * Usage: mqtt_broker [port] [drop_every] (1883 by default).
+ * drop_every: leave every n-th PUBACK out, to test retransmissions.
+ * @version 0.0.1
+ *  ***************************************************************************/
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <ctype.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+#define DEFAULT_PORT 1883
+#define MAX_PACKET 65536
+#define MAX_SESSIONS 16
+#define MAX_CLIENT_ID 64
+
+#define CONNECT 1
+#define PUBLISH 3
+#define PUBACK 4
+#define PINGREQ 12
+#define PINGRESP 13
+#define DISCONNECT 14
+
+static char sessions[MAX_SESSIONS][MAX_CLIENT_ID];
+static int num_sessions = 0;
+
+static int readFully(int fd, uint8_t *buf, size_t len) {
+    while (len > 0) {
+        ssize_t n = read(fd, buf, len);
+        if (n <= 0) {
+            return 0;
+        }
+        buf += n;
+        len -= (size_t) n;
+    }
+    return 1;
+}
+
+/**
+ * Reads one packet.
+ * @return its remaining length, -1 if the connection closed.
+ */
+static long readPacket(int fd, uint8_t *type_flags, uint8_t *body) {
+    uint8_t byte;
+    long remaining = 0;
+    if (!readFully(fd, type_flags, 1)) {
+        return -1;
+    }
+    for (int shift = 0; shift < 28; shift += 7) {
+        if (!readFully(fd, &byte, 1)) {
+            return -1;
+        }
+        remaining |= (long) (byte & 0x7F) << shift;
+        if ((byte & 0x80) == 0) {
+            break;
+        }
+    }
+    if (remaining > MAX_PACKET || !readFully(fd, body, (size_t) remaining)) {
+        return -1;
+    }
+    return remaining;
+}
+
+/**
+ * Looks a client ID up, adds it if it is new.
+ * @return 1 if a session was kept for it.
+ */
+static int resumeSession(const char *client_id, int clean) {
+    for (int i = 0; i < num_sessions; i++) {
+        if (strcmp(sessions[i], client_id) == 0) {
+            return !clean;
+        }
+    }
+    if (!clean && num_sessions < MAX_SESSIONS) {
+        strncpy(sessions[num_sessions++], client_id, MAX_CLIENT_ID - 1);
+    }
+    return 0;
+}
+
+static void printMessage(const uint8_t *body, long remaining, int qos, int dup) {
+    int topic_len = (body[0] << 8) | body[1];
+    long offset = 2 + topic_len + (qos > 0 ? 2 : 0);
+    long len = remaining - offset;
+    int printable = 1;
+    for (long i = 0; i < len; i++) {
+        if (!isprint(body[offset + i]) && !isspace(body[offset + i])) {
+            printable = 0;
+            break;
+        }
+    }
+    fprintf(stderr, "PUBLISH %.*s qos %d%s, %ld bytes\n", topic_len, (const char *) &body[2], qos,
+            dup ? " dup" : "", len);
+    if (printable) {
+        fwrite(&body[offset], 1, (size_t) len, stdout);
+        fputc('\n', stdout);
+        fflush(stdout);
+    }
+}
+
+static void serve(int fd, int drop_every) {
+    static uint8_t body[MAX_PACKET];
+    uint8_t type_flags;
+    long remaining;
+    unsigned long publishes = 0;
+
+    while ((remaining = readPacket(fd, &type_flags, body)) >= 0) {
+        switch (type_flags >> 4) {
+        case CONNECT: {
+            // protocol name, level, flags, keepalive, client ID
+            int name_len = (body[0] << 8) | body[1];
+            int flags = body[2 + name_len + 1];
+            int keepalive = (body[2 + name_len + 2] << 8) | body[2 + name_len + 3];
+            const uint8_t *id = &body[2 + name_len + 4];
+            char client_id[MAX_CLIENT_ID] = "";
+            int id_len = (id[0] << 8) | id[1];
+            snprintf(client_id, sizeof(client_id), "%.*s", id_len, (const char *) &id[2]);
+            int present = resumeSession(client_id, flags & 0x02);
+            fprintf(stderr, "CONNECT %s keepalive %ds, session %s\n", client_id, keepalive, present ? "resumed" : "new");
+            uint8_t connack[4] = {0x20, 2, (uint8_t) present, 0};
+            write(fd, connack, sizeof(connack));
+            break;
+        }
+        case PUBLISH: {
+            int qos = (type_flags >> 1) & 0x03;
+            printMessage(body, remaining, qos, type_flags & 0x08);
+            publishes++;
+            if (qos == 1) {
+                int topic_len = (body[0] << 8) | body[1];
+                uint8_t puback[4] = {PUBACK << 4, 2, body[2 + topic_len], body[3 + topic_len]};
+                if (drop_every > 0 && publishes % drop_every == 0) {
+                    fprintf(stderr, "PUBACK %d dropped\n", (puback[2] << 8) | puback[3]);
+                } else {
+                    write(fd, puback, sizeof(puback));
+                }
+            }
+            break;
+        }
+        case PINGREQ: {
+            uint8_t pingresp[2] = {PINGRESP << 4, 0};
+            fprintf(stderr, "PINGREQ\n");
+            write(fd, pingresp, sizeof(pingresp));
+            break;
+        }
+        case DISCONNECT:
+            fprintf(stderr, "DISCONNECT\n");
+            return;
+        default:
+            fprintf(stderr, "packet type %d, %ld bytes\n", type_flags >> 4, remaining);
+            break;
+        }
+    }
+    fprintf(stderr, "connection lost\n");
+}
+
+int main(int argc, char *argv[]) {
+    int port = (argc > 1) ? atoi(argv[1]) : DEFAULT_PORT;
+    int drop_every = (argc > 2) ? atoi(argv[2]) : 0;
+    int one = 1;
+
+    int listener = socket(AF_INET, SOCK_STREAM, 0);
+    struct sockaddr_in address = {0};
+    address.sin_family = AF_INET;
+    address.sin_addr.s_addr = htonl(INADDR_ANY);
+    address.sin_port = htons((uint16_t) port);
+    setsockopt(listener, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+    if (listener < 0 || bind(listener, (struct sockaddr *) &address, sizeof(address)) < 0 || listen(listener, 1) < 0) {
+        perror("listen");
+        return 1;
+    }
+    fprintf(stderr, "listening on port %d\n", port);
+
+    while (1) {
+        int fd = accept(listener, NULL, NULL);
+        if (fd < 0) {
+            perror("accept");
+            continue;
+        }
+        serve(fd, drop_every);
+        close(fd);
+    }
+    return 0;
+}
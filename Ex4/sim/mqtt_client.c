@@ -0,0 +1,152 @@
+/**************************************************************************//**
+ * @mqtt_client.c
+ * @brief Test of the MQTT client (mqtt.c) against the broker stand-in, over
+ * POSIX sockets. Starts mqtt_broker with every third PUBACK left out, then
+ * connects, publishes binary messages with zero bytes at QoS 1 and 0, checks
+ * that the broker got each one at its size, that the unacknowledged ones are
+ * sent again as duplicates until their PUBACK, the keepalive ping and that
+ * the session is resumed after a reconnect.
+ * Usage: mqtt_client <path of mqtt_broker>. Exits with 1 if a test fails.
+ * @version 0.0.1
+ *  ***************************************************************************/
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include "mqtt.h"
+#include "cellular_posix.h"
+
+#define SRV_PROFILE_ID 2
+#define CLIENT_ID "ex4-test"
+#define TOPIC "ex4/test"
+#define KEEPALIVE_S 60
+#define DROP_EVERY "3"
+#define NUM_MESSAGES 6
+#define LOG_TIMEOUT_MS 2000
+#define ACK_WAIT_MS 300            // for a PUBACK that does not come
+
+bool DEBUG = false;
+
+static MQTT_CLIENT client;
+static char address[64];
+
+/**
+ * Fills a message that holds zeros, and bytes that look like packet headers.
+ */
+static void fillMessage(uint8_t *data, uint32_t len, uint32_t seed) {
+    for (uint32_t i = 0; i < len; i++) {
+        data[i] = (i % 3 == 0) ? 0x00 : (uint8_t) ((i * 0x40) + seed);
+    }
+}
+
+/**
+ * Polls until nothing is in flight or the time is up.
+ */
+static bool waitForAcks(uint32_t timeout_ms) {
+    uint64_t deadline = TimebaseGetMs() + timeout_ms;
+    while (MqttGetInflight(&client) > 0 && TimebaseGetMs() < deadline) {
+        MqttPoll(&client);
+    }
+    return MqttGetInflight(&client) == 0;
+}
+
+static bool fail(const char *what) {
+    printf("%s\n", what);
+    return false;
+}
+
+static bool testPublish(void) {
+    static const uint32_t sizes[NUM_MESSAGES] = {1, 2, 100, 500, 1000, 3};
+    uint8_t message[1000];
+    char expected[64];
+
+    if (!MqttConnect(&client) || !StandInExpect("CONNECT " CLIENT_ID, LOG_TIMEOUT_MS)) {
+        return fail("connect failed");
+    }
+    for (int i = 0; i < NUM_MESSAGES; i++) {
+        fillMessage(message, sizes[i], (uint32_t) i);
+        if (!MqttPublish(&client, TOPIC, message, sizes[i], 1)) {
+            return fail("publish failed");
+        }
+        snprintf(expected, sizeof(expected), "PUBLISH " TOPIC " qos 1, %lu bytes", (unsigned long) sizes[i]);
+        if (!StandInExpect(expected, LOG_TIMEOUT_MS)) {
+            return fail("message not at the broker");
+        }
+        MqttPoll(&client);
+    }
+
+    // the third and the sixth PUBACK were left out
+    waitForAcks(ACK_WAIT_MS);
+    if (MqttGetInflight(&client) != 2) {
+        return fail("dropped PUBACKs not noticed");
+    }
+    PosixSkipMs(MQTT_RETRY_MS);
+    if (!waitForAcks(LOG_TIMEOUT_MS) || !StandInExpect("qos 1 dup", LOG_TIMEOUT_MS)) {
+        return fail("no retransmission");
+    }
+    if (client.stats.acked != NUM_MESSAGES || client.stats.retransmits != 2) {
+        return fail("wrong ack or retransmit count");
+    }
+
+    fillMessage(message, 10, 0);
+    if (!MqttPublish(&client, TOPIC, message, 10, 0) ||
+        !StandInExpect("PUBLISH " TOPIC " qos 0, 10 bytes", LOG_TIMEOUT_MS)) {
+        return fail("QoS 0 message lost");
+    }
+    printf("publish: ok\n");
+    return true;
+}
+
+static bool testKeepalive(void) {
+    PosixSkipMs(KEEPALIVE_S * 500);
+    MqttPoll(&client);
+    if (!client.ping_outstanding || !StandInExpect("PINGREQ", LOG_TIMEOUT_MS)) {
+        return fail("no PINGREQ");
+    }
+    uint64_t deadline = TimebaseGetMs() + LOG_TIMEOUT_MS;
+    while (client.ping_outstanding && TimebaseGetMs() < deadline) {
+        MqttPoll(&client);
+    }
+    if (client.ping_outstanding) {
+        return fail("no PINGRESP");
+    }
+    printf("keepalive: ok\n");
+    return true;
+}
+
+static bool testSessionResumed(void) {
+    MqttDisconnect(&client);
+    if (!StandInExpect("DISCONNECT", LOG_TIMEOUT_MS)) {
+        return fail("no DISCONNECT");
+    }
+    if (!MqttConnect(&client) || !StandInExpect("session resumed", LOG_TIMEOUT_MS) ||
+        !client.session_present) {
+        return fail("session not resumed");
+    }
+    MqttDisconnect(&client);
+    printf("session: ok\n");
+    return true;
+}
+
+int main(int argc, char *argv[]) {
+    char port[8];
+    bool ok;
+
+    if (argc < 2) {
+        printf("usage: mqtt_client <path of mqtt_broker>\n");
+        return 1;
+    }
+    snprintf(port, sizeof(port), "%d", PosixPickPort());
+    char *broker[] = {argv[1], port, DROP_EVERY, NULL};
+    if (!StandInStart(broker)) {
+        return 1;
+    }
+    snprintf(address, sizeof(address), "socktcp://127.0.0.1:%s", port);
+    MqttInit(&client, SRV_PROFILE_ID, address, CLIENT_ID, KEEPALIVE_S);
+
+    ok = testPublish() && testKeepalive() && testSessionResumed();
+
+    StandInStop();
+    printf(ok ? "ok\n" : "FAILED\n");
+    return ok ? 0 : 1;
+}
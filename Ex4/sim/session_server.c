@@ -0,0 +1,136 @@
+/**************************************************************************//**
+ * @session_server.c
+ * @brief Local stand-in for the socket session endpoint (SOCKET_SESSION).
+ * Accepts one connection at a time and prints the records it receives:
+ * lines as they are, telemetry batches expanded to lines, LZ compressed
+ * records decompressed first. A closed connection is logged and the next one
+ * accepted, to test reconnects.
+ * Usage: session_server [port] (5000 by default).
+ * @version 0.0.1
+ *  ***************************************************************************/
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include "session.h"
+#include "telemetry.h"
+#include "lz.h"
+
+#define DEFAULT_PORT 5000
+#define MAX_RECORD_SIZE 65536
+#define MAX_LINE_LEN 300
+
+bool DEBUG = false;
+
+/**
+ * Reads exactly len bytes.
+ * @return 1 on success, 0 if the connection closed.
+ */
+static int readFully(int fd, uint8_t *buf, size_t len) {
+    while (len > 0) {
+        ssize_t n = read(fd, buf, len);
+        if (n <= 0) {
+            return 0;
+        }
+        buf += n;
+        len -= (size_t) n;
+    }
+    return 1;
+}
+
+static void printTelemetry(const uint8_t *batch, uint32_t len) {
+    TELEMETRY_DECODER decoder;
+    TELEMETRY_POINT point;
+    char line[MAX_LINE_LEN];
+
+    if (!TelemetryDecodeBegin(&decoder, batch, len)) {
+        fprintf(stderr, "not a telemetry batch (version %d)\n", TELEMETRY_VERSION);
+        return;
+    }
+    while (TelemetryDecodeNext(&decoder, &point)) {
+        TelemetryFormatLine(&decoder, &point, line, sizeof(line));
+        fputs(line, stdout);
+    }
+}
+
+static void printRecord(uint8_t type, const uint8_t *payload, uint32_t len) {
+    static uint8_t decompressed[MAX_RECORD_SIZE];
+
+    if (type & SESSION_RECORD_LZ) {
+        int decompressed_len = LzDecompress(payload, len, decompressed, sizeof(decompressed));
+        if (decompressed_len < 0) {
+            fprintf(stderr, "corrupted LZ record\n");
+            return;
+        }
+        fprintf(stderr, "lz: %lu -> %d bytes\n", (unsigned long) len, decompressed_len);
+        payload = decompressed;
+        len = (uint32_t) decompressed_len;
+    }
+
+    switch (type & SESSION_RECORD_TYPE_MASK) {
+    case SESSION_RECORD_LINES:
+        fwrite(payload, 1, len, stdout);
+        fputc('\n', stdout);
+        break;
+    case SESSION_RECORD_TELEMETRY:
+        printTelemetry(payload, len);
+        break;
+    case SESSION_RECORD_CBOR:
+        fprintf(stderr, "cbor record, %lu bytes\n", (unsigned long) len);
+        break;
+    default:
+        fprintf(stderr, "unknown record type %d, %lu bytes\n", type, (unsigned long) len);
+        break;
+    }
+    fflush(stdout);
+}
+
+int main(int argc, char *argv[]) {
+    static uint8_t payload[MAX_RECORD_SIZE];
+    int port = (argc > 1) ? atoi(argv[1]) : DEFAULT_PORT;
+    int one = 1;
+
+    int listener = socket(AF_INET, SOCK_STREAM, 0);
+    struct sockaddr_in address = {0};
+    address.sin_family = AF_INET;
+    address.sin_addr.s_addr = htonl(INADDR_ANY);
+    address.sin_port = htons((uint16_t) port);
+    setsockopt(listener, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+    if (listener < 0 || bind(listener, (struct sockaddr *) &address, sizeof(address)) < 0 || listen(listener, 1) < 0) {
+        perror("listen");
+        return 1;
+    }
+    fprintf(stderr, "listening on port %d\n", port);
+
+    while (1) {
+        struct sockaddr_in peer;
+        socklen_t peer_len = sizeof(peer);
+        int fd = accept(listener, (struct sockaddr *) &peer, &peer_len);
+        if (fd < 0) {
+            perror("accept");
+            continue;
+        }
+        fprintf(stderr, "connected: %s\n", inet_ntoa(peer.sin_addr));
+
+        unsigned long records = 0;
+        unsigned long bytes = 0;
+        uint8_t header[SESSION_HEADER_SIZE];
+        while (readFully(fd, header, SESSION_HEADER_SIZE)) {
+            uint32_t len = ((uint32_t) header[1] << 8) | header[2];
+            if (!readFully(fd, payload, len)) {
+                fprintf(stderr, "connection closed in a record\n");
+                break;
+            }
+            printRecord(header[0], payload, len);
+            records++;
+            bytes += SESSION_HEADER_SIZE + len;
+        }
+        fprintf(stderr, "closed: %lu records, %lu bytes\n", records, bytes);
+        close(fd);
+    }
+    return 0;
+}
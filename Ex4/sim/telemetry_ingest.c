@@ -0,0 +1,120 @@
+/**************************************************************************//**
+ * @telemetry_ingest.c
+ * @brief Local stand-in for the telemetry ingest: expands a binary batch back
+ * to InfluxDB line protocol, e.g. to pipe it into the database.
+ * Usage: telemetry_ingest [-z] [batch_file] (stdin by default).
+ * -z: the upload is LZ compressed (COMPRESS_PAYLOADS), it is decompressed
+ * first and may also hold plain lines, which are passed through.
+ * The lines go to stdout, the size comparison to stderr.
+ * @version 0.0.1
+ *  ***************************************************************************/
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+#include "telemetry.h"
+#include "lz.h"
+
+#define MAX_BATCH_SIZE 65536
+#define MAX_LINE_LEN 300
+#define TIMING_RUNS 100
+
+/**
+ * Decompresses an upload and reports the ratio and the host CPU cost.
+ * @return length of the decompressed upload, -1 if it is corrupted.
+ */
+static int decompress(const uint8_t *upload, uint32_t upload_len, uint8_t *out, uint32_t out_size) {
+    static uint8_t recompressed[LZ_BOUND(MAX_BATCH_SIZE)];
+    static LZ_COMPRESSOR lz;
+    int out_len = LzDecompress(upload, upload_len, out, out_size);
+    if (out_len <= 0) {
+        return out_len;
+    }
+
+    clock_t start = clock();
+    for (int i = 0; i < TIMING_RUNS; i++) {
+        LzDecompress(upload, upload_len, out, out_size);
+    }
+    double decompress_sec = (double) (clock() - start) / CLOCKS_PER_SEC / TIMING_RUNS;
+    start = clock();
+    for (int i = 0; i < TIMING_RUNS; i++) {
+        LzInit(&lz);
+        LzCompress(&lz, out, out_len, recompressed, sizeof(recompressed));
+    }
+    double compress_sec = (double) (clock() - start) / CLOCKS_PER_SEC / TIMING_RUNS;
+
+    double kbytes = out_len / 1024.0;
+    fprintf(stderr, "lz: %lu -> %d bytes (%.2fx), compress %.1f us/KB, decompress %.1f us/KB\n",
+            (unsigned long) upload_len, out_len, (double) out_len / upload_len,
+            compress_sec * 1e6 / kbytes, decompress_sec * 1e6 / kbytes);
+    return out_len;
+}
+
+int main(int argc, char *argv[]) {
+    static uint8_t upload[MAX_BATCH_SIZE];
+    static uint8_t decompressed[MAX_BATCH_SIZE];
+    uint8_t *batch = upload;
+    FILE *input = stdin;
+    int arg = 1;
+    int compressed = 0;
+
+    if (arg < argc && strcmp(argv[arg], "-z") == 0) {
+        compressed = 1;
+        arg++;
+    }
+    if (arg < argc) {
+        input = fopen(argv[arg], "rb");
+        if (input == NULL) {
+            perror(argv[arg]);
+            return 1;
+        }
+    }
+    size_t batch_len = fread(upload, 1, sizeof(upload), input);
+    if (input != stdin) {
+        fclose(input);
+    }
+
+    if (compressed) {
+        int decompressed_len = decompress(upload, (uint32_t) batch_len, decompressed, sizeof(decompressed));
+        if (decompressed_len < 0) {
+            fprintf(stderr, "corrupted LZ stream\n");
+            return 1;
+        }
+        batch = decompressed;
+        batch_len = decompressed_len;
+        if (batch_len > 0 && batch[0] != TELEMETRY_MAGIC) {
+            // lines, as posted to TRANSMIT_URL
+            fwrite(batch, 1, batch_len, stdout);
+            return 0;
+        }
+    }
+
+    TELEMETRY_DECODER decoder;
+    if (!TelemetryDecodeBegin(&decoder, batch, (uint32_t) batch_len)) {
+        fprintf(stderr, "not a telemetry batch (version %d)\n", TELEMETRY_VERSION);
+        return 1;
+    }
+
+    TELEMETRY_POINT point;
+    unsigned long num_points = 0;
+    unsigned long lines_len = 0;
+    while (TelemetryDecodeNext(&decoder, &point)) {
+        char line[MAX_LINE_LEN];
+        int line_len = TelemetryFormatLine(&decoder, &point, line, sizeof(line));
+        fputs(line, stdout);
+        lines_len += line_len;
+        num_points++;
+    }
+    if (decoder.pos != decoder.len) {
+        fprintf(stderr, "truncated batch, %lu bytes left\n", (unsigned long) (decoder.len - decoder.pos));
+    }
+
+    fprintf(stderr, "%s %s: %lu points, %lu bytes binary, %lu bytes as lines",
+            decoder.name, decoder.iccid, num_points, (unsigned long) batch_len, lines_len);
+    if (num_points > 0) {
+        fprintf(stderr, " (%.1f vs %.1f bytes per point)",
+                (double) batch_len / num_points, (double) lines_len / num_points);
+    }
+    fprintf(stderr, "\n");
+    return 0;
+}
@@ -0,0 +1,120 @@
+/******************************************************************************
+ * @cbor.c
+ * @brief Streaming CBOR encoder, definite lengths and integers only.
+ * Every item is a head byte of major type and argument, followed by 0, 1, 2
+ * or 4 argument bytes in network order.
+ * @version 0.0.1
+ *  **************************************************************************/
+#include <string.h>
+
+#include "cbor.h"
+
+/******************************************************************************
+ * 								DEFS
+*****************************************************************************/
+#define MAJOR_UINT 0
+#define MAJOR_NEGATIVE 1
+#define MAJOR_BYTES 2
+#define MAJOR_TEXT 3
+#define MAJOR_ARRAY 4
+#define MAJOR_MAP 5
+#define MAJOR_SIMPLE 7
+#define SIMPLE_FALSE 20
+#define SIMPLE_TRUE 21
+#define ARG_1_BYTE 24
+#define ARG_2_BYTES 25
+#define ARG_4_BYTES 26
+
+
+/******************************************************************************
+ * @brief Writes the head of an item, with the shortest argument encoding.
+ *****************************************************************************/
+static void writeHead(CBOR_WRITER * writer, uint8_t major, uint32_t argument) {
+	uint8_t head[5];
+	uint32_t len;
+
+	if (argument < ARG_1_BYTE) {
+		head[0] = (major << 5) | argument;
+		len = 1;
+	} else if (argument <= UINT8_MAX) {
+		head[0] = (major << 5) | ARG_1_BYTE;
+		head[1] = argument;
+		len = 2;
+	} else if (argument <= UINT16_MAX) {
+		head[0] = (major << 5) | ARG_2_BYTES;
+		head[1] = argument >> 8;
+		head[2] = argument;
+		len = 3;
+	} else {
+		head[0] = (major << 5) | ARG_4_BYTES;
+		head[1] = argument >> 24;
+		head[2] = argument >> 16;
+		head[3] = argument >> 8;
+		head[4] = argument;
+		len = 5;
+	}
+
+	if (writer->overflow || writer->len + len > writer->size) {
+		writer->overflow = true;
+		return;
+	}
+	memcpy(&writer->buf[writer->len], head, len);
+	writer->len += len;
+}
+
+/******************************************************************************
+ * @brief Writes the head and content of a string.
+ *****************************************************************************/
+static void writeString(CBOR_WRITER * writer, uint8_t major, const void * data, uint32_t len) {
+	writeHead(writer, major, len);
+	if (writer->overflow || writer->len + len > writer->size) {
+		writer->overflow = true;
+		return;
+	}
+	memcpy(&writer->buf[writer->len], data, len);
+	writer->len += len;
+}
+
+void CborInit(CBOR_WRITER * writer, uint8_t * buf, uint32_t size) {
+	writer->buf = buf;
+	writer->size = size;
+	writer->len = 0;
+	writer->overflow = false;
+}
+
+void CborMap(CBOR_WRITER * writer, uint32_t num_pairs) {
+	writeHead(writer, MAJOR_MAP, num_pairs);
+}
+
+void CborArray(CBOR_WRITER * writer, uint32_t num_items) {
+	writeHead(writer, MAJOR_ARRAY, num_items);
+}
+
+void CborUint(CBOR_WRITER * writer, uint32_t value) {
+	writeHead(writer, MAJOR_UINT, value);
+}
+
+void CborInt(CBOR_WRITER * writer, int32_t value) {
+	if (value < 0) {
+		// -1 - n, computed without overflowing INT32_MIN
+		writeHead(writer, MAJOR_NEGATIVE, (uint32_t) (-(value + 1)));
+	} else {
+		writeHead(writer, MAJOR_UINT, (uint32_t) value);
+	}
+}
+
+void CborBool(CBOR_WRITER * writer, bool value) {
+	writeHead(writer, MAJOR_SIMPLE, value ? SIMPLE_TRUE : SIMPLE_FALSE);
+}
+
+void CborText(CBOR_WRITER * writer, const char * text) {
+	writeString(writer, MAJOR_TEXT, text, strlen(text));
+}
+
+void CborBytes(CBOR_WRITER * writer, const uint8_t * data, uint32_t len) {
+	writeString(writer, MAJOR_BYTES, data, len);
+}
+
+int CborGetLength(const CBOR_WRITER * writer) {
+	return writer->overflow ? -1 : (int) writer->len;
+}
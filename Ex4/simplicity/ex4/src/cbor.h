@@ -0,0 +1,70 @@
+/******************************************************************************
+ * @cbor.h
+ * @brief Interface for a streaming CBOR (RFC 7049) encoder.
+ * Items are written straight into a caller's buffer, maps and arrays are
+ * started with their number of items and then filled in order. Running out
+ * of buffer is remembered, so a record is written without checks in between
+ * and CborGetLength tells at the end whether it fit.
+ * @version 0.0.1
+ *  **************************************************************************/
+#ifndef SRC_CBOR_H_
+#define SRC_CBOR_H_
+
+#include <stdbool.h>
+#include <stdint.h>
+
+/******************************************************************************
+ * 								DEFS
+*****************************************************************************/
+#define CBOR_CONTENT_TYPE "application/cbor"
+
+typedef struct _CBOR_WRITER {
+	uint8_t * buf;
+	uint32_t size;
+	uint32_t len;
+	bool overflow;		// an item did not fit, the output is not valid
+} CBOR_WRITER;
+
+
+/******************************************************************************
+ * @brief Starts writing into buf.
+ * @param writer - the writer.
+ * @param buf - output buffer.
+ * @param size - size of buf.
+ *****************************************************************************/
+void CborInit(CBOR_WRITER * writer, uint8_t * buf, uint32_t size);
+
+/******************************************************************************
+ * @brief Starts a map, followed by num_pairs keys and values.
+ *****************************************************************************/
+void CborMap(CBOR_WRITER * writer, uint32_t num_pairs);
+
+/******************************************************************************
+ * @brief Starts an array, followed by num_items items.
+ *****************************************************************************/
+void CborArray(CBOR_WRITER * writer, uint32_t num_items);
+
+void CborUint(CBOR_WRITER * writer, uint32_t value);
+
+void CborInt(CBOR_WRITER * writer, int32_t value);
+
+void CborBool(CBOR_WRITER * writer, bool value);
+
+/******************************************************************************
+ * @brief Writes a NUL terminated text string.
+ *****************************************************************************/
+void CborText(CBOR_WRITER * writer, const char * text);
+
+/******************************************************************************
+ * @brief Writes a byte string.
+ *****************************************************************************/
+void CborBytes(CBOR_WRITER * writer, const uint8_t * data, uint32_t len);
+
+/******************************************************************************
+ * @param writer - the writer.
+ * @return the number of bytes written, -1 if the buffer was too small.
+ *****************************************************************************/
+int CborGetLength(const CBOR_WRITER * writer);
+
+
+#endif /* SRC_CBOR_H_ */
@@ -1,5 +1,9 @@
+#include <stdarg.h>
 #include "cellular.h"
 #include "serial_io_usart.h"
+#include "cmux.h"
+#include "telemetry.h"
+#include "timebase.h"
 
 
 /****************************************************************************
@@ -11,6 +15,10 @@ bool waitForATresponse(unsigned char ** token_array, unsigned char * expected_re
 int splitBufferToResponses(unsigned char * buffer, unsigned char ** tokens_array, int max_tokens);
 int splitCopsResponseToOpsTokens(unsigned char * cops_response, OPERATOR_INFO *opList, int max_ops);
 bool splitOpTokensToOPINFO(unsigned char * op_token, OPERATOR_INFO *opInfo);
+bool inetServiceClose(int srvProfileId);
+int resolveCCIDresult(char * iccid_buffer);
+static bool readIdentity(void);
+static void dispatchURCs(const unsigned char * buffer);
 
 
 /*****************************************************************************
@@ -20,33 +28,50 @@ bool splitOpTokensToOPINFO(unsigned char * op_token, OPERATOR_INFO *opInfo);
 #define MAX_OP_TOKEN_SIZE 50
 #define MAX_AT_CMD_LEN 100
 #define GENERAL_RECV_TIMEOUT_MS 10000
+#define MODEM_STARTUP_WAIT_MS 2000      // between looking for the modem at every rate
 #define GENERAL_RECV_DLY_TIMEOUT_MS 15000
 #define GET_OPS_TIMEOUT_MS 120000
 #define MAX_conProfileId 5
-#define HTTP_POST_srvProfileId 6
+#define CON_PROFILE_APN "postm2m.lu"
+#define SICS_PARAM_SIZE 16
+#define SICS_VALUE_SIZE 64
+#define MAX_srvProfileId 9
+#define URC_POLL_MS 10		// to collect URCs that arrived while idle
 
 #define SISS_CMD_HTTP_GET 0
 #define SISS_CMD_HTTP_POST 1
 #define SISS_CMD_HTTP_HEAD 2
 
 #define RESPONSE_TOKENS_SIZE 10
+#define SISW_MAX_CHUNK 1500		// AT^SISW takes at most 1500 bytes at a time
+#define SISR_MUX_MAX_CHUNK (CMUX_RX_BUFFER_SIZE - 64)	// while muxed, the whole AT^SISR answer fits the channel's buffer
+#define AT_BATCH_LINE_SIZE 256		// longest line of concatenated commands
+#define AT_BATCH_MAX_COMMANDS 8		// commands on one line
+#define POWER_SPOW_TIMEOUT_MS 1000	// UART idle time before the modem sleeps
+#define POWER_SPOW_AWAKE_MS 50		// the modem stays awake this long after each paging
+#define POWER_WAKE_PROBE_MS 300		// for the answer to one wake up AT
+#define POWER_WAKE_TRIES 10
 
 
 /*****************************************************************************
  * 							GLOBAL VARIABLES
 *****************************************************************************/
 static bool CELLULAR_INITIALIZED = false;
+static bool CELLULAR_MUXED = false;	// AT, data and status commands run on CMUX channels of their own
 unsigned char command_to_send_buffer[MAX_INCOMING_BUF_SIZE] = "";
 
 unsigned char AT_CMD_SUFFIX[] = "\r\n";
 // AT_COMMANDS
 unsigned char AT_CMD_ECHO_OFF[] = "ATE0\r\n";
+unsigned char AT_CMD_FLOW_RTS_CTS[] = "AT\\Q3\r\n";
 unsigned char AT_CMD_AT[] = "AT\r\n";
 unsigned char AT_CMD_COPS_TEST[] = "AT+COPS=?\r\n";
 const unsigned char AT_CMD_COPS_WRITE_PREFIX[] = "AT+COPS=";
 unsigned char AT_CMD_CREG_READ[] = "AT+CREG?\r\n";
+unsigned char AT_CMD_CREG_URC_ON[] = "AT+CREG=2\r\n";
 unsigned char AT_CMD_CSQ[] = "AT+CSQ\r\n";
 unsigned char AT_CMD_SICS_WRITE_PRFX[] = "AT^SICS=";
+unsigned char AT_CMD_SICS_READ[] = "AT^SICS?\r\n";
 unsigned char AT_CMD_SISS_WRITE_PRFX[] = "AT^SISS=";
 unsigned char AT_CMD_SISO_WRITE_PRFX[] = "AT^SISO=";
 unsigned char AT_CMD_SISR_WRITE_PRFX[] = "AT^SISR=";
@@ -54,7 +79,14 @@ unsigned char AT_CMD_SISW_WRITE_PRFX[] = "AT^SISW=";
 unsigned char AT_CMD_SISC_WRITE_PRFX[] = "AT^SISC=";
 unsigned char AT_CMD_SISE_WRITE_PRFX[] = "AT^SISE=";
 unsigned char AT_CMD_CCID_READ[] = "AT+CCID?";
+unsigned char AT_CMD_CGSN[] = "AT+CGSN\r\n";
+unsigned char AT_CMD_CGMR[] = "AT+CGMR\r\n";
+unsigned char AT_CMD_CIMI[] = "AT+CIMI\r\n";
+unsigned char AT_CMD_SCKS_URC_ON[] = "AT^SCKS=1\r\n";
 unsigned char AT_CMD_SHUTDOWN[] = "AT^SMSO\r\n";
+unsigned char AT_CMD_SPOW_WRITE_PRFX[] = "AT^SPOW=";
+unsigned char AT_CMD_CEDRXS_WRITE_PRFX[] = "AT+CEDRXS=";
+unsigned char AT_CMD_CPSMS_WRITE_PRFX[] = "AT+CPSMS=";
 
 // AT RESPONDS
 unsigned char AT_RES_OK[] = "OK";
@@ -63,18 +95,80 @@ unsigned char AT_RES_CME[] = "+CME";
 unsigned char AT_RES_SYSSTART[] = "^SYSSTART";
 unsigned char AT_RES_PBREADY[] = "+PBREADY";
 unsigned char AT_URC_SHUTDOWN[] = "^SHUTDOWN";
+unsigned char AT_URC_SISW[] = "^SISW";
+unsigned char AT_URC_SISR[] = "^SISR";
+unsigned char AT_URC_SCKS[] = "^SCKS:";
+unsigned char AT_URC_CREG[] = "+CREG: ";
+unsigned char AT_URC_SIS[] = "^SIS: ";
+unsigned char AT_URC_SISW_CAUSE[] = "^SISW: ";
+unsigned char AT_URC_SISR_CAUSE[] = "^SISR: ";
+
+// Final result codes, a response is complete once one of them arrives.
+#define NUM_FINAL_RESPONSES 3
+const char * AT_FINAL_RESPONSES[NUM_FINAL_RESPONSES] = {"OK", "ERROR", "+CME ERROR"};
 
 // Internet connection profile identifier. 0..5
 // The <conProfileId> identifies all parameters of a connection profile,
 // and, when a service profile is created with AT^SISS the <conProfileId>
 // needs to be set as "conId" value of the AT^SISS parameter <srvParmTag>.
 int conProfileId = -1;
+// inactTO conProfileId was set up with, -1 until it was checked against the modem
+static int conProfileInactTO = -1;
+
+/* Settings of a connection profile, as read back with AT^SICS? */
+typedef struct __CON_PROFILE_SETTINGS {
+    bool gprs0;     // conType is GPRS0
+    bool apn;       // apn is CON_PROFILE_APN
+    int inactTO;    // -1 if not set
+} CON_PROFILE_SETTINGS;
 
 // Internet service profile identifier.0..9
 // The <srvProfileId> is used to reference all parameters related to the same service profile. Furthermore,
 // when using the AT commands AT^SISO, AT^SISR, AT^SISW, AT^SIST, AT^SISH and AT^SISC the
 //<srvProfileId> is needed to select a specific service profile.
-int srvProfileId = -1;
+// Service of the last HTTP request, for CellularGetLastError
+static int lastSrvProfileId = -1;
+
+/* State of a service profile, kept up to date by the ^SIS, ^SISR and ^SISW URCs */
+typedef struct __SERVICE_STATE {
+    bool in_use;        // an HTTP request of the pool runs on it
+    bool connected;     // socket service is open, cleared when the connection closes
+    bool data_pending;  // "^SISR: <srvProfileId>,1", the service has data to read
+    bool data_finished; // "^SISR: <srvProfileId>,2" or a read at the end, all data was read
+    bool error;         // a ^SIS URC reported an error of the service
+} SERVICE_STATE;
+
+// Identity cache, the SIM part is dropped when ^SCKS reports a SIM change
+static CELLULAR_IDENTITY identity;
+static bool MODEM_IDENTITY_VALID = false;
+static bool SIM_IDENTITY_VALID = false;
+
+// Network registration, kept up to date by +CREG URCs
+static CELLULAR_REGISTRATION registration = {REGISTRATION_UNKNOWN, 0, 0, 0};
+
+// Power manager, the modem sleeps between uploads if the policy says so
+enum POWER_STATE {POWER_AWAKE, POWER_ASLEEP, POWER_WAKING};
+static CELLULAR_POWER_POLICY power_policy = POWER_POLICY_ALWAYS_ON;
+static enum POWER_STATE power_state = POWER_AWAKE;
+static uint64_t power_sleep_ms;     // when the modem went to sleep
+static CELLULAR_POWER_STATS power_stats;
+
+// Cleared once the modem refused a line of concatenated commands it takes one by one
+static bool AT_BATCH_CONCAT = true;
+
+/* Independent commands sent on one line, "AT<command>;<command>...", with one final result */
+typedef struct __AT_BATCH {
+    char line[AT_BATCH_LINE_SIZE];
+    int len;                                // 0 while nothing is queued
+    int starts[AT_BATCH_MAX_COMMANDS];      // offset of each queued command in line
+    int queued;
+    int commands;                           // commands sent in all
+    int round_trips;
+    bool ok;                                // false from the first command that failed on
+} AT_BATCH;
+
+// Every service profile, HTTP_POOL_SIZE of them from HTTP_POOL_FIRST_PROFILE on are the HTTP pool
+static SERVICE_STATE services[MAX_srvProfileId + 1];
 
 
 /**
@@ -85,15 +179,20 @@ void CellularInit(char *port){
     printf("Initializing Cellular modem..\n");
 
     if (!CELLULAR_INITIALIZED) {
-        CELLULAR_INITIALIZED = SerialInitCellular(port, MODEM_BAUD_RATE);
+        CELLULAR_INITIALIZED = SerialInitCellular(port, MODEM_BAUD_RATE, MODEM_FLOW_CONTROL);
         if (!CELLULAR_INITIALIZED) {
             printf("Initialization FAILED.\n");
             exit(EXIT_FAILURE);
         }
 
-        // check modem responded with ^+PBREADY
-        unsigned char * token_array[5] = {};
-        while(!waitForATresponse(token_array, AT_RES_PBREADY, sizeof(AT_RES_PBREADY) - 1, 5, GENERAL_RECV_TIMEOUT_MS));
+        // the modem keeps its AT+IPR rate over a reset and says +PBREADY only
+        // after power up, so it is looked for at every rate
+        while (SerialFindBaudCellular() == 0) {
+            // still starting up, +PBREADY ends the wait if it comes at MODEM_BAUD_RATE
+            unsigned char * token_array[5] = {};
+            printf("no answer from the modem, waiting...\n");
+            waitForATresponse(token_array, AT_RES_PBREADY, sizeof(AT_RES_PBREADY) - 1, 5, MODEM_STARTUP_WAIT_MS);
+        }
 
         bool echo_off = false;
         printf("Setting echo off...");
@@ -106,6 +205,24 @@ void CellularInit(char *port){
         }
 
         printf("successfully.\n");
+
+        if (MODEM_FLOW_CONTROL) {
+            sendATcommand(AT_CMD_FLOW_RTS_CTS, sizeof(AT_CMD_FLOW_RTS_CTS) - 1);
+            waitForOK();
+        }
+        SerialNegotiateBaudCellular(MODEM_MAX_BAUD_RATE);
+
+        // report SIM removal and insertion, then read the identity once
+        sendATcommand(AT_CMD_SCKS_URC_ON, sizeof(AT_CMD_SCKS_URC_ON) - 1);
+        waitForOK();
+
+        // report registration changes with LAC and cell ID
+        sendATcommand(AT_CMD_CREG_URC_ON, sizeof(AT_CMD_CREG_URC_ON) - 1);
+        waitForOK();
+        if (readIdentity() && DEBUG) {
+            printf("ICCID %s IMSI %s\nIMEI %s %s\n", identity.iccid, identity.imsi, identity.imei, identity.firmware);
+        }
+
         printf("Cellular modem initialized successfully.\n");
     }
 }
@@ -116,15 +233,185 @@ void CellularInit(char *port){
  */
 void CellularDisable(){
     if (CELLULAR_INITIALIZED) {
+        // the modem keeps its rate, it has to be the one CellularInit starts at
+        SERIAL_STATS serial_stats;
+        SerialGetStatsCellular(&serial_stats);
+        if (serial_stats.baud != MODEM_BAUD_RATE) {
+            char command[MAX_AT_CMD_LEN];
+            int len = snprintf(command, sizeof(command), "AT+IPR=%d\r\n", MODEM_BAUD_RATE);
+            sendATcommand((unsigned char *) command, len);
+            waitForOK();
+        }
+
         // shut down modem
         sendATcommand(AT_CMD_SHUTDOWN, sizeof(AT_CMD_SHUTDOWN) - 1);
 
         // Disable serial connection
         SerialDisableCellular();
         CELLULAR_INITIALIZED = false;
+        CELLULAR_MUXED = false;
+        MODEM_IDENTITY_VALID = false;
+        SIM_IDENTITY_VALID = false;
+        conProfileInactTO = -1;
+        registration.status = REGISTRATION_UNKNOWN;
+        memset(services, 0, sizeof(services));
+        power_state = POWER_AWAKE;
+    }
+}
+
+bool CellularEnableMux(void) {
+    if (!CELLULAR_INITIALIZED) {
+        return false;
+    }
+    if (CELLULAR_MUXED) {
+        return true;
+    }
+    if (!SerialMuxCellular()) {
+        if (DEBUG) { printf("modem did not switch to CMUX\n"); }
+        return false;
+    }
+
+    // every channel is an AT interpreter of its own, echo is on in each
+    for (uint8_t channel = CMUX_CHANNEL_AT; channel < CMUX_NUM_CHANNELS; channel++) {
+        SerialSelectCellularChannel(channel);
+        sendATcommand(AT_CMD_ECHO_OFF, sizeof(AT_CMD_ECHO_OFF) - 1);
+        waitForOK();
+    }
+    SerialSelectCellularChannel(CMUX_CHANNEL_AT);
+    CELLULAR_MUXED = true;
+    return true;
+}
+
+/**
+ * Sends AT^SPOW=<mode>,<timeout>,<awake>, mode 0 keeps the modem awake.
+ * Built in a buffer of its own, CellularWake runs it from sendATcommand
+ * while command_to_send_buffer may hold the command being sent.
+ */
+static bool setPowerSaving(bool on) {
+    char command[MAX_AT_CMD_LEN];
+    int cmd_size = snprintf(command, sizeof(command), "%s%d,%d,%d%s", AT_CMD_SPOW_WRITE_PRFX, on ? 1 : 0,
+                            on ? POWER_SPOW_TIMEOUT_MS : 0, on ? POWER_SPOW_AWAKE_MS : 0, AT_CMD_SUFFIX);
+    sendATcommand((unsigned char *) command, cmd_size);
+    return waitForOK();
+}
+
+bool CellularSetPowerPolicy(const CELLULAR_POWER_POLICY *policy) {
+    bool ok = true;
+    int cmd_size;
+
+    if (!CELLULAR_INITIALIZED) {
+        return false;
+    }
+    power_policy = *policy;
+    if (!power_policy.sleep && power_state == POWER_ASLEEP) {
+        CellularWake();
+    }
+
+    // both depend on the network, an ERROR means the modem does not have them
+    if (policy->edrx) {
+        cmd_size = sprintf(command_to_send_buffer, "%s1,%d,\"%s\"%s",
+                           AT_CMD_CEDRXS_WRITE_PRFX, POWER_EDRX_ACT, POWER_EDRX_VALUE, AT_CMD_SUFFIX);
+    } else {
+        cmd_size = sprintf(command_to_send_buffer, "%s0%s", AT_CMD_CEDRXS_WRITE_PRFX, AT_CMD_SUFFIX);
+    }
+    sendATcommand(command_to_send_buffer, cmd_size);
+    if (!waitForOK() && policy->edrx) {
+        if (DEBUG) { printf("modem refused eDRX\n"); }
+        ok = false;
+    }
+
+    if (policy->psm) {
+        cmd_size = sprintf(command_to_send_buffer, "%s1,,,\"%s\",\"%s\"%s",
+                           AT_CMD_CPSMS_WRITE_PRFX, POWER_PSM_TAU, POWER_PSM_ACTIVE_TIME, AT_CMD_SUFFIX);
+    } else {
+        cmd_size = sprintf(command_to_send_buffer, "%s0%s", AT_CMD_CPSMS_WRITE_PRFX, AT_CMD_SUFFIX);
+    }
+    sendATcommand(command_to_send_buffer, cmd_size);
+    if (!waitForOK() && policy->psm) {
+        if (DEBUG) { printf("modem refused PSM\n"); }
+        ok = false;
+    }
+    return ok;
+}
+
+bool CellularSleep(void) {
+    if (!CELLULAR_INITIALIZED || CELLULAR_MUXED || !power_policy.sleep) {
+        return false;
+    }
+    if (power_state == POWER_ASLEEP) {
+        return true;
+    }
+    if (!setPowerSaving(true)) {
+        return false;
+    }
+    power_state = POWER_ASLEEP;
+    power_sleep_ms = TimebaseGetMs();
+    power_stats.sleeps++;
+    return true;
+}
+
+/**
+ * Sends AT until the modem answers, the first characters only wake it and
+ * may be lost.
+ * @return true once it answered OK
+ */
+static bool probeAwake(void) {
+    unsigned char response[MAX_INCOMING_BUF_SIZE];
+
+    for (int i = 0; i < POWER_WAKE_TRIES; i++) {
+        unsigned int time_left_ms = POWER_WAKE_PROBE_MS;
+        sendATcommand(AT_CMD_AT, sizeof(AT_CMD_AT) - 1);
+        if (SerialRecvCellularUntil(response, sizeof(response), &time_left_ms,
+                                    AT_FINAL_RESPONSES, NUM_FINAL_RESPONSES) > 0) {
+            dispatchURCs(response);
+            if (strstr((char *) response, (char *) AT_RES_OK) != NULL) {
+                return true;
+            }
+        }
+    }
+    return false;
+}
+
+bool CellularWake(void) {
+    uint64_t start_ms;
+    bool ready;
+
+    if (!CELLULAR_INITIALIZED) {
+        return false;
+    }
+    if (power_state != POWER_ASLEEP) {
+        return true;
+    }
+
+    // commands sent while waking go straight out
+    power_state = POWER_WAKING;
+    start_ms = TimebaseGetMs();
+    power_stats.asleep_ms += (uint32_t) (start_ms - power_sleep_ms);
+    ready = probeAwake() && setPowerSaving(false);
+    power_state = POWER_AWAKE;
+
+    if (!ready) {
+        // awake or not, the next command finds out
+        power_stats.failed_wakes++;
+        if (DEBUG) { printf("modem did not wake\n"); }
+        return false;
     }
+    power_stats.last_wake_ms = (uint32_t) (TimebaseGetMs() - start_ms);
+    power_stats.total_wake_ms += power_stats.last_wake_ms;
+    if (power_stats.last_wake_ms > power_stats.max_wake_ms) {
+        power_stats.max_wake_ms = power_stats.last_wake_ms;
+    }
+    power_stats.wakes++;
+    if (DEBUG) { printf("modem awake after %lu ms\n", (unsigned long) power_stats.last_wake_ms); }
+    return true;
 }
 
+void CellularGetPowerStats(CELLULAR_POWER_STATS *stats) {
+    *stats = power_stats;
+    if (power_state == POWER_ASLEEP) {
+        stats->asleep_ms += (uint32_t) (TimebaseGetMs() - power_sleep_ms);
+    }
+}
 
 /**
  * Checks if the modem is responding to AT commands.
@@ -159,7 +446,17 @@ bool CellularCheckModem(void){
  * value of the <regStatus> field of the "+CREG" AT command.
 
  */
+static bool queryRegistrationStatus(int *status);
+
 bool CellularGetRegistrationStatus(int *status){
+    // on the status channel, URCs and service data of the AT and data channels wait meanwhile
+    SerialSelectCellularChannel(CMUX_CHANNEL_STATUS);
+    bool ok = queryRegistrationStatus(status);
+    SerialSelectCellularChannel(CMUX_CHANNEL_AT);
+    return ok;
+}
+
+static bool queryRegistrationStatus(int *status){
     // AT+CREG?
     // response: +CREG: <Mode>, <regStatus>[, <netLac>, <netCellId>[, <AcT>]] followed by OK
     sendATcommand(AT_CMD_CREG_READ, sizeof(AT_CMD_CREG_READ) - 1);
@@ -176,6 +473,43 @@ bool CellularGetRegistrationStatus(int *status){
     return false;
 }
 
+const CELLULAR_REGISTRATION * CellularGetRegistration(void) {
+    return &registration;
+}
+
+/**
+ * @return true if registered to home network (1) or roaming (5).
+ */
+static bool isRegistered(void) {
+    return registration.status == 1 || registration.status == 5;
+}
+
+bool CellularHasData(void) {
+    return CELLULAR_INITIALIZED && SerialDataAvailableCellular();
+}
+
+bool CellularWaitForRegistration(unsigned int timeout_ms) {
+    unsigned char line[MAX_INCOMING_BUF_SIZE];
+    unsigned int time_left_ms = timeout_ms;
+    int status;
+
+    if (!CELLULAR_INITIALIZED) {
+        return false;
+    }
+    // no URC since the operator changed, ask once
+    if (registration.status == REGISTRATION_UNKNOWN) {
+        CellularGetRegistrationStatus(&status);
+    }
+
+    // no command is running, every line read here is a URC
+    while (!isRegistered() && time_left_ms > 0) {
+        if (SerialRecvCellularUntil(line, MAX_INCOMING_BUF_SIZE, &time_left_ms, NULL, 0) > 0) {
+            dispatchURCs(line);
+        }
+    }
+    return isRegistered();
+}
+
 
 /**
  * @param csq
@@ -186,10 +520,19 @@ bool CellularGetRegistrationStatus(int *status){
  * -51dBm.
 
  */
+static bool querySignalQuality(int *csq);
+
 bool CellularGetSignalQuality(int *csq) {
     if (!CELLULAR_INITIALIZED) {
         return false;
     }
+    SerialSelectCellularChannel(CMUX_CHANNEL_STATUS);
+    bool ok = querySignalQuality(csq);
+    SerialSelectCellularChannel(CMUX_CHANNEL_AT);
+    return ok;
+}
+
+static bool querySignalQuality(int *csq) {
     // AT+CSQ
     // response : +CSQ <rssi>,<ber> followed by OK
     // rssi: 0,1,2-30,31,99, ber: 0-7,99unknown
@@ -233,6 +576,9 @@ bool CellularSetOperator(int mode, char *operatorName){
     // When SIM PIN is disabled or after SIM PIN authentication has completed and
     // "+PBREADY" URC has shown up the power up default <mode>=2 automatically
     // changes to <mode>=0, causing the ME to select a network.
+
+    // the +CREG URCs that follow tell the new status
+    registration.status = REGISTRATION_UNKNOWN;
     memset(command_to_send_buffer, '\0',MAX_INCOMING_BUF_SIZE);
     if (mode == REG_AUTOMATICALLY || mode == DEREGISTER) {
         int cmd_size = sprintf(command_to_send_buffer, "%s%d%s", AT_CMD_COPS_WRITE_PREFIX, mode, AT_CMD_SUFFIX);
@@ -311,6 +657,10 @@ bool CellularGetOperators(OPERATOR_INFO *opList, int maxops, int *numOpsFound){
  * @return true if send the command serial. otherwise false.
  */
 void sendATcommand(unsigned char* command, unsigned int command_size) {
+	// a sleeping modem is woken on demand, by the first command that needs it
+	if (power_state == POWER_ASLEEP) {
+		CellularWake();
+	}
 	if (DEBUG) { printf("\n%s\n", command); }
 	if (CELLULAR_INITIALIZED){
 		while(!SerialSendCellular(command, command_size));
@@ -318,15 +668,227 @@ void sendATcommand(unsigned char* command, unsigned int command_size) {
 }
 
 
+/**
+ * Updates the registration from a "+CREG: " line, either the URC
+ * +CREG: <regStatus>[,<netLac>,<netCellId>[,<AcT>]] or the AT+CREG? answer
+ * +CREG: <Mode>,<regStatus>[,<netLac>,<netCellId>[,<AcT>]].
+ * @param text start of the line
+ */
+static void updateRegistration(const char * text) {
+    char line[MAX_OP_TOKEN_SIZE];
+    int first, status;
+    unsigned int lac, cell_id;
+    const char * fields;
+
+    // the line alone, the fields must not run into the next ones
+    size_t len = strcspn(text, "\r\n");
+    if (len >= sizeof(line)) {
+        len = sizeof(line) - 1;
+    }
+    memcpy(line, text, len);
+    line[len] = '\0';
+
+    if (sscanf(line, "+CREG: %d,%d", &first, &status) == 2) {
+        // the answer has a numeric second field, the URC a quoted LAC
+        fields = strchr(strchr(line, ',') + 1, ',');
+    } else if (sscanf(line, "+CREG: %d", &status) == 1) {
+        fields = strchr(line, ',');
+    } else {
+        return;
+    }
+
+    registration.status = status;
+    if (fields != NULL && sscanf(fields, ",\"%x\",\"%x\"", &lac, &cell_id) == 2) {
+        registration.lac = (uint16_t) lac;
+        registration.cell_id = cell_id;
+    }
+    registration.updates++;
+    if (DEBUG) { printf("registration %d lac %X cell %lX\n", registration.status, registration.lac, (unsigned long) registration.cell_id); }
+}
+
+/**
+ * Marks a service readable on "^SISR: <srvProfileId>,1", and at its end of
+ * data on "^SISR: <srvProfileId>,2".
+ * The ^SISR answer of AT^SISR looks the same, inetServiceReadChunk reads it
+ * without passing it here.
+ * @param line start of the line
+ */
+static void updateDataPending(const char * line) {
+    int id, cause;
+    if (sscanf(line, "^SISR: %d,%d", &id, &cause) != 2 || id < 0 || id > MAX_srvProfileId) {
+        return;
+    }
+    if (cause == 1) {
+        services[id].data_pending = true;
+    } else if (cause == 2) {
+        services[id].data_finished = true;
+    }
+}
+
+/**
+ * Clears the URC state of a service before it is opened.
+ * @param srvProfileId
+ */
+static void resetServiceState(int srvProfileId) {
+    SERVICE_STATE * service = &services[srvProfileId];
+    service->data_pending = false;
+    service->data_finished = false;
+    service->error = false;
+}
+
+/**
+ * Marks a service failed on "^SIS: <srvProfileId>,0,<urcInfoId>" with an
+ * error info ID. A socket service is closed by that, or by
+ * "^SISW: <srvProfileId>,2" (connection finished), which also ends its data.
+ * The ^SISW answer of AT^SISW has a third field and is no URC.
+ * @param line start of the line
+ */
+static void updateServiceState(const char * line) {
+    int id, cause, info;
+    int fields;
+
+    if ((fields = sscanf(line, "^SIS: %d,%d,%d", &id, &cause, &info)) >= 2) {
+        if (cause != 0 || (fields == 3 && (info < 1 || info > 2000))) {
+            return;
+        }
+        if (id >= 0 && id <= MAX_srvProfileId) {
+            services[id].error = true;
+        }
+    } else if ((fields = sscanf(line, "^SISW: %d,%d,%d", &id, &cause, &info)) == 2) {
+        if (cause != 2) {
+            return;
+        }
+    } else {
+        return;
+    }
+
+    if (id >= 0 && id <= MAX_srvProfileId && services[id].connected) {
+        services[id].connected = false;
+        services[id].data_finished = true;
+        if (DEBUG) { printf("socket %d closed\n", id); }
+    }
+}
+
+/**
+ * Handles the URCs in received text. Called on everything read from the modem,
+ * URCs can show up between the lines of any response.
+ * @param buffer received text
+ */
+static void dispatchURCs(const unsigned char * buffer) {
+    const char * text = (const char *) buffer;
+
+    // ^SCKS: SIM removed or inserted
+    if (SIM_IDENTITY_VALID && strstr(text, (const char *) AT_URC_SCKS) != NULL) {
+        SIM_IDENTITY_VALID = false;
+        if (DEBUG) { printf("SIM changed\n"); }
+    }
+
+    for (const char * creg = strstr(text, (const char *) AT_URC_CREG); creg != NULL;
+         creg = strstr(creg + 1, (const char *) AT_URC_CREG)) {
+        updateRegistration(creg);
+    }
+
+    for (const char * sis = strstr(text, (const char *) AT_URC_SIS); sis != NULL;
+         sis = strstr(sis + 1, (const char *) AT_URC_SIS)) {
+        updateServiceState(sis);
+    }
+    for (const char * sisw = strstr(text, (const char *) AT_URC_SISW_CAUSE); sisw != NULL;
+         sisw = strstr(sisw + 1, (const char *) AT_URC_SISW_CAUSE)) {
+        updateServiceState(sisw);
+    }
+    for (const char * sisr = strstr(text, (const char *) AT_URC_SISR_CAUSE); sisr != NULL;
+         sisr = strstr(sisr + 1, (const char *) AT_URC_SISR_CAUSE)) {
+        updateDataPending(sisr);
+    }
+}
+
+/**
+ * Reads the URCs that came in while no command was running.
+ */
+static void pollURCs(void) {
+    unsigned char line[MAX_INCOMING_BUF_SIZE];
+    unsigned int time_left_ms = URC_POLL_MS;
+
+    while (time_left_ms > 0 &&
+           SerialRecvCellularUntil(line, MAX_INCOMING_BUF_SIZE, &time_left_ms, NULL, 0) > 0) {
+        dispatchURCs(line);
+    }
+}
+
+/**
+ * Sends a command whose answer is a single information line, e.g. AT+CGSN.
+ * @param command command to send
+ * @param command_size length of command
+ * @param info buffer for the line
+ * @param info_size size of info
+ * @return true if the modem answered the line and OK.
+ */
+static bool queryInfoLine(unsigned char * command, unsigned int command_size, char * info, int info_size) {
+    unsigned char incoming_buffer[MAX_INCOMING_BUF_SIZE] = "";
+    unsigned int time_left_ms = GENERAL_RECV_TIMEOUT_MS;
+    char * lines[RESPONSE_TOKENS_SIZE];
+    int num_of_lines = 0;
+
+    sendATcommand(command, command_size);
+    SerialRecvCellularUntil(incoming_buffer, MAX_INCOMING_BUF_SIZE, &time_left_ms,
+                            AT_FINAL_RESPONSES, NUM_FINAL_RESPONSES);
+    if (DEBUG) { printf("\n%s\n", incoming_buffer); }
+    dispatchURCs(incoming_buffer);
+
+    // the lines point into incoming_buffer, which stays valid here
+    char * line = strtok((char *) incoming_buffer, "\r\n");
+    while (line != NULL && num_of_lines < RESPONSE_TOKENS_SIZE) {
+        lines[num_of_lines++] = line;
+        line = strtok(NULL, "\r\n");
+    }
+    if (num_of_lines < 2 || strcmp(lines[num_of_lines - 1], (char *) AT_RES_OK) != 0) {
+        return false;
+    }
+    // skip URCs that came in between
+    for (int i = 0; i < num_of_lines - 1; i++) {
+        if (lines[i][0] != '^' && lines[i][0] != '+') {
+            strncpy(info, lines[i], info_size - 1);
+            info[info_size - 1] = '\0';
+            return true;
+        }
+    }
+    return false;
+}
+
+/**
+ * Fills the parts of the identity cache that are not valid.
+ * @return true if the whole identity is valid.
+ */
+static bool readIdentity(void) {
+    if (!MODEM_IDENTITY_VALID) {
+        MODEM_IDENTITY_VALID =
+                queryInfoLine(AT_CMD_CGSN, sizeof(AT_CMD_CGSN) - 1, identity.imei, IMEI_BUFFER_SIZE) &&
+                queryInfoLine(AT_CMD_CGMR, sizeof(AT_CMD_CGMR) - 1, identity.firmware, FIRMWARE_BUFFER_SIZE);
+    }
+    if (!SIM_IDENTITY_VALID) {
+        //AT+CCID?
+        int cmd_size = sprintf(command_to_send_buffer, "%s%s", AT_CMD_CCID_READ, AT_CMD_SUFFIX);
+        sendATcommand(command_to_send_buffer, cmd_size);
+        SIM_IDENTITY_VALID =
+                resolveCCIDresult(identity.iccid) > 0 &&
+                queryInfoLine(AT_CMD_CIMI, sizeof(AT_CMD_CIMI) - 1, identity.imsi, IMSI_BUFFER_SIZE);
+    }
+    return MODEM_IDENTITY_VALID && SIM_IDENTITY_VALID;
+}
+
 bool waitForOK() {
     unsigned char incoming_buffer[MAX_INCOMING_BUF_SIZE] = "";
     unsigned char * token_array[10] = {};
     unsigned int bytes_received = 0;
     int num_of_tokens = 0;
 
+	unsigned int time_left_ms = GENERAL_RECV_TIMEOUT_MS;
+
 	memset(incoming_buffer, '\0', MAX_INCOMING_BUF_SIZE);
-	bytes_received = SerialRecvCellular(incoming_buffer, MAX_INCOMING_BUF_SIZE, GENERAL_RECV_TIMEOUT_MS);
+	bytes_received = SerialRecvCellularUntil(incoming_buffer, MAX_INCOMING_BUF_SIZE, &time_left_ms,
+											 AT_FINAL_RESPONSES, NUM_FINAL_RESPONSES);
 	if (DEBUG) { printf("\n%s\n", incoming_buffer); }
+	dispatchURCs(incoming_buffer);
 
 	if (bytes_received > 0) {
 		num_of_tokens = splitBufferToResponses(incoming_buffer, token_array, 10);
@@ -340,16 +902,34 @@ bool waitForOK() {
 }
 
 
+/**
+ * Waits for a response line or a final result code.
+ * @param token_array set to the lines of the response. They point into a
+ *        buffer that holds them until the next call.
+ * @param expected_response prefix of the line to wait for
+ * @param response_size length of expected_response
+ * @param max_responses size of token_array
+ * @param timeout_ms
+ * @return true if the last line is the expected one.
+ */
 bool waitForATresponse(unsigned char ** token_array, unsigned char * expected_response,
         unsigned int response_size, int max_responses, unsigned int timeout_ms) {
 
-	unsigned char incoming_buffer[MAX_INCOMING_BUF_SIZE] = "";
+	static unsigned char incoming_buffer[MAX_INCOMING_BUF_SIZE];
 	unsigned int bytes_received = 0;
 	int num_of_tokens = 0;
 
+	// stop on the expected response or on any final result code
+	char expected[MAX_AT_CMD_LEN] = "";
+	memcpy(expected, expected_response, response_size < MAX_AT_CMD_LEN ? response_size : MAX_AT_CMD_LEN - 1);
+	const char * terminators[NUM_FINAL_RESPONSES + 1] = {expected};
+	memcpy(&terminators[1], AT_FINAL_RESPONSES, sizeof(AT_FINAL_RESPONSES));
+
 	memset(incoming_buffer, '\0', MAX_INCOMING_BUF_SIZE);
-	bytes_received = SerialRecvCellular(incoming_buffer, MAX_INCOMING_BUF_SIZE, timeout_ms);
+	bytes_received = SerialRecvCellularUntil(incoming_buffer, MAX_INCOMING_BUF_SIZE, &timeout_ms,
+											 terminators, NUM_FINAL_RESPONSES + 1);
 	if (DEBUG) { printf("\n%s\n", incoming_buffer); }
+	dispatchURCs(incoming_buffer);
 	if (bytes_received == 0) {
 		token_array[0] = NULL;
 		if (DEBUG) { printf("bytes = 0\n"); }
@@ -375,23 +955,39 @@ bool waitForATresponse(unsigned char ** token_array, unsigned char * expected_re
 }
 
 
+/**
+ * Collects response and URC lines.
+ * @param token_array set to the lines. They point into a buffer that holds
+ *        them until the next call.
+ * @param total_expected_urcs number of lines to wait for
+ * @param max_urcs size of token_array
+ * @param timeout_ms
+ * @return number of lines, fewer on timeout or ERROR.
+ */
 int getSISURCs(unsigned char ** token_array, int total_expected_urcs, int max_urcs, unsigned int timeout_ms) {
+    static unsigned char lines_buffer[MAX_INCOMING_BUF_SIZE];
     unsigned char incoming_buffer[MAX_INCOMING_BUF_SIZE] = "";
     unsigned char temp_buffer[MAX_INCOMING_BUF_SIZE] = "";
     unsigned int bytes_received = 0;
+    unsigned int time_left_ms = timeout_ms;
     int num_of_tokens = 0;
 
+    // each URC is a line of its own, return as soon as the expected lines arrived
     do {
         memset(incoming_buffer, '\0', bytes_received);
-        bytes_received = SerialRecvCellular(incoming_buffer, MAX_INCOMING_BUF_SIZE, timeout_ms);
+        bytes_received = SerialRecvCellularUntil(incoming_buffer,
+                MAX_INCOMING_BUF_SIZE - 1 - strlen(temp_buffer), &time_left_ms, NULL, 0);
         strncat(temp_buffer, (const char *) incoming_buffer, bytes_received);
-        num_of_tokens = splitBufferToResponses(temp_buffer, token_array, max_urcs);
+        dispatchURCs(incoming_buffer);
+        // splitting cuts the lines apart, temp_buffer keeps collecting
+        memcpy(lines_buffer, temp_buffer, strlen(temp_buffer) + 1);
+        num_of_tokens = splitBufferToResponses(lines_buffer, token_array, max_urcs);
 
         if ((num_of_tokens > 0) && (strcmp(token_array[num_of_tokens - 1], "ERROR") == 0)) {
             break;
         }
 
-    } while (num_of_tokens < total_expected_urcs);
+    } while (num_of_tokens < total_expected_urcs && time_left_ms > 0);
 
     return num_of_tokens;
 }
@@ -406,11 +1002,11 @@ int getSISURCs(unsigned char ** token_array, int total_expected_urcs, int max_ur
  */
 bool parseSISresponse(char * sis_result, int * urcCause, int * urcInfoId) {
     // ^SIS: <srvProfileId>, <urcCause>[, [<urcInfoId>][, <urcInfoText>]]
-    char * temp_token = strtok(sis_result, ",");   //<srvProfileId>,
-    temp_token = strtok(NULL, ",");         //<urcCause>
-    *urcCause = atoi(temp_token);
-    temp_token = strtok(NULL, ",");         //<urcInfoId>
-    *urcInfoId = atoi(temp_token);
+    int id;
+    *urcInfoId = 0;
+    if (sscanf(sis_result, "%d,%d,%d", &id, urcCause, urcInfoId) < 2) {
+        return true;
+    }
 
     // if <urcCause>==0
     if ((*urcCause == 0) && (1 <= *urcInfoId) && (*urcInfoId <= 2000)) {
@@ -427,9 +1023,8 @@ bool parseSISresponse(char * sis_result, int * urcCause, int * urcInfoId) {
  */
 int parseSISRWresponse(char * sisrw_result) {
     //^SISR: <srvProfileId>, <urcCauseId>
-    char * urcCauseId = "";
-    strcpy(urcCauseId, &sisrw_result[2]);
-    return atoi(urcCauseId);
+    char * urcCauseId = strchr(sisrw_result, ',');
+    return (urcCauseId != NULL) ? atoi(urcCauseId + 1) : -1;
 }
 
 
@@ -465,25 +1060,31 @@ int resolveCCIDresult(char * iccid_buffer) {
  * this method parse SIS URCs
  * @param token_array tokens of SIS responses
  * @param received_urcs num of tokens.
+ * @param urc_read_buffer gets the <infoID>[, <info>] of a ^SISE line, may be NULL
+ * @param buffer_size size of urc_read_buffer
  * @return false if SIS URC reflecting error, true otherwise
  */
-bool parseSISURCs(unsigned char ** token_array, int received_urcs, char * urc_read_buffer) {
+bool parseSISURCs(unsigned char ** token_array, int received_urcs, char * urc_read_buffer, int buffer_size) {
     const char urc_delimiter[] = ": ";
     for (int urc_idx = 0; urc_idx < received_urcs; urc_idx++) {
-        char * urc_prefix = "";
+        char urc_prefix[MAX_OP_TOKEN_SIZE] = "";
         char * urc_result = "";
-        char * temp_token = "";
+        char * line = (char *) token_array[urc_idx];
 
-        if (strcmp(token_array[urc_idx], "ERROR") == 0) {
+        if (strcmp(line, "ERROR") == 0 ||
+            strncmp(line, (const char *) AT_RES_CME, sizeof(AT_RES_CME) - 1) == 0) {
             return false;
+        }
 
-        temp_token = strtok(token_array[urc_idx], urc_delimiter);
-        strcpy(urc_prefix, temp_token);
-        temp_token = strtok(NULL, urc_delimiter);
-        strcpy(urc_result, temp_token);
-
+        // "<prefix>: <result>", lines without the delimiter are data or OK
+        char * delimiter = strstr(line, urc_delimiter);
+        if (delimiter == NULL || delimiter - line >= MAX_OP_TOKEN_SIZE) {
+            continue;
+        }
+        memcpy(urc_prefix, line, delimiter - line);
+        urc_result = delimiter + strlen(urc_delimiter);
 
-        } else if (strcmp(urc_prefix, "^SIS") == 0) {
+        if (strcmp(urc_prefix, "^SIS") == 0) {
             //^SIS: <srvProfileId>, <urcCause>[, [<urcInfoId>][, <urcInfoText>]]
             int urcCause, urcInfoId;
             if (!parseSISresponse(urc_result, &urcCause, &urcInfoId)) {
@@ -492,7 +1093,10 @@ bool parseSISURCs(unsigned char ** token_array, int received_urcs, char * urc_re
 
         } else if (strcmp(urc_prefix, "^SISE") == 0) {
             //^SISE: <srvProfileId>, <infoID>[, <info>]
-            strcpy(urc_read_buffer, &urc_result[2]);
+            char * info = strchr(urc_result, ',');
+            if (urc_read_buffer != NULL && info != NULL) {
+                snprintf(urc_read_buffer, buffer_size, "%s", info + 1);
+            }
             return true;
 
         } else if (strcmp(urc_prefix, "^SISR") == 0) {
@@ -502,9 +1106,6 @@ bool parseSISURCs(unsigned char ** token_array, int received_urcs, char * urc_re
         } else if (strcmp(urc_prefix, "^SISW") == 0) {
             //^SISW: <srvProfileId>, <urcCauseId>
             if (parseSISRWresponse(urc_result) != 2) { return false; }
-
-        } else if (urc_prefix[0] == '{') {
-            strcpy(urc_read_buffer, urc_prefix);
         }
 
     }
@@ -512,58 +1113,190 @@ bool parseSISURCs(unsigned char ** token_array, int received_urcs, char * urc_re
 }
 
 
-bool inetServiceSetupProfile(int srvProfileId, char *URL, char *payload, int payload_len) {
+/**
+ * Starts a batch of independent commands.
+ * @param batch
+ */
+static void atBatchBegin(AT_BATCH * batch) {
+    batch->len = 0;
+    batch->queued = 0;
+    batch->commands = 0;
+    batch->round_trips = 0;
+    batch->ok = true;
+}
+
+/**
+ * Sends one command of a batch alone and waits for its result.
+ * @param command the command without "AT" and "\r\n"
+ * @param len length of command
+ * @return true on OK.
+ */
+static bool atBatchSendAlone(const char * command, int len) {
+    int cmd_size = snprintf(command_to_send_buffer, MAX_INCOMING_BUF_SIZE, "AT%.*s%s", len, command, AT_CMD_SUFFIX);
+    sendATcommand(command_to_send_buffer, cmd_size);
+    return waitForOK();
+}
+
+/**
+ * Sends the queued commands of a batch on one line. If the modem refuses
+ * the line but takes the commands one by one, it does not get concatenated
+ * commands anymore.
+ * @param batch
+ * @return false if a command of the batch failed.
+ */
+static bool atBatchFlush(AT_BATCH * batch) {
+    if (batch->queued == 0 || !batch->ok) {
+        batch->len = 0;
+        batch->queued = 0;
+        return batch->ok;
+    }
+
+    memcpy(&batch->line[batch->len], AT_CMD_SUFFIX, sizeof(AT_CMD_SUFFIX));
+    sendATcommand((unsigned char *) batch->line, batch->len + sizeof(AT_CMD_SUFFIX) - 1);
+    batch->round_trips++;
+    batch->ok = waitForOK();
+
+    if (!batch->ok && batch->queued > 1) {
+        // either a command failed or the modem does not take them together
+        batch->ok = true;
+        for (int i = 0; i < batch->queued && batch->ok; i++) {
+            // after the first command, each starts behind its ';'
+            int start = batch->starts[i];
+            int end = (i + 1 < batch->queued) ? batch->starts[i + 1] - 1 : batch->len;
+            batch->ok = atBatchSendAlone(&batch->line[start], end - start);
+            batch->round_trips++;
+        }
+        if (batch->ok) {
+            if (DEBUG) { printf("modem refused concatenated commands\n"); }
+            AT_BATCH_CONCAT = false;
+        }
+    }
+    batch->len = 0;
+    batch->queued = 0;
+    return batch->ok;
+}
+
+/**
+ * Queues a command of a batch. The line is sent once it is full, or alone
+ * for a command too long to share one.
+ * @param batch
+ * @param format the command without "AT" and "\r\n", e.g. "^SISS=6,\"cmd\",\"1\""
+ */
+static void atBatchAdd(AT_BATCH * batch, const char * format, ...) {
+    char command[MAX_INCOMING_BUF_SIZE];
+    va_list args;
+
+    va_start(args, format);
+    int len = vsnprintf(command, sizeof(command), format, args);
+    va_end(args);
+    // a truncated command must not be sent, nor one that does not fit
+    // command_to_send_buffer with "AT" and "\r\n" when sent alone
+    if (!batch->ok || len < 0 || 2 + len + sizeof(AT_CMD_SUFFIX) > MAX_INCOMING_BUF_SIZE) {
+        if (DEBUG && len >= 0) { printf("batch: command too long (%d)\n", len); }
+        batch->ok = false;
+        return;
+    }
+    batch->commands++;
+
+    // "AT" or ';' before, "\r\n" after
+    int needed = ((batch->len == 0) ? 2 : 1) + len + sizeof(AT_CMD_SUFFIX);
+    if (batch->queued == AT_BATCH_MAX_COMMANDS || batch->len + needed > AT_BATCH_LINE_SIZE) {
+        atBatchFlush(batch);
+    }
+    if (!AT_BATCH_CONCAT || 2 + len + sizeof(AT_CMD_SUFFIX) > AT_BATCH_LINE_SIZE) {
+        atBatchFlush(batch);
+        batch->ok = batch->ok && atBatchSendAlone(command, len);
+        batch->round_trips++;
+        return;
+    }
+
+    if (batch->len == 0) {
+        batch->len = sprintf(batch->line, "AT");
+    } else {
+        batch->line[batch->len++] = ';';
+    }
+    batch->starts[batch->queued++] = batch->len;
+    memcpy(&batch->line[batch->len], command, len);
+    batch->len += len;
+}
+
+/**
+ * Sends what is left of a batch.
+ * @param batch
+ * @return true if every command of the batch succeeded.
+ */
+static bool atBatchEnd(AT_BATCH * batch) {
+    atBatchFlush(batch);
+    if (DEBUG) { printf("batch: %d commands, %d round trips\n", batch->commands, batch->round_trips); }
+    return batch->ok;
+}
+
+bool inetServiceSetupProfile(int srvProfileId, char *URL, char *payload, int payload_len, const char *content_type) {
     // AT^SISS=<srvProfileId>, <srvParmTag>, <srvParmValue>
+    // the settings do not depend on each other, they go out in one or two lines
+    const char * siss = (const char *) &AT_CMD_SISS_WRITE_PRFX[2];
+    AT_BATCH batch;
+    atBatchBegin(&batch);
 
     // AT^SISS=6,"SrvType","Http"
-    int cmd_size = sprintf(command_to_send_buffer, "%s%d,\"SrvType\",\"Http\"%s",
-                           AT_CMD_SISS_WRITE_PRFX, srvProfileId, AT_CMD_SUFFIX);
-    // send command and check response OK/ERROR
-    sendATcommand(command_to_send_buffer, cmd_size);
-    if (!waitForOK()) { return false; }
+    atBatchAdd(&batch, "%s%d,\"SrvType\",\"Http\"", siss, srvProfileId);
 
     // AT^SISS=6,"conId","<conProfileId>"
-    cmd_size = sprintf(command_to_send_buffer, "%s%d,\"conId\",\"%d\"%s",
-                       AT_CMD_SISS_WRITE_PRFX, srvProfileId, conProfileId, AT_CMD_SUFFIX);
-    // send command and check response OK/ERROR
-    sendATcommand(command_to_send_buffer, cmd_size);
-    if (!waitForOK()) { return false; }
+    atBatchAdd(&batch, "%s%d,\"conId\",\"%d\"", siss, srvProfileId, conProfileId);
 
     // AT^SISS=6,"address","<url>"
-    cmd_size = sprintf(command_to_send_buffer, "%s%d,\"address\",\"%s\"%s",
-                       AT_CMD_SISS_WRITE_PRFX, srvProfileId, URL, AT_CMD_SUFFIX);
-    // send command and check response OK/ERROR
-    sendATcommand(command_to_send_buffer, cmd_size);
-    if (!waitForOK()) { return false; }
-
+    atBatchAdd(&batch, "%s%d,\"address\",\"%s\"", siss, srvProfileId, URL);
 
     // AT^SISS=6,"cmd","1"
-    cmd_size = sprintf(command_to_send_buffer, "%s%d,\"cmd\",\"%d\"%s",
-                       AT_CMD_SISS_WRITE_PRFX, srvProfileId, SISS_CMD_HTTP_POST, AT_CMD_SUFFIX);
-    // send command and check response OK/ERROR
-    sendATcommand(command_to_send_buffer, cmd_size);
-    if (!waitForOK()) { return false; }
+    atBatchAdd(&batch, "%s%d,\"cmd\",\"%d\"", siss, srvProfileId, SISS_CMD_HTTP_POST);
 
+    // AT^SISS=6,"hcProp","Content-Type: application/cbor"
+    // an empty hcProp clears the header a previous request set
+    if (content_type != NULL) {
+        atBatchAdd(&batch, "%s%d,\"hcProp\",\"Content-Type: %s\"", siss, srvProfileId, content_type);
+    } else {
+        atBatchAdd(&batch, "%s%d,\"hcProp\",\"\"", siss, srvProfileId);
+    }
 
     // AT^SISS=6,"hcContLen","0"
     // If "hcContLen" = 0 then the data given in the "hcContent" string will be posted
     // without AT^SISW required.
-    cmd_size = sprintf(command_to_send_buffer, "%s%d,\"hcContLen\",\"%d\"%s",
-                       AT_CMD_SISS_WRITE_PRFX, srvProfileId, 0, AT_CMD_SUFFIX);
-    // send command and check response OK/ERROR
-    sendATcommand(command_to_send_buffer, cmd_size);
-    if (!waitForOK()) { return false; }
-
+    // Without a payload string the body is binary, payload_len bytes are written
+    // with AT^SISW once the service is open.
+    atBatchAdd(&batch, "%s%d,\"hcContLen\",\"%d\"", siss, srvProfileId, (payload == NULL) ? payload_len : 0);
 
     //AT^SISS=6,"hcContent","HelloWorld!"
-    cmd_size = sprintf(command_to_send_buffer, "%s%d,\"hcContent\",\"%s\"%s",
-                       AT_CMD_SISS_WRITE_PRFX, srvProfileId, payload, AT_CMD_SUFFIX);
-    // send command and check response OK/ERROR
-   sendATcommand(command_to_send_buffer, cmd_size);
-   return waitForOK();
+    if (payload != NULL) {
+        atBatchAdd(&batch, "%s%d,\"hcContent\",\"%s\"", siss, srvProfileId, payload);
+    }
+    return atBatchEnd(&batch);
+}
+
+/**
+ * Sets up a socket service profile.
+ * @param srvProfileId
+ * @param address e.g. "socktcp://host:port"
+ * @return true if all settings were taken.
+ */
+bool inetServiceSetupSocket(int srvProfileId, const char *address) {
+    const char * siss = (const char *) &AT_CMD_SISS_WRITE_PRFX[2];
+    AT_BATCH batch;
+    atBatchBegin(&batch);
+
+    // AT^SISS=1,"SrvType","Socket"
+    atBatchAdd(&batch, "%s%d,\"SrvType\",\"Socket\"", siss, srvProfileId);
+
+    // AT^SISS=1,"conId","<conProfileId>"
+    atBatchAdd(&batch, "%s%d,\"conId\",\"%d\"", siss, srvProfileId, conProfileId);
+
+    // AT^SISS=1,"address","socktcp://host:port"
+    atBatchAdd(&batch, "%s%d,\"address\",\"%s\"", siss, srvProfileId, address);
+    return atBatchEnd(&batch);
 }
 
 bool inetServiceOpen(int srvProfileId) {
+    resetServiceState(srvProfileId);
+
     //AT^SISO=6
     int cmd_size = sprintf(command_to_send_buffer, "%s%d%s", AT_CMD_SISO_WRITE_PRFX, srvProfileId, AT_CMD_SUFFIX);
     sendATcommand(command_to_send_buffer, cmd_size);
@@ -572,16 +1305,196 @@ bool inetServiceOpen(int srvProfileId) {
     // ^SIS: 6,0,2200,"Http en8wtnrvtnkt5.x.pipedream.net:443"
     // ^SISW: 6,2
     // ^SISR: 6,1
-    char * urc_read_buff = "";
     unsigned char * tokens_array[10] = {};
     int received_urcs = getSISURCs(tokens_array, 4, 10, GENERAL_RECV_DLY_TIMEOUT_MS);
-    if (!parseSISURCs(tokens_array, received_urcs, urc_read_buff)) {
+    if (!parseSISURCs(tokens_array, received_urcs, NULL, 0)) {
         return false;
     } else {
         return true;
     }
 }
 
+/**
+ * Opens a service whose body is written with AT^SISW (hcContLen > 0).
+ * @param srvProfileId
+ * @return true once the service is ready for data.
+ */
+bool inetServiceOpenForWrite(int srvProfileId) {
+    resetServiceState(srvProfileId);
+
+    //AT^SISO=6
+    int cmd_size = sprintf(command_to_send_buffer, "%s%d%s", AT_CMD_SISO_WRITE_PRFX, srvProfileId, AT_CMD_SUFFIX);
+    sendATcommand(command_to_send_buffer, cmd_size);
+    if (!waitForOK()) { return false; }
+
+    // ^SISW: 6,1
+    unsigned char * tokens_array[RESPONSE_TOKENS_SIZE] = {};
+    return waitForATresponse(tokens_array, AT_URC_SISW, sizeof(AT_URC_SISW) - 1,
+                             RESPONSE_TOKENS_SIZE, GENERAL_RECV_DLY_TIMEOUT_MS);
+}
+
+/**
+ * Writes binary data to an open service, in chunks AT^SISW accepts.
+ * @param srvProfileId
+ * @param data
+ * @param len
+ * @return true if all of data was written.
+ */
+static bool writeChunks(int srvProfileId, const uint8_t * data, int len);
+
+bool inetServiceWrite(int srvProfileId, const uint8_t * data, int len) {
+    // the data channel carries nothing but the data and its command
+    SerialSelectCellularChannel(CMUX_CHANNEL_DATA);
+    bool written = writeChunks(srvProfileId, data, len);
+    SerialSelectCellularChannel(CMUX_CHANNEL_AT);
+    return written;
+}
+
+static bool writeChunks(int srvProfileId, const uint8_t * data, int len) {
+    unsigned char * tokens_array[RESPONSE_TOKENS_SIZE] = {};
+    int written = 0;
+
+    while (written < len) {
+        int chunk = (len - written < SISW_MAX_CHUNK) ? len - written : SISW_MAX_CHUNK;
+
+        // AT^SISW=6,<len>
+        // ^SISW: 6,<len>,<unackData>, then the modem takes <len> bytes and answers OK
+        int cmd_size = sprintf(command_to_send_buffer, "%s%d,%d%s", AT_CMD_SISW_WRITE_PRFX, srvProfileId, chunk, AT_CMD_SUFFIX);
+        sendATcommand(command_to_send_buffer, cmd_size);
+        if (!waitForATresponse(tokens_array, AT_URC_SISW, sizeof(AT_URC_SISW) - 1,
+                               RESPONSE_TOKENS_SIZE, GENERAL_RECV_TIMEOUT_MS)) {
+            return false;
+        }
+
+        while (!SerialSendCellular((unsigned char *) &data[written], chunk));
+        if (!waitForOK()) { return false; }
+        written += chunk;
+    }
+    return true;
+}
+
+/**
+ * Reads the data a service has ready with one AT^SISR.
+ * @param srvProfileId
+ * @param buf
+ * @param maxlen at most SISW_MAX_CHUNK bytes are read, SISR_MUX_MAX_CHUNK while
+ * multiplexing: RTS does not hold the modem off for a full channel buffer
+ * @return number of bytes read, 0 if there was none, -1 on error.
+ */
+static int readChunk(int srvProfileId, uint8_t * buf, int maxlen);
+
+static int inetServiceReadChunk(int srvProfileId, uint8_t * buf, int maxlen) {
+    // no URC gets between the ^SISR answer and the data on the data channel
+    SerialSelectCellularChannel(CMUX_CHANNEL_DATA);
+    int count = readChunk(srvProfileId, buf, maxlen);
+    SerialSelectCellularChannel(CMUX_CHANNEL_AT);
+    return count;
+}
+
+static int readChunk(int srvProfileId, uint8_t * buf, int maxlen) {
+    unsigned char line[MAX_INCOMING_BUF_SIZE];
+    unsigned int time_left_ms = GENERAL_RECV_TIMEOUT_MS;
+    const char * terminators[NUM_FINAL_RESPONSES + 1] = {(const char *) AT_URC_SISR_CAUSE};
+    int id, count;
+
+    // AT^SISR=6,<maxlen>
+    // ^SISR: 6,<cnfReadLength>, then <cnfReadLength> bytes of data and OK
+    if (maxlen > SISW_MAX_CHUNK) {
+        maxlen = SISW_MAX_CHUNK;
+    }
+    if (CELLULAR_MUXED && maxlen > SISR_MUX_MAX_CHUNK) {
+        maxlen = SISR_MUX_MAX_CHUNK;
+    }
+    int cmd_size = sprintf(command_to_send_buffer, "%s%d,%d%s", AT_CMD_SISR_WRITE_PRFX, srvProfileId, maxlen, AT_CMD_SUFFIX);
+    sendATcommand(command_to_send_buffer, cmd_size);
+
+    // stops right after the ^SISR line, before the data. No ^SISR URC comes
+    // while there is unread data, so the line is the answer.
+    memcpy(&terminators[1], AT_FINAL_RESPONSES, sizeof(AT_FINAL_RESPONSES));
+    SerialRecvCellularUntil(line, MAX_INCOMING_BUF_SIZE, &time_left_ms, terminators, NUM_FINAL_RESPONSES + 1);
+    char * answer = strstr((char *) line, (char *) AT_URC_SISR_CAUSE);
+    if (answer == NULL || sscanf(answer, "^SISR: %d,%d", &id, &count) != 2 || count > maxlen) {
+        services[srvProfileId].data_pending = false;
+        return -1;
+    }
+    if (count < 0) {
+        // -1: all data was read, other values: none yet
+        waitForOK();
+        services[srvProfileId].data_pending = false;
+        services[srvProfileId].data_finished = services[srvProfileId].data_finished || (count == -1);
+        return 0;
+    }
+    if (count > 0 && SerialRecvCellular(buf, count, GENERAL_RECV_TIMEOUT_MS) != (unsigned int) count) {
+        return -1;
+    }
+    waitForOK();
+
+    // a full read may have left more, a short one emptied the buffer
+    services[srvProfileId].data_pending = (count == maxlen);
+    return count;
+}
+
+/**
+ * Reads URCs until a service has data to read, its data ended or it failed.
+ * @param srvProfileId
+ * @param time_left_ms time to wait, decremented
+ * @return true if there is data to read.
+ */
+static bool inetServiceWaitForData(int srvProfileId, unsigned int * time_left_ms) {
+    unsigned char line[MAX_INCOMING_BUF_SIZE];
+
+    // no command is running, every line read here is a URC
+    while (!services[srvProfileId].data_pending && !services[srvProfileId].data_finished && !services[srvProfileId].error &&
+           *time_left_ms > 0) {
+        if (SerialRecvCellularUntil(line, MAX_INCOMING_BUF_SIZE, time_left_ms, NULL, 0) > 0) {
+            dispatchURCs(line);
+        }
+    }
+    return services[srvProfileId].data_pending;
+}
+
+/* Where inetServiceReadResponse collects the response */
+typedef struct __RESPONSE_BUFFER {
+    char * buf;
+    int size;
+    int len;
+} RESPONSE_BUFFER;
+
+static void copyToResponse(const uint8_t * data, int len, void * context) {
+    RESPONSE_BUFFER * response = (RESPONSE_BUFFER *) context;
+    int room = response->size - response->len;
+    if (len > room) {
+        len = room;
+    }
+    memcpy(&response->buf[response->len], data, len);
+    response->len += len;
+}
+
+/**
+ * Reads the HTTP response of an open service and closes it. The whole
+ * response is read, what does not fit into response is dropped.
+ * @param srvProfileId
+ * @param response
+ * @param response_max_len
+ * @return number of bytes in response, -1 on error.
+ */
+int inetServiceReadResponse(int srvProfileId, char *response, int response_max_len) {
+    RESPONSE_BUFFER collected = {response, response_max_len, 0};
+
+    // ^SISR: 6,1
+    // AT^SISR=6,1500 while there is more, ^SISR: 6,2 once all was read
+    int total = CellularServiceRead(srvProfileId, copyToResponse, &collected, GENERAL_RECV_DLY_TIMEOUT_MS);
+
+    if (!inetServiceClose(srvProfileId) || total < 0) {
+        return -1;
+    }
+    if (collected.len < response_max_len) {
+        response[collected.len] = '\0';
+    }
+    if (DEBUG && total > collected.len) { printf("response cut, %d of %d bytes\n", collected.len, total); }
+    return collected.len;
+}
+
 bool inetServiceClose(int srvProfileId) {
     //AT^SISC=6
     int cmd_size = sprintf(command_to_send_buffer, "%s%d%s", AT_CMD_SISC_WRITE_PRFX, srvProfileId, AT_CMD_SUFFIX);
@@ -590,14 +1503,18 @@ bool inetServiceClose(int srvProfileId) {
     return waitForOK();
 }
 
+/**
+ * Splits a buffer into its lines, in place.
+ * @param buffer text, its line ends are overwritten
+ * @param tokens_array set to the lines, they point into buffer
+ * @param max_tokens size of tokens_array
+ * @return number of lines.
+ */
 int splitBufferToResponses(unsigned char * buffer, unsigned char ** tokens_array, int max_tokens) {
-    unsigned char temp_buffer[MAX_INCOMING_BUF_SIZE];
-    memcpy(temp_buffer, buffer, MAX_INCOMING_BUF_SIZE);
-
     const char delimiter[] = "\r\n";
     char * token;
     int i=0;
-    token = strtok(temp_buffer, delimiter);
+    token = strtok((char *) buffer, delimiter);
     while (token != NULL && i < max_tokens) {
         tokens_array[i++] = (unsigned char *)token;
         token = strtok(NULL, delimiter);
@@ -681,46 +1598,111 @@ bool splitOpTokensToOPINFO(unsigned char * op_token, OPERATOR_INFO *opInfo) {
 
 
 /**
- * Initialize an internet connection profile (AT^SICS) with inactTO=inact_time_sec and conType= GPRS0
- * and apn="postm2m.lu".
- * @param inact_time_sec
- * @return true if inet connection profile set successfully, false otherwise
+ * Reads the connection profiles back with AT^SICS?. The answer is read line by
+ * line, it is longer than MAX_INCOMING_BUF_SIZE.
+ * @param profiles array of MAX_conProfileId + 1 settings to fill
+ * @return true if the modem answered OK.
  */
-bool CellularSetupInternetConnectionProfile(int inact_time_sec) {
+static bool readConnectionProfiles(CON_PROFILE_SETTINGS * profiles) {
+    unsigned char line[MAX_INCOMING_BUF_SIZE];
+    unsigned int time_left_ms = GENERAL_RECV_TIMEOUT_MS;
+
+    for (int id = 0; id <= MAX_conProfileId; id++) {
+        profiles[id].gprs0 = false;
+        profiles[id].apn = false;
+        profiles[id].inactTO = -1;
+    }
 
-    int conProfileId_cand;
+    sendATcommand(AT_CMD_SICS_READ, sizeof(AT_CMD_SICS_READ) - 1);
+    while (time_left_ms > 0) {
+        // every non empty line ends the reception
+        if (SerialRecvCellularUntil(line, MAX_INCOMING_BUF_SIZE, &time_left_ms, NULL, 0) == 0) {
+            return false;
+        }
+        dispatchURCs(line);
+
+        // ^SICS: <conProfileId>,"<conParmTag>","<conParmValue>"
+        int id;
+        char param[SICS_PARAM_SIZE];
+        char value[SICS_VALUE_SIZE] = "";
+        if (sscanf((char *) line, "^SICS: %d,\"%15[^\"]\",\"%63[^\"]\"", &id, param, value) >= 2) {
+            if (id < 0 || id > MAX_conProfileId) {
+                continue;
+            }
+            if (strcmp(param, "conType") == 0) {
+                profiles[id].gprs0 = (strcmp(value, "GPRS0") == 0);
+            } else if (strcmp(param, "apn") == 0) {
+                profiles[id].apn = (strcmp(value, CON_PROFILE_APN) == 0);
+            } else if (strcmp(param, "inactTO") == 0 && value[0] != '\0') {
+                profiles[id].inactTO = atoi(value);
+            }
+        } else if (strncmp((char *) line, (char *) AT_RES_OK, strlen((char *) AT_RES_OK)) == 0) {
+            return true;
+        } else if (strstr((char *) line, (char *) AT_RES_ERROR) != NULL) {
+            return false;
+        }
+    }
+    return false;
+}
 
-    for (conProfileId_cand = 0; conProfileId_cand <= MAX_conProfileId; conProfileId_cand++) {
-        memset(command_to_send_buffer, '\0',MAX_INCOMING_BUF_SIZE);
+/**
+ * Writes the settings of a connection profile that differ from the wanted ones.
+ * @param id conProfileId
+ * @param settings current settings of the profile
+ * @param inact_time_sec wanted inactTO
+ * @return true if the profile holds the wanted settings.
+ */
+static bool writeConnectionProfile(int id, const CON_PROFILE_SETTINGS * settings, int inact_time_sec) {
+    const char * sics = (const char *) &AT_CMD_SICS_WRITE_PRFX[2];
+    AT_BATCH batch;
+    atBatchBegin(&batch);
 
+    if (!settings->gprs0) {
         // AT^SICS=0,conType,GPRS0
-        int cmd_size = sprintf(command_to_send_buffer, "%s%d,conType,GPRS0%s", AT_CMD_SICS_WRITE_PRFX, conProfileId_cand, AT_CMD_SUFFIX);
-        sendATcommand(command_to_send_buffer, cmd_size);
+        atBatchAdd(&batch, "%s%d,conType,GPRS0", sics, id);
+    }
 
-        if (!waitForOK()) {
-            continue;
-        }
+    if (settings->inactTO != inact_time_sec) {
+        // AT^SICS=0,"inactTO", "20"
+        atBatchAdd(&batch, "%s%d,\"inactTO\", \"%d\"", sics, id, inact_time_sec);
+    }
 
-        memset(command_to_send_buffer, '\0', MAX_INCOMING_BUF_SIZE);
+    if (!settings->apn) {
+        // AT^SICS=0,apn,"postm2m.lu"
+        atBatchAdd(&batch, "%s%d,apn,\"%s\"", sics, id, CON_PROFILE_APN);
+    }
+    return atBatchEnd(&batch);
+}
 
-        // AT^SICS=0,"inactTO", "20"
-        cmd_size = sprintf(command_to_send_buffer, "%s%d,\"inactTO\", \"%d\"%s",
-                           AT_CMD_SICS_WRITE_PRFX, conProfileId_cand, inact_time_sec, AT_CMD_SUFFIX);
-        sendATcommand(command_to_send_buffer, cmd_size);
+/**
+ * Initialize an internet connection profile (AT^SICS) with inactTO=inact_time_sec and conType= GPRS0
+ * and apn="postm2m.lu". A profile that already holds these settings is reused, otherwise
+ * only the settings that differ are written. Once set up, later calls send nothing.
+ * @param inact_time_sec
+ * @return true if inet connection profile set successfully, false otherwise
+ */
+bool CellularSetupInternetConnectionProfile(int inact_time_sec) {
+    CON_PROFILE_SETTINGS profiles[MAX_conProfileId + 1];
 
-        if (!waitForOK()) {
-            continue;
-        }
+    if (conProfileId != -1 && conProfileInactTO == inact_time_sec) {
+        return true;
+    }
 
-        memset(command_to_send_buffer, '\0', MAX_INCOMING_BUF_SIZE);
+    // if the read back fails all settings count as different and get written
+    readConnectionProfiles(profiles);
 
-        // AT^SICS=0,apn,"postm2m.lu"
-        cmd_size = sprintf(command_to_send_buffer, "%s%d,apn,\"postm2m.lu\"%s",
-                           AT_CMD_SICS_WRITE_PRFX, conProfileId_cand, AT_CMD_SUFFIX);
-        sendATcommand(command_to_send_buffer, cmd_size);
+    for (int id = 0; id <= MAX_conProfileId; id++) {
+        if (profiles[id].gprs0 && profiles[id].apn && profiles[id].inactTO == inact_time_sec) {
+            conProfileId = id;
+            conProfileInactTO = inact_time_sec;
+            return true;
+        }
+    }
 
-        if (waitForOK()) {
-            conProfileId = conProfileId_cand;
+    for (int id = 0; id <= MAX_conProfileId; id++) {
+        if (writeConnectionProfile(id, &profiles[id], inact_time_sec)) {
+            conProfileId = id;
+            conProfileInactTO = inact_time_sec;
             return true;
         }
     }
@@ -728,6 +1710,43 @@ bool CellularSetupInternetConnectionProfile(int inact_time_sec) {
     return false;
 }
 
+/**
+ * Takes a free service profile of the HTTP pool.
+ * @return the srvProfileId, -1 if all are in use.
+ */
+static int httpPoolAcquire(void) {
+    for (int id = HTTP_POOL_FIRST_PROFILE; id < HTTP_POOL_FIRST_PROFILE + HTTP_POOL_SIZE; id++) {
+        if (!services[id].in_use) {
+            services[id].in_use = true;
+            lastSrvProfileId = id;
+            return id;
+        }
+    }
+    if (DEBUG) { printf("no free HTTP service profile\n"); }
+    return -1;
+}
+
+/**
+ * Closes a service of the HTTP pool and gives it back.
+ * @param srvProfileId
+ * @return false if AT^SISC failed.
+ */
+static bool httpPoolRelease(int srvProfileId) {
+    bool closed = inetServiceClose(srvProfileId);
+    services[srvProfileId].in_use = false;
+    return closed;
+}
+
+/**
+ * Reads the response of a request and gives its service back to the pool.
+ * @return as inetServiceReadResponse.
+ */
+static int httpFinish(int srvProfileId, char *response, int response_max_len) {
+    int len = inetServiceReadResponse(srvProfileId, response, response_max_len);
+    services[srvProfileId].in_use = false;
+    return len;
+}
+
 /**
  * Send an HTTP POST request. Opens and closes the socket.
  * @param URL is the complete address of the page we are posting to, e.g. “https://helloworld.com/mystuf/thispagewillreceivemypost?andadditional=stuff”
@@ -742,50 +1761,151 @@ int CellularSendHTTPPOSTRequest(char *URL, char *payload, int payload_len, char
     // sanity check: conProfileId exists
     if (conProfileId == -1) { return -1;}
 
-    srvProfileId = HTTP_POST_srvProfileId;
+    int srvProfileId = httpPoolAcquire();
+    if (srvProfileId == -1) {
+        return -1;
+    }
 
-    if (!inetServiceSetupProfile(srvProfileId, URL, payload, payload_len)) {
+    if (!inetServiceSetupProfile(srvProfileId, URL, payload, payload_len, NULL) ||
+        !inetServiceOpen(srvProfileId)) {
+        httpPoolRelease(srvProfileId);
         return -1;
     }
 
-    if (!inetServiceOpen(srvProfileId)) {
+    return httpFinish(srvProfileId, response, response_max_len);
+}
+
+int CellularSendHTTPPOSTBinary(char *URL, const uint8_t *data, int data_len, const char *content_type,
+                               char *response, int response_max_len) {
+    int request = CellularHTTPPOSTBinaryStart(URL, data, data_len, content_type);
+    if (request == -1) {
         return -1;
     }
+    return CellularHTTPPOSTFinish(request, response, response_max_len);
+}
 
+int CellularHTTPPOSTBinaryStart(char *URL, const uint8_t *data, int data_len, const char *content_type) {
+    // sanity check: conProfileId exists
+    if (conProfileId == -1) { return -1;}
 
-    // ready to read
-    char * urc_read_buff = "";
-    unsigned char * tokens_array[10] = {};
+    int srvProfileId = httpPoolAcquire();
+    if (srvProfileId == -1) {
+        return -1;
+    }
 
-    // AT^SISR=6,20
-    int cmd_size = sprintf(command_to_send_buffer, "%s%d,%d%s", AT_CMD_SISR_WRITE_PRFX, srvProfileId, response_max_len, AT_CMD_SUFFIX);
-    sendATcommand(command_to_send_buffer, cmd_size);
+    // no hcContent, the body is written after opening
+    if (!inetServiceSetupProfile(srvProfileId, URL, NULL, data_len, content_type) ||
+        !inetServiceOpenForWrite(srvProfileId) ||
+        !inetServiceWrite(srvProfileId, data, data_len)) {
+        httpPoolRelease(srvProfileId);
+        return -1;
+    }
 
-    // OK or ERROR
-    // ^SISR: 6,16
-    // {"success":true}
-    // OK
-    //
-    // ^SISR: 6,2
+    // the request went out once hcContLen bytes were written, ^SISR: 6,1 when the response is in
+    return srvProfileId;
+}
 
-    int received_urcs = getSISURCs(tokens_array, 4, 10, GENERAL_RECV_DLY_TIMEOUT_MS);
-    if (!parseSISURCs(tokens_array, received_urcs, urc_read_buff)) {
+int CellularHTTPPOSTFinish(int request, char *response, int response_max_len) {
+    if (request < HTTP_POOL_FIRST_PROFILE || request >= HTTP_POOL_FIRST_PROFILE + HTTP_POOL_SIZE ||
+        !services[request].in_use) {
         return -1;
     }
+    return httpFinish(request, response, response_max_len);
+}
 
-    if (!inetServiceClose(srvProfileId)) {
+bool CellularSocketOpen(int srvProfileId, const char *address) {
+    if (conProfileId == -1 || srvProfileId < 0 || srvProfileId > MAX_srvProfileId) {
+        return false;
+    }
+    if (srvProfileId >= HTTP_POOL_FIRST_PROFILE && srvProfileId < HTTP_POOL_FIRST_PROFILE + HTTP_POOL_SIZE) {
+        if (DEBUG) { printf("service profile %d belongs to the HTTP pool\n", srvProfileId); }
+        return false;
+    }
+
+    // a profile left open or down by a lost connection must be closed before it opens again
+    inetServiceClose(srvProfileId);
+    services[srvProfileId].connected = false;
+
+    if (!inetServiceSetupSocket(srvProfileId, address)) {
+        return false;
+    }
+    // ^SISW: 1,1 once the connection is up
+    if (!inetServiceOpenForWrite(srvProfileId)) {
+        inetServiceClose(srvProfileId);
+        return false;
+    }
+    services[srvProfileId].connected = true;
+    return true;
+}
+
+bool CellularSocketIsOpen(int srvProfileId) {
+    if (srvProfileId < 0 || srvProfileId > MAX_srvProfileId) {
+        return false;
+    }
+    pollURCs();
+    return services[srvProfileId].connected;
+}
+
+bool CellularSocketWrite(int srvProfileId, const uint8_t *data, int len) {
+    if (!CellularSocketIsOpen(srvProfileId)) {
+        return false;
+    }
+    if (!inetServiceWrite(srvProfileId, data, len)) {
+        services[srvProfileId].connected = false;
+        return false;
+    }
+    return true;
+}
+
+int CellularSocketRead(int srvProfileId, uint8_t *buf, int maxlen, unsigned int timeout_ms) {
+    unsigned int time_left_ms = timeout_ms;
+
+    if (srvProfileId < 0 || srvProfileId > MAX_srvProfileId) {
         return -1;
     }
+    pollURCs();
 
+    if (!inetServiceWaitForData(srvProfileId, &time_left_ms)) {
+        return services[srvProfileId].connected ? 0 : -1;
+    }
+    // AT^SISR=1,<maxlen>
+    return inetServiceReadChunk(srvProfileId, buf, maxlen);
+}
 
-    // all went fine
-    strncpy(response, urc_read_buff, response_max_len);
+int CellularServiceRead(int srvProfileId, CELLULAR_DATA_HANDLER handler, void *context, unsigned int timeout_ms) {
+    // not on the stack, the read path below already holds a few KB of line buffers
+    static uint8_t chunk[SISW_MAX_CHUNK];
+    unsigned int time_left_ms = timeout_ms;
+    int total = 0;
 
-    if (response_max_len < strlen(urc_read_buff)) {
-        return response_max_len;
-    } else {
-        return strlen(urc_read_buff);
+    if (srvProfileId < 0 || srvProfileId > MAX_srvProfileId) {
+        return -1;
     }
+
+    // every ^SISR: <srvProfileId>,1 gives data until a short read emptied the modem's buffer
+    while (inetServiceWaitForData(srvProfileId, &time_left_ms)) {
+        int count = inetServiceReadChunk(srvProfileId, chunk, SISW_MAX_CHUNK);
+        if (count < 0) {
+            return -1;
+        }
+        if (count > 0) {
+            handler(chunk, count, context);
+            total += count;
+        }
+    }
+
+    if (services[srvProfileId].error || (!services[srvProfileId].data_finished && total == 0)) {
+        return -1;
+    }
+    return total;
+}
+
+void CellularSocketClose(int srvProfileId) {
+    if (srvProfileId < 0 || srvProfileId > MAX_srvProfileId) {
+        return;
+    }
+    inetServiceClose(srvProfileId);
+    services[srvProfileId].connected = false;
 }
 
 /**
@@ -796,44 +1916,62 @@ int CellularSendHTTPPOSTRequest(char *URL, char *payload, int payload_len, char
  * @return
  */
 int CellularGetLastError(char *errmsg, int errmsg_max_len) {
+    if (lastSrvProfileId == -1) {
+        return -1;
+    }
 
     // AT^SISE=<srvProfileId>
     int cmd_size = sprintf(command_to_send_buffer, "%s%d%s",
-                           AT_CMD_SISE_WRITE_PRFX, srvProfileId, AT_CMD_SUFFIX);
+                           AT_CMD_SISE_WRITE_PRFX, lastSrvProfileId, AT_CMD_SUFFIX);
     // send command and check response OK/ERROR
     sendATcommand(command_to_send_buffer, cmd_size);
 
-    char * urc_read_buff = "";
     unsigned char * tokens_array[10] = {};
     // response:
     // ^SISE: <srvProfileId>, <infoID>[, <info>]
+    errmsg[0] = '\0';
     int received_urcs = getSISURCs(tokens_array, 2, 10, GENERAL_RECV_DLY_TIMEOUT_MS);
-    if (!parseSISURCs(tokens_array, received_urcs, urc_read_buff)) {
+    if (!parseSISURCs(tokens_array, received_urcs, errmsg, errmsg_max_len)) {
         return -1;
     }
 
     // all went fine
-    strncpy(errmsg, urc_read_buff, errmsg_max_len);
+    return strlen(errmsg);
+}
 
-    if (errmsg_max_len < strlen(urc_read_buff)) {
-        return errmsg_max_len;
-    } else {
-        return strlen(urc_read_buff);
-    }
+void CellularGetLinkStats(CELLULAR_LINK_STATS *stats) {
+    SERIAL_STATS serial_stats;
+    SerialGetStatsCellular(&serial_stats);
+
+    stats->baud = serial_stats.baud;
+    stats->flow_control = serial_stats.flow_control;
+    stats->rx_bytes = serial_stats.rx_bytes;
+    stats->tx_bytes = serial_stats.tx_bytes;
+    stats->stalls = serial_stats.stalls;
+    stats->overruns = serial_stats.overruns;
+    // a long reception that took no measurable time came at least at 1 byte/ms
+    stats->throughput = (serial_stats.burst_bytes == 0) ? 0 :
+            (uint32_t) ((uint64_t) serial_stats.burst_bytes * 1000 / (serial_stats.burst_ms > 0 ? serial_stats.burst_ms : 1));
 }
 
 /**
- * Will send AT+CCID cmd and parse the response to return the sim ICCID
+ * Copies the sim ICCID from the identity cache, reading it first if needed.
  * @param iccid buffer to storce ICCID
  * @return ICCID length
  */
 int CellularGetICCID(char * iccid) {
-    //AT+CCID?
-    int cmd_size = sprintf(command_to_send_buffer, "%s%s", AT_CMD_CCID_READ, AT_CMD_SUFFIX);
-    // send command and check response OK/ERROR
-    sendATcommand(command_to_send_buffer, cmd_size);
+    if (!SIM_IDENTITY_VALID) {
+        readIdentity();
+    }
+    if (!SIM_IDENTITY_VALID) {
+        return 0;
+    }
+    strcpy(iccid, identity.iccid);
+    return strlen(iccid);
+}
 
-    return resolveCCIDresult(iccid);
+const CELLULAR_IDENTITY * CellularGetIdentity(void) {
+    return readIdentity() ? &identity : NULL;
 }
 
 /**
@@ -842,24 +1980,47 @@ int CellularGetICCID(char * iccid) {
  * @param num_of_ops num of operators in array
  * @param unix_time unix time provided from gps
  * @param cell_payload buffer to store payload into.
- * @return length of payload copied to buffer.
+ * @param maxlen size of cell_payload.
+ * @return length of payload copied to buffer, -1 if it does not fit.
  */
-int CellularGetPayload(OPERATOR_INFO *opList, int num_of_ops, char * iccid, char * unix_time, char * cell_payload) {
-
-    char operators_payload[300] = "";
-
+int CellularGetPayload(OPERATOR_INFO *opList, int num_of_ops, char * iccid, char * unix_time, char * cell_payload, uint32_t maxlen) {
+    PAYLOAD_BUILDER builder;
+    PayloadInit(&builder, cell_payload, maxlen);
+
+    //cellular,name=..,ICCID=8935201641400948300 opt1name=42501,opt1csq=17,opt2name=42502,opt2csq=5 1557086230000000000
+    PayloadLineStart(&builder, "cellular");
+    PayloadTag(&builder, "name", TELEMETRY_DEVICE_NAME);
+    PayloadTag(&builder, "ICCID", iccid);
     for (int op_idx = 0; op_idx < num_of_ops; op_idx++) {
-        char current_op[30] = "";
-        sprintf(current_op, "opt%dname=%d,opt%dcsq=%d",
-                op_idx+1, opList[op_idx].operatorCode, op_idx+1, opList[op_idx].csq);
-
-        strcat(operators_payload, current_op);
-        if (op_idx != num_of_ops -1) {
-            strcat(operators_payload, ",");
-        }
+        PayloadFieldIndexedInt(&builder, "opt", op_idx + 1, "name", opList[op_idx].operatorCode);
+        PayloadFieldIndexedInt(&builder, "opt", op_idx + 1, "csq", opList[op_idx].csq);
     }
+    PayloadLineEnd(&builder, unix_time);
+    return PayloadGetLength(&builder);
+}
 
-    //8935201641400948300 opt1name= 42501,opt1csq=17,opt2name=42502,opt2csq=5,opt3name=42503,opt3csq=28 1557086230000000000
-    int payload_len = sprintf(cell_payload, CELL_PAYLOAD_FORMAT, iccid, operators_payload, unix_time);
-    return payload_len;
+int CellularGetCBORPayload(OPERATOR_INFO *opList, int num_of_ops, char * iccid, uint32_t unix_time, uint8_t * buf, uint32_t maxlen) {
+    CBOR_WRITER writer;
+    CborInit(&writer, buf, maxlen);
+
+    // {"m": "cellular", "name": .., "ICCID": .., "t": .., "ops": [{"name": 42501, "csq": 17}, ..]}
+    CborMap(&writer, 5);
+    CborText(&writer, "m");
+    CborText(&writer, "cellular");
+    CborText(&writer, "name");
+    CborText(&writer, TELEMETRY_DEVICE_NAME);
+    CborText(&writer, "ICCID");
+    CborText(&writer, iccid);
+    CborText(&writer, "t");
+    CborUint(&writer, unix_time);
+    CborText(&writer, "ops");
+    CborArray(&writer, num_of_ops);
+    for (int op_idx = 0; op_idx < num_of_ops; op_idx++) {
+        CborMap(&writer, 2);
+        CborText(&writer, "name");
+        CborInt(&writer, opList[op_idx].operatorCode);
+        CborText(&writer, "csq");
+        CborInt(&writer, opList[op_idx].csq);
+    }
+    return CborGetLength(&writer);
 }
@@ -10,6 +10,8 @@
 #include <stdint.h>
 #include <string.h>
 #include <stdlib.h>
+#include "cbor.h"
+#include "payload.h"
 
 extern bool DEBUG;
 
@@ -24,10 +26,78 @@ typedef struct __OPERATOR_INFO {
     int csq;
 } OPERATOR_INFO;
 
-#define MODEM_BAUD_RATE 115200
+#define MODEM_BAUD_RATE 115200         // the modem's rate at power up, negotiated up from there
+#define MODEM_MAX_BAUD_RATE 921600
+#define MODEM_FLOW_CONTROL true         // RTS/CTS are wired to the modem
 #define WAIT_BETWEEN_CMDS_MS 100
 #define ICCID_BUFFER_SIZE 23
-#define CELL_PAYLOAD_FORMAT "--data-binary cellular,name=NetanelFayoumi_SapirElyovitch,ICCID=%s %s %s000000000"
+#define IMSI_BUFFER_SIZE 16
+#define IMEI_BUFFER_SIZE 16
+#define FIRMWARE_BUFFER_SIZE 32
+/* Service profiles the HTTP requests take turns on, sockets must use the others */
+#define HTTP_POOL_FIRST_PROFILE 6
+#define HTTP_POOL_SIZE 3
+
+/* Identity of the modem and SIM, read once and kept while powered */
+typedef struct __CELLULAR_IDENTITY {
+    char iccid[ICCID_BUFFER_SIZE];
+    char imsi[IMSI_BUFFER_SIZE];
+    char imei[IMEI_BUFFER_SIZE];
+    char firmware[FIRMWARE_BUFFER_SIZE];    // AT+CGMR revision
+} CELLULAR_IDENTITY;
+
+#define REGISTRATION_UNKNOWN -1
+
+/* Network registration as reported by +CREG URCs (AT+CREG=2) */
+typedef struct __CELLULAR_REGISTRATION {
+    int status;         // <regStatus> of +CREG, REGISTRATION_UNKNOWN after an operator change
+    uint16_t lac;       // location area code of the serving cell
+    uint32_t cell_id;
+    uint32_t updates;   // number of +CREG lines seen
+} CELLULAR_REGISTRATION;
+
+/* Modem link counters, see CellularGetLinkStats */
+typedef struct __CELLULAR_LINK_STATS {
+    unsigned int baud;
+    bool flow_control;
+    uint32_t rx_bytes;
+    uint32_t tx_bytes;
+    uint32_t throughput;    // bytes/s of long receptions, 0 until one was seen
+    uint32_t stalls;        // times RTS held the modem off
+    uint32_t overruns;      // bytes lost to a full receive buffer
+} CELLULAR_LINK_STATS;
+
+/* How the modem spends the time between uploads, see CellularSetPowerPolicy */
+typedef struct __CELLULAR_POWER_POLICY {
+    bool sleep;         // AT^SPOW power saving while idle, the next command wakes the modem
+    bool edrx;          // ask the network for eDRX paging, POWER_EDRX_VALUE
+    bool psm;           // ask the network for PSM, POWER_PSM_TAU and POWER_PSM_ACTIVE_TIME
+    uint32_t idle_ms;   // how long the application waits after an upload before CellularSleep
+} CELLULAR_POWER_POLICY;
+
+/* From the shortest upload latency to the longest battery life */
+#define POWER_POLICY_ALWAYS_ON {false, false, false, 0}
+#define POWER_POLICY_SLEEP {true, false, false, 2000}
+#define POWER_POLICY_DEEP_SLEEP {true, true, true, 0}
+
+#define POWER_EDRX_ACT 4                // E-UTRAN
+#define POWER_EDRX_VALUE "0101"         // 81.92 s paging cycle
+#define POWER_PSM_TAU "00100001"        // periodic TAU, 1 hour
+#define POWER_PSM_ACTIVE_TIME "00000101"    // reachable for 10 s after each activity
+
+/* Modem power counters, see CellularGetPowerStats */
+typedef struct __CELLULAR_POWER_STATS {
+    uint32_t sleeps;
+    uint32_t wakes;
+    uint32_t failed_wakes;  // the modem did not answer within POWER_WAKE_TRIES probes
+    uint32_t last_wake_ms;  // wake-to-ready latency of the last wake
+    uint32_t max_wake_ms;
+    uint32_t total_wake_ms; // of all wakes, for the average
+    uint32_t asleep_ms;     // time spent asleep, the current sleep included
+} CELLULAR_POWER_STATS;
+
+/* Gets the data of a service as it is read, see CellularServiceRead */
+typedef void (*CELLULAR_DATA_HANDLER)(const uint8_t * data, int len, void * context);
 
 
 /**************************************************************************//**
@@ -48,6 +118,46 @@ void CellularInit(char *port);
  */
 void CellularDisable();
 
+/**
+ * Switches the modem link to 27.010 multiplexing (AT+CMUX). Commands then
+ * run on the AT channel, where the URCs come in, except for AT+CSQ / AT+CREG?
+ * on the status channel and AT^SISW / AT^SISR with their data on the data
+ * channel. Status queries no longer wait behind service data, and no URC
+ * ends up in the middle of the data. Call after CellularInit.
+ * @return true if multiplexing, false if the link stays a single stream.
+ */
+bool CellularEnableMux(void);
+
+/**
+ * Sets how the modem saves power between uploads. eDRX and PSM are asked
+ * from the network now (or turned off), they take effect once it grants
+ * them. Sleeping is up to CellularSleep.
+ * @param policy POWER_POLICY_* or one of its own
+ * @return false if the modem refused eDRX or PSM, the rest of the policy applies
+ */
+bool CellularSetPowerPolicy(const CELLULAR_POWER_POLICY *policy);
+
+/**
+ * Puts the modem into power saving (AT^SPOW) until the next command, if the
+ * policy sleeps. Any command wakes it first, the wake-to-ready latency is
+ * tracked. Not while multiplexing, the channels keep the link busy.
+ * @return true if the modem sleeps now
+ */
+bool CellularSleep(void);
+
+/**
+ * Wakes the modem now instead of on the next command, e.g. ahead of an
+ * upload so the wake overlaps other work.
+ * @return true if the modem is awake and answers
+ */
+bool CellularWake(void);
+
+/**
+ * Gets the sleep and wake counters, the wake latencies among them.
+ * @param stats to be filled
+ */
+void CellularGetPowerStats(CELLULAR_POWER_STATS *stats);
+
 /**
  * Checks if the modem is responding to AT commands.
  * @return Return true if it does, returns false otherwise.
@@ -64,6 +174,29 @@ bool CellularCheckModem(void);
  */
 bool CellularGetRegistrationStatus(int *status);
 
+/**
+ * Gets the registration state. It is updated by every +CREG URC the driver
+ * reads, without sending commands.
+ * @return the registration state.
+ */
+const CELLULAR_REGISTRATION * CellularGetRegistration(void);
+
+/**
+ * Checks whether the modem sent something that was not read yet, e.g. a
+ * URC. EVENT_CELLULAR_RX is posted once such data arrives.
+ * @return true if there is unread data.
+ */
+bool CellularHasData(void);
+
+/**
+ * Waits until the modem is registered to home network (1) or roaming (5).
+ * Returns as soon as the +CREG URC arrives. The status is asked with AT+CREG?
+ * only if no URC came since the last operator change.
+ * @param timeout_ms - deadline, 0 to check without waiting.
+ * @return true if registered.
+ */
+bool CellularWaitForRegistration(unsigned int timeout_ms);
+
 /**
  * @param csq
  * @return Returns false if the modem did not respond or responded with an error
@@ -111,15 +244,114 @@ bool CellularSetupInternetConnectionProfile(int inact_time_sec);
 
 /**
  * Send an HTTP POST request. Opens and closes the socket.
+ * The whole response body is read, in as many AT^SISR reads as it takes.
  * @param URL
  * @param payload
  * @param payload_len
+ * @param response gets the body, '\0' terminated if it has room left
+ * @param response_max_len what does not fit is read and dropped
+ * @return The return value indicates the number of read bytes in response.
+ *         If there is any kind of error, return -1.
+ */
+int CellularSendHTTPPOSTRequest(char *URL, char *payload, int payload_len, char *response, int response_max_len);
+
+/**
+ * Send an HTTP POST request with a binary body, written to the modem with
+ * AT^SISW. Opens and closes the socket.
+ * @param URL
+ * @param data
+ * @param data_len
+ * @param content_type e.g. CBOR_CONTENT_TYPE, sent as the Content-Type header
  * @param response
  * @param response_max_len
  * @return The return value indicates the number of read bytes in response.
  *         If there is any kind of error, return -1.
  */
-int CellularSendHTTPPOSTRequest(char *URL, char *payload, int payload_len, char *response, int response_max_len);
+int CellularSendHTTPPOSTBinary(char *URL, const uint8_t *data, int data_len, const char *content_type,
+                               char *response, int response_max_len);
+
+/**
+ * Starts an HTTP POST with a binary body on a free service profile of the
+ * pool: sets it up, opens it and writes the body. While the server answers,
+ * further requests can be started on the other profiles of the pool.
+ * @param URL
+ * @param data written to the modem before returning, may be reused then
+ * @param data_len
+ * @param content_type e.g. CBOR_CONTENT_TYPE, sent as the Content-Type header
+ * @return the request, for CellularHTTPPOSTFinish. -1 on error or if all
+ *         HTTP_POOL_SIZE profiles are in use.
+ */
+int CellularHTTPPOSTBinaryStart(char *URL, const uint8_t *data, int data_len, const char *content_type);
+
+/**
+ * Reads the response of a request started with CellularHTTPPOSTBinaryStart,
+ * closes its service and gives the profile back to the pool.
+ * @param request
+ * @param response
+ * @param response_max_len
+ * @return as CellularSendHTTPPOSTBinary.
+ */
+int CellularHTTPPOSTFinish(int request, char *response, int response_max_len);
+
+/**
+ * Opens a socket service (AT^SISS SrvType "Socket") and keeps it open for
+ * CellularSocketWrite. The internet connection profile must be set up.
+ * A UDP socket sends each write as one datagram and reads one per read.
+ * @param srvProfileId service profile to use, 0..9 but not one of the HTTP pool
+ * @param address "socktcp://host:port" or "sockudp://host:port"
+ * @return true once the connection is up.
+ */
+bool CellularSocketOpen(int srvProfileId, const char *address);
+
+/**
+ * Checks whether a socket service is still connected. A connection lost or
+ * closed by the peer is reported by ^SIS / ^SISW URCs, which are read first.
+ * @param srvProfileId
+ * @return true if connected.
+ */
+bool CellularSocketIsOpen(int srvProfileId);
+
+/**
+ * Writes data to an open socket service with AT^SISW.
+ * @param srvProfileId
+ * @param data
+ * @param len
+ * @return true if all of data was written, false if the socket is closed
+ *         or broke, then CellularSocketOpen connects it again.
+ */
+bool CellularSocketWrite(int srvProfileId, const uint8_t *data, int len);
+
+/**
+ * Reads data that arrived on a socket service. Waits for the
+ * "^SISR: <srvProfileId>,1" URC, then reads with AT^SISR.
+ * @param srvProfileId
+ * @param buf
+ * @param maxlen at most 1500 bytes are read at a time
+ * @param timeout_ms time to wait for data, 0 to only check
+ * @return number of bytes read, 0 if none arrived, -1 if the socket is closed or on error.
+ */
+int CellularSocketRead(int srvProfileId, uint8_t *buf, int maxlen, unsigned int timeout_ms);
+
+/**
+ * Reads all data of an open service, e.g. an HTTP response or what a socket
+ * peer sends until it closes. Every "^SISR: <srvProfileId>,1" URC starts
+ * AT^SISR reads that go on until the modem's buffer is empty. Stops on
+ * "^SISR: <srvProfileId>,2" (end of data), a closed socket, an error or
+ * the timeout.
+ * @param srvProfileId
+ * @param handler gets the data, chunk by chunk, as it is read. It must not
+ * call CellularServiceRead, the chunk buffer is shared
+ * @param context passed to handler
+ * @param timeout_ms time to wait for all of the data
+ * @return number of bytes read, -1 on error or if no data came before the timeout.
+ */
+int CellularServiceRead(int srvProfileId, CELLULAR_DATA_HANDLER handler, void *context, unsigned int timeout_ms);
+
+/**
+ * Closes a socket service.
+ * @param srvProfileId
+ */
+void CellularSocketClose(int srvProfileId);
 
 /**
  * Returns additional information on the last error occurred during CellularSendHTTPPOSTRequest.
@@ -130,23 +362,53 @@ int CellularSendHTTPPOSTRequest(char *URL, char *payload, int payload_len, char
  */
 int CellularGetLastError(char *errmsg, int errmsg_max_len);
 
+/**
+ * Gets the rate and counters of the modem link. CellularInit finds the
+ * modem at the rate it kept, MODEM_BAUD_RATE after the first power up, and
+ * moves it up to MODEM_MAX_BAUD_RATE where the modem and the wiring allow.
+ * @param stats to be filled
+ */
+void CellularGetLinkStats(CELLULAR_LINK_STATS *stats);
+
 
 /**
- * Will send AT+CCID cmd and parse the response to return the sim ICCID
+ * Copies the sim ICCID from the identity cache. AT+CCID is only sent when
+ * the cache is empty, e.g. after the SIM changed.
  * @param iccid buffer to storce ICCID
  * @return ICCID length
  */
 int CellularGetICCID(char * iccid);
 
+/**
+ * Gets the modem and SIM identity. It is read at CellularInit, the SIM part
+ * again after a ^SCKS URC reported the SIM removed or inserted.
+ * @return the identity, NULL if the modem did not answer.
+ */
+const CELLULAR_IDENTITY * CellularGetIdentity(void);
+
 /**
  *
  * @param opList OPERATOR_INFO array of successfully registerd operators.
  * @param num_of_ops num of operators in array
  * @param unix_time unix time provided from gps
  * @param cell_payload buffer to store payload into.
- * @return length of payload copied to buffer.
+ * @param maxlen size of cell_payload.
+ * @return length of payload copied to buffer, -1 if it does not fit.
+ */
+int CellularGetPayload(OPERATOR_INFO *opList, int num_of_ops, char * iccid, char * unix_time, char * cell_payload, uint32_t maxlen);
+
+/**
+ * Writes the operators as a CBOR map, the fields of the CellularGetPayload
+ * line with the operators in an array of {name, csq} maps.
+ * @param opList OPERATOR_INFO array of successfully registerd operators.
+ * @param num_of_ops num of operators in array
+ * @param iccid SIM ICCID
+ * @param unix_time unix time provided from gps
+ * @param buf buffer to store payload into.
+ * @param maxlen size of buf.
+ * @return length of payload, -1 if it does not fit.
  */
-int CellularGetPayload(OPERATOR_INFO *opList, int num_of_ops, char * iccid, char * unix_time, char * cell_payload);
+int CellularGetCBORPayload(OPERATOR_INFO *opList, int num_of_ops, char * iccid, uint32_t unix_time, uint8_t * buf, uint32_t maxlen);
 
 
 #endif //IOT_CELLULAR_H
@@ -0,0 +1,382 @@
+/******************************************************************************
+ * @cmux.c
+ * @brief 3GPP 27.010 multiplexer, basic option.
+ * A frame is F9 <address> <control> <length> <information> <FCS> F9, the FCS
+ * a reflected CRC-8 (x^8 + x^2 + x + 1) over address, control and length,
+ * for UI frames over the information too.
+ * Frames that arrive in the RX interrupt only change state there, answers
+ * to them (UA, control channel responses) are sent from the next call of
+ * the main context, so frames never interleave on the link.
+ * @version 0.0.1
+ *  **************************************************************************/
+#include <string.h>
+
+#include "cmux.h"
+
+/******************************************************************************
+ * 								DEFS
+*****************************************************************************/
+#define FLAG 0xF9
+#define EA 0x01
+#define CR 0x02
+#define PF 0x10
+
+// control field, without the P/F bit
+#define SABM 0x2F
+#define UA 0x63
+#define DM 0x0F
+#define DISC 0x43
+#define UIH 0xEF
+#define UI 0x03
+
+// control channel message types, with EA set and C/R clear
+#define MSG_CLD 0xC1
+#define MSG_MSC 0xE1
+#define MSG_MAX_LEN 8
+#define MSC_SIGNALS 0x0D		// EA, RTC and RTR, ready to communicate and receive
+
+#define FCS_INIT 0xFF
+#define FCS_GOOD 0xCF
+#define FRAME_OVERHEAD 7		// flags, address, control, 2 length bytes, FCS
+
+enum DECODER_STATE {WAIT_FLAG, ADDRESS, CONTROL, LENGTH, LENGTH2, DATA, CHECK, END};
+
+typedef struct _CMUX_CHANNEL {
+	uint8_t buf[CMUX_RX_BUFFER_SIZE];
+	volatile uint32_t write_index;
+	uint32_t read_index;
+	volatile bool open;
+} CMUX_CHANNEL;
+
+
+/******************************************************************************
+ * 							GLOBAL VARIABLES
+*****************************************************************************/
+static CMUX_WRITE link_write = NULL;
+static bool initiator = true;	// the side that opened the control channel, its commands have C/R set
+static volatile bool active = false;
+static CMUX_CHANNEL channels[CMUX_NUM_CHANNELS];
+static CMUX_STATS stats;
+
+// frame being decoded
+static enum DECODER_STATE state = WAIT_FLAG;
+static uint8_t frame_address;
+static uint8_t frame_control;
+static uint32_t frame_len;
+static uint32_t frame_index;
+static uint8_t frame_fcs;
+static uint8_t frame_data[CMUX_MAX_FRAME];
+
+// answers due, sent from the main context. A flag per channel, so that
+// clearing one does not rewrite what the interrupt set meanwhile
+static volatile bool ua_due[CMUX_NUM_CHANNELS];
+static volatile bool msc_due[CMUX_NUM_CHANNELS];	// opened by us, MSC command not sent yet
+static uint8_t control_reply[MSG_MAX_LEN];
+static volatile uint32_t control_reply_len;
+static volatile bool stop_due;
+
+
+/******************************************************************************
+ * @brief Adds a byte to a reflected CRC-8.
+ *****************************************************************************/
+static uint8_t fcsAdd(uint8_t fcs, uint8_t byte) {
+	fcs ^= byte;
+	for (int bit = 0; bit < 8; bit++) {
+		fcs = (fcs & 1) ? (uint8_t) ((fcs >> 1) ^ 0xE0) : (uint8_t) (fcs >> 1);
+	}
+	return fcs;
+}
+
+/******************************************************************************
+ * @brief Sends one frame.
+ * @param channel - DLCI.
+ * @param control - control field, with P/F.
+ * @param command - true for a command, false for a response.
+ *****************************************************************************/
+static void writeFrame(uint8_t channel, uint8_t control, bool command, const uint8_t * data, uint32_t len) {
+	uint8_t frame[CMUX_MAX_FRAME + FRAME_OVERHEAD];
+	uint32_t i = 0;
+	uint8_t fcs = FCS_INIT;
+
+	// C/R is set on commands of the initiator and on responses of the other side
+	bool cr = (command == initiator);
+	frame[i++] = FLAG;
+	frame[i++] = (uint8_t) ((channel << 2) | (cr ? CR : 0) | EA);
+	frame[i++] = control;
+	frame[i++] = (uint8_t) ((len << 1) | EA);
+	for (uint32_t j = 1; j < i; j++) {
+		fcs = fcsAdd(fcs, frame[j]);
+	}
+	memcpy(&frame[i], data, len);
+	i += len;
+	frame[i++] = (uint8_t) ~fcs;
+	frame[i++] = FLAG;
+
+	link_write(frame, i);
+	stats.frames_sent++;
+}
+
+/******************************************************************************
+ * @brief Sends the answers that frames received in the interrupt asked for.
+ *****************************************************************************/
+static void sendDue(void) {
+	if (!active) {
+		return;
+	}
+	for (uint8_t channel = 0; channel < CMUX_NUM_CHANNELS; channel++) {
+		// cleared before the answer is sent, one due again meanwhile gets it too
+		if (ua_due[channel]) {
+			ua_due[channel] = false;
+			writeFrame(channel, UA | PF, false, NULL, 0);
+		}
+		if (msc_due[channel]) {
+			// a data channel is ready once both sides sent their V.24 signals
+			uint8_t msc[4] = {MSG_MSC | CR, (2 << 1) | EA, (uint8_t) ((channel << 2) | CR | EA), MSC_SIGNALS};
+			msc_due[channel] = false;
+			writeFrame(CMUX_CHANNEL_CONTROL, UIH, true, msc, sizeof(msc));
+		}
+	}
+	if (control_reply_len > 0) {
+		writeFrame(CMUX_CHANNEL_CONTROL, UIH, false, control_reply, control_reply_len);
+		control_reply_len = 0;
+	}
+	if (stop_due) {
+		// the other side closed the multiplexer
+		stop_due = false;
+		active = false;
+	}
+}
+
+/******************************************************************************
+ * @brief Handles a message of the control channel: commands are answered
+ * with the same message, C/R cleared.
+ *****************************************************************************/
+static void controlMessage(const uint8_t * msg, uint32_t len) {
+	if (len < 2 || !(msg[0] & CR) || len > MSG_MAX_LEN || control_reply_len > 0) {
+		return;
+	}
+	memcpy(control_reply, msg, len);
+	control_reply[0] &= (uint8_t) ~CR;
+	control_reply_len = len;
+	if ((msg[0] & ~CR) == MSG_CLD) {
+		stop_due = true;
+	}
+}
+
+/******************************************************************************
+ * @brief Acts on a complete frame with a good FCS.
+ *****************************************************************************/
+static void handleFrame(void) {
+	uint8_t channel = frame_address >> 2;
+	CMUX_CHANNEL * ch;
+
+	stats.frames_received++;
+	if (channel >= CMUX_NUM_CHANNELS) {
+		return;
+	}
+	ch = &channels[channel];
+
+	switch (frame_control & ~PF) {
+	case SABM:
+		// the first SABM comes from the initiator
+		if (channel == CMUX_CHANNEL_CONTROL && !ch->open) {
+			initiator = false;
+		}
+		ch->open = true;
+		ua_due[channel] = true;
+		break;
+	case UA:
+		// answer to our SABM or DISC
+		if (!ch->open && channel != CMUX_CHANNEL_CONTROL) {
+			msc_due[channel] = true;
+		}
+		ch->open = !ch->open;
+		break;
+	case DM:
+		ch->open = false;
+		break;
+	case DISC:
+		ch->open = false;
+		ua_due[channel] = true;
+		break;
+	case UIH:
+	case UI:
+		if (channel == CMUX_CHANNEL_CONTROL) {
+			controlMessage(frame_data, frame_len);
+			break;
+		}
+		for (uint32_t i = 0; i < frame_len; i++) {
+			uint32_t next = (ch->write_index + 1) % CMUX_RX_BUFFER_SIZE;
+			if (next == ch->read_index) {
+				stats.dropped_bytes += frame_len - i;
+				break;
+			}
+			ch->buf[ch->write_index] = frame_data[i];
+			ch->write_index = next;
+		}
+		break;
+	default:
+		break;
+	}
+}
+
+void CmuxStart(CMUX_WRITE write) {
+	memset(channels, 0, sizeof(channels));
+	memset(&stats, 0, sizeof(stats));
+	link_write = write;
+	initiator = true;
+	state = WAIT_FLAG;
+	memset((void *) ua_due, 0, sizeof(ua_due));
+	memset((void *) msc_due, 0, sizeof(msc_due));
+	control_reply_len = 0;
+	stop_due = false;
+	active = true;
+}
+
+void CmuxStop(void) {
+	if (!active) {
+		return;
+	}
+	sendDue();
+	for (uint8_t channel = CMUX_NUM_CHANNELS - 1; channel > CMUX_CHANNEL_CONTROL; channel--) {
+		if (channels[channel].open) {
+			writeFrame(channel, DISC | PF, true, NULL, 0);
+		}
+	}
+	if (active && channels[CMUX_CHANNEL_CONTROL].open) {
+		uint8_t cld[2] = {MSG_CLD | CR, EA};
+		writeFrame(CMUX_CHANNEL_CONTROL, UIH, true, cld, sizeof(cld));
+	}
+	active = false;
+}
+
+bool CmuxIsActive(void) {
+	return active;
+}
+
+void CmuxOpenChannel(uint8_t channel) {
+	if (!active || channel >= CMUX_NUM_CHANNELS) {
+		return;
+	}
+	sendDue();
+	writeFrame(channel, SABM | PF, true, NULL, 0);
+}
+
+bool CmuxIsOpen(uint8_t channel) {
+	sendDue();
+	return active && channel < CMUX_NUM_CHANNELS && channels[channel].open;
+}
+
+void CmuxReceive(uint8_t byte) {
+	if (!active) {
+		return;
+	}
+
+	switch (state) {
+	case WAIT_FLAG:
+		if (byte == FLAG) {
+			state = ADDRESS;
+		}
+		break;
+	case ADDRESS:
+		// flags between frames
+		if (byte == FLAG) {
+			break;
+		}
+		frame_address = byte;
+		frame_fcs = fcsAdd(FCS_INIT, byte);
+		state = CONTROL;
+		break;
+	case CONTROL:
+		frame_control = byte;
+		frame_fcs = fcsAdd(frame_fcs, byte);
+		state = LENGTH;
+		break;
+	case LENGTH:
+		frame_len = byte >> 1;
+		frame_index = 0;
+		frame_fcs = fcsAdd(frame_fcs, byte);
+		state = (byte & EA) ? ((frame_len > 0) ? DATA : CHECK) : LENGTH2;
+		break;
+	case LENGTH2:
+		frame_len |= (uint32_t) byte << 7;
+		frame_fcs = fcsAdd(frame_fcs, byte);
+		state = (frame_len > 0) ? DATA : CHECK;
+		break;
+	case DATA:
+		if (frame_len > CMUX_MAX_FRAME) {
+			// longer than N1, skipped up to the next flag
+			stats.bad_frames++;
+			state = WAIT_FLAG;
+			break;
+		}
+		if ((frame_control & ~PF) == UI) {
+			frame_fcs = fcsAdd(frame_fcs, byte);
+		}
+		frame_data[frame_index++] = byte;
+		if (frame_index == frame_len) {
+			state = CHECK;
+		}
+		break;
+	case CHECK:
+		frame_fcs = fcsAdd(frame_fcs, byte);
+		state = END;
+		break;
+	case END:
+		if (byte != FLAG) {
+			stats.bad_frames++;
+			state = WAIT_FLAG;
+			break;
+		}
+		if (frame_fcs == FCS_GOOD) {
+			handleFrame();
+		} else {
+			stats.bad_frames++;
+		}
+		// the closing flag may open the next frame
+		state = ADDRESS;
+		break;
+	}
+}
+
+bool CmuxWrite(uint8_t channel, const uint8_t * data, uint32_t len) {
+	if (!CmuxIsOpen(channel)) {
+		return false;
+	}
+	while (len > 0) {
+		uint32_t chunk = (len > CMUX_MAX_FRAME) ? CMUX_MAX_FRAME : len;
+		writeFrame(channel, UIH, true, data, chunk);
+		data += chunk;
+		len -= chunk;
+	}
+	return true;
+}
+
+uint32_t CmuxRead(uint8_t channel, uint8_t * buf, uint32_t maxlen) {
+	uint32_t i = 0;
+	CMUX_CHANNEL * ch;
+
+	sendDue();
+	if (channel >= CMUX_NUM_CHANNELS) {
+		return 0;
+	}
+	ch = &channels[channel];
+	while (i < maxlen && ch->read_index != ch->write_index) {
+		buf[i++] = ch->buf[ch->read_index];
+		ch->read_index = (ch->read_index + 1) % CMUX_RX_BUFFER_SIZE;
+	}
+	return i;
+}
+
+uint32_t CmuxAvailable(uint8_t channel) {
+	if (channel >= CMUX_NUM_CHANNELS) {
+		return 0;
+	}
+	CMUX_CHANNEL * ch = &channels[channel];
+	uint32_t write_index = ch->write_index;
+	return (write_index + CMUX_RX_BUFFER_SIZE - ch->read_index) % CMUX_RX_BUFFER_SIZE;
+}
+
+void CmuxGetStats(CMUX_STATS * out) {
+	*out = stats;
+}
@@ -0,0 +1,109 @@
+/******************************************************************************
+ * @cmux.h
+ * @brief Interface for a 3GPP 27.010 (GSM 07.10) multiplexer in basic mode.
+ * It splits one serial link into virtual channels, each a DLCI with a byte
+ * stream of its own. Frames are decoded byte by byte, e.g. from the RX
+ * interrupt, into a receive buffer per channel. The module has no hardware
+ * dependencies, the bytes to send go through a write function.
+ * Either side of the link may use it: commands (SABM, DISC) are sent by
+ * CmuxOpenChannel and CmuxStop, received ones are answered with UA.
+ * @version 0.0.1
+ *  **************************************************************************/
+#ifndef SRC_CMUX_H_
+#define SRC_CMUX_H_
+
+#include <stdbool.h>
+#include <stdint.h>
+
+/******************************************************************************
+ * 								DEFS
+*****************************************************************************/
+#define CMUX_CHANNEL_CONTROL 0		// DLCI 0, multiplexer control
+#define CMUX_CHANNEL_AT 1			// commands and URCs
+#define CMUX_CHANNEL_DATA 2			// commands that move service data, AT^SISW / AT^SISR
+#define CMUX_CHANNEL_STATUS 3		// network status queries, AT+CSQ / AT+CREG?
+#define CMUX_NUM_CHANNELS 4
+
+#define CMUX_MAX_FRAME 127			// N1, maximum information field, as set with AT+CMUX
+#define CMUX_RX_BUFFER_SIZE 1024	// receive buffer of each channel
+#define CMUX_AT_PREFIX "AT+CMUX=0,0,"	// basic mode, UIH frames, then <port_speed>,<N1>
+
+/* Sends bytes on the underlying link */
+typedef void (*CMUX_WRITE)(const uint8_t * data, uint32_t len);
+
+typedef struct _CMUX_STATS {
+	uint32_t frames_sent;
+	uint32_t frames_received;
+	uint32_t bad_frames;		// wrong FCS or length
+	uint32_t dropped_bytes;		// a channel's receive buffer was full
+} CMUX_STATS;
+
+
+/******************************************************************************
+ * @brief Starts multiplexing, call once the other side switched to it.
+ * All channels start closed.
+ * @param write - sends bytes on the serial link.
+ *****************************************************************************/
+void CmuxStart(CMUX_WRITE write);
+
+/******************************************************************************
+ * @brief Closes the open channels with DISC and the multiplexer with CLD,
+ * then stops decoding.
+ *****************************************************************************/
+void CmuxStop(void);
+
+/******************************************************************************
+ * @return true between CmuxStart and CmuxStop.
+ *****************************************************************************/
+bool CmuxIsActive(void);
+
+/******************************************************************************
+ * @brief Asks the other side to open a channel (SABM). It is open once the
+ * UA answer arrived, see CmuxIsOpen.
+ * @param channel - DLCI, CMUX_CHANNEL_CONTROL first.
+ *****************************************************************************/
+void CmuxOpenChannel(uint8_t channel);
+
+/******************************************************************************
+ * @param channel - DLCI.
+ * @return true if the channel is open.
+ *****************************************************************************/
+bool CmuxIsOpen(uint8_t channel);
+
+/******************************************************************************
+ * @brief Decodes one received byte. Safe to call from an interrupt.
+ * @param byte - next byte of the serial link.
+ *****************************************************************************/
+void CmuxReceive(uint8_t byte);
+
+/******************************************************************************
+ * @brief Sends data on a channel, in UIH frames of up to CMUX_MAX_FRAME bytes.
+ * @param channel - DLCI.
+ * @param data - bytes to send.
+ * @param len - number of bytes.
+ * @return false if the channel is not open.
+ *****************************************************************************/
+bool CmuxWrite(uint8_t channel, const uint8_t * data, uint32_t len);
+
+/******************************************************************************
+ * @brief Takes received bytes of a channel.
+ * @param channel - DLCI.
+ * @param buf - buffer to be filled.
+ * @param maxlen - size of buf.
+ * @return number of bytes copied, 0 if none are waiting.
+ *****************************************************************************/
+uint32_t CmuxRead(uint8_t channel, uint8_t * buf, uint32_t maxlen);
+
+/******************************************************************************
+ * @param channel - DLCI.
+ * @return number of received bytes waiting on the channel.
+ *****************************************************************************/
+uint32_t CmuxAvailable(uint8_t channel);
+
+/******************************************************************************
+ * @brief Gets the frame counters since CmuxStart.
+ * @param stats - to be filled.
+ *****************************************************************************/
+void CmuxGetStats(CMUX_STATS * stats);
+
+#endif /* SRC_CMUX_H_ */
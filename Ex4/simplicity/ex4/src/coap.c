@@ -0,0 +1,370 @@
+/******************************************************************************
+ * @coap.c
+ * @brief Compact CoAP client over a modem UDP socket.
+ * @version 0.0.1
+ *  **************************************************************************/
+#include <stdio.h>
+#include <string.h>
+
+#include "coap.h"
+#include "cellular.h"
+#include "timebase.h"
+
+/******************************************************************************
+ * 								DEFS
+*****************************************************************************/
+#define COAP_VERSION 1
+#define COAP_TYPE_CON 0
+#define COAP_TYPE_NON 1
+#define COAP_TYPE_ACK 2
+#define COAP_TYPE_RST 3
+#define COAP_HEADER_SIZE 4
+#define COAP_TOKEN_SIZE 2
+#define COAP_POST COAP_CODE(0, 2)
+#define COAP_EMPTY 0
+
+#define COAP_OPTION_URI_PATH 11
+#define COAP_OPTION_CONTENT_FORMAT 12
+#define COAP_OPTION_BLOCK1 27
+#define COAP_PAYLOAD_MARKER 0xFF
+#define COAP_OPTION_EXT8 13
+#define COAP_OPTION_EXT16 14
+
+#define COAP_BLOCK_MORE 0x08
+#define COAP_BLOCK_SZX_MASK 0x07
+#define COAP_SEPARATE_TIMEOUT_MS (COAP_ACK_TIMEOUT_MS << COAP_MAX_RETRANSMIT)	// after an empty ACK
+
+/* What the client needs of a received message */
+typedef struct _COAP_MESSAGE {
+	uint8_t type;
+	uint8_t code;
+	uint16_t message_id;
+	uint16_t token;
+	bool has_block1;
+	uint32_t block1;
+} COAP_MESSAGE;
+
+
+/******************************************************************************
+ * 								MESSAGES
+*****************************************************************************/
+
+/******************************************************************************
+ * @brief Message being built into a buffer, fails once it is full.
+ *****************************************************************************/
+typedef struct _COAP_WRITER {
+	uint8_t * buf;
+	uint32_t size;
+	uint32_t len;
+	uint16_t last_option;
+	bool overflow;
+} COAP_WRITER;
+
+static void putBytes(COAP_WRITER * writer, const uint8_t * bytes, uint32_t len) {
+	if (writer->len + len > writer->size) {
+		writer->overflow = true;
+		return;
+	}
+	memcpy(&writer->buf[writer->len], bytes, len);
+	writer->len += len;
+}
+
+/******************************************************************************
+ * @brief Writes an option, options must come in increasing number order.
+ *****************************************************************************/
+static void putOption(COAP_WRITER * writer, uint16_t number, const uint8_t * value, uint16_t len) {
+	uint8_t header[5];
+	uint32_t header_len = 1;
+	uint16_t delta = number - writer->last_option;
+	uint8_t nibbles[2];
+	uint16_t fields[2] = {delta, len};
+
+	// each nibble is the value, or 13 / 14 for one or two extra bytes
+	for (int i = 0; i < 2; i++) {
+		if (fields[i] < COAP_OPTION_EXT8) {
+			nibbles[i] = (uint8_t) fields[i];
+		} else if (fields[i] < 269) {
+			nibbles[i] = COAP_OPTION_EXT8;
+			header[header_len++] = (uint8_t) (fields[i] - COAP_OPTION_EXT8);
+		} else {
+			nibbles[i] = COAP_OPTION_EXT16;
+			header[header_len++] = (uint8_t) ((fields[i] - 269) >> 8);
+			header[header_len++] = (uint8_t) (fields[i] - 269);
+		}
+	}
+	header[0] = (uint8_t) (nibbles[0] << 4 | nibbles[1]);
+	putBytes(writer, header, header_len);
+	putBytes(writer, value, len);
+	writer->last_option = number;
+}
+
+/******************************************************************************
+ * @brief Writes an unsigned option in as few bytes as it needs, 0 in none.
+ *****************************************************************************/
+static void putUintOption(COAP_WRITER * writer, uint16_t number, uint32_t value) {
+	uint8_t bytes[4];
+	uint16_t len = 0;
+	for (int shift = 24; shift >= 0; shift -= 8) {
+		if (len > 0 || (value >> shift) != 0) {
+			bytes[len++] = (uint8_t) (value >> shift);
+		}
+	}
+	putOption(writer, number, bytes, len);
+}
+
+/******************************************************************************
+ * @brief Builds a POST into client->tx.
+ * @param block1 - Block1 option value, -1 for none.
+ * @return length of the message, -1 if it does not fit.
+ *****************************************************************************/
+static int buildPost(COAP_CLIENT * client, uint8_t type, const char * path, uint16_t content_format,
+					 const uint8_t * payload, uint32_t len, int32_t block1) {
+	COAP_WRITER writer = {client->tx, sizeof(client->tx), 0, 0, false};
+	uint8_t header[COAP_HEADER_SIZE + COAP_TOKEN_SIZE] = {
+		(uint8_t) (COAP_VERSION << 6 | type << 4 | COAP_TOKEN_SIZE), COAP_POST,
+		(uint8_t) (client->message_id >> 8), (uint8_t) client->message_id,
+		(uint8_t) (client->token >> 8), (uint8_t) client->token};
+	putBytes(&writer, header, sizeof(header));
+
+	// one Uri-Path option per segment
+	const char * segment = path;
+	while (*segment != '\0') {
+		const char * end = strchr(segment, '/');
+		uint16_t segment_len = (uint16_t) ((end != NULL) ? (uint32_t) (end - segment) : strlen(segment));
+		putOption(&writer, COAP_OPTION_URI_PATH, (const uint8_t *) segment, segment_len);
+		segment += segment_len + ((end != NULL) ? 1 : 0);
+	}
+	putUintOption(&writer, COAP_OPTION_CONTENT_FORMAT, content_format);
+	if (block1 >= 0) {
+		putUintOption(&writer, COAP_OPTION_BLOCK1, (uint32_t) block1);
+	}
+
+	if (len > 0) {
+		uint8_t marker = COAP_PAYLOAD_MARKER;
+		putBytes(&writer, &marker, 1);
+		putBytes(&writer, payload, len);
+	}
+	return writer.overflow ? -1 : (int) writer.len;
+}
+
+/******************************************************************************
+ * @brief Reads the header, token and Block1 option of a message.
+ * @return false if it is no CoAP message.
+ *****************************************************************************/
+static bool parseMessage(const uint8_t * buf, uint32_t len, COAP_MESSAGE * message) {
+	if (len < COAP_HEADER_SIZE || (buf[0] >> 6) != COAP_VERSION) {
+		return false;
+	}
+	uint8_t token_len = buf[0] & 0x0F;
+	message->type = (buf[0] >> 4) & 0x03;
+	message->code = buf[1];
+	message->message_id = ((uint16_t) buf[2] << 8) | buf[3];
+	message->token = 0;
+	message->has_block1 = false;
+	if (token_len > 8 || COAP_HEADER_SIZE + token_len > len) {
+		return false;
+	}
+	for (uint8_t i = 0; i < token_len; i++) {
+		message->token = (uint16_t) (message->token << 8 | buf[COAP_HEADER_SIZE + i]);
+	}
+
+	uint32_t pos = COAP_HEADER_SIZE + token_len;
+	uint16_t number = 0;
+	while (pos < len && buf[pos] != COAP_PAYLOAD_MARKER) {
+		uint16_t fields[2] = {buf[pos] >> 4, buf[pos] & 0x0F};
+		pos++;
+		for (int i = 0; i < 2; i++) {
+			if (fields[i] == COAP_OPTION_EXT8 && pos < len) {
+				fields[i] = COAP_OPTION_EXT8 + buf[pos++];
+			} else if (fields[i] == COAP_OPTION_EXT16 && pos + 1 < len) {
+				fields[i] = 269 + ((uint16_t) buf[pos] << 8 | buf[pos + 1]);
+				pos += 2;
+			} else if (fields[i] > COAP_OPTION_EXT16) {
+				return false;
+			}
+		}
+		number += fields[0];
+		if (pos + fields[1] > len) {
+			return false;
+		}
+		if (number == COAP_OPTION_BLOCK1) {
+			message->has_block1 = true;
+			message->block1 = 0;
+			for (uint16_t i = 0; i < fields[1]; i++) {
+				message->block1 = message->block1 << 8 | buf[pos + i];
+			}
+		}
+		pos += fields[1];
+	}
+	return true;
+}
+
+
+/******************************************************************************
+ * 								CLIENT
+*****************************************************************************/
+
+/******************************************************************************
+ * @brief Timer callback, arg is the client.
+ *****************************************************************************/
+static void retransmitTimer(void * arg) {
+	((COAP_CLIENT *) arg)->retransmit_due = true;
+}
+
+static void startTimer(COAP_CLIENT * client, uint32_t timeout_ms) {
+	client->retransmit_due = false;
+	TimerStart(&client->timer, timeout_ms, 0, retransmitTimer, client);
+}
+
+static bool sendMessage(COAP_CLIENT * client, const uint8_t * message, int len) {
+	if (!CellularSocketIsOpen(client->srv_profile_id) &&
+		!CellularSocketOpen(client->srv_profile_id, client->address)) {
+		return false;
+	}
+	if (!CellularSocketWrite(client->srv_profile_id, message, len)) {
+		return false;
+	}
+	client->stats.bytes += len;
+	return true;
+}
+
+/******************************************************************************
+ * @brief Sends the confirmable message in client->tx and waits for its
+ * response, piggybacked on the ACK or separate after an empty ACK.
+ * @param response - the response.
+ * @return false if it was never acknowledged or was reset.
+ *****************************************************************************/
+static bool exchange(COAP_CLIENT * client, int len, COAP_MESSAGE * response) {
+	uint16_t message_id = client->message_id;
+	uint16_t token = client->token;
+	uint32_t timeout_ms = COAP_ACK_TIMEOUT_MS + (uint32_t) (TimebaseGetTicks() % COAP_ACK_RANDOM_MS);
+	int retransmits = 0;
+	bool acked = false;
+
+	if (!sendMessage(client, client->tx, len)) {
+		return false;
+	}
+	client->stats.requests++;
+	startTimer(client, timeout_ms);
+
+	while (true) {
+		// the read returns when the timer is due, the timer decides what happens
+		uint64_t now = TimebaseGetMs();
+		if (!client->retransmit_due && now >= client->timer.expiry_ms) {
+			client->retransmit_due = true;
+		}
+		if (client->retransmit_due) {
+			if (acked || retransmits == COAP_MAX_RETRANSMIT) {
+				break;
+			}
+			retransmits++;
+			timeout_ms *= 2;
+			client->stats.retransmits++;
+			if (DEBUG) { printf("coap: retransmit %d of %04X\n", retransmits, message_id); }
+			if (!sendMessage(client, client->tx, len)) {
+				break;
+			}
+			startTimer(client, timeout_ms);
+			continue;
+		}
+
+		int received = CellularSocketRead(client->srv_profile_id, client->rx, sizeof(client->rx),
+										  (unsigned int) (client->timer.expiry_ms - now));
+		if (received < 0) {
+			break;
+		}
+		if (received == 0 || !parseMessage(client->rx, received, response)) {
+			continue;
+		}
+
+		if (response->message_id == message_id && response->type == COAP_TYPE_RST) {
+			break;
+		} else if (response->message_id == message_id && response->type == COAP_TYPE_ACK) {
+			if (response->code != COAP_EMPTY) {
+				TimerStop(&client->timer);
+				return true;
+			}
+			// the response comes separately, no more retransmissions
+			acked = true;
+			startTimer(client, COAP_SEPARATE_TIMEOUT_MS);
+		} else if (response->token == token && response->code != COAP_EMPTY &&
+				   (response->type == COAP_TYPE_CON || response->type == COAP_TYPE_NON)) {
+			if (response->type == COAP_TYPE_CON) {
+				uint8_t ack[COAP_HEADER_SIZE] = {COAP_VERSION << 6 | COAP_TYPE_ACK << 4, COAP_EMPTY,
+												 (uint8_t) (response->message_id >> 8), (uint8_t) response->message_id};
+				sendMessage(client, ack, sizeof(ack));
+			}
+			TimerStop(&client->timer);
+			return true;
+		}
+	}
+
+	TimerStop(&client->timer);
+	return false;
+}
+
+void CoapInit(COAP_CLIENT * client, int srv_profile_id, const char * address) {
+	memset(client, 0, sizeof(*client));
+	client->srv_profile_id = srv_profile_id;
+	client->address = address;
+	// message IDs and tokens of a new run should not repeat the last run's
+	client->message_id = (uint16_t) TimebaseGetTicks();
+	client->token = (uint16_t) (TimebaseGetTicks() >> 16);
+}
+
+int CoapPost(COAP_CLIENT * client, const char * path, uint16_t content_format, const uint8_t * payload,
+			 uint32_t len, bool confirmable) {
+	COAP_MESSAGE response;
+	int message_len;
+
+	if (len <= COAP_BLOCK_SIZE) {
+		client->message_id++;
+		client->token++;
+		message_len = buildPost(client, confirmable ? COAP_TYPE_CON : COAP_TYPE_NON, path, content_format,
+								payload, len, -1);
+		if (message_len < 0) {
+			return -1;
+		}
+		if (!confirmable) {
+			if (!sendMessage(client, client->tx, message_len)) {
+				return -1;
+			}
+			client->stats.requests++;
+			return 0;
+		}
+		return exchange(client, message_len, &response) ? response.code : -1;
+	}
+
+	// block-wise, each block waits for its 2.31 Continue
+	uint32_t offset = 0;
+	uint8_t szx = COAP_BLOCK_SZX;
+	while (true) {
+		uint32_t block_size = 16U << szx;
+		uint32_t num = offset / block_size;
+		bool more = offset + block_size < len;
+		uint32_t chunk = more ? block_size : len - offset;
+
+		client->message_id++;
+		client->token++;
+		message_len = buildPost(client, COAP_TYPE_CON, path, content_format, &payload[offset], chunk,
+								(int32_t) (num << 4 | (more ? COAP_BLOCK_MORE : 0) | szx));
+		if (message_len < 0 || !exchange(client, message_len, &response)) {
+			return -1;
+		}
+		if (!more || response.code != COAP_CONTINUE) {
+			return response.code;
+		}
+
+		// the server kept the whole block, it may ask for smaller ones from here on
+		// (RFC 7959 figure 7: 1:0/1/128, 2.31 1:0/1/32, then 1:4/1/32)
+		offset += chunk;
+		if (response.has_block1 && (response.block1 & COAP_BLOCK_SZX_MASK) < szx) {
+			szx = response.block1 & COAP_BLOCK_SZX_MASK;
+		}
+	}
+}
+
+void CoapClose(COAP_CLIENT * client) {
+	TimerStop(&client->timer);
+	CellularSocketClose(client->srv_profile_id);
+}
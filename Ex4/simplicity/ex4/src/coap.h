@@ -0,0 +1,89 @@
+/******************************************************************************
+ * @coap.h
+ * @brief Interface for a compact CoAP (RFC 7252) client over a modem UDP
+ * socket. POSTs go out confirmable or non-confirmable, payloads longer than
+ * a block are sent block-wise with Block1 (RFC 7959). A confirmable message
+ * is retransmitted with a doubling timeout from a timer until its ACK.
+ * @version 0.0.1
+ *  **************************************************************************/
+#ifndef SRC_COAP_H_
+#define SRC_COAP_H_
+
+#include <stdbool.h>
+#include <stdint.h>
+#include "timer.h"
+
+extern bool DEBUG;
+
+/******************************************************************************
+ * 								DEFS
+*****************************************************************************/
+#define COAP_BLOCK_SZX 5						// blocks of 16 << 5 = 512 bytes
+#define COAP_BLOCK_SIZE (16 << COAP_BLOCK_SZX)
+#define COAP_MAX_MESSAGE (COAP_BLOCK_SIZE + 64)	// header, token, options and a block
+#define COAP_ACK_TIMEOUT_MS 2000
+#define COAP_ACK_RANDOM_MS 1000				// the first timeout is 2..3 s
+#define COAP_MAX_RETRANSMIT 4
+
+/* Content-Format option values */
+#define COAP_FORMAT_TEXT 0
+#define COAP_FORMAT_OCTET_STREAM 42
+#define COAP_FORMAT_CBOR 60
+
+/* Response codes, class << 5 | detail */
+#define COAP_CODE(class, detail) (((class) << 5) | (detail))
+#define COAP_CODE_CLASS(code) ((code) >> 5)
+#define COAP_CHANGED COAP_CODE(2, 4)
+#define COAP_CONTINUE COAP_CODE(2, 31)
+
+typedef struct _COAP_STATS {
+	uint32_t requests;		// messages sent, blocks counted one by one
+	uint32_t retransmits;
+	uint32_t bytes;			// datagram bytes sent, headers included
+} COAP_STATS;
+
+typedef struct _COAP_CLIENT {
+	int srv_profile_id;
+	const char * address;
+	uint16_t message_id;
+	uint16_t token;
+	TIMER timer;			// retransmission of the confirmable message in flight
+	volatile bool retransmit_due;
+	uint8_t tx[COAP_MAX_MESSAGE];
+	uint8_t rx[COAP_MAX_MESSAGE];
+	COAP_STATS stats;
+} COAP_CLIENT;
+
+
+/******************************************************************************
+ * @brief Sets up a client, the socket opens with the first request.
+ * @param client - the client.
+ * @param srv_profile_id - modem service profile of the socket.
+ * @param address - server, e.g. "sockudp://host:5683".
+ *****************************************************************************/
+void CoapInit(COAP_CLIENT * client, int srv_profile_id, const char * address);
+
+
+/******************************************************************************
+ * @brief POSTs a payload. Payloads longer than COAP_BLOCK_SIZE are sent
+ * block-wise, always confirmable.
+ * @param client - the client.
+ * @param path - resource path, e.g. "ex4/telemetry".
+ * @param content_format - COAP_FORMAT_* value.
+ * @param payload - the payload.
+ * @param len - its length.
+ * @param confirmable - wait for the ACK and retransmit until it arrives.
+ * @return response code of the (last) response, 0 for a non-confirmable
+ *         message that was sent, -1 if it was not sent or never acknowledged.
+ *****************************************************************************/
+int CoapPost(COAP_CLIENT * client, const char * path, uint16_t content_format, const uint8_t * payload,
+			 uint32_t len, bool confirmable);
+
+
+/******************************************************************************
+ * @brief Closes the socket.
+ *****************************************************************************/
+void CoapClose(COAP_CLIENT * client);
+
+
+#endif /* SRC_COAP_H_ */
@@ -0,0 +1,203 @@
+/******************************************************************************
+ * @energy.c
+ * @brief Sleeping in the deepest allowed energy mode while waiting.
+ * @version 0.0.1
+ *  **************************************************************************/
+#include "em_device.h"
+#include "em_emu.h"
+#include "em_core.h"
+
+#include "energy.h"
+#include "timer.h"
+
+/******************************************************************************
+ * 							GLOBAL VARIABLES
+*****************************************************************************/
+static volatile uint8_t mode_blocks[ENERGY_NUM_MODES] = {0};
+static uint64_t time_in_mode_ticks[ENERGY_NUM_MODES] = {0};
+static uint32_t wakeups = 0;
+static uint64_t last_account_ticks = 0;	// timebase ticks of the last mode change
+static bool ENERGY_INITIALIZED = false;
+static ENERGY_IDLE_HOOK idle_hooks[ENERGY_MAX_IDLE_HOOKS] = {NULL};
+static bool IN_IDLE_HOOKS = false;
+
+
+/******************************************************************************
+ * @brief Starts measuring the time spent in each mode.
+ *****************************************************************************/
+void EnergyInit(void) {
+	last_account_ticks = TimebaseGetTicks();
+	ENERGY_INITIALIZED = true;
+}
+
+void EnergyBlockMode(ENERGY_MODE mode) {
+	CORE_DECLARE_IRQ_STATE;
+	CORE_ENTER_ATOMIC();
+	mode_blocks[mode]++;
+	CORE_EXIT_ATOMIC();
+}
+
+void EnergyUnblockMode(ENERGY_MODE mode) {
+	CORE_DECLARE_IRQ_STATE;
+	CORE_ENTER_ATOMIC();
+	if (mode_blocks[mode] > 0) {
+		mode_blocks[mode]--;
+	}
+	CORE_EXIT_ATOMIC();
+}
+
+bool EnergyAddIdleHook(ENERGY_IDLE_HOOK hook) {
+	for (int i = 0; i < ENERGY_MAX_IDLE_HOOKS; i++) {
+		if (idle_hooks[i] == hook) {
+			return true;
+		}
+	}
+	for (int i = 0; i < ENERGY_MAX_IDLE_HOOKS; i++) {
+		if (idle_hooks[i] == NULL) {
+			idle_hooks[i] = hook;
+			return true;
+		}
+	}
+	return false;
+}
+
+void EnergyRemoveIdleHook(ENERGY_IDLE_HOOK hook) {
+	for (int i = 0; i < ENERGY_MAX_IDLE_HOOKS; i++) {
+		if (idle_hooks[i] == hook) {
+			idle_hooks[i] = NULL;
+		}
+	}
+}
+
+/******************************************************************************
+ * @brief Runs the idle hooks. A hook that ends up in EnergyWaitFor does not
+ * run the hooks again.
+ *****************************************************************************/
+static void runIdleHooks(void) {
+	if (IN_IDLE_HOOKS) {
+		return;
+	}
+	IN_IDLE_HOOKS = true;
+	for (int i = 0; i < ENERGY_MAX_IDLE_HOOKS; i++) {
+		if (idle_hooks[i] != NULL) {
+			idle_hooks[i]();
+		}
+	}
+	IN_IDLE_HOOKS = false;
+}
+
+/******************************************************************************
+ * @brief Gets the deepest mode no peripheral has blocked.
+ *****************************************************************************/
+static ENERGY_MODE deepestAllowedMode(void) {
+	if (mode_blocks[ENERGY_EM1] > 0) {
+		return ENERGY_EM0;
+	} else if (mode_blocks[ENERGY_EM2] > 0) {
+		return ENERGY_EM1;
+	}
+	return ENERGY_EM2;
+}
+
+/******************************************************************************
+ * @brief Adds the timebase ticks passed since the last call to mode.
+ *****************************************************************************/
+static void accountTime(ENERGY_MODE mode) {
+	if (!ENERGY_INITIALIZED) {
+		return;
+	}
+	uint64_t now = TimebaseGetTicks();
+	time_in_mode_ticks[mode] += now - last_account_ticks;
+	last_account_ticks = now;
+}
+
+/******************************************************************************
+ * @brief Sleeps in mode until the next interrupt. The RTCC keeps running in
+ * EM1 and EM2, no periodic tick is needed to keep time.
+ * Must be called with interrupts disabled.
+ *****************************************************************************/
+static void sleepInMode(ENERGY_MODE mode) {
+	accountTime(ENERGY_EM0);
+	if (mode == ENERGY_EM2) {
+		EMU_EnterEM2(true);
+	} else {
+		EMU_EnterEM1();
+	}
+	accountTime(mode);
+}
+
+/******************************************************************************
+ * @brief Timer callback of EnergyWaitFor, arg points to its timed out flag.
+ *****************************************************************************/
+static void waitTimedOut(void * arg) {
+	*(volatile bool *) arg = true;
+}
+
+bool EnergyWaitFor(bool (*ready)(void), uint32_t timeout_ms) {
+	// the timeout is a wheel timer like any other deadline
+	TIMER timeout_timer = {0};
+	volatile bool timed_out = false;
+	bool is_ready = false;
+	if (timeout_ms != UINT32_MAX) {
+		TimerStart(&timeout_timer, timeout_ms, 0, waitTimedOut, (void *) &timed_out);
+	}
+
+	while (true) {
+		runIdleHooks();
+		TimerProcess();
+
+		// interrupts stay pending while disabled and still wake the core,
+		// so nothing that arrives between the check and the sleep is missed.
+		__disable_irq();
+		is_ready = (ready != NULL && ready());
+		if (is_ready || timed_out) {
+			__enable_irq();
+			break;
+		}
+
+		ENERGY_MODE mode = deepestAllowedMode();
+		if (mode != ENERGY_EM0) {
+			uint64_t wakeup = TimerNextDeadline();
+			if (mode == ENERGY_EM2 && wakeup - TimebaseGetMs() < ENERGY_EM2_MIN_SLEEP_MS) {
+				mode = ENERGY_EM1;
+			}
+			if (wakeup == TIMEBASE_NO_DEADLINE) {
+				TimebaseCancelWakeup();
+			} else {
+				TimebaseSetWakeup(wakeup);
+			}
+			sleepInMode(mode);
+			wakeups++;
+		}
+
+		// let the pending handler run
+		__enable_irq();
+	}
+
+	TimerStop(&timeout_timer);
+	return is_ready;
+}
+
+void EnergyDelay(uint32_t ms) {
+	EnergyWaitFor(NULL, ms);
+}
+
+void EnergyGetStats(ENERGY_STATS * stats) {
+	CORE_DECLARE_IRQ_STATE;
+	CORE_ENTER_ATOMIC();
+	accountTime(ENERGY_EM0);
+	for (int mode = 0; mode < ENERGY_NUM_MODES; mode++) {
+		stats->time_in_mode_ms[mode] = (uint32_t) ((time_in_mode_ticks[mode] * 1000) / RTCC_FREQ_HZ);
+	}
+	stats->wakeups = wakeups;
+	CORE_EXIT_ATOMIC();
+}
+
+void EnergyPrintStats(void) {
+	ENERGY_STATS stats;
+	EnergyGetStats(&stats);
+	printf("EM0: %lums\nEM1: %lums\nEM2: %lums\nwakeups: %lu\n",
+		   (unsigned long) stats.time_in_mode_ms[ENERGY_EM0],
+		   (unsigned long) stats.time_in_mode_ms[ENERGY_EM1],
+		   (unsigned long) stats.time_in_mode_ms[ENERGY_EM2],
+		   (unsigned long) stats.wakeups);
+}
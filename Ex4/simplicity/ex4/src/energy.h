@@ -0,0 +1,102 @@
+/******************************************************************************
+ * @energy.h
+ * @brief Interface for sleeping in the deepest allowed energy mode while waiting.
+ * @version 0.0.1
+ *  **************************************************************************/
+#ifndef SRC_ENERGY_H_
+#define SRC_ENERGY_H_
+
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdint.h>
+#include "timebase.h"
+
+/******************************************************************************
+ * 								DEFS
+*****************************************************************************/
+#define ENERGY_EM2_MIN_SLEEP_MS 2	// shorter sleeps are not worth the EM2 wake up
+#define ENERGY_MAX_IDLE_HOOKS 4
+
+typedef void (*ENERGY_IDLE_HOOK)(void);
+
+typedef enum {ENERGY_EM0, ENERGY_EM1, ENERGY_EM2, ENERGY_NUM_MODES} ENERGY_MODE;
+
+typedef struct _ENERGY_STATS {
+	uint32_t time_in_mode_ms[ENERGY_NUM_MODES];
+	uint32_t wakeups;
+} ENERGY_STATS;
+
+extern bool DEBUG;
+
+
+/******************************************************************************
+ * @brief Starts measuring the time spent in each mode. Call after TimebaseInit.
+ *****************************************************************************/
+void EnergyInit(void);
+
+
+/******************************************************************************
+ * @brief Forbids sleeping in mode or deeper, e.g. while a HF peripheral is used.
+ * Every call must be matched by a call to EnergyUnblockMode.
+ * @param mode - the shallowest mode that is not allowed.
+ *****************************************************************************/
+void EnergyBlockMode(ENERGY_MODE mode);
+
+
+/******************************************************************************
+ * @brief Releases a block taken by EnergyBlockMode.
+ * @param mode - the mode given to EnergyBlockMode.
+ *****************************************************************************/
+void EnergyUnblockMode(ENERGY_MODE mode);
+
+
+/******************************************************************************
+ * @brief Adds a hook that runs on every wake up of EnergyWaitFor, before ready
+ * is evaluated. For background work that has to keep up with interrupts even
+ * while a caller is blocked, e.g. draining an RX buffer. Must not wait.
+ * @param hook - the hook.
+ * @return true if added, false if all hook slots are taken.
+ *****************************************************************************/
+bool EnergyAddIdleHook(ENERGY_IDLE_HOOK hook);
+
+
+/******************************************************************************
+ * @brief Removes a hook added by EnergyAddIdleHook.
+ * @param hook - the hook.
+ *****************************************************************************/
+void EnergyRemoveIdleHook(ENERGY_IDLE_HOOK hook);
+
+
+/******************************************************************************
+ * @brief Sleeps in the deepest allowed mode until ready returns true or the
+ * timeout expires. ready is evaluated with interrupts disabled, after every
+ * wake up (UART RX, GPIO or RTCC). The timeout is a software timer, expired
+ * timers are processed while waiting and the core wakes up for them only.
+ * @param ready - condition to wait for, NULL to wait for the timeout only.
+ * @param timeout_ms - length of the timeout in ms, UINT32_MAX for no timeout.
+ * @return true if ready returned true, false on timeout.
+ *****************************************************************************/
+bool EnergyWaitFor(bool (*ready)(void), uint32_t timeout_ms);
+
+
+/******************************************************************************
+ * @brief Sleeps for ms milliseconds.
+ * @param ms - time to sleep.
+ *****************************************************************************/
+void EnergyDelay(uint32_t ms);
+
+
+/******************************************************************************
+ * @brief Gets the time spent in each energy mode since EnergyInit.
+ * @param stats - struct to be filled.
+ *****************************************************************************/
+void EnergyGetStats(ENERGY_STATS * stats);
+
+
+/******************************************************************************
+ * @brief Prints the time spent in each energy mode.
+ *****************************************************************************/
+void EnergyPrintStats(void);
+
+
+#endif /* SRC_ENERGY_H_ */
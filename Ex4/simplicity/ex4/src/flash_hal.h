@@ -0,0 +1,59 @@
+/******************************************************************************
+ * @flash_hal.h
+ * @brief Interface for the flash pages used by the flash log.
+ * Implemented by flash_hal_msc.c on the EFM32PG12 and by a RAM simulator on
+ * the host (Ex4/sim/flash_hal_sim.c).
+ * @version 0.0.1
+ *  **************************************************************************/
+#ifndef SRC_FLASH_HAL_H_
+#define SRC_FLASH_HAL_H_
+
+#include <stdbool.h>
+#include <stdint.h>
+
+/******************************************************************************
+ * 								DEFS
+*****************************************************************************/
+#define FLASH_HAL_PAGE_SIZE 2048	// EFM32PG12 flash page
+#define FLASH_HAL_NUM_PAGES 32		// 64 KB at the top of the main flash
+#define FLASH_HAL_ERASED_WORD 0xFFFFFFFFUL
+
+
+/******************************************************************************
+ * @brief Prepares the flash controller.
+ * @return true if successful.
+ *****************************************************************************/
+bool FlashHalInit(void);
+
+
+/******************************************************************************
+ * @brief Erases a page, all its words read FLASH_HAL_ERASED_WORD afterwards.
+ * @param page - page index, less than FLASH_HAL_NUM_PAGES.
+ * @return true if successful.
+ *****************************************************************************/
+bool FlashHalErasePage(uint32_t page);
+
+
+/******************************************************************************
+ * @brief Writes words to an erased part of a page. Like NOR flash, a write can
+ * only clear bits.
+ * @param page - page index.
+ * @param offset - byte offset in the page, word aligned.
+ * @param words - data to write.
+ * @param num_words - number of words.
+ * @return true if successful.
+ *****************************************************************************/
+bool FlashHalWrite(uint32_t page, uint32_t offset, const uint32_t * words, uint32_t num_words);
+
+
+/******************************************************************************
+ * @brief Reads from a page.
+ * @param page - page index.
+ * @param offset - byte offset in the page.
+ * @param buf - buffer to be filled.
+ * @param len - number of bytes.
+ *****************************************************************************/
+void FlashHalRead(uint32_t page, uint32_t offset, void * buf, uint32_t len);
+
+
+#endif /* SRC_FLASH_HAL_H_ */
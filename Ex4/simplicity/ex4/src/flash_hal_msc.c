@@ -0,0 +1,47 @@
+/******************************************************************************
+ * @flash_hal_msc.c
+ * @brief Flash log pages in the EFM32PG12 main flash, written through the MSC.
+ * The last FLASH_HAL_NUM_PAGES pages of the main flash are used. The project
+ * links with efm32pg12b_flash_log.ld, which leaves them out of FLASH, and
+ * takes MSC_* from emlib/em_msc.c.
+ * @version 0.0.1
+ *  **************************************************************************/
+#include <string.h>
+#include "em_device.h"
+#include "em_msc.h"
+
+#include "flash_hal.h"
+
+/******************************************************************************
+ * 								DEFS
+*****************************************************************************/
+#define FLASH_LOG_BASE (FLASH_BASE + FLASH_SIZE - FLASH_HAL_NUM_PAGES * FLASH_HAL_PAGE_SIZE)
+#define PAGE_ADDRESS(page) (FLASH_LOG_BASE + (page) * FLASH_HAL_PAGE_SIZE)
+
+
+bool FlashHalInit(void) {
+	MSC_Init();
+	return true;
+}
+
+bool FlashHalErasePage(uint32_t page) {
+	if (page >= FLASH_HAL_NUM_PAGES) {
+		return false;
+	}
+	return MSC_ErasePage((uint32_t *) PAGE_ADDRESS(page)) == mscReturnOk;
+}
+
+bool FlashHalWrite(uint32_t page, uint32_t offset, const uint32_t * words, uint32_t num_words) {
+	if (page >= FLASH_HAL_NUM_PAGES || (offset & 3) != 0
+			|| offset + num_words * sizeof(uint32_t) > FLASH_HAL_PAGE_SIZE) {
+		return false;
+	}
+	// one call for the whole batch, the MSC keeps the write sequence open
+	return MSC_WriteWord((uint32_t *) (PAGE_ADDRESS(page) + offset), words,
+						 num_words * sizeof(uint32_t)) == mscReturnOk;
+}
+
+void FlashHalRead(uint32_t page, uint32_t offset, void * buf, uint32_t len) {
+	// the main flash is memory mapped
+	memcpy(buf, (const void *) (PAGE_ADDRESS(page) + offset), len);
+}
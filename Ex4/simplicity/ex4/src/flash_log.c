@@ -0,0 +1,317 @@
+/******************************************************************************
+ * @flash_log.c
+ * @brief Log-structured record store in flash.
+ * The pages are used as a ring in order, so every page is erased as often as
+ * the others. A page starts with a header (sequence, magic) and holds records
+ * of a header word (type, length, CRC-16) and a payload padded to words.
+ * Pages and records are only appended, the newest state is found again on
+ * boot by scanning. Appends are staged in RAM and written in batches.
+ * @version 0.0.1
+ *  **************************************************************************/
+#include <string.h>
+
+#include "flash_log.h"
+
+/******************************************************************************
+ * 								DEFS
+*****************************************************************************/
+#define PAGE_MAGIC 0x31474F4CUL			// "LOG1"
+#define PAGE_HEADER_SIZE 8				// sequence word, magic word
+#define RECORD_HEADER_SIZE 4
+#define WORDS(bytes) (((bytes) + 3) / 4)
+#define RECORD_SIZE(len) (RECORD_HEADER_SIZE + WORDS(len) * 4)
+#define ERASED_TYPE 0xFF
+
+/******************************************************************************
+ * 							GLOBAL VARIABLES
+*****************************************************************************/
+static uint32_t head_page = 0;			// page being appended to
+static uint32_t head_sequence = 0;		// its sequence, 0 before the first page
+static uint32_t head_offset = FLASH_HAL_PAGE_SIZE;	// end of the flushed records
+static uint32_t tail_sequence = 1;		// oldest page still needed
+static FLASH_LOG_CURSOR release_cursor = {1, PAGE_HEADER_SIZE};
+
+static uint32_t staging[FLASH_LOG_BATCH_SIZE / 4];	// records not written yet
+static uint32_t staged_bytes = 0;
+static FLASH_LOG_STATS stats;
+
+
+/******************************************************************************
+ * @brief CRC-16/CCITT-FALSE.
+ *****************************************************************************/
+static uint16_t crc16(uint16_t crc, const uint8_t * data, uint32_t len) {
+	for (uint32_t i = 0; i < len; i++) {
+		crc ^= (uint16_t) data[i] << 8;
+		for (int bit = 0; bit < 8; bit++) {
+			crc = (crc & 0x8000) ? (crc << 1) ^ 0x1021 : (crc << 1);
+		}
+	}
+	return crc;
+}
+
+/******************************************************************************
+ * @brief Builds the header word of a record.
+ *****************************************************************************/
+static uint32_t recordHeader(uint8_t type, const void * data, uint32_t len) {
+	uint8_t prefix[2] = {type, (uint8_t) len};
+	uint16_t crc = crc16(0xFFFF, prefix, sizeof(prefix));
+	crc = crc16(crc, data, len);
+	return type | (len << 8) | ((uint32_t) crc << 16);
+}
+
+/******************************************************************************
+ * @brief Gets the page holding sequence, which must be in the ring.
+ *****************************************************************************/
+static uint32_t pageOfSequence(uint32_t sequence) {
+	uint32_t distance = (head_sequence - sequence) % FLASH_HAL_NUM_PAGES;
+	return (head_page + FLASH_HAL_NUM_PAGES - distance) % FLASH_HAL_NUM_PAGES;
+}
+
+/******************************************************************************
+ * @brief Reads the sequence of a page.
+ * @return false if the page has no valid header.
+ *****************************************************************************/
+static bool readPageHeader(uint32_t page, uint32_t * sequence) {
+	uint32_t header[2];
+	FlashHalRead(page, 0, header, sizeof(header));
+	*sequence = header[0];
+	return header[1] == PAGE_MAGIC && header[0] != 0 && header[0] != FLASH_HAL_ERASED_WORD;
+}
+
+/******************************************************************************
+ * @brief Reads and checks the record at offset of page.
+ * @return false at the end of the page's records (erased or bad record).
+ * *corrupt is set for a bad record.
+ *****************************************************************************/
+static bool readRecord(uint32_t page, uint32_t offset, uint8_t * type, uint8_t * data, uint32_t * len, bool * corrupt) {
+	uint32_t header;
+	*corrupt = false;
+	if (offset + RECORD_HEADER_SIZE > FLASH_HAL_PAGE_SIZE) {
+		return false;
+	}
+	FlashHalRead(page, offset, &header, sizeof(header));
+	if (header == FLASH_HAL_ERASED_WORD) {
+		return false;
+	}
+
+	*type = header & 0xFF;
+	*len = (header >> 8) & 0xFF;
+	if (*type == ERASED_TYPE || offset + RECORD_SIZE(*len) > FLASH_HAL_PAGE_SIZE) {
+		*corrupt = true;
+		return false;
+	}
+	FlashHalRead(page, offset + RECORD_HEADER_SIZE, data, *len);
+	if (recordHeader(*type, data, *len) != header) {
+		*corrupt = true;
+		return false;
+	}
+	return true;
+}
+
+/******************************************************************************
+ * @brief Erases the next page of the ring and starts it. Drops the oldest
+ * page if the ring is full.
+ *****************************************************************************/
+static bool openNextPage(void) {
+	uint32_t page = (head_page + 1) % FLASH_HAL_NUM_PAGES;
+	uint32_t sequence = head_sequence + 1;
+
+	if (sequence - tail_sequence >= FLASH_HAL_NUM_PAGES) {
+		tail_sequence = sequence - FLASH_HAL_NUM_PAGES + 1;
+		stats.pages_dropped++;
+	}
+	if (!FlashHalErasePage(page)) {
+		return false;
+	}
+	stats.pages_erased++;
+
+	// the sequence goes first, the magic marks the header complete
+	uint32_t sequence_word = sequence;
+	uint32_t magic_word = PAGE_MAGIC;
+	if (!FlashHalWrite(page, 0, &sequence_word, 1) || !FlashHalWrite(page, 4, &magic_word, 1)) {
+		return false;
+	}
+	head_page = page;
+	head_sequence = sequence;
+	head_offset = PAGE_HEADER_SIZE;
+	return true;
+}
+
+bool FlashLogInit(void) {
+	uint8_t data[FLASH_LOG_MAX_RECORD_LEN];
+	memset(&stats, 0, sizeof(stats));
+	staged_bytes = 0;
+	if (!FlashHalInit()) {
+		return false;
+	}
+
+	// the newest page is the head
+	bool found = false;
+	for (uint32_t page = 0; page < FLASH_HAL_NUM_PAGES; page++) {
+		uint32_t sequence;
+		if (readPageHeader(page, &sequence) && (!found || sequence > head_sequence)) {
+			head_page = page;
+			head_sequence = sequence;
+			found = true;
+		}
+	}
+	if (!found) {
+		// empty log, the first append opens page 0
+		head_page = FLASH_HAL_NUM_PAGES - 1;
+		head_sequence = 0;
+		head_offset = FLASH_HAL_PAGE_SIZE;
+		tail_sequence = 1;
+		release_cursor.sequence = 1;
+		release_cursor.offset = PAGE_HEADER_SIZE;
+		return true;
+	}
+
+	// the pages before it with consecutive sequences are the rest of the log
+	tail_sequence = head_sequence;
+	for (uint32_t back = 1; back < FLASH_HAL_NUM_PAGES && back < head_sequence; back++) {
+		uint32_t page = (head_page + FLASH_HAL_NUM_PAGES - back) % FLASH_HAL_NUM_PAGES;
+		uint32_t sequence;
+		if (!readPageHeader(page, &sequence) || sequence != head_sequence - back) {
+			break;
+		}
+		tail_sequence = sequence;
+	}
+
+	// scan the records for the last release and the end of the head page
+	release_cursor.sequence = tail_sequence;
+	release_cursor.offset = PAGE_HEADER_SIZE;
+	for (uint32_t sequence = tail_sequence; sequence <= head_sequence; sequence++) {
+		uint32_t page = pageOfSequence(sequence);
+		uint32_t offset = PAGE_HEADER_SIZE;
+		uint8_t type;
+		uint32_t len;
+		bool corrupt;
+
+		while (readRecord(page, offset, &type, data, &len, &corrupt)) {
+			if (type == FLASH_LOG_TYPE_RELEASE && len == sizeof(FLASH_LOG_CURSOR)) {
+				memcpy(&release_cursor, data, sizeof(FLASH_LOG_CURSOR));
+			} else {
+				stats.records_recovered++;
+			}
+			offset += RECORD_SIZE(len);
+		}
+		if (corrupt) {
+			stats.corrupt_pages++;
+		}
+		if (sequence == head_sequence) {
+			// never write behind a bad record, start a new page instead
+			head_offset = corrupt ? FLASH_HAL_PAGE_SIZE : offset;
+		}
+	}
+
+	if (release_cursor.sequence > tail_sequence && release_cursor.sequence <= head_sequence) {
+		tail_sequence = release_cursor.sequence;
+	} else if (release_cursor.sequence < tail_sequence || release_cursor.sequence > head_sequence) {
+		release_cursor.sequence = tail_sequence;
+		release_cursor.offset = PAGE_HEADER_SIZE;
+	}
+
+	if (DEBUG) {
+		printf("flash log: %lu records, pages %lu..%lu\n", (unsigned long) stats.records_recovered,
+			   (unsigned long) tail_sequence, (unsigned long) head_sequence);
+	}
+	return true;
+}
+
+bool FlashLogFlush(void) {
+	if (staged_bytes == 0) {
+		return true;
+	}
+	bool result = FlashHalWrite(head_page, head_offset, staging, staged_bytes / 4);
+	// on failure the page is not trusted any more, the next append opens a new one
+	head_offset = result ? head_offset + staged_bytes : FLASH_HAL_PAGE_SIZE;
+	staged_bytes = 0;
+	stats.flushes++;
+	return result;
+}
+
+bool FlashLogAppend(uint8_t type, const void * data, uint32_t len) {
+	uint32_t size = RECORD_SIZE(len);
+	if (len > FLASH_LOG_MAX_RECORD_LEN || type == ERASED_TYPE) {
+		return false;
+	}
+
+	// records never span pages
+	if (head_offset + staged_bytes + size > FLASH_HAL_PAGE_SIZE) {
+		// a failed batch is lost either way, the log goes on in the next page
+		FlashLogFlush();
+		if (!openNextPage()) {
+			return false;
+		}
+	}
+	if (staged_bytes + size > FLASH_LOG_BATCH_SIZE && !FlashLogFlush()) {
+		return false;
+	}
+
+	uint32_t * record = &staging[staged_bytes / 4];
+	record[0] = recordHeader(type, data, len);
+	record[WORDS(len)] = FLASH_HAL_ERASED_WORD;	// padding of the last word
+	memcpy(&record[1], data, len);
+	staged_bytes += size;
+	stats.records_appended++;
+
+	if (staged_bytes == FLASH_LOG_BATCH_SIZE) {
+		return FlashLogFlush();
+	}
+	return true;
+}
+
+void FlashLogOldest(FLASH_LOG_CURSOR * cursor) {
+	if (release_cursor.sequence < tail_sequence) {
+		cursor->sequence = tail_sequence;
+		cursor->offset = PAGE_HEADER_SIZE;
+	} else {
+		*cursor = release_cursor;
+	}
+}
+
+bool FlashLogReadNext(FLASH_LOG_CURSOR * cursor, uint8_t * type, void * data, uint32_t maxlen, uint32_t * len) {
+	uint8_t record[FLASH_LOG_MAX_RECORD_LEN];
+
+	if (cursor->sequence < tail_sequence) {
+		// overwritten while the reader was behind
+		cursor->sequence = tail_sequence;
+		cursor->offset = PAGE_HEADER_SIZE;
+	}
+	while (cursor->sequence <= head_sequence) {
+		uint32_t page = pageOfSequence(cursor->sequence);
+		bool corrupt;
+
+		if ((cursor->sequence == head_sequence && cursor->offset >= head_offset)
+				|| !readRecord(page, cursor->offset, type, record, len, &corrupt)) {
+			if (cursor->sequence == head_sequence) {
+				return false;
+			}
+			// end of this page
+			cursor->sequence++;
+			cursor->offset = PAGE_HEADER_SIZE;
+			continue;
+		}
+
+		cursor->offset += RECORD_SIZE(*len);
+		if (*type == FLASH_LOG_TYPE_RELEASE) {
+			continue;
+		}
+		memcpy(data, record, (*len < maxlen) ? *len : maxlen);
+		return true;
+	}
+	return false;
+}
+
+bool FlashLogRelease(const FLASH_LOG_CURSOR * cursor) {
+	if (cursor->sequence < tail_sequence || cursor->sequence > head_sequence) {
+		return false;
+	}
+	release_cursor = *cursor;
+	tail_sequence = cursor->sequence;
+	return FlashLogAppend(FLASH_LOG_TYPE_RELEASE, cursor, sizeof(FLASH_LOG_CURSOR));
+}
+
+void FlashLogGetStats(FLASH_LOG_STATS * log_stats) {
+	memcpy(log_stats, &stats, sizeof(FLASH_LOG_STATS));
+}
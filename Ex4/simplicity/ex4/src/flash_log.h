@@ -0,0 +1,104 @@
+/******************************************************************************
+ * @flash_log.h
+ * @brief Interface for the log-structured record store in flash.
+ * @version 0.0.1
+ *  **************************************************************************/
+#ifndef SRC_FLASH_LOG_H_
+#define SRC_FLASH_LOG_H_
+
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdint.h>
+#include "flash_hal.h"
+
+/******************************************************************************
+ * 								DEFS
+*****************************************************************************/
+#define FLASH_LOG_MAX_RECORD_LEN 255	// payload bytes
+#define FLASH_LOG_BATCH_SIZE FLASH_HAL_PAGE_SIZE	// staged in RAM, a full page is written at once
+
+/* Record types, 0xFF is what erased flash reads */
+enum FLASH_LOG_TYPE{FLASH_LOG_TYPE_FIX = 1, FLASH_LOG_TYPE_TELEMETRY = 2, FLASH_LOG_TYPE_RELEASE = 0x7F};
+
+/* Position of a record in the log */
+typedef struct _FLASH_LOG_CURSOR {
+	uint32_t sequence;	// sequence number of the page
+	uint32_t offset;	// byte offset in the page
+} FLASH_LOG_CURSOR;
+
+typedef struct _FLASH_LOG_STATS {
+	uint32_t records_recovered;	// valid records found by FlashLogInit
+	uint32_t records_appended;
+	uint32_t flushes;			// flash write batches
+	uint32_t pages_erased;
+	uint32_t pages_dropped;		// unreleased pages overwritten because the log was full
+	uint32_t corrupt_pages;		// pages cut short by a bad record, e.g. after power loss
+} FLASH_LOG_STATS;
+
+extern bool DEBUG;
+
+
+/******************************************************************************
+ * @brief Recovers the log from flash: finds the newest page, the end of its
+ * records and the last release. Records after a bad CRC are ignored and the
+ * page is not written again.
+ * @return true if successful.
+ *****************************************************************************/
+bool FlashLogInit(void);
+
+
+/******************************************************************************
+ * @brief Appends a record. Records are staged in RAM and written in batches,
+ * call FlashLogFlush to make them persistent.
+ * @param type - record type (enum FLASH_LOG_TYPE).
+ * @param data - payload.
+ * @param len - payload length, at most FLASH_LOG_MAX_RECORD_LEN.
+ * @return true if successful.
+ *****************************************************************************/
+bool FlashLogAppend(uint8_t type, const void * data, uint32_t len);
+
+
+/******************************************************************************
+ * @brief Writes the staged records to flash.
+ * @return true if successful.
+ *****************************************************************************/
+bool FlashLogFlush(void);
+
+
+/******************************************************************************
+ * @brief Gets the position of the oldest record that was not released.
+ * @param cursor - cursor to be set.
+ *****************************************************************************/
+void FlashLogOldest(FLASH_LOG_CURSOR * cursor);
+
+
+/******************************************************************************
+ * @brief Reads the record at cursor and moves cursor past it. Only records
+ * already flushed are read.
+ * @param cursor - position, from FlashLogOldest or a previous call.
+ * @param type - set to the record type.
+ * @param data - buffer for the payload, longer payloads are cut.
+ * @param maxlen - size of data.
+ * @param len - set to the payload length.
+ * @return false if there are no more records.
+ *****************************************************************************/
+bool FlashLogReadNext(FLASH_LOG_CURSOR * cursor, uint8_t * type, void * data, uint32_t maxlen, uint32_t * len);
+
+
+/******************************************************************************
+ * @brief Releases all records before cursor, e.g. once they were uploaded.
+ * Their pages may be reused. The release is logged and survives a reset.
+ * @param cursor - position returned by FlashLogReadNext.
+ * @return true if successful.
+ *****************************************************************************/
+bool FlashLogRelease(const FLASH_LOG_CURSOR * cursor);
+
+
+/******************************************************************************
+ * @brief Gets the log statistics since FlashLogInit.
+ * @param stats - struct to be filled.
+ *****************************************************************************/
+void FlashLogGetStats(FLASH_LOG_STATS * stats);
+
+
+#endif /* SRC_FLASH_LOG_H_ */
@@ -6,12 +6,45 @@
 #include <stdlib.h>
 #include <time.h>
 #include "gps.h"
+#include "energy.h"
+#include "scheduler.h"
+#include "telemetry.h"
+
+/******************************************************************************
+ * 								DEFS
+******************************************************************************/
+#define GPS_COORDINATE_DECIMALS 7	// coordinates are kept in 1e-7 degrees
+#define GPS_CBOR_PAIRS 10	// m, name, ICCID, t and the writeFixLine fields
 
 /******************************************************************************
  * 							GLOBAL VARIABLES
 ******************************************************************************/
 static bool GPS_INITIALIZED = false;
 
+/* Background fix pipeline, fed from the RX ring by gpsIdleHook */
+static GPS_LOCATION_INFO current_location;	// assembled from RMC and GGA lines
+static GPS_LOCATION_INFO latest_location;	// newest valid fix
+static bool epoch_has_speed = false;		// an RMC line of the current epoch was parsed
+static uint32_t fix_count = 0;				// valid fixes stored since GPSInit
+
+/* Track ring, the last GPS_TRACK_MINUTES of fixes */
+_Static_assert(sizeof(GPS_FIX_RECORD) == 16, "GPS_FIX_RECORD must stay 16 bytes");
+static GPS_FIX_RECORD track[GPS_TRACK_SIZE];
+static uint32_t track_head = 0;				// index of the oldest record
+static uint32_t track_length = 0;
+static uint32_t track_base_time = 0;		// unix time of time_delta 0
+static uint32_t fix_count_waited = 0;		// fix_count when GPSGetFixInformation started
+static char last_line[MAX_NMEA_LEN] = "";
+static uint32_t line_count = 0;				// lines read since GPSInit
+static uint32_t line_count_waited = 0;		// line_count when GPSGetReadRaw started
+
+/******************************************************************************
+ * @brief Idle hook, keeps the pipeline running while the core waits.
+ *****************************************************************************/
+static void gpsIdleHook(void) {
+	GPSProcessPending();
+}
+
 /******************************************************************************
  * @brief Initiate GPS connection.
  *****************************************************************************/
@@ -22,22 +55,38 @@ void GPSInit(char * port) {
     	printf("Initialization FAILED.\n");
         exit(EXIT_FAILURE);
     }
+    memset(&current_location, 0, sizeof(current_location));
+    fix_count = 0;
+    track_length = 0;
+    line_count = 0;
+    EnergyAddIdleHook(gpsIdleHook);
     printf("Initializing successfully.\n");
 }
 
 /******************************************************************************
- * Gets line from GPS.
+ * @brief Wake up condition for GPSGetReadRaw.
+ *****************************************************************************/
+static bool newLineRead(void) {
+	return line_count != line_count_waited;
+}
+
+/******************************************************************************
+ * Gets the next line from GPS, as seen by the fix pipeline.
  * @param buf - output buffer to put the line into.
  * @param maxlen - max length of a line.
  * @return number of bytes received.
  *****************************************************************************/
 uint32_t GPSGetReadRaw(char *buf, unsigned int maxlen) {
-    if (GPS_INITIALIZED) {
-        return SerialRecvGPS((unsigned char*) buf, maxlen, RECV_TIMEOUT_MS);
+    if (!GPS_INITIALIZED || maxlen == 0) {
+        return 0;
     }
-    else {
+    line_count_waited = line_count;
+    if (!EnergyWaitFor(newLineRead, RECV_TIMEOUT_MS)) {
         return 0;
     }
+    strncpy(buf, last_line, maxlen - 1);
+    buf[maxlen - 1] = '\0';
+    return strlen(buf);
 }
 
 /******************************************************************************
@@ -100,6 +149,11 @@ bool parseRMC(char** split_line, GPS_LOCATION_INFO *location){
         split_line[RMC_DATE_FIELD] == NULL){
         return false;
     }
+    // speed over ground, knots
+    location->speed = 0;
+    if (split_line[RMC_SPEED_FIELD] != NULL) {
+        location->speed = atof(split_line[RMC_SPEED_FIELD]) * KNOTS_TO_CM_PER_SEC;
+    }
 //    strcpy(location->fixtime, split_line[RMC_TIME_FIELD]);
 //    strcpy(location->fixtime+6, split_line[RMC_DATE_FIELD]);
     sprintf(location->fixtime,
@@ -244,24 +298,159 @@ bool parseRawData(char* buf, GPS_LOCATION_INFO* location){
 }
 
 /******************************************************************************
- * Updates location with information from GPSGetReadRaw.
+ * Moves the track's base time forward so that unix_time fits a time_delta.
+ * Records older than that are dropped. Runs at most every 18 hours.
+ * @param unix_time - time of the record to be appended.
+ *****************************************************************************/
+static void rebaseTrack(uint32_t unix_time) {
+    while (track_length > 0 &&
+           unix_time - (track_base_time + track[track_head].time_delta) > UINT16_MAX) {
+        track_head = (track_head + 1) % GPS_TRACK_SIZE;
+        track_length--;
+    }
+    if (track_length == 0) {
+        track_base_time = unix_time;
+        return;
+    }
+
+    uint16_t shift = track[track_head].time_delta;
+    for (uint32_t i = 0; i < track_length; i++) {
+        track[(track_head + i) % GPS_TRACK_SIZE].time_delta -= shift;
+    }
+    track_base_time += shift;
+}
+
+/******************************************************************************
+ * Appends a valid fix to the track, overwriting the oldest record when full.
+ * @param location - the fix.
+ *****************************************************************************/
+static void storeFix(GPS_LOCATION_INFO *location) {
+    uint32_t unix_time = GPSGetUnixTime(location);
+
+    memcpy(&latest_location, location, sizeof(GPS_LOCATION_INFO));
+    fix_count++;
+
+    if (track_length == 0 || unix_time < track_base_time) {
+        // empty, or the time went backwards: start a new track
+        track_length = 0;
+        track_base_time = unix_time;
+    } else if (unix_time - track_base_time > UINT16_MAX) {
+        rebaseTrack(unix_time);
+    }
+    if (track_length == GPS_TRACK_SIZE) {
+        track_head = (track_head + 1) % GPS_TRACK_SIZE;
+        track_length--;
+    }
+
+    GPS_FIX_RECORD *record = &track[(track_head + track_length) % GPS_TRACK_SIZE];
+    record->time_delta = unix_time - track_base_time;
+    record->latitude = location->latitude;
+    record->longitude = location->longitude;
+    record->altitude = location->altitude / ALT_FACTOR;
+    record->speed = location->speed;
+    record->hdop = location->hdop;
+    record->sats_flags = (location->num_sats & GPS_RECORD_SATS_MASK) |
+                         (location->valid_fix ? GPS_RECORD_VALID_FIX : 0) |
+                         (epoch_has_speed ? GPS_RECORD_HAS_SPEED : 0);
+    track_length++;
+}
+
+uint32_t GPSProcessPending(void) {
+    char buf[MAX_NMEA_LEN];
+    uint32_t new_fixes = 0;
+
+    if (!GPS_INITIALIZED) {
+        return 0;
+    }
+    while (SerialRecvGPS((unsigned char*) buf, MAX_NMEA_LEN, 0) > 0) {
+        // parsing splits buf in place
+        strcpy(last_line, buf);
+        line_count++;
+
+        // a GGA line closes the epoch, RMC before it already set time and speed
+        bool is_gga = (strncmp(buf, GGA_PREFIX, PREFIX_LEN) == 0);
+        bool is_rmc = (strncmp(buf, RMC_PREFIX, PREFIX_LEN) == 0);
+        bool parsed = parseRawData(buf, &current_location);
+        if (parsed && is_rmc) {
+            epoch_has_speed = true;
+        }
+        if (!is_gga) {
+            continue;
+        }
+        if (parsed && current_location.valid_fix == 1 && current_location.fixtime[0] != '\0') {
+            storeFix(&current_location);
+            new_fixes++;
+        }
+        epoch_has_speed = false;
+    }
+
+    if (new_fixes > 0) {
+        SchedulerPostOnce(EVENT_PRIORITY_NORMAL, EVENT_GPS_FIX, 0);
+    }
+    return new_fixes;
+}
+
+uint32_t GPSGetFixCount(void) {
+    return fix_count;
+}
+
+bool GPSGetLatestFix(GPS_LOCATION_INFO *location) {
+    if (fix_count == 0) {
+        return false;
+    }
+    memcpy(location, &latest_location, sizeof(GPS_LOCATION_INFO));
+    return true;
+}
+
+uint32_t GPSGetTrackLength(void) {
+    return track_length;
+}
+
+bool GPSGetTrackRecord(uint32_t age, GPS_FIX_RECORD *record, uint32_t *unix_time) {
+    if (age >= track_length) {
+        return false;
+    }
+    const GPS_FIX_RECORD *stored = &track[(track_head + track_length - 1 - age) % GPS_TRACK_SIZE];
+    memcpy(record, stored, sizeof(GPS_FIX_RECORD));
+    if (unix_time != NULL) {
+        *unix_time = track_base_time + stored->time_delta;
+    }
+    return true;
+}
+
+uint32_t GPSGetTrack(GPS_FIX_RECORD *records, uint32_t max_records, uint32_t *base_time) {
+    uint32_t num_records = (track_length < max_records) ? track_length : max_records;
+
+    // the newest num_records, oldest first
+    for (uint32_t i = 0; i < num_records; i++) {
+        uint32_t index = (track_head + track_length - num_records + i) % GPS_TRACK_SIZE;
+        memcpy(&records[i], &track[index], sizeof(GPS_FIX_RECORD));
+    }
+    *base_time = track_base_time;
+    return num_records;
+}
+
+/******************************************************************************
+ * @brief Wake up condition for GPSGetFixInformation.
+ *****************************************************************************/
+static bool newFixStored(void) {
+    return fix_count != fix_count_waited;
+}
+
+/******************************************************************************
+ * Waits for the next valid fix of the pipeline.
  * @param location - the struct to be filled.
  * @return true if successful, false otherwise.
  *****************************************************************************/
 bool GPSGetFixInformation(GPS_LOCATION_INFO *location){
-    char buf[MAX_NMEA_LEN] = "";
-    uint32_t bytes_read;
-
-    bool result = false;
-    while (!result) {
-        // call GPSGetReadRaw
-        bytes_read = GPSGetReadRaw(buf, MAX_NMEA_LEN);
-        if (bytes_read > 0) {
-            result = parseRawData(buf, location);
-        }
+    if (!GPS_INITIALIZED) {
+        return false;
     }
 
-    return result;
+    fix_count_waited = fix_count;
+    while (!EnergyWaitFor(newFixStored, RECV_TIMEOUT_MS));
+
+    return GPSGetLatestFix(location);
 }
 
 /******************************************************************************
@@ -269,67 +458,119 @@ bool GPSGetFixInformation(GPS_LOCATION_INFO *location){
  *****************************************************************************/
 void GPSDisable() {
     if (GPS_INITIALIZED) {
+    	EnergyRemoveIdleHook(gpsIdleHook);
     	SerialDisableGPS();
         GPS_INITIALIZED = false;
     }
 }
 
+/**
+ * @brief reads two decimal digits.
+ */
+static int twoDigits(const char * digits) {
+    return (digits[0] - '0') * 10 + (digits[1] - '0');
+}
+
+uint32_t GPSGetUnixTime(GPS_LOCATION_INFO * gps_data) {
+    struct tm current_time;
+    memset(&current_time, 0, sizeof(current_time));
+
+    // hh:mm:ss DD.MM.YY
+    current_time.tm_hour = twoDigits(&gps_data->fixtime[0]);        //hours since midnight [0, 23]
+    current_time.tm_min = twoDigits(&gps_data->fixtime[3]);         //minutes after the hour [0, 59]
+    current_time.tm_sec = twoDigits(&gps_data->fixtime[6]);         //seconds after the minute [0, 60]
+    current_time.tm_mday = twoDigits(&gps_data->fixtime[9]);        //day of the month [1, 31]
+    current_time.tm_mon = twoDigits(&gps_data->fixtime[12]) - 1;    //months since January [0, 11]
+    current_time.tm_year = twoDigits(&gps_data->fixtime[15]) + 100; //years since 1900
+
+    return (uint32_t) mktime(&current_time);
+}
+
 /**
  * @brief this method will convert gps time to unix time in seconds.
  * @param gps_data - struct of GPS_LOCATION_INFO to extract time from.
  * @param unix_time - pointer to buffer where to store result.
  */
 void GPSConvertFixtimeToUnixTime(GPS_LOCATION_INFO * gps_data, char * unix_time) {
-    struct tm current_time;
-    char temp[3];
-    memset(temp, '\0', 3);
-    strncpy(temp, gps_data->fixtime, 2);
-    current_time.tm_hour = atoi(temp);      //hours since midnight  [0, 23]
-    strncpy(temp, &gps_data->fixtime[3], 2);
-    current_time.tm_min = atoi(temp);    //minutes after the hour  [0, 59]
-    strncpy(temp, &gps_data->fixtime[6], 2);
-	current_time.tm_sec = atoi(temp);    //seconds after the minute  [0, 60]
-	strncpy(temp, &gps_data->fixtime[9], 2);
-	current_time.tm_mday = atoi(temp);       //day of the month  [1, 31]
-	strncpy(temp, &gps_data->fixtime[12], 2);
-	current_time.tm_mon = atoi(temp) - 1;  //months since January  [0, 11]
-	strncpy(temp, &gps_data->fixtime[15], 2);
-	current_time.tm_year = atoi(temp) + 100;//years since 1900
-
-    time_t unix_time_stamp = mktime(&current_time);
-    sprintf(unix_time, "%d", unix_time_stamp);
+    sprintf(unix_time, "%lu", (unsigned long) GPSGetUnixTime(gps_data));
 }
 
 
 /**
- * @brief prepare a predefined GPS payload based on inputs.
- * @param gps_data GPS LOCATION as received from GPS module
- * @param gps_payload where to store result
- * @return length of payload
+ * Writes the gps line of the text payloads up to its last field.
  */
-int GPSGetPayload(GPS_LOCATION_INFO * gps_data, char * iccid, char * unix_time, char * gps_payload) {
-    //latitude= 31.7498445,longitude= 35.1838178,altitude=10,hdop=2,valid_fix=1,num_sats=4 1557086230000000000
-    float lat_deg = (gps_data->latitude) / 10000000.0;
-    float long_deg = (gps_data->longitude) / 10000000.0;
+static void writeFixLine(PAYLOAD_BUILDER *builder, GPS_LOCATION_INFO *gps_data, char *iccid) {
+    PayloadLineStart(builder, "gps");
+    PayloadTag(builder, "name", TELEMETRY_DEVICE_NAME);
+    PayloadTag(builder, "ICCID", iccid);
+    PayloadFieldFixed(builder, "latitude", gps_data->latitude, GPS_COORDINATE_DECIMALS);
+    PayloadFieldFixed(builder, "longitude", gps_data->longitude, GPS_COORDINATE_DECIMALS);
+    PayloadFieldInt(builder, "altitude", gps_data->altitude);
+    PayloadFieldInt(builder, "hdop", gps_data->hdop);
+    PayloadFieldInt(builder, "valid_fix", gps_data->valid_fix);
+    PayloadFieldInt(builder, "num_sats", gps_data->num_sats);
+}
+
+int GPSGetPayload(GPS_LOCATION_INFO * gps_data, char * iccid, char * unix_time, char * gps_payload, uint32_t maxlen) {
+    //latitude=31.7498445,longitude=35.1838178,altitude=10,hdop=2,valid_fix=1,num_sats=4 1557086230000000000
+    PAYLOAD_BUILDER builder;
+    PayloadInit(&builder, gps_payload, maxlen);
+    writeFixLine(&builder, gps_data, iccid);
+    PayloadLineEnd(&builder, unix_time);
+    return PayloadGetLength(&builder);
+}
 
-    //FORMAT "--data-binary gps,name=NetanelFayoumi_SapirElyovitch,ICCID=%s latitude=%f,longitude=%f,altitude=%ld,hdop=%u,valid_fix=%u,num_sats=%u %s"
-	int	payload_len = sprintf(gps_payload, GPS_PAYLOAD_FORMAT,
-								  iccid, lat_deg, long_deg, gps_data->altitude,
-								  gps_data->hdop, gps_data->valid_fix, gps_data->num_sats, unix_time);
+int GPSGetSPEEDPayload(GPS_LOCATION_INFO * gps_data, char * iccid, char * unix_time, bool highspeed, char * gps_payload, uint32_t maxlen) {
+    PAYLOAD_BUILDER builder;
+    PayloadInit(&builder, gps_payload, maxlen);
+    writeFixLine(&builder, gps_data, iccid);
+    PayloadFieldRaw(&builder, "highspeed", highspeed ? "true" : "false");
+    PayloadLineEnd(&builder, unix_time);
+    return PayloadGetLength(&builder);
+}
 
-    return payload_len;
+/**
+ * Writes the map head and the fields of writeFixLine.
+ * @param extra_pairs - pairs the caller adds after them.
+ */
+static void writeCBORFix(CBOR_WRITER *writer, GPS_LOCATION_INFO *gps_data, char *iccid, uint32_t unix_time, uint32_t extra_pairs) {
+    CborMap(writer, GPS_CBOR_PAIRS + extra_pairs);
+    CborText(writer, "m");
+    CborText(writer, "gps");
+    CborText(writer, "name");
+    CborText(writer, TELEMETRY_DEVICE_NAME);
+    CborText(writer, "ICCID");
+    CborText(writer, iccid);
+    CborText(writer, "t");
+    CborUint(writer, unix_time);
+    CborText(writer, "latitude");       // 1e-7 degrees
+    CborInt(writer, gps_data->latitude);
+    CborText(writer, "longitude");
+    CborInt(writer, gps_data->longitude);
+    CborText(writer, "altitude");
+    CborInt(writer, gps_data->altitude);
+    CborText(writer, "hdop");
+    CborUint(writer, gps_data->hdop);
+    CborText(writer, "valid_fix");
+    CborBool(writer, gps_data->valid_fix);
+    CborText(writer, "num_sats");
+    CborUint(writer, gps_data->num_sats);
 }
 
-int GPSGetSPEEDPayload(GPS_LOCATION_INFO * gps_data, char * iccid, char * unix_time, bool highspeed, char * gps_payload) {
-    float lat_deg = (gps_data->latitude) / 10000000.0;
-    float long_deg = (gps_data->longitude) / 10000000.0;
+int GPSGetCBORPayload(GPS_LOCATION_INFO * gps_data, char * iccid, uint32_t unix_time, uint8_t * buf, uint32_t maxlen) {
+    CBOR_WRITER writer;
+    CborInit(&writer, buf, maxlen);
+    writeCBORFix(&writer, gps_data, iccid, unix_time, 0);
+    return CborGetLength(&writer);
+}
 
-	char * highspeed_val = (highspeed? "true" : "false");
-    //GPS_PAYLOAD_SPEED_FORMAT "--data-binary gps,name=NetanelFayoumi_SapirElyovitch,ICCID=%s latitude=%f,longitude=%f,altitude=%d,hdop=%u,valid_fix=%u,num_sats=%u,highspeed=%s %s"
-	int payload_len = sprintf(gps_payload, GPS_PAYLOAD_SPEED_FORMAT,
-						  iccid, lat_deg, long_deg, gps_data->altitude,
-						  gps_data->hdop, gps_data->valid_fix, gps_data->num_sats, highspeed_val, unix_time);
-    return payload_len;
+int GPSGetSPEEDCBORPayload(GPS_LOCATION_INFO * gps_data, char * iccid, uint32_t unix_time, bool highspeed, uint8_t * buf, uint32_t maxlen) {
+    CBOR_WRITER writer;
+    CborInit(&writer, buf, maxlen);
+    writeCBORFix(&writer, gps_data, iccid, unix_time, 1);
+    CborText(&writer, "highspeed");
+    CborBool(&writer, highspeed);
+    return CborGetLength(&writer);
 }
 
 double GPSGetSpeedOfLocations(GPS_LOCATION_INFO * old_loc, GPS_LOCATION_INFO * new_loc) {
@@ -344,13 +585,7 @@ double GPSGetSpeedOfLocations(GPS_LOCATION_INFO * old_loc, GPS_LOCATION_INFO * n
 	double c = 2 * atan2(sqrt(a), sqrt(1-a));
 	double distance = c * EARTH_RADIUS_KMS;
 
-	char old_unix_time[35];
-	memset(old_unix_time, '\0', 35);
-	char new_unix_time[35];
-	memset(new_unix_time, '\0', 35);
-	GPSConvertFixtimeToUnixTime(old_loc, old_unix_time);
-	GPSConvertFixtimeToUnixTime(new_loc, new_unix_time);
-	int time_diff_sec = atoi(new_unix_time) - atoi(old_unix_time);
+	int time_diff_sec = (int) (GPSGetUnixTime(new_loc) - GPSGetUnixTime(old_loc));
 	double speed_kmps = distance / time_diff_sec;
 	double speed_kph = speed_kmps * 3600.0;
 	return speed_kph;
@@ -11,6 +11,9 @@
 #include <stdbool.h>
 #include <math.h>
 #include "serial_io_uart.h"
+#include "timebase.h"
+#include "cbor.h"
+#include "payload.h"
 
 extern bool DEBUG;
 
@@ -21,6 +24,8 @@ extern bool DEBUG;
 #define GPS_BAUD_RATE 9600
 #define MAX_NMEA_LEN 82
 #define RECV_TIMEOUT_MS 3000
+#define GPS_TRACK_MINUTES 10	// track kept in RAM by the background pipeline
+#define GPS_TRACK_SIZE (GPS_TRACK_MINUTES * 60)	// records, one fix per second
 #define EARTH_RADIUS_METERS 6378100
 #define EARTH_RADIUS_KMS 6373
 #define MATH_PI 3.14159265358979323846
@@ -40,18 +45,17 @@ extern bool DEBUG;
 #define GGA_MIN_REQUIRED_FIELDS 7 // time .. #satellites
 #define RMC_DATE_FIELD 8
 #define RMC_TIME_FIELD 0
+#define RMC_SPEED_FIELD 6
 
 #define FLOAT_RMV_FACTOR 10000000
 #define ALT_FACTOR 100
 #define HDOP_FACTOR 5
 #define LAT_DEG_DIGITS 2
 #define LONGIT_DEG_DIGITS 3
+#define KNOTS_TO_CM_PER_SEC 51.4444
 
 #define DATE_FORMAT "%c%c:%c%c:%c%c %c%c.%c%c.%c%c"
 
-#define GPS_PAYLOAD_FORMAT "--data-binary gps,name=NetanelFayoumi_SapirElyovitch,ICCID=%s latitude=%f,longitude=%f,altitude=%d,hdop=%u,valid_fix=%u,num_sats=%u %s000000000"
-#define GPS_PAYLOAD_SPEED_FORMAT "--data-binary gps,name=NetanelFayoumi_SapirElyovitch,ICCID=%s latitude=%f,longitude=%f,altitude=%d,hdop=%u,valid_fix=%u,num_sats=%u,highspeed=%s %s000000000"
-
 typedef __packed struct _GPS_LOCATION_INFO {
     int32_t latitude;
     int32_t longitude;
@@ -60,9 +64,26 @@ typedef __packed struct _GPS_LOCATION_INFO {
     uint8_t valid_fix : 1;
     uint8_t reserved1 : 3;
     uint8_t num_sats : 4;
+    uint16_t speed; // cm/s, from RMC
     char fixtime[18]; // hh:mm:ss DD.MM.YY\0
 } GPS_LOCATION_INFO;
 
+/* Flags of a GPS_FIX_RECORD, next to the number of satellites */
+#define GPS_RECORD_SATS_MASK 0x0F
+#define GPS_RECORD_VALID_FIX 0x10
+#define GPS_RECORD_HAS_SPEED 0x20	// an RMC line of the epoch gave the speed
+
+/* One fix of the track, 16 bytes. Fields are ordered to need no padding. */
+typedef struct _GPS_FIX_RECORD {
+    int32_t latitude;     // 1e-7 degrees
+    int32_t longitude;    // 1e-7 degrees
+    uint16_t time_delta;  // seconds since the track's base time
+    int16_t altitude;     // meters above sea level
+    uint16_t speed;       // cm/s
+    uint8_t hdop;
+    uint8_t sats_flags;   // GPS_RECORD_SATS_MASK | GPS_RECORD_* flags
+} GPS_FIX_RECORD;
+
 
 
 /**************************************************************************//**
@@ -71,7 +92,7 @@ typedef __packed struct _GPS_LOCATION_INFO {
 void GPSInit();
 
 /**
- * Gets line from GPS.
+ * Gets the next line from GPS, as seen by the fix pipeline.
  * @param buf - output buffer to put the line into.
  * @param maxlen - max length of a line.
  * @return number of bytes received.
@@ -79,12 +100,62 @@ void GPSInit();
 uint32_t GPSGetReadRaw(char *buf, unsigned int maxlen);
 
 /**
- * Updates location with information from GPSGetReadRaw.
+ * Waits for the next valid fix of the pipeline.
  * @param location - the struct to be filled.
- * @return 0 if successful, -1 otherwise.
+ * @return true if successful, false otherwise.
  */
 bool GPSGetFixInformation(GPS_LOCATION_INFO *location);
 
+/**
+ * Parses every line buffered by the RX interrupt and stores the valid fixes
+ * in the history. Runs in the background on every wake up, from GPSInit on,
+ * and posts EVENT_GPS_FIX when fixes were stored.
+ * @return the number of fixes stored.
+ */
+uint32_t GPSProcessPending(void);
+
+/**
+ * @return the number of valid fixes stored since GPSInit.
+ */
+uint32_t GPSGetFixCount(void);
+
+/**
+ * Gets the newest fix.
+ * @param location - the struct to be filled.
+ * @return false if no fix was stored yet.
+ */
+bool GPSGetLatestFix(GPS_LOCATION_INFO *location);
+
+/**
+ * @return the number of records in the track, at most GPS_TRACK_SIZE.
+ */
+uint32_t GPSGetTrackLength(void);
+
+/**
+ * Gets one record of the track.
+ * @param age - 0 for the newest record, GPSGetTrackLength() - 1 for the oldest.
+ * @param record - the record to be filled.
+ * @param unix_time - set to the time of the record, may be NULL.
+ * @return false if there is no such record.
+ */
+bool GPSGetTrackRecord(uint32_t age, GPS_FIX_RECORD *record, uint32_t *unix_time);
+
+/**
+ * Takes a snapshot of the track.
+ * @param records - array to be filled, oldest record first.
+ * @param max_records - size of records.
+ * @param base_time - set to the unix time the time deltas count from.
+ * @return the number of records copied, the newest ones if there are more.
+ */
+uint32_t GPSGetTrack(GPS_FIX_RECORD *records, uint32_t max_records, uint32_t *base_time);
+
+/**
+ * Gets the fix time as a number.
+ * @param gps_data - fix with a fixtime.
+ * @return seconds since 1970 (UTC).
+ */
+uint32_t GPSGetUnixTime(GPS_LOCATION_INFO * gps_data);
+
 
 
 /**************************************************************************//**
@@ -99,11 +170,28 @@ void GPSConvertFixtimeToUnixTime(GPS_LOCATION_INFO * gps_data, char * unix_time)
   *
   * @param gps_data GPS LOCATION as received from GPS module
   * @param gps_payload where to store result
-  * @return length of payload
+  * @param maxlen size of gps_payload
+  * @return length of payload, -1 if it does not fit
   */
-int GPSGetPayload(GPS_LOCATION_INFO * gps_data, char * iccid, char * unix_time, char * gps_payload);
+int GPSGetPayload(GPS_LOCATION_INFO * gps_data, char * iccid, char * unix_time, char * gps_payload, uint32_t maxlen);
+
+int GPSGetSPEEDPayload(GPS_LOCATION_INFO * gps_data, char * iccid, char * unix_time, bool highspeed, char * gps_payload, uint32_t maxlen);
 
-int GPSGetSPEEDPayload(GPS_LOCATION_INFO * gps_data, char * iccid, char * unix_time, bool highspeed, char * gps_payload);
+/**
+ * Writes a fix as a CBOR map with the fields writeFixLine puts in the text line.
+ * @param gps_data - the fix.
+ * @param iccid - SIM ICCID.
+ * @param unix_time - time of the fix, from GPSGetUnixTime.
+ * @param buf - where to store the result.
+ * @param maxlen - size of buf.
+ * @return length of payload, -1 if it does not fit.
+ */
+int GPSGetCBORPayload(GPS_LOCATION_INFO * gps_data, char * iccid, uint32_t unix_time, uint8_t * buf, uint32_t maxlen);
+
+/**
+ * Like GPSGetCBORPayload, with the highspeed field of GPSGetSPEEDPayload.
+ */
+int GPSGetSPEEDCBORPayload(GPS_LOCATION_INFO * gps_data, char * iccid, uint32_t unix_time, bool highspeed, uint8_t * buf, uint32_t maxlen);
 
 double GPSGetSpeedOfLocations(GPS_LOCATION_INFO * old_loc, GPS_LOCATION_INFO * new_loc);
 
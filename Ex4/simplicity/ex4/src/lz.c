@@ -0,0 +1,197 @@
+/******************************************************************************
+ * @lz.c
+ * @brief Small LZ77 compressor and decompressor.
+ * A sequence is a token byte (literal count << 4 | match length - 4), counts
+ * of 15 continued in extra bytes of up to 255, the literals, a 16 bit little
+ * endian offset and the extra match length bytes. Offset 0 ends a chunk and
+ * has no match. Matches are found with a single entry hash table of the next
+ * 4 bytes, checked against the real bytes, which keeps the work per input
+ * byte constant.
+ * @version 0.0.1
+ *  **************************************************************************/
+#include <string.h>
+
+#include "lz.h"
+
+/******************************************************************************
+ * 								DEFS
+*****************************************************************************/
+#define MIN_MATCH 4
+#define RUN_MASK 15
+#define OFFSET_END 0
+#define HASH_MULTIPLIER 2654435761U
+
+
+/******************************************************************************
+ * @brief Output of one chunk, fails once out is full.
+ *****************************************************************************/
+typedef struct _LZ_OUTPUT {
+	uint8_t * buf;
+	uint32_t size;
+	uint32_t len;
+	bool overflow;
+} LZ_OUTPUT;
+
+static void putByte(LZ_OUTPUT * output, uint8_t byte) {
+	if (output->len >= output->size) {
+		output->overflow = true;
+		return;
+	}
+	output->buf[output->len++] = byte;
+}
+
+/******************************************************************************
+ * @brief Writes the part of a count above RUN_MASK.
+ *****************************************************************************/
+static void putCount(LZ_OUTPUT * output, uint32_t count) {
+	if (count < RUN_MASK) {
+		return;
+	}
+	for (count -= RUN_MASK; count >= 255; count -= 255) {
+		putByte(output, 255);
+	}
+	putByte(output, count);
+}
+
+/******************************************************************************
+ * @brief Writes a sequence, offset OFFSET_END for the last one of a chunk.
+ *****************************************************************************/
+static void putSequence(LZ_OUTPUT * output, const uint8_t * literals, uint32_t num_literals,
+						uint32_t offset, uint32_t match_len) {
+	uint32_t match_code = (offset == OFFSET_END) ? 0 : match_len - MIN_MATCH;
+	uint8_t token = ((num_literals < RUN_MASK ? num_literals : RUN_MASK) << 4)
+					| (match_code < RUN_MASK ? match_code : RUN_MASK);
+
+	putByte(output, token);
+	putCount(output, num_literals);
+	for (uint32_t i = 0; i < num_literals; i++) {
+		putByte(output, literals[i]);
+	}
+	putByte(output, offset & 0xFF);
+	putByte(output, offset >> 8);
+	if (offset != OFFSET_END) {
+		putCount(output, match_code);
+	}
+}
+
+/******************************************************************************
+ * @brief Gets the input byte at stream position, from the current piece or
+ * from the history of earlier ones.
+ *****************************************************************************/
+static uint8_t byteAt(const LZ_COMPRESSOR * lz, const uint8_t * in, uint32_t position) {
+	if (position >= lz->position) {
+		return in[position - lz->position];
+	}
+	return lz->window[position % LZ_WINDOW_SIZE];
+}
+
+static uint32_t hash(const uint8_t * bytes) {
+	uint32_t value = bytes[0] | (bytes[1] << 8) | (bytes[2] << 16) | ((uint32_t) bytes[3] << 24);
+	return (uint32_t) (value * HASH_MULTIPLIER) >> (32 - LZ_HASH_BITS);
+}
+
+void LzInit(LZ_COMPRESSOR * lz) {
+	memset(lz, 0, sizeof(LZ_COMPRESSOR));
+}
+
+int LzCompress(LZ_COMPRESSOR * lz, const uint8_t * in, uint32_t in_len, uint8_t * out, uint32_t out_size) {
+	LZ_OUTPUT output = {out, out_size, 0, false};
+	uint32_t literal_start = 0;
+	uint32_t i = 0;
+
+	while (i + MIN_MATCH <= in_len) {
+		uint32_t position = lz->position + i;
+		uint32_t slot = hash(&in[i]);
+		// positions are kept in 16 bits, the distance is right modulo 64K
+		uint32_t distance = (uint16_t) (position - lz->head[slot]);
+		lz->head[slot] = (uint16_t) position;
+
+		uint32_t match_len = 0;
+		if (distance > 0 && distance <= LZ_WINDOW_SIZE && distance <= position) {
+			while (i + match_len < in_len
+					&& byteAt(lz, in, position - distance + match_len) == in[i + match_len]) {
+				match_len++;
+			}
+		}
+		if (match_len < MIN_MATCH) {
+			i++;
+			continue;
+		}
+
+		putSequence(&output, &in[literal_start], i - literal_start, distance, match_len);
+		i += match_len;
+		literal_start = i;
+	}
+	putSequence(&output, &in[literal_start], in_len - literal_start, OFFSET_END, 0);
+
+	// keep the history of this piece for the next ones
+	for (uint32_t j = (in_len > LZ_WINDOW_SIZE) ? in_len - LZ_WINDOW_SIZE : 0; j < in_len; j++) {
+		lz->window[(lz->position + j) % LZ_WINDOW_SIZE] = in[j];
+	}
+	lz->position += in_len;
+
+	if (output.overflow) {
+		return -1;
+	}
+	lz->output_len += output.len;
+	return output.len;
+}
+
+/******************************************************************************
+ * @brief Reads the part of a count above RUN_MASK.
+ * @return false if the input ends.
+ *****************************************************************************/
+static bool getCount(const uint8_t * in, uint32_t in_len, uint32_t * pos, uint32_t * count) {
+	if (*count < RUN_MASK) {
+		return true;
+	}
+	while (*pos < in_len) {
+		uint8_t byte = in[(*pos)++];
+		*count += byte;
+		if (byte != 255) {
+			return true;
+		}
+	}
+	return false;
+}
+
+int LzDecompress(const uint8_t * in, uint32_t in_len, uint8_t * out, uint32_t out_size) {
+	uint32_t pos = 0;
+	uint32_t out_len = 0;
+
+	while (pos < in_len) {
+		uint8_t token = in[pos++];
+		uint32_t num_literals = token >> 4;
+		uint32_t match_len = token & RUN_MASK;
+
+		if (!getCount(in, in_len, &pos, &num_literals)
+				|| num_literals > in_len - pos || num_literals > out_size - out_len) {
+			return -1;
+		}
+		memcpy(&out[out_len], &in[pos], num_literals);
+		pos += num_literals;
+		out_len += num_literals;
+
+		if (in_len - pos < 2) {
+			return -1;
+		}
+		uint32_t offset = in[pos] | (in[pos + 1] << 8);
+		pos += 2;
+		if (offset == OFFSET_END) {
+			continue;
+		}
+
+		if (!getCount(in, in_len, &pos, &match_len)) {
+			return -1;
+		}
+		match_len += MIN_MATCH;
+		if (offset > out_len || match_len > out_size - out_len) {
+			return -1;
+		}
+		// byte by byte, the match may overlap its own output
+		for (uint32_t i = 0; i < match_len; i++, out_len++) {
+			out[out_len] = out[out_len - offset];
+		}
+	}
+	return out_len;
+}
@@ -0,0 +1,62 @@
+/******************************************************************************
+ * @lz.h
+ * @brief Interface for a small LZ77 compressor for upload payloads.
+ * The input is compressed in pieces, each piece is a chunk of LZ4-like
+ * sequences ended by a zero offset and may refer back to every earlier piece.
+ * The compressor keeps a 1 KB history and a 512 byte hash table.
+ * @version 0.0.1
+ *  **************************************************************************/
+#ifndef SRC_LZ_H_
+#define SRC_LZ_H_
+
+#include <stdbool.h>
+#include <stdint.h>
+
+/******************************************************************************
+ * 								DEFS
+*****************************************************************************/
+#define LZ_CONTENT_TYPE "application/x-ex4-lz"
+#define LZ_WINDOW_SIZE 1024				// back references reach this far
+#define LZ_HASH_BITS 8
+#define LZ_HASH_SIZE (1 << LZ_HASH_BITS)
+#define LZ_BOUND(len) ((len) + (len) / 255 + 16)	// worst case output of one piece
+
+typedef struct _LZ_COMPRESSOR {
+	uint8_t window[LZ_WINDOW_SIZE];		// last input bytes, indexed by position % LZ_WINDOW_SIZE
+	uint16_t head[LZ_HASH_SIZE];		// newest position of each 4 byte hash
+	uint32_t position;					// input bytes compressed so far
+	uint32_t output_len;
+} LZ_COMPRESSOR;
+
+
+/******************************************************************************
+ * @brief Starts a new stream.
+ * @param lz - compressor state.
+ *****************************************************************************/
+void LzInit(LZ_COMPRESSOR * lz);
+
+
+/******************************************************************************
+ * @brief Compresses the next piece of the stream.
+ * @param lz - compressor state.
+ * @param in - the piece.
+ * @param in_len - its length.
+ * @param out - output buffer, the chunk is written at its start.
+ * @param out_size - size of out, LZ_BOUND(in_len) always fits.
+ * @return length of the chunk, -1 if out is too small.
+ *****************************************************************************/
+int LzCompress(LZ_COMPRESSOR * lz, const uint8_t * in, uint32_t in_len, uint8_t * out, uint32_t out_size);
+
+
+/******************************************************************************
+ * @brief Decompresses a whole stream, all of its chunks one after the other.
+ * @param in - compressed stream.
+ * @param in_len - its length.
+ * @param out - output buffer.
+ * @param out_size - size of out.
+ * @return length of the output, -1 if the stream is corrupted or too long.
+ *****************************************************************************/
+int LzDecompress(const uint8_t * in, uint32_t in_len, uint8_t * out, uint32_t out_size);
+
+
+#endif /* SRC_LZ_H_ */
@@ -1,5 +1,16 @@
 #include "gps.h"
 #include "cellular.h"
+#include "energy.h"
+#include "timebase.h"
+#include "timer.h"
+#include "scheduler.h"
+#include "flash_log.h"
+#include "telemetry.h"
+#include "cbor.h"
+#include "lz.h"
+#include "session.h"
+#include "mqtt.h"
+#include "coap.h"
 
 #include <stdio.h>
 #include "em_device.h"
@@ -22,8 +33,14 @@
  * 								DECLARATIONS
 *****************************************************************************/
 void Delay(uint32_t dlyTicks);
-void infoOnDemand(GPS_LOCATION_INFO* last_location);
-void speedLimitInterval(GPS_LOCATION_INFO* last_location, GPS_LOCATION_INFO* old_location);
+void onButton(const EVENT * event);
+void onGPSFix(const EVENT * event);
+void onTimer(const EVENT * event);
+void onStep(const EVENT * event);
+void onMqtt(const EVENT * event);
+void onCellularData(const EVENT * event);
+void infoOnDemandStep(void);
+void speedLimitStep(void);
 
 /****************************************************************************
  * 								DEFS
@@ -31,12 +48,54 @@ void speedLimitInterval(GPS_LOCATION_INFO* last_location, GPS_LOCATION_INFO* old
 #define PRINT_FORMAT "\fIteration #%d \nLatitude:\n%d\nLongitude:\n%d\nAltitude:\n%d\nTime:\n%s\nGoogle Maps:\n%f, %f\n"
 #define MAX_IL_CELL_OPS 10
 #define TRANSMIT_URL "https://en8wtnrvtnkt5.x.pipedream.net/write?db=mydb"
+#define CBOR_URL "https://en8wtnrvtnkt5.x.pipedream.net/cbor"
+#define TELEMETRY_URL "https://en8wtnrvtnkt5.x.pipedream.net/telemetry"	// ingest expands batches to TRANSMIT_URL lines
+#define UPLOAD_ACCEPTED "\"success\":true"	// in the response body once the server took an upload
+#define SESSION_ADDRESS "socktcp://ingest.example.com:5000"	// runs the sim/session_server stand-in
+#define MQTT_ADDRESS "socktcp://broker.example.com:1883"	// runs the sim/mqtt_broker stand-in
+#define MQTT_SRV_PROFILE_ID 2
+#define MQTT_KEEPALIVE_S 300
+#define MQTT_QOS 1
+#define MQTT_TOPIC_SIZE 32
+#define MQTT_TOPIC_LZ_SUFFIX "/lz"
+#define COAP_ADDRESS "sockudp://coap.example.com:5683"	// runs the sim/coap_server stand-in
+#define COAP_SRV_PROFILE_ID 3
+#define COAP_CONFIRMABLE true
 #define ONE_MINUTE_IN_MS 60000
 #define FIVE_SECS_IN_MS 5000
+#define REGISTRATION_TIMEOUT_MS ONE_MINUTE_IN_MS	// to register with a chosen operator
+#define REGISTRATION_SLICE_MS 100		// +CREG wait of one OD_CONNECT_STATUS step
+#define REGISTRATION_POLL_MS 1000		// between OD_CONNECT_STATUS steps while the modem sends nothing
+#define CAPSENSE_SCAN_MS 100
 #define MIN_SPEED_LIM 0
 #define MAX_SPEED_LIM 30
-
-enum PROCEDURE_TO_RUN{WAIT_FOR_USER, GPS_CELL_ON_DEMAND, SPEED_LIMIT_INIT, SPEED_LIMIT};
+#define ON_DEMAND_FIXES 10
+#define SPEED_LIMIT_INIT_FIXES 10
+#define SPEED_LIMIT_SAMPLE_FIXES 5
+#define PAYLOAD_BUFFER_SIZE 1000
+#define BENCHMARK_RUNS 100
+#define STACK_PROBE_WORDS 256		// stack below the benchmark checked for use, down to __StackLimit
+#define STACK_PAINT 0xDEADBEEF
+#define LOG_FLUSH_MS ONE_MINUTE_IN_MS	// fixes not in a full page yet reach flash by then
+
+enum PROCEDURE_TO_RUN{WAIT_FOR_USER, GPS_CELL_ON_DEMAND, SPEED_LIMIT};
+enum JOB{JOB_GPS_SAMPLE, JOB_CAPSENSE_SCAN, JOB_LOG_FLUSH, JOB_MODEM_SLEEP};
+
+/* Payload of a FLASH_LOG_TYPE_FIX record */
+typedef struct _LOGGED_FIX {
+	uint32_t unix_time;
+	GPS_FIX_RECORD record;
+} LOGGED_FIX;
+
+/* Steps of infoOnDemand, each one does at most a couple of AT commands */
+enum ON_DEMAND_STATE{OD_CHECK_MODEM, OD_DEREGISTER, OD_FIND_OPERATORS,
+					 OD_SCAN_DEREGISTER, OD_SCAN_REGISTER, OD_SCAN_STATUS,
+					 OD_CONNECT_DEREGISTER, OD_CONNECT_REGISTER, OD_CONNECT_STATUS,
+					 OD_SETUP_INTERNET, OD_JOIN_GPS, OD_SEND_GPS, OD_SEND_CELL, OD_DONE};
+
+/* Steps of the speed limit procedure */
+enum SPEED_LIMIT_STATE{SL_COLLECT_FIXES, SL_IDLE, SL_SAMPLE, SL_FIND_OPERATORS,
+					   SL_DEREGISTER, SL_REGISTER, SL_SETUP_INTERNET, SL_SEND};
 
 /**************************************************************************//**
  * 							GLOBAL VARIABLES
@@ -53,34 +112,128 @@ static char* MODEM_PORT = "0";
 #endif
 
 bool DEBUG = true;
-volatile uint32_t msTicks = 0; /* counts 1ms timeTicks */
-
-enum PROCEDURE_TO_RUN CURRENT_OPERATION = WAIT_FOR_USER;
+static bool CBOR_PAYLOADS = false;	// post application/cbor to CBOR_URL instead of lines to TRANSMIT_URL
+static bool COMPRESS_PAYLOADS = false;	// LZ compress uploads, lines go to the ingest at TELEMETRY_URL
+static bool SOCKET_SESSION = false;	// send uploads as records over a TCP socket kept open, instead of HTTP posts
+static bool MQTT_PAYLOADS = false;	// publish uploads to the broker at MQTT_ADDRESS, instead of HTTP posts
+static bool COAP_PAYLOADS = false;	// POST uploads as CoAP datagrams to COAP_ADDRESS, instead of HTTP posts
+static bool MODEM_MUX = false;		// run the modem link as CMUX channels, status queries apart from uploads
+static bool BENCHMARK_PAYLOADS = false;	// print size, cycles and stack of each payload builder on every on-demand run
+/* Modem power between uploads: POWER_POLICY_SLEEP or _DEEP_SLEEP trade upload latency for battery */
+static const CELLULAR_POWER_POLICY MODEM_POWER_POLICY = POWER_POLICY_ALWAYS_ON;
+
+static enum PROCEDURE_TO_RUN CURRENT_OPERATION = WAIT_FOR_USER;
+static uint32_t current_run = 0;	// changes on every button press, old steps are ignored
 static int speed_limit = MIN_SPEED_LIM;
 static bool high_speed_flag = false;
 static bool transmit_speed_event = false;
-static uint32_t last_location_Ticks = 0;
-static uint32_t old_location_Ticks = 0;
+
+static GPS_LOCATION_INFO* last_location = NULL;
+static GPS_LOCATION_INFO* old_location = NULL;
+static uint32_t fixes_target = 0;	// GPSGetFixCount to reach, 0 once reached
+static bool fixes_collected = false;
+
+/* infoOnDemand acquires GPS and attaches the modem at the same time */
+static uint64_t run_started_ms = 0;
+static uint64_t fixes_ready_ms = 0;
+static uint64_t modem_ready_ms = 0;
+
+static TIMER gps_sample_timer;
+static TIMER capsense_scan_timer;
+static TIMER step_timer;
+static TIMER log_flush_timer;
+static TIMER modem_idle_timer;
+static uint32_t logged_fix_count = 0;	// GPSGetFixCount of the last fix logged to flash
+
+/* State of the running procedure, only one runs at a time */
+static enum ON_DEMAND_STATE on_demand_state = OD_DONE;
+static enum SPEED_LIMIT_STATE speed_limit_state = SL_IDLE;
+static OPERATOR_INFO operators_info[MAX_IL_CELL_OPS];
+static OPERATOR_INFO past_registerd_operators[MAX_IL_CELL_OPS];
+static int num_operators_found = 0;
+static int num_of_past_registerd = 0;
+static int op_index = 0;
+static uint64_t registration_deadline_ms = 0;	// OD_CONNECT_STATUS gives the operator up then
+static char iccid[ICCID_BUFFER_SIZE] = "";
+static char unix_time[35] = "";
+static char payload[PAYLOAD_BUFFER_SIZE] = "";
+static int payload_len = 0;
+static TELEMETRY_BATCH telemetry_batch;
+static FLASH_LOG_CURSOR batch_end;	// first log record not in telemetry_batch
+static LZ_COMPRESSOR compressor;
+static uint8_t compressed[LZ_BOUND(PAYLOAD_BUFFER_SIZE)];
+static MQTT_CLIENT mqtt_client;
+static COAP_CLIENT coap_client;
+/* Topic of each SESSION_RECORD_* type */
+static const char * const MQTT_TOPICS[] = {"ex4", "ex4/lines", "ex4/telemetry", "ex4/cbor"};
 
 /***************************************************************************//**
- * @brief SysTick_Handler
- * Interrupt Service Routine for system tick counter
+ * @brief Timer callback, posts the job given in arg unless it is still queued.
+ * @param arg the job (enum JOB)
  ******************************************************************************/
-void SysTick_Handler(void)
+void postJob(void * arg)
 {
-  msTicks++;       /* increment counter necessary in Delay()*/
+  SchedulerPostOnce(EVENT_PRIORITY_NORMAL, EVENT_TIMER, (uint32_t) (uintptr_t) arg);
 }
 
 /***************************************************************************//**
- * @brief Delays number of msTick Systicks (typically 1 ms)
- * @param dlyTicks Number of ticks to delay
+ * @brief Starts collecting num_fixes more valid fixes, fixes_collected is set
+ * when they were stored.
  ******************************************************************************/
-void Delay(uint32_t dlyTicks)
+void waitForFixes(uint32_t num_fixes)
+{
+  fixes_target = GPSGetFixCount() + num_fixes;
+  fixes_collected = false;
+}
+
+/***************************************************************************//**
+ * @return true if the current procedure cannot go on until fixes_collected.
+ ******************************************************************************/
+bool stepWaitsForFixes(void)
+{
+  return (CURRENT_OPERATION == GPS_CELL_ON_DEMAND && on_demand_state == OD_JOIN_GPS)
+		  || (CURRENT_OPERATION == SPEED_LIMIT
+			  && (speed_limit_state == SL_COLLECT_FIXES || speed_limit_state == SL_SAMPLE));
+}
+
+/***************************************************************************//**
+ * @brief Timer callback, posts the next step of the run given in arg.
+ * @param arg the run the step belongs to
+ ******************************************************************************/
+void postStep(void * arg)
+{
+  SchedulerPost(EVENT_PRIORITY_LOW, EVENT_STEP, (uint32_t) (uintptr_t) arg);
+}
+
+/***************************************************************************//**
+ * @brief Runs the next step of the current procedure after delay_ms.
+ * @param delay_ms 0 to run it as soon as higher priority events are handled
+ ******************************************************************************/
+void scheduleStep(uint32_t delay_ms)
 {
-  uint32_t curTicks;
+  if (delay_ms == 0) {
+	  postStep((void *) (uintptr_t) current_run);
+  } else {
+	  TimerStart(&step_timer, delay_ms, 0, postStep, (void *) (uintptr_t) current_run);
+  }
+}
 
-  curTicks = msTicks;
-  while ((msTicks - curTicks) < dlyTicks) ;
+/***************************************************************************//**
+ * @param timeout_ms Time to wait for the +CREG URC, 0 to check once
+ * @return true if the modem is registered to home network (1) or roaming (5).
+ ******************************************************************************/
+bool isRegistered(uint32_t timeout_ms)
+{
+  return CellularWaitForRegistration(timeout_ms);
+}
+
+/***************************************************************************//**
+ * @brief Sleeps for dlyTicks milliseconds.
+ * @param dlyTicks Number of ms to delay
+ ******************************************************************************/
+void Delay(uint32_t dlyTicks)
+{
+  EnergyDelay(dlyTicks);
 }
 
 /*******************************************************************************
@@ -118,9 +271,23 @@ void initDeviceSettings() {
 	NVIC_EnableIRQ(GPIO_ODD_IRQn);
 
 
-	/* Setup SysTick Timer for 1 msec interrupts  */
-	if (SysTick_Config(CMU_ClockFreqGet(cmuClock_CORE) / 1000)) {
-		while (1) ;
+	/* Start the tickless RTCC timebase, waits sleep in EM1/EM2 from now on */
+	TimebaseInit();
+	EnergyInit();
+
+	/* Recover the trip log, fixes are kept there while there is no coverage */
+	if (!FlashLogInit()) {
+		printf("Flash log init failed\n");
+	}
+	SessionInit(SESSION_ADDRESS);
+	MqttInit(&mqtt_client, MQTT_SRV_PROFILE_ID, MQTT_ADDRESS, iccid, MQTT_KEEPALIVE_S);
+	CoapInit(&coap_client, COAP_SRV_PROFILE_ID, COAP_ADDRESS);
+
+	/* Cycle counter for the payload benchmarks */
+	if (DEBUG) {
+		CoreDebug->DEMCR |= CoreDebug_DEMCR_TRCENA_Msk;
+		DWT->CYCCNT = 0;
+		DWT->CTRL |= DWT_CTRL_CYCCNTENA_Msk;
 	}
 
 	/* Start capacitive sense buttons */
@@ -143,14 +310,14 @@ int main(void)
 	initDeviceSettings();
 
 	/* General declarations and memory allocations for main use. */
-	GPS_LOCATION_INFO* last_location = malloc(sizeof(GPS_LOCATION_INFO));
+	last_location = malloc(sizeof(GPS_LOCATION_INFO));
 	if (last_location == NULL) {
 	  printf("Memory Allocation Error");
 	  return 1;
 	} else {
 		memset(last_location->fixtime, '\0', 18);
 	}
-	GPS_LOCATION_INFO* old_location = malloc(sizeof(GPS_LOCATION_INFO));
+	old_location = malloc(sizeof(GPS_LOCATION_INFO));
 	if (old_location == NULL) {
 		printf("Memory Allocation Error");
 		return 1;
@@ -164,59 +331,32 @@ int main(void)
 	Delay(1000);
 	GPSInit(GPS_PORT);
 	CellularInit(MODEM_PORT);
+	if (MODEM_MUX && !CellularEnableMux()) {
+		printf("CMUX failed, single channel\n");
+	}
+	if (!CellularSetPowerPolicy(&MODEM_POWER_POLICY)) {
+		printf("modem power saving partly unsupported\n");
+	}
 	printf("\fDear user,\nPlease press any button.\n");
 	printf("BTN0:\n  GPS+CELL on demand\n");
 	printf("BTN1:\n  Speed limit\n");
 
-	while(true) {
-		if (CURRENT_OPERATION == GPS_CELL_ON_DEMAND) {
-			CURRENT_OPERATION = WAIT_FOR_USER;
-			infoOnDemand(last_location);
+	SchedulerSetHandler(EVENT_BUTTON, onButton);
+	SchedulerSetHandler(EVENT_GPS_FIX, onGPSFix);
+	SchedulerSetHandler(EVENT_TIMER, onTimer);
+	SchedulerSetHandler(EVENT_STEP, onStep);
+	SchedulerSetHandler(EVENT_MQTT, onMqtt);
+	SchedulerSetHandler(EVENT_CELLULAR_RX, onCellularData);
+	TimerStart(&log_flush_timer, LOG_FLUSH_MS, LOG_FLUSH_MS, postJob, (void *) (uintptr_t) JOB_LOG_FLUSH);
 
-		} else if (CURRENT_OPERATION == SPEED_LIMIT_INIT) {
-			speed_limit = MIN_SPEED_LIM;
-			high_speed_flag = false;
-			transmit_speed_event = false;
-			// update location
-			uint32_t iteration_counter = 10;
-			while (iteration_counter > 0) {
-				bool result;
-				result = GPSGetFixInformation(last_location);
-				if (result && last_location->valid_fix == 1){
-					iteration_counter--;
-				}
-			}
-			last_location_Ticks = msTicks;
-			old_location = memcpy(old_location, last_location, sizeof(GPS_LOCATION_INFO));
-			old_location_Ticks = last_location_Ticks;
-			CURRENT_OPERATION = SPEED_LIMIT;
-
-		} else if (CURRENT_OPERATION == SPEED_LIMIT) {
-			printf("\fcurrent speed limit:\n%2d Km/h", speed_limit);
-			if (msTicks - last_location_Ticks > FIVE_SECS_IN_MS) {
-				speedLimitInterval(last_location, old_location);
-			}
-
-			Delay(100);
-			CAPSENSE_Sense();
-
-			if (CAPSENSE_getPressed(BUTTON1_CHANNEL)
-				&& !CAPSENSE_getPressed(BUTTON0_CHANNEL)) {
-				if (speed_limit < MAX_SPEED_LIM){
-					speed_limit += 5;
-				}
-			  printf("\r%2d", speed_limit);
-			} else if (CAPSENSE_getPressed(BUTTON0_CHANNEL)
-					   && !CAPSENSE_getPressed(BUTTON1_CHANNEL)) {
-			  if (speed_limit > MIN_SPEED_LIM) {
-				  speed_limit -= 5;
-			  }
-			  printf("\r%2d", speed_limit);
-			}
-		}
-	}
+	/* handle events until power off, sleeps while there are none */
+	SchedulerRun();
 
 	printf("\nDisabling Cellular and exiting..\n");
+	FlashLogFlush();
+	SessionClose();
+	MqttDisconnect(&mqtt_client);
+	CoapClose(&coap_client);
 	CellularDisable();
 	GPSDisable();
 
@@ -224,234 +364,801 @@ int main(void)
 	exit(0);
 }
 
-void infoOnDemand(GPS_LOCATION_INFO* last_location) {
-	// update location
-	uint32_t iteration_counter = 10;
-	while (iteration_counter > 0) {
-		bool result;
-		result = GPSGetFixInformation(last_location);
-		if (result && last_location->valid_fix == 1){
-			iteration_counter--;
-		}
+/***************************************************************************//**
+ * @brief Starts the procedure of the pressed button, stopping the running one.
+ ******************************************************************************/
+void onButton(const EVENT * event)
+{
+	/* Clear screen */
+	printf("\f");
+	TimerStop(&gps_sample_timer);
+	TimerStop(&capsense_scan_timer);
+	TimerStop(&step_timer);
+	TimerStop(&modem_idle_timer);
+	current_run++;
+
+	if (event->data == 0) {
+		// the GPS pipeline collects fixes while the modem attaches
+		CURRENT_OPERATION = GPS_CELL_ON_DEMAND;
+		run_started_ms = TimebaseGetMs();
+		waitForFixes(ON_DEMAND_FIXES);
+		on_demand_state = OD_CHECK_MODEM;
+		scheduleStep(0);
+	} else {
+		CURRENT_OPERATION = SPEED_LIMIT;
+		speed_limit = MIN_SPEED_LIM;
+		high_speed_flag = false;
+		transmit_speed_event = false;
+		speed_limit_state = SL_COLLECT_FIXES;
+		waitForFixes(SPEED_LIMIT_INIT_FIXES);
 	}
+}
 
-	// Makes sure its responding to AT commands.
-	// looping to check modem responsiveness.
-	while (!CellularCheckModem()) {
-		Delay(WAIT_BETWEEN_CMDS_MS);
+/***************************************************************************//**
+ * @brief Appends the track records stored since the last call to the flash log.
+ ******************************************************************************/
+static void logNewFixes(void)
+{
+	uint32_t fix_count = GPSGetFixCount();
+	uint32_t new_fixes = fix_count - logged_fix_count;
+	if (new_fixes > GPSGetTrackLength()) {
+		new_fixes = GPSGetTrackLength();
+	}
+	logged_fix_count = fix_count;
+
+	// oldest first
+	while (new_fixes > 0) {
+		LOGGED_FIX entry;
+		new_fixes--;
+		if (GPSGetTrackRecord(new_fixes, &entry.record, &entry.unix_time)) {
+			FlashLogAppend(FLASH_LOG_TYPE_FIX, &entry, sizeof(entry));
+		}
 	}
+}
+
+/***************************************************************************//**
+ * @brief Payload builders measured by benchmarkPayloads, on the last fix and
+ * the registered operators. Each one fills the payload buffer.
+ ******************************************************************************/
+static int benchGPSText(void)
+{
+	return GPSGetPayload(last_location, iccid, unix_time, payload, PAYLOAD_BUFFER_SIZE);
+}
+
+static int benchGPSCBOR(void)
+{
+	return GPSGetCBORPayload(last_location, iccid, GPSGetUnixTime(last_location), (uint8_t *) payload, PAYLOAD_BUFFER_SIZE);
+}
+
+static int benchSpeedText(void)
+{
+	return GPSGetSPEEDPayload(last_location, iccid, unix_time, false, payload, PAYLOAD_BUFFER_SIZE);
+}
 
-	// Setting modem to unregister and remain unregistered.
-	while (!CellularSetOperator(DEREGISTER, NULL)) {
-		Delay(WAIT_BETWEEN_CMDS_MS);
+static int benchSpeedCBOR(void)
+{
+	return GPSGetSPEEDCBORPayload(last_location, iccid, GPSGetUnixTime(last_location), false,
+								  (uint8_t *) payload, PAYLOAD_BUFFER_SIZE);
+}
+
+static int benchCellText(void)
+{
+	return CellularGetPayload(past_registerd_operators, num_of_past_registerd, iccid, unix_time,
+							  payload, PAYLOAD_BUFFER_SIZE);
+}
+
+static int benchCellCBOR(void)
+{
+	return CellularGetCBORPayload(past_registerd_operators, num_of_past_registerd, iccid,
+								  GPSGetUnixTime(last_location), (uint8_t *) payload, PAYLOAD_BUFFER_SIZE);
+}
+
+/* Lowest address of the stack, from the linker script */
+extern uint32_t __StackLimit;
+
+/***************************************************************************//**
+ * @brief Gets the stack a builder uses: paints the unused stack below the
+ * current frame, no further than the end of the stack, runs the builder and
+ * finds the deepest word it changed. Interrupts in between can only make the
+ * result larger.
+ ******************************************************************************/
+static uint32_t measureStack(int (*builder)(void))
+{
+	uint32_t * top = (uint32_t *) __get_MSP();
+	uint32_t * limit = &__StackLimit;
+	uint32_t * bottom = (top - limit > STACK_PROBE_WORDS) ? top - STACK_PROBE_WORDS : limit;
+	uint32_t * word;
+
+	for (word = bottom; word < top; word++) {
+		*word = STACK_PAINT;
 	}
+	builder();
+	for (word = bottom; word < top && *word == STACK_PAINT; word++);
+	return (top - word) * sizeof(uint32_t);
+}
 
+/***************************************************************************//**
+ * @brief Prints the size, encode time and stack use of the text and CBOR
+ * payloads. Uses the payload buffer.
+ ******************************************************************************/
+static void benchmarkPayloads(void)
+{
+	const char * names[] = {"gps text", "gps cbor", "speed text", "speed cbor", "cell text", "cell cbor"};
+	int (*builders[])(void) = {benchGPSText, benchGPSCBOR, benchSpeedText, benchSpeedCBOR,
+							   benchCellText, benchCellCBOR};
+
+	for (int b = 0; b < sizeof(builders) / sizeof(builders[0]); b++) {
+		int len = 0;
+		uint32_t start = DWT->CYCCNT;
+		for (int i = 0; i < BENCHMARK_RUNS; i++) {
+			len = builders[b]();
+		}
+		uint32_t cycles = (DWT->CYCCNT - start) / BENCHMARK_RUNS;
+		printf("%s: %dB %lu cyc %luB stack\n", names[b], len, (unsigned long) cycles,
+			   (unsigned long) measureStack(builders[b]));
+	}
+}
 
-	// store data about found operators and registered ones.
-	OPERATOR_INFO operators_info[MAX_IL_CELL_OPS];
-	OPERATOR_INFO past_registerd_operators[MAX_IL_CELL_OPS];
-	int num_operators_found = 0;
-	int num_of_past_registerd = 0;
+/***************************************************************************//**
+ * @brief Checks the response of an HTTP upload. The modem does not pass the
+ * status code on, a ^SIS error already makes the post fail. Any other
+ * response counts only if its body says the server took the data.
+ * @param len - as returned by the post.
+ * @param response - the body, '\0' terminated.
+ * @return true if the server accepted the upload.
+ ******************************************************************************/
+static bool uploadAccepted(int len, const char * response)
+{
+	if (len == -1) {
+		return false;
+	}
+	if (strstr(response, UPLOAD_ACCEPTED) == NULL) {
+		if (DEBUG) { printf("upload refused: %.60s\n", response); }
+		return false;
+	}
+	return true;
+}
 
-	/* Finds all available cellular operators. */
-	printf("Finding all available cellular operators...");
-	while (!CellularGetOperators(operators_info, MAX_IL_CELL_OPS, &num_operators_found)) {
-		printf(".");
+/***************************************************************************//**
+ * @brief Posts data with AT^SISW, LZ compressed if COMPRESS_PAYLOADS is set.
+ * With SOCKET_SESSION set it goes out as a record of record_type instead.
+ * @return as CellularSendHTTPPOSTBinary, -1 also if the server refused it.
+ ******************************************************************************/
+static int postBinary(char * url, uint8_t record_type, const uint8_t * data, int len, const char * content_type)
+{
+	char transmit_response[100] = "";
+	if (COMPRESS_PAYLOADS) {
+		uint32_t start = DWT->CYCCNT;
+		LzInit(&compressor);
+		int compressed_len = LzCompress(&compressor, data, len, compressed, sizeof(compressed));
+		if (DEBUG && compressed_len > 0) {
+			printf("lz: %dB -> %dB, %lu cyc/KB\n", len, compressed_len,
+				   (unsigned long) ((uint64_t) (DWT->CYCCNT - start) * 1024 / len));
+		}
+		data = compressed;
+		len = compressed_len;
+		content_type = LZ_CONTENT_TYPE;
+		record_type |= SESSION_RECORD_LZ;
+	}
+	if (SOCKET_SESSION) {
+		return SessionSend(record_type, data, len) ? 0 : -1;
+	}
+	if (MQTT_PAYLOADS) {
+		char topic[MQTT_TOPIC_SIZE];
+		snprintf(topic, sizeof(topic), "%s%s", MQTT_TOPICS[record_type & SESSION_RECORD_TYPE_MASK],
+				 (record_type & SESSION_RECORD_LZ) ? MQTT_TOPIC_LZ_SUFFIX : "");
+		return MqttPublish(&mqtt_client, topic, data, len, MQTT_QOS) ? 0 : -1;
 	}
-	printf(" %d operators found.\n", num_operators_found);
+	if (COAP_PAYLOADS) {
+		// the topics double as resource paths
+		uint16_t format = (record_type == SESSION_RECORD_LINES) ? COAP_FORMAT_TEXT :
+						  (record_type == SESSION_RECORD_CBOR) ? COAP_FORMAT_CBOR : COAP_FORMAT_OCTET_STREAM;
+		char path[MQTT_TOPIC_SIZE];
+		snprintf(path, sizeof(path), "%s%s", MQTT_TOPICS[record_type & SESSION_RECORD_TYPE_MASK],
+				 (record_type & SESSION_RECORD_LZ) ? MQTT_TOPIC_LZ_SUFFIX : "");
+		int code = CoapPost(&coap_client, path, format, data, len, COAP_CONFIRMABLE);
+		return (code == 0 || COAP_CODE_CLASS(code) == 2) ? 0 : -1;
+	}
+	int response_len = CellularSendHTTPPOSTBinary(url, data, len, content_type, transmit_response, 99);
+	return uploadAccepted(response_len, transmit_response) ? response_len : -1;
+}
 
-	/* Tries to register with each one of them (one at a time). */
-	printf("Trying to register with each one of them (one at a time)\n");
-	for (int op_index = 0; op_index < num_operators_found; op_index++) {
+/***************************************************************************//**
+ * @brief Posts the payload, as CBOR or as Influx lines.
+ * @return as CellularSendHTTPPOSTRequest.
+ ******************************************************************************/
+static int sendPayload(void)
+{
+	char transmit_response[100] = "";
+	if (CBOR_PAYLOADS) {
+		return postBinary(CBOR_URL, SESSION_RECORD_CBOR, (uint8_t *) payload, payload_len, CBOR_CONTENT_TYPE);
+	} else if (COMPRESS_PAYLOADS || SOCKET_SESSION || MQTT_PAYLOADS || COAP_PAYLOADS) {
+		return postBinary(TELEMETRY_URL, SESSION_RECORD_LINES, (uint8_t *) payload, payload_len, NULL);
+	}
+	return CellularSendHTTPPOSTRequest(TRANSMIT_URL, payload, payload_len, transmit_response, 99);
+}
 
-		// unregister from current operator
-		while (!CellularSetOperator(DEREGISTER, NULL));
+/***************************************************************************//**
+ * @brief Fills the payload with a binary batch of the logged fixes that were
+ * not sent yet, as many as fit.
+ * @param from first log record of the batch, NULL for the oldest one
+ * @return the number of points in the batch.
+ ******************************************************************************/
+static uint32_t buildTelemetryBatch(const FLASH_LOG_CURSOR * from)
+{
+	FLASH_LOG_CURSOR cursor;
+	LOGGED_FIX entry;
+	uint8_t type;
+	uint32_t len;
+
+	FlashLogFlush();
+	if (from != NULL) {
+		cursor = *from;
+	} else {
+		FlashLogOldest(&cursor);
+	}
+	batch_end = cursor;
+	TelemetryBegin(&telemetry_batch, (uint8_t *) payload, PAYLOAD_BUFFER_SIZE, TELEMETRY_DEVICE_NAME, iccid);
+
+	while (FlashLogReadNext(&cursor, &type, &entry, sizeof(entry), &len)) {
+		if (type == FLASH_LOG_TYPE_FIX && len == sizeof(entry)) {
+			// GPS_RECORD_* and TELEMETRY_* flags are the same bits
+			TELEMETRY_POINT point = {entry.unix_time, entry.record.latitude, entry.record.longitude,
+									 entry.record.altitude, entry.record.speed, entry.record.hdop,
+									 entry.record.sats_flags};
+			if (!TelemetryAddPoint(&telemetry_batch, &point)) {
+				break;
+			}
+		}
+		batch_end = cursor;
+	}
+	payload_len = telemetry_batch.len;
+	return telemetry_batch.num_points;
+}
 
-		// register to specific operator
-		printf("Trying to register with %s...", operators_info[op_index].operatorName);
-		if (CellularSetOperator(SPECIFIC_OP, operators_info[op_index].operatorName)) {
+/***************************************************************************//**
+ * @brief Posts the telemetry batch in payload, then the rest of the log batch
+ * by batch. Over plain HTTP each batch is posted while the server still
+ * answers the previous one, on another service profile of the pool. A batch
+ * is released from the log once the server accepted it, see uploadAccepted.
+ * @return 0 once the log was sent, -1 on error. The payload then holds the
+ * oldest batch that was not released.
+ ******************************************************************************/
+static int postTelemetryBacklog(void)
+{
+	char transmit_response[100] = "";
+	int pending = -1;				// request whose response is still due
+	FLASH_LOG_CURSOR pending_end;
+	bool ok = true;
+
+	if (COMPRESS_PAYLOADS || SOCKET_SESSION || MQTT_PAYLOADS || COAP_PAYLOADS) {
+		do {
+			if (postBinary(TELEMETRY_URL, SESSION_RECORD_TELEMETRY, (uint8_t *) payload, payload_len,
+						   TELEMETRY_CONTENT_TYPE) == -1) {
+				return -1;
+			}
+			FlashLogRelease(&batch_end);
+		} while (buildTelemetryBatch(NULL) > 0);
+		return 0;
+	}
 
-			// If registered successfully, it prints the signal quality.
-			int registration_status = 0;
-
-			// verify registration to operator and check status
-			if (CellularGetRegistrationStatus(&registration_status) &&
-					(registration_status == 1 || registration_status == 5)) {
-				printf("registered successfully\n");
-				// registration_status == 1: Registered to home network
-				// registration_status == 5: Registered,
-				// roaming ME is registered at a foreign network (national or international network)
-				int signal_quality = -1;
-				if (CellularGetSignalQuality(&signal_quality)) {
-					printf("Current signal quality: %ddBm\n", signal_quality);
-					operators_info[op_index].csq = signal_quality;
-
-				} else if (signal_quality == -1){
-					printf("Modem didn't respond\n");
-
-				} else if (signal_quality == 99) {
-					printf("Current signal quality is UNKNOWN\n");
-				}
-
-				// copy operator info to past_registerd_operators archive
-				memcpy(&past_registerd_operators[num_of_past_registerd++],
-					   &operators_info[op_index], sizeof(operators_info[op_index]));
-				continue;
+	while (true) {
+		int request = CellularHTTPPOSTBinaryStart(TELEMETRY_URL, (uint8_t *) payload, payload_len, TELEMETRY_CONTENT_TYPE);
+		ok = (request != -1);
+		if (pending != -1) {
+			// a release also covers the batches before, so only in order
+			if (!uploadAccepted(CellularHTTPPOSTFinish(pending, transmit_response, 99), transmit_response)) {
+				ok = false;
+			} else {
+				FlashLogRelease(&pending_end);
 			}
 		}
-		printf("Modem registration failed\n");
+		pending = request;
+		pending_end = batch_end;
+		if (!ok || buildTelemetryBatch(&batch_end) == 0) {
+			break;
+		}
+	}
+	if (pending != -1) {
+		if (!uploadAccepted(CellularHTTPPOSTFinish(pending, transmit_response, 99), transmit_response)) {
+			ok = false;
+		} else if (ok) {
+			FlashLogRelease(&pending_end);
+		}
+	}
+
+	if (!ok) {
+		buildTelemetryBatch(NULL);
+		return -1;
 	}
+	return 0;
+}
 
+/***************************************************************************//**
+ * @brief Updates the location, steps on once enough valid fixes were collected.
+ * The GPS pipeline keeps storing fixes in the background, also while a step
+ * waits for the modem.
+ ******************************************************************************/
+void onGPSFix(const EVENT * event)
+{
+	GPSGetLatestFix(last_location);
+	logNewFixes();
+	if (fixes_target != 0 && GPSGetFixCount() >= fixes_target) {
+		fixes_target = 0;
+		fixes_collected = true;
+		fixes_ready_ms = TimebaseGetMs();
+		if (stepWaitsForFixes()) {
+			scheduleStep(0);
+		}
+	}
+}
 
-	// Connects to an available operator (if available, if no, tries again after one minute)
-	for (int op_index = 0; op_index < num_of_past_registerd; op_index++) {
+/***************************************************************************//**
+ * @brief Lets the modem sleep once it was not used for the idle time of the
+ * power policy. Call when a procedure is done with the modem.
+ ******************************************************************************/
+static void modemIdle(void)
+{
+	if (MODEM_POWER_POLICY.sleep) {
+		TimerStart(&modem_idle_timer, MODEM_POWER_POLICY.idle_ms, 0, postJob, (void *) (uintptr_t) JOB_MODEM_SLEEP);
+	}
+}
 
+/***************************************************************************//**
+ * @return true while a procedure may send the modem commands.
+ ******************************************************************************/
+static bool modemInUse(void)
+{
+	return (CURRENT_OPERATION == GPS_CELL_ON_DEMAND)
+		   || (CURRENT_OPERATION == SPEED_LIMIT && speed_limit_state != SL_IDLE
+			   && speed_limit_state != SL_COLLECT_FIXES);
+}
 
-		// unregister from current operator
-		printf("Unregister from current operator\n");
-		while (!CellularSetOperator(DEREGISTER, NULL));
+/***************************************************************************//**
+ * @brief Runs a step that waits for a URC once the modem sent something,
+ * instead of at its next poll. Data a step already read is no reason to run.
+ ******************************************************************************/
+void onCellularData(const EVENT * event)
+{
+	if (CURRENT_OPERATION == GPS_CELL_ON_DEMAND && on_demand_state == OD_CONNECT_STATUS && CellularHasData()) {
+		TimerStop(&step_timer);
+		scheduleStep(0);
+	}
+}
 
-		// register to operator
-		printf("Trying to register with %s...\n", past_registerd_operators[op_index].operatorName);
-		if (CellularSetOperator(SPECIFIC_OP, past_registerd_operators[op_index].operatorName)) {
+/***************************************************************************//**
+ * @brief Keepalive and retransmissions of the MQTT client.
+ ******************************************************************************/
+void onMqtt(const EVENT * event)
+{
+	MqttPoll(&mqtt_client);
+	if (CURRENT_OPERATION == WAIT_FOR_USER) {
+		modemIdle();
+	}
+}
 
-			// If registered successfully, it prints the signal quality.
-			int registration_status = 0;
+/***************************************************************************//**
+ * @brief Runs the periodic jobs: the flash log flush and the jobs of the speed
+ * limit procedure.
+ ******************************************************************************/
+void onTimer(const EVENT * event)
+{
+	if (event->data == JOB_LOG_FLUSH) {
+		FlashLogFlush();
+		return;
+	}
+	if (event->data == JOB_MODEM_SLEEP) {
+		// the modem wakes on the next command, e.g. of the next upload
+		if (!modemInUse()) {
+			CellularSleep();
+		}
+		return;
+	}
+	if (CURRENT_OPERATION != SPEED_LIMIT) {
+		return;
+	}
 
-			/* Trying to register to operator. (if available, if no, tries again after one minute)  */
-			/* verify registration to operator and check status */
-			if (!(CellularGetRegistrationStatus(&registration_status) &&
-				  (registration_status == 1 || registration_status == 5))) {
+	if (event->data == JOB_GPS_SAMPLE) {
+		// skip the sample while the previous one is still being handled
+		if (speed_limit_state == SL_IDLE) {
+			old_location = memcpy(old_location, last_location, sizeof(GPS_LOCATION_INFO));
+			speed_limit_state = SL_SAMPLE;
+			waitForFixes(SPEED_LIMIT_SAMPLE_FIXES);
+		}
 
-				Delay(ONE_MINUTE_IN_MS);
+	} else if (event->data == JOB_CAPSENSE_SCAN) {
+		printf("\fcurrent speed limit:\n%2d Km/h", speed_limit);
+		CAPSENSE_Sense();
 
-				if (!(CellularGetRegistrationStatus(&registration_status) &&
-					  (registration_status == 1 || registration_status == 5))) {
-					continue;
-				}
+		if (CAPSENSE_getPressed(BUTTON1_CHANNEL)
+			&& !CAPSENSE_getPressed(BUTTON0_CHANNEL)) {
+			if (speed_limit < MAX_SPEED_LIM){
+				speed_limit += 5;
 			}
+		  printf("\r%2d", speed_limit);
+		} else if (CAPSENSE_getPressed(BUTTON0_CHANNEL)
+				   && !CAPSENSE_getPressed(BUTTON1_CHANNEL)) {
+		  if (speed_limit > MIN_SPEED_LIM) {
+			  speed_limit -= 5;
+		  }
+		  printf("\r%2d", speed_limit);
+		}
+	}
+}
 
-			// we registered to operator, setup inet connection
-			if (!CellularSetupInternetConnectionProfile(60)) {
-				continue;
-			}
+/***************************************************************************//**
+ * @brief Runs the next step of the current procedure.
+ ******************************************************************************/
+void onStep(const EVENT * event)
+{
+	if (event->data != current_run) {
+		return;
+	}
+	if (CURRENT_OPERATION == GPS_CELL_ON_DEMAND) {
+		infoOnDemandStep();
+	} else if (CURRENT_OPERATION == SPEED_LIMIT) {
+		speedLimitStep();
+	}
+}
 
-			// get CCID
-			char iccid[ICCID_BUFFER_SIZE] = "";
-			CellularGetICCID(iccid);
+/***************************************************************************//**
+ * @brief Moves infoOnDemand to state and schedules it.
+ ******************************************************************************/
+void onDemandGoTo(enum ON_DEMAND_STATE state)
+{
+	on_demand_state = state;
+	scheduleStep(0);
+}
+
+void infoOnDemandStep(void) {
+	switch (on_demand_state) {
+	case OD_CHECK_MODEM:
+		// Makes sure it's responding to AT commands.
+		if (!CellularCheckModem()) {
+			scheduleStep(WAIT_BETWEEN_CMDS_MS);
+			break;
+		}
+		onDemandGoTo(OD_DEREGISTER);
+		break;
+
+	case OD_DEREGISTER:
+		// Setting modem to unregister and remain unregistered.
+		if (!CellularSetOperator(DEREGISTER, NULL)) {
+			scheduleStep(WAIT_BETWEEN_CMDS_MS);
+			break;
+		}
+		num_operators_found = 0;
+		num_of_past_registerd = 0;
+		printf("Finding all available cellular operators...");
+		onDemandGoTo(OD_FIND_OPERATORS);
+		break;
+
+	case OD_FIND_OPERATORS:
+		/* Finds all available cellular operators. */
+		if (!CellularGetOperators(operators_info, MAX_IL_CELL_OPS, &num_operators_found)) {
+			printf(".");
+			scheduleStep(0);
+			break;
+		}
+		printf(" %d operators found.\n", num_operators_found);
+		printf("Trying to register with each one of them (one at a time)\n");
+		op_index = 0;
+		onDemandGoTo(OD_SCAN_DEREGISTER);
+		break;
+
+	case OD_SCAN_DEREGISTER:
+		/* Tries to register with each one of them (one at a time). */
+		if (op_index >= num_operators_found) {
+			op_index = 0;
+			onDemandGoTo(OD_CONNECT_DEREGISTER);
+			break;
+		}
+		// unregister from current operator
+		if (CellularSetOperator(DEREGISTER, NULL)) {
+			on_demand_state = OD_SCAN_REGISTER;
+		}
+		scheduleStep(0);
+		break;
 
-			// get unix time
-			char unix_time[35];
-			GPSConvertFixtimeToUnixTime(last_location, unix_time);
+	case OD_SCAN_REGISTER:
+		// register to specific operator
+		printf("Trying to register with %s...", operators_info[op_index].operatorName);
+		if (CellularSetOperator(SPECIFIC_OP, operators_info[op_index].operatorName)) {
+			onDemandGoTo(OD_SCAN_STATUS);
+			break;
+		}
+		printf("Modem registration failed\n");
+		op_index++;
+		onDemandGoTo(OD_SCAN_DEREGISTER);
+		break;
+
+	case OD_SCAN_STATUS:
+		// verify registration to operator, if registered prints the signal quality.
+		if (isRegistered(0)) {
+			printf("registered successfully\n");
+			int signal_quality = -1;
+			if (CellularGetSignalQuality(&signal_quality)) {
+				printf("Current signal quality: %ddBm\n", signal_quality);
+				operators_info[op_index].csq = signal_quality;
+
+			} else if (signal_quality == -1){
+				printf("Modem didn't respond\n");
+
+			} else if (signal_quality == 99) {
+				printf("Current signal quality is UNKNOWN\n");
+			}
 
-			// transmit GPS data over HTTP
-			char gps_payload[1000] = "";
-			int gps_payload_len = GPSGetPayload(last_location, iccid, unix_time, gps_payload);
+			// copy operator info to past_registerd_operators archive
+			memcpy(&past_registerd_operators[num_of_past_registerd++],
+				   &operators_info[op_index], sizeof(operators_info[op_index]));
+		} else {
+			printf("Modem registration failed\n");
+		}
+		op_index++;
+		onDemandGoTo(OD_SCAN_DEREGISTER);
+		break;
+
+	case OD_CONNECT_DEREGISTER:
+		// Connects to an available operator (if available, if no, tries again after one minute)
+		if (op_index >= num_of_past_registerd) {
+			onDemandGoTo(OD_DONE);
+			break;
+		}
+		printf("Unregister from current operator\n");
+		if (CellularSetOperator(DEREGISTER, NULL)) {
+			on_demand_state = OD_CONNECT_REGISTER;
+		}
+		scheduleStep(0);
+		break;
 
-			char transmit_response[100] = "";
-			while (CellularSendHTTPPOSTRequest(TRANSMIT_URL, gps_payload, gps_payload_len, transmit_response, 99) == -1);
+	case OD_CONNECT_REGISTER:
+		printf("Trying to register with %s...\n", past_registerd_operators[op_index].operatorName);
+		if (!CellularSetOperator(SPECIFIC_OP, past_registerd_operators[op_index].operatorName)) {
+			op_index++;
+			onDemandGoTo(OD_CONNECT_DEREGISTER);
+			break;
+		}
+		registration_deadline_ms = TimebaseGetMs() + REGISTRATION_TIMEOUT_MS;
+		onDemandGoTo(OD_CONNECT_STATUS);
+		break;
+
+	case OD_CONNECT_STATUS:
+		/* wait for the registration to operator, up to one minute, a short slice per step.
+		 * The +CREG URC runs the step at once, see onCellularData */
+		if (isRegistered(REGISTRATION_SLICE_MS)) {
+			onDemandGoTo(OD_SETUP_INTERNET);
+		} else if (TimebaseGetMs() < registration_deadline_ms) {
+			scheduleStep(REGISTRATION_POLL_MS);
+		} else {
+			op_index++;
+			onDemandGoTo(OD_CONNECT_DEREGISTER);
+		}
+		break;
 
-			// transmit cell data over HTTP
-			char cell_payload[1000] = "";
-			int cell_payload_len = CellularGetPayload(past_registerd_operators, num_of_past_registerd, iccid, unix_time, cell_payload);
-			while (CellularSendHTTPPOSTRequest(TRANSMIT_URL, cell_payload, cell_payload_len, transmit_response, 99) == -1);
+	case OD_SETUP_INTERNET:
+		// we registered to operator, setup inet connection
+		if (!CellularSetupInternetConnectionProfile(60)) {
+			op_index++;
+			onDemandGoTo(OD_CONNECT_DEREGISTER);
+			break;
+		}
+		CellularGetICCID(iccid);
+		modem_ready_ms = TimebaseGetMs();
+		onDemandGoTo(OD_JOIN_GPS);
+		break;
 
-			op_index = num_of_past_registerd;//todo check
+	case OD_JOIN_GPS:
+		// modem is ready, onGPSFix steps on once the fixes are in
+		if (!fixes_collected) {
 			break;
 		}
+		if (DEBUG) {
+			printf("GPS ready after %lu ms, modem after %lu ms\n",
+				   (uint32_t) (fixes_ready_ms - run_started_ms), (uint32_t) (modem_ready_ms - run_started_ms));
+		}
+		// newest fix, the pipeline kept tracking during the operator scan
+		GPSGetLatestFix(last_location);
+		GPSConvertFixtimeToUnixTime(last_location, unix_time);
+		if (BENCHMARK_PAYLOADS) { benchmarkPayloads(); }
+		// the fixes logged while offline go out with the new ones
+		buildTelemetryBatch(NULL);
+		onDemandGoTo(OD_SEND_GPS);
+		break;
+
+	case OD_SEND_GPS: {
+		// transmit the logged fixes in binary batches over HTTP
+		if (postTelemetryBacklog() == -1) {
+			scheduleStep(0);
+			break;
+		}
+		if (CBOR_PAYLOADS) {
+			payload_len = CellularGetCBORPayload(past_registerd_operators, num_of_past_registerd, iccid,
+												 GPSGetUnixTime(last_location), (uint8_t *) payload, PAYLOAD_BUFFER_SIZE);
+		} else {
+			payload_len = CellularGetPayload(past_registerd_operators, num_of_past_registerd, iccid, unix_time,
+											 payload, PAYLOAD_BUFFER_SIZE);
+		}
+		onDemandGoTo(OD_SEND_CELL);
+		break;
 	}
-}
 
+	case OD_SEND_CELL: {
+		// transmit cell data over HTTP
+		if (sendPayload() == -1) {
+			scheduleStep(0);
+			break;
+		}
+		onDemandGoTo(OD_DONE);
+		break;
+	}
 
-void speedLimitInterval(GPS_LOCATION_INFO* last_location, GPS_LOCATION_INFO* old_location) {
-	old_location = memcpy(old_location, last_location, sizeof(GPS_LOCATION_INFO));
-	old_location_Ticks = last_location_Ticks;
-	// update location
-	uint32_t iteration_counter = 5;
-	while (iteration_counter > 0) {
-		bool result;
-		result = GPSGetFixInformation(last_location);
-		if (result && last_location->valid_fix == 1){
-			iteration_counter--;
+	case OD_DONE:
+		CURRENT_OPERATION = WAIT_FOR_USER;
+		modemIdle();
+		if (DEBUG) { EnergyPrintStats(); }
+		if (DEBUG && MODEM_POWER_POLICY.sleep) {
+			CELLULAR_POWER_STATS power_stats;
+			CellularGetPowerStats(&power_stats);
+			printf("modem power: %lu sleeps, %lu ms asleep, %lu wakes of %lu ms avg, %lu ms max, %lu failed\n",
+				   (unsigned long) power_stats.sleeps, (unsigned long) power_stats.asleep_ms,
+				   (unsigned long) power_stats.wakes,
+				   (unsigned long) (power_stats.wakes ? power_stats.total_wake_ms / power_stats.wakes : 0),
+				   (unsigned long) power_stats.max_wake_ms, (unsigned long) power_stats.failed_wakes);
+		}
+		if (DEBUG) {
+			CELLULAR_LINK_STATS link_stats;
+			CellularGetLinkStats(&link_stats);
+			printf("modem link: %u baud%s, %lu bytes in at %lu B/s sustained, %lu out, %lu stalls, %lu lost\n",
+				   link_stats.baud, link_stats.flow_control ? " RTS/CTS" : "", (unsigned long) link_stats.rx_bytes,
+				   (unsigned long) link_stats.throughput, (unsigned long) link_stats.tx_bytes,
+				   (unsigned long) link_stats.stalls, (unsigned long) link_stats.overruns);
+		}
+		if (DEBUG && SOCKET_SESSION) {
+			SESSION_STATS session_stats;
+			SessionGetStats(&session_stats);
+			printf("session: %lu records, %lu bytes, %lu connects\n", (unsigned long) session_stats.records,
+				   (unsigned long) session_stats.bytes, (unsigned long) session_stats.connects);
 		}
+		if (DEBUG && MQTT_PAYLOADS) {
+			printf("mqtt: %lu published, %lu acked, %lu resent, %lu in flight\n",
+				   (unsigned long) mqtt_client.stats.published, (unsigned long) mqtt_client.stats.acked,
+				   (unsigned long) mqtt_client.stats.retransmits, (unsigned long) MqttGetInflight(&mqtt_client));
+		}
+		if (DEBUG && COAP_PAYLOADS) {
+			printf("coap: %lu requests, %lu resent, %lu bytes\n", (unsigned long) coap_client.stats.requests,
+				   (unsigned long) coap_client.stats.retransmits, (unsigned long) coap_client.stats.bytes);
+		}
+		break;
 	}
-	last_location_Ticks = msTicks;
+}
 
-	// calculate speed
-	double speed = GPSGetSpeedOfLocations(old_location, last_location);
+/***************************************************************************//**
+ * @brief Moves the speed limit procedure to state and schedules it.
+ ******************************************************************************/
+void speedLimitGoTo(enum SPEED_LIMIT_STATE state)
+{
+	speed_limit_state = state;
+	scheduleStep(0);
+}
 
-	// check conditions
-	if (speed > speed_limit){
-		high_speed_flag = true;
-		transmit_speed_event = true;
-	}
+void speedLimitStep(void) {
+	switch (speed_limit_state) {
+	case SL_COLLECT_FIXES:
+		// location updated, sample it every five seconds from now on
+		old_location = memcpy(old_location, last_location, sizeof(GPS_LOCATION_INFO));
+		speed_limit_state = SL_IDLE;
+		TimerStart(&gps_sample_timer, FIVE_SECS_IN_MS, FIVE_SECS_IN_MS, postJob, (void *) (uintptr_t) JOB_GPS_SAMPLE);
+		TimerStart(&capsense_scan_timer, CAPSENSE_SCAN_MS, CAPSENSE_SCAN_MS, postJob, (void *) (uintptr_t) JOB_CAPSENSE_SCAN);
+		break;
+
+	case SL_IDLE:
+		break;
+
+	case SL_SAMPLE: {
+		// calculate speed
+		double speed = GPSGetSpeedOfLocations(old_location, last_location);
+
+		// check conditions
+		if (speed > speed_limit){
+			high_speed_flag = true;
+			transmit_speed_event = true;
+		}
 
-	if (high_speed_flag && speed < speed_limit) {
-		high_speed_flag = false;
-		transmit_speed_event = true;
-	}
+		if (high_speed_flag && speed < speed_limit) {
+			high_speed_flag = false;
+			transmit_speed_event = true;
+		}
 
-	if (transmit_speed_event) {
+		if (!transmit_speed_event) {
+			speed_limit_state = SL_IDLE;
+			break;
+		}
 		transmit_speed_event = false;
 
 		// get CCID
-		char iccid[ICCID_BUFFER_SIZE] = "";
 		CellularGetICCID(iccid);
 
 		// get unix time
-		char unix_time[35];
-		memset(unix_time, '\0', 35);
+		memset(unix_time, '\0', sizeof(unix_time));
 		GPSConvertFixtimeToUnixTime(last_location, unix_time);
-		char gps_payload[1000] = "";
-		int gps_payload_len = GPSGetSPEEDPayload(last_location, iccid, unix_time, high_speed_flag, gps_payload);
+		if (CBOR_PAYLOADS) {
+			payload_len = GPSGetSPEEDCBORPayload(last_location, iccid, GPSGetUnixTime(last_location), high_speed_flag,
+												 (uint8_t *) payload, PAYLOAD_BUFFER_SIZE);
+		} else {
+			payload_len = GPSGetSPEEDPayload(last_location, iccid, unix_time, high_speed_flag, payload, PAYLOAD_BUFFER_SIZE);
+		}
 
-		// store data about found operators and registered ones.
-		OPERATOR_INFO operators_info[MAX_IL_CELL_OPS];
-		int num_operators_found = 0;
+		num_operators_found = 0;
+		printf("Finding all available cellular operators...");
+		speedLimitGoTo(SL_FIND_OPERATORS);
+		break;
+	}
 
+	case SL_FIND_OPERATORS:
 		/* Finds all available cellular operators. */
-		printf("Finding all available cellular operators...");
-		while (!CellularGetOperators(operators_info, MAX_IL_CELL_OPS, &num_operators_found)) {
+		if (!CellularGetOperators(operators_info, MAX_IL_CELL_OPS, &num_operators_found)) {
 			printf(".");
+			scheduleStep(0);
+			break;
 		}
+		op_index = 0;
+		speedLimitGoTo(SL_DEREGISTER);
+		break;
 
+	case SL_DEREGISTER:
 		/* Tries to register with one of them (one at a time). */
-		for (int op_index = 0; op_index < num_operators_found; op_index++) {
-
-			// unregister from current operator
-			while (!CellularSetOperator(DEREGISTER, NULL));
-
-			// register to specific operator
-			printf("Trying to register with %s...", operators_info[op_index].operatorName);
-			if (CellularSetOperator(SPECIFIC_OP, operators_info[op_index].operatorName)) {
-
-				// If registered successfully, it prints the signal quality.
-				int registration_status = 0;
-
-				// verify registration to operator and check status
-				if (CellularGetRegistrationStatus(&registration_status) &&
-						(registration_status == 1 || registration_status == 5)) {
-					printf("registered successfully\n");
-
-					// we registered to operator, setup inet connection
-					if (!CellularSetupInternetConnectionProfile(60)) {
-						continue;
-					}
+		if (op_index >= num_operators_found) {
+			speed_limit_state = SL_IDLE;
+			modemIdle();
+			break;
+		}
+		// unregister from current operator
+		if (CellularSetOperator(DEREGISTER, NULL)) {
+			speed_limit_state = SL_REGISTER;
+		}
+		scheduleStep(0);
+		break;
 
-					char transmit_response[100] = "";
-					while (CellularSendHTTPPOSTRequest(TRANSMIT_URL, gps_payload, gps_payload_len, transmit_response, 99) == -1);
-					break;
-				}
+	case SL_REGISTER:
+		// register to specific operator
+		printf("Trying to register with %s...", operators_info[op_index].operatorName);
+		if (CellularSetOperator(SPECIFIC_OP, operators_info[op_index].operatorName)) {
+			speedLimitGoTo(SL_SETUP_INTERNET);
+			break;
+		}
+		op_index++;
+		speedLimitGoTo(SL_DEREGISTER);
+		break;
+
+	case SL_SETUP_INTERNET:
+		// verify registration to operator, then setup inet connection
+		if (isRegistered(0)) {
+			printf("registered successfully\n");
+			if (CellularSetupInternetConnectionProfile(60)) {
+				speedLimitGoTo(SL_SEND);
+				break;
 			}
 		}
+		op_index++;
+		speedLimitGoTo(SL_DEREGISTER);
+		break;
 
+	case SL_SEND: {
+		if (sendPayload() == -1) {
+			scheduleStep(0);
+			break;
+		}
+		speed_limit_state = SL_IDLE;
+		modemIdle();
+		break;
+	}
 	}
 }
 
 /***************************************************************************//**
  * @brief Unified GPIO Interrupt handler (pushbuttons)
- *        PB0 Prints first name.
- *        PB1 Prints last name.
+ *        PB0 posts EVENT_BUTTON 0, GPS+CELL on demand.
+ *        PB1 posts EVENT_BUTTON 1, speed limit.
  *****************************************************************************/
 void GPIO_Unified_IRQ(void) {
   /* Get and clear all pending GPIO interrupts */
@@ -460,17 +1167,11 @@ void GPIO_Unified_IRQ(void) {
 
   /* Act on interrupts */
   if (interruptMask & (1 << BSP_GPIO_PB0_PIN)) {
-	  /* Clear screen */
-	  printf("\f");
-	  /* set flag */
-	  CURRENT_OPERATION = GPS_CELL_ON_DEMAND;
+	  SchedulerPost(EVENT_PRIORITY_HIGH, EVENT_BUTTON, 0);
   }
 
   if (interruptMask & (1 << BSP_GPIO_PB1_PIN)) {
-	  /* Clear screen */
-	  printf("\f");
-	  /* set flag */
-	  CURRENT_OPERATION = SPEED_LIMIT_INIT;
+	  SchedulerPost(EVENT_PRIORITY_HIGH, EVENT_BUTTON, 1);
   }
 }
 
@@ -0,0 +1,412 @@
+/******************************************************************************
+ * @mqtt.c
+ * @brief Minimal MQTT 3.1.1 client over a modem socket.
+ * @version 0.0.1
+ *  **************************************************************************/
+#include <stdio.h>
+#include <string.h>
+
+#include "mqtt.h"
+#include "cellular.h"
+#include "scheduler.h"
+#include "timebase.h"
+
+/******************************************************************************
+ * 								DEFS
+*****************************************************************************/
+#define MQTT_CONNECT 0x10
+#define MQTT_CONNACK 0x20
+#define MQTT_PUBLISH 0x30
+#define MQTT_PUBACK 0x40
+#define MQTT_PINGREQ 0xC0
+#define MQTT_PINGRESP 0xD0
+#define MQTT_DISCONNECT 0xE0
+#define MQTT_TYPE_MASK 0xF0
+
+#define MQTT_PUBLISH_DUP 0x08
+#define MQTT_PUBLISH_QOS_SHIFT 1
+#define MQTT_CONNECT_FLAGS 0x00		// no clean session, will, user or password
+#define MQTT_PROTOCOL_LEVEL 4		// 3.1.1
+#define MQTT_MAX_REMAINING_BYTES 4
+#define MQTT_CONNECT_MAX 64			// fixed header, variable header and a client ID
+
+
+/******************************************************************************
+ * 								PACKETS
+*****************************************************************************/
+
+/******************************************************************************
+ * @brief Writes the fixed header.
+ * @return its length.
+ *****************************************************************************/
+static uint32_t putFixedHeader(uint8_t * buf, uint8_t type_flags, uint32_t remaining) {
+	uint32_t len = 0;
+	buf[len++] = type_flags;
+	do {
+		uint8_t byte = remaining & 0x7F;
+		remaining >>= 7;
+		buf[len++] = byte | ((remaining > 0) ? 0x80 : 0);
+	} while (remaining > 0);
+	return len;
+}
+
+static uint32_t putString(uint8_t * buf, const char * str) {
+	uint16_t len = (uint16_t) strlen(str);
+	buf[0] = (uint8_t) (len >> 8);
+	buf[1] = (uint8_t) len;
+	memcpy(&buf[2], str, len);
+	return 2 + len;
+}
+
+/******************************************************************************
+ * @return length of the CONNECT packet, -1 if it does not fit.
+ *****************************************************************************/
+static int encodeConnect(uint8_t * buf, uint32_t size, const char * client_id, uint16_t keepalive_s) {
+	uint32_t remaining = 10 + 2 + strlen(client_id);
+	if (1 + MQTT_MAX_REMAINING_BYTES + remaining > size) {
+		return -1;
+	}
+	uint32_t len = putFixedHeader(buf, MQTT_CONNECT, remaining);
+	len += putString(&buf[len], "MQTT");
+	buf[len++] = MQTT_PROTOCOL_LEVEL;
+	buf[len++] = MQTT_CONNECT_FLAGS;
+	buf[len++] = (uint8_t) (keepalive_s >> 8);
+	buf[len++] = (uint8_t) keepalive_s;
+	len += putString(&buf[len], client_id);
+	return len;
+}
+
+/******************************************************************************
+ * @return length of the PUBLISH packet, -1 if it does not fit.
+ *****************************************************************************/
+static int encodePublish(uint8_t * buf, uint32_t size, const char * topic, const uint8_t * payload,
+						 uint32_t payload_len, uint8_t qos, uint16_t packet_id) {
+	uint32_t remaining = 2 + strlen(topic) + ((qos > 0) ? 2 : 0) + payload_len;
+	if (1 + MQTT_MAX_REMAINING_BYTES + remaining > size) {
+		return -1;
+	}
+	uint32_t len = putFixedHeader(buf, MQTT_PUBLISH | (qos << MQTT_PUBLISH_QOS_SHIFT), remaining);
+	len += putString(&buf[len], topic);
+	if (qos > 0) {
+		buf[len++] = (uint8_t) (packet_id >> 8);
+		buf[len++] = (uint8_t) packet_id;
+	}
+	memcpy(&buf[len], payload, payload_len);
+	return len + payload_len;
+}
+
+/******************************************************************************
+ * @brief Reads a fixed header.
+ * @param header_len - set to the length of the fixed header.
+ * @param remaining - set to the length of the rest of the packet.
+ * @return 1 if complete, 0 if more bytes are needed, -1 if malformed.
+ *****************************************************************************/
+static int decodeFixedHeader(const uint8_t * buf, uint32_t len, uint32_t * header_len, uint32_t * remaining) {
+	*remaining = 0;
+	for (uint32_t i = 1; i <= MQTT_MAX_REMAINING_BYTES; i++) {
+		if (i >= len) {
+			return 0;
+		}
+		*remaining |= (uint32_t) (buf[i] & 0x7F) << (7 * (i - 1));
+		if ((buf[i] & 0x80) == 0) {
+			*header_len = i + 1;
+			return 1;
+		}
+	}
+	return -1;
+}
+
+
+/******************************************************************************
+ * 								CLIENT
+*****************************************************************************/
+
+/******************************************************************************
+ * @brief Timer callback, the work is done by MqttPoll on EVENT_MQTT.
+ *****************************************************************************/
+static void pollTimer(void * arg) {
+	SchedulerPostOnce(EVENT_PRIORITY_NORMAL, EVENT_MQTT, 0);
+}
+
+static bool sendPacket(MQTT_CLIENT * client, const uint8_t * packet, uint32_t len) {
+	if (!CellularSocketWrite(client->srv_profile_id, packet, len)) {
+		client->connected = false;
+		return false;
+	}
+	client->last_send_ms = TimebaseGetMs();
+	return true;
+}
+
+/******************************************************************************
+ * @brief Handles a complete packet from the broker.
+ *****************************************************************************/
+static void handlePacket(MQTT_CLIENT * client, const uint8_t * packet, uint32_t header_len, uint32_t remaining) {
+	const uint8_t * body = &packet[header_len];
+
+	switch (packet[0] & MQTT_TYPE_MASK) {
+	case MQTT_CONNACK:
+		if (remaining >= 2) {
+			client->session_present = (body[0] & 0x01) != 0;
+			client->connack_code = body[1];
+			client->connack = true;
+		}
+		break;
+
+	case MQTT_PUBACK:
+		if (remaining >= 2) {
+			uint16_t packet_id = ((uint16_t) body[0] << 8) | body[1];
+			for (int i = 0; i < MQTT_INFLIGHT_WINDOW; i++) {
+				if (client->inflight[i].packet_id == packet_id) {
+					client->inflight[i].packet_id = 0;
+					client->stats.acked++;
+				}
+			}
+		}
+		break;
+
+	case MQTT_PINGRESP:
+		client->ping_outstanding = false;
+		break;
+
+	case MQTT_PUBLISH: {
+		// nothing is subscribed, a kept session may still deliver. Ack QoS 1.
+		uint8_t qos = (packet[0] >> MQTT_PUBLISH_QOS_SHIFT) & 0x03;
+		uint32_t topic_len = (remaining >= 2) ? (((uint32_t) body[0] << 8) | body[1]) : remaining;
+		if (qos == 1 && 2 + topic_len + 2 <= remaining) {
+			uint8_t puback[4] = {MQTT_PUBACK, 2, body[2 + topic_len], body[3 + topic_len]};
+			sendPacket(client, puback, sizeof(puback));
+		}
+		break;
+	}
+
+	default:
+		break;
+	}
+}
+
+/******************************************************************************
+ * @brief Reads what arrived and handles the complete packets.
+ * @param timeout_ms - time to wait for the first bytes.
+ *****************************************************************************/
+static void readPackets(MQTT_CLIENT * client, unsigned int timeout_ms) {
+	int received = CellularSocketRead(client->srv_profile_id, &client->rx[client->rx_len],
+									  MQTT_RX_SIZE - client->rx_len, timeout_ms);
+	if (received < 0) {
+		client->connected = false;
+		return;
+	}
+	client->rx_len += received;
+
+	while (client->rx_len > 0) {
+		uint32_t header_len, remaining, consumed;
+
+		if (client->rx_skip > 0) {
+			consumed = (client->rx_skip < client->rx_len) ? client->rx_skip : client->rx_len;
+			client->rx_skip -= consumed;
+		} else {
+			int status = decodeFixedHeader(client->rx, client->rx_len, &header_len, &remaining);
+			if (status == 0) {
+				break;
+			} else if (status < 0) {
+				// out of step with the stream, start over on a new connection
+				client->rx_len = 0;
+				CellularSocketClose(client->srv_profile_id);
+				client->connected = false;
+				return;
+			}
+			if (header_len + remaining > MQTT_RX_SIZE) {
+				client->rx_skip = header_len + remaining;
+				continue;
+			}
+			if (header_len + remaining > client->rx_len) {
+				break;
+			}
+			handlePacket(client, client->rx, header_len, remaining);
+			consumed = header_len + remaining;
+		}
+		client->rx_len -= consumed;
+		memmove(client->rx, &client->rx[consumed], client->rx_len);
+	}
+}
+
+void MqttInit(MQTT_CLIENT * client, int srv_profile_id, const char * address, const char * client_id,
+			  uint16_t keepalive_s) {
+	memset(client, 0, sizeof(*client));
+	client->srv_profile_id = srv_profile_id;
+	client->address = address;
+	client->client_id = client_id;
+	client->keepalive_s = keepalive_s;
+	client->next_packet_id = 1;
+}
+
+bool MqttConnect(MQTT_CLIENT * client) {
+	uint8_t packet[MQTT_CONNECT_MAX];
+	int len = encodeConnect(packet, sizeof(packet), client->client_id, client->keepalive_s);
+
+	client->connected = false;
+	client->connack = false;
+	client->ping_outstanding = false;
+	client->rx_len = 0;
+	client->rx_skip = 0;
+	if (len < 0 || !CellularSocketOpen(client->srv_profile_id, client->address)) {
+		return false;
+	}
+	client->connected = true;
+	if (!sendPacket(client, packet, len)) {
+		return false;
+	}
+
+	uint64_t deadline = TimebaseGetMs() + MQTT_ACK_TIMEOUT_MS;
+	while (client->connected && !client->connack && TimebaseGetMs() < deadline) {
+		readPackets(client, (unsigned int) (deadline - TimebaseGetMs()));
+	}
+	if (!client->connack || client->connack_code != 0) {
+		if (DEBUG) { printf("mqtt: connect refused (%d)\n", client->connack ? client->connack_code : -1); }
+		CellularSocketClose(client->srv_profile_id);
+		client->connected = false;
+		return false;
+	}
+	client->stats.connects++;
+	if (DEBUG) { printf("mqtt: connected, session %s\n", client->session_present ? "resumed" : "new"); }
+
+	// whatever was not acknowledged goes again, marked as a duplicate
+	for (int i = 0; i < MQTT_INFLIGHT_WINDOW; i++) {
+		MQTT_INFLIGHT * slot = &client->inflight[i];
+		if (slot->packet_id != 0) {
+			slot->packet[0] |= MQTT_PUBLISH_DUP;
+			slot->sent_ms = TimebaseGetMs();
+			client->stats.retransmits++;
+			if (!sendPacket(client, slot->packet, slot->len)) {
+				return false;
+			}
+		}
+	}
+
+	if (!TimerIsActive(&client->timer)) {
+		uint32_t period_ms = MQTT_RETRY_MS;
+		if (client->keepalive_s > 0 && client->keepalive_s * 500UL < period_ms) {
+			period_ms = client->keepalive_s * 500UL;
+		}
+		TimerStart(&client->timer, period_ms, period_ms, pollTimer, client);
+	}
+	return true;
+}
+
+/******************************************************************************
+ * @return a free in-flight slot, NULL if the window is full.
+ *****************************************************************************/
+static MQTT_INFLIGHT * freeSlot(MQTT_CLIENT * client) {
+	for (int i = 0; i < MQTT_INFLIGHT_WINDOW; i++) {
+		if (client->inflight[i].packet_id == 0) {
+			return &client->inflight[i];
+		}
+	}
+	return NULL;
+}
+
+bool MqttPublish(MQTT_CLIENT * client, const char * topic, const uint8_t * payload, uint32_t len,
+				 uint8_t qos) {
+	static uint8_t packet[MQTT_MAX_PACKET];
+
+	if (!client->connected && !MqttConnect(client)) {
+		return false;
+	}
+
+	if (qos == 0) {
+		int packet_len = encodePublish(packet, sizeof(packet), topic, payload, len, 0, 0);
+		if (packet_len < 0 || !sendPacket(client, packet, packet_len)) {
+			return false;
+		}
+		client->stats.published++;
+		return true;
+	}
+
+	MQTT_INFLIGHT * slot = freeSlot(client);
+	if (slot == NULL) {
+		readPackets(client, MQTT_ACK_TIMEOUT_MS);
+		slot = freeSlot(client);
+		if (slot == NULL) {
+			return false;
+		}
+	}
+
+	uint16_t packet_id = client->next_packet_id++;
+	if (client->next_packet_id == 0) {
+		client->next_packet_id = 1;
+	}
+	int packet_len = encodePublish(slot->packet, sizeof(slot->packet), topic, payload, len, 1, packet_id);
+	if (packet_len < 0) {
+		return false;
+	}
+	slot->packet_id = packet_id;
+	slot->len = (uint16_t) packet_len;
+	slot->sent_ms = TimebaseGetMs();
+	client->stats.published++;
+
+	// in the window now, a failed write is repeated by the reconnect
+	if (!sendPacket(client, slot->packet, slot->len)) {
+		MqttConnect(client);
+	}
+	return true;
+}
+
+void MqttPoll(MQTT_CLIENT * client) {
+	if (!client->connected) {
+		if (MqttGetInflight(client) == 0 || !MqttConnect(client)) {
+			return;
+		}
+	}
+
+	readPackets(client, 0);
+	if (!client->connected) {
+		return;
+	}
+
+	uint64_t now = TimebaseGetMs();
+	for (int i = 0; i < MQTT_INFLIGHT_WINDOW; i++) {
+		MQTT_INFLIGHT * slot = &client->inflight[i];
+		if (slot->packet_id != 0 && now - slot->sent_ms >= MQTT_RETRY_MS) {
+			slot->packet[0] |= MQTT_PUBLISH_DUP;
+			slot->sent_ms = now;
+			client->stats.retransmits++;
+			if (!sendPacket(client, slot->packet, slot->len)) {
+				return;
+			}
+		}
+	}
+
+	// ping at half the keepalive, a ping without answer by the next one means the link is gone
+	if (client->keepalive_s > 0 && now - client->last_send_ms >= client->keepalive_s * 500UL) {
+		if (client->ping_outstanding) {
+			if (DEBUG) { printf("mqtt: no PINGRESP\n"); }
+			CellularSocketClose(client->srv_profile_id);
+			client->connected = false;
+			return;
+		}
+		uint8_t pingreq[2] = {MQTT_PINGREQ, 0};
+		if (sendPacket(client, pingreq, sizeof(pingreq))) {
+			client->ping_outstanding = true;
+			client->stats.pings++;
+		}
+	}
+}
+
+void MqttDisconnect(MQTT_CLIENT * client) {
+	uint8_t disconnect[2] = {MQTT_DISCONNECT, 0};
+	if (client->connected) {
+		sendPacket(client, disconnect, sizeof(disconnect));
+		CellularSocketClose(client->srv_profile_id);
+	}
+	client->connected = false;
+	TimerStop(&client->timer);
+}
+
+uint32_t MqttGetInflight(const MQTT_CLIENT * client) {
+	uint32_t inflight = 0;
+	for (int i = 0; i < MQTT_INFLIGHT_WINDOW; i++) {
+		if (client->inflight[i].packet_id != 0) {
+			inflight++;
+		}
+	}
+	return inflight;
+}
@@ -0,0 +1,122 @@
+/******************************************************************************
+ * @mqtt.h
+ * @brief Interface for a minimal MQTT 3.1.1 client over a modem socket.
+ * CONNECT with a kept session, PUBLISH with QoS 0 or 1 and PINGREQ. QoS 1
+ * messages stay in a small in-flight window until their PUBACK and are sent
+ * again after MQTT_RETRY_MS or a reconnect. A timer posts EVENT_MQTT for the
+ * keepalive and retransmission work, which MqttPoll does.
+ * @version 0.0.1
+ *  **************************************************************************/
+#ifndef SRC_MQTT_H_
+#define SRC_MQTT_H_
+
+#include <stdbool.h>
+#include <stdint.h>
+#include "timer.h"
+
+extern bool DEBUG;
+
+/******************************************************************************
+ * 								DEFS
+*****************************************************************************/
+#define MQTT_INFLIGHT_WINDOW 2		// unacknowledged QoS 1 messages
+#define MQTT_MAX_PACKET 1100		// a PUBLISH of a whole payload buffer
+#define MQTT_RX_SIZE 64				// acks only, bigger packets are dropped
+#define MQTT_ACK_TIMEOUT_MS 10000
+#define MQTT_RETRY_MS 20000			// a QoS 1 message without PUBACK is sent again
+
+typedef struct _MQTT_INFLIGHT {
+	uint16_t packet_id;		// 0 if the slot is free
+	uint16_t len;
+	uint64_t sent_ms;
+	uint8_t packet[MQTT_MAX_PACKET];
+} MQTT_INFLIGHT;
+
+typedef struct _MQTT_STATS {
+	uint32_t published;
+	uint32_t acked;
+	uint32_t retransmits;
+	uint32_t connects;
+	uint32_t pings;
+} MQTT_STATS;
+
+typedef struct _MQTT_CLIENT {
+	int srv_profile_id;
+	const char * address;
+	const char * client_id;
+	uint16_t keepalive_s;
+	bool connected;
+	bool session_present;	// the broker kept the session of the last connection
+	bool connack;			// CONNACK received, connack_code valid
+	uint8_t connack_code;
+	bool ping_outstanding;
+	uint16_t next_packet_id;
+	uint64_t last_send_ms;
+	MQTT_INFLIGHT inflight[MQTT_INFLIGHT_WINDOW];
+	uint8_t rx[MQTT_RX_SIZE];
+	uint32_t rx_len;
+	uint32_t rx_skip;		// bytes of a dropped packet still to come
+	TIMER timer;
+	MQTT_STATS stats;
+} MQTT_CLIENT;
+
+
+/******************************************************************************
+ * @brief Sets up a client, nothing is sent yet.
+ * @param client - the client.
+ * @param srv_profile_id - modem service profile of the socket.
+ * @param address - broker, e.g. "socktcp://host:1883".
+ * @param client_id - identifies the session at the broker, must stay valid.
+ * @param keepalive_s - keepalive of the CONNECT, 0 for none.
+ *****************************************************************************/
+void MqttInit(MQTT_CLIENT * client, int srv_profile_id, const char * address, const char * client_id,
+			  uint16_t keepalive_s);
+
+
+/******************************************************************************
+ * @brief Opens the socket and connects without a clean session, then sends
+ * the in-flight messages again.
+ * @param client - the client.
+ * @return true once the broker accepted the connection.
+ *****************************************************************************/
+bool MqttConnect(MQTT_CLIENT * client);
+
+
+/******************************************************************************
+ * @brief Publishes a message, connecting first if needed. A QoS 1 message is
+ * kept until its PUBACK, with a full window it waits for one.
+ * @param client - the client.
+ * @param topic - topic name.
+ * @param payload - the message.
+ * @param len - its length.
+ * @param qos - 0 or 1.
+ * @return true if sent, for QoS 1 if it is in the window.
+ *****************************************************************************/
+bool MqttPublish(MQTT_CLIENT * client, const char * topic, const uint8_t * payload, uint32_t len,
+				 uint8_t qos);
+
+
+/******************************************************************************
+ * @brief Reads the acks that arrived, sends PINGREQ when the keepalive is
+ * due and the messages that were not acknowledged in time. Reconnects while
+ * messages are in flight. Called on EVENT_MQTT.
+ * @param client - the client.
+ *****************************************************************************/
+void MqttPoll(MQTT_CLIENT * client);
+
+
+/******************************************************************************
+ * @brief Sends DISCONNECT and closes the socket. The session stays at the
+ * broker.
+ * @param client - the client.
+ *****************************************************************************/
+void MqttDisconnect(MQTT_CLIENT * client);
+
+
+/******************************************************************************
+ * @return the number of QoS 1 messages waiting for their PUBACK.
+ *****************************************************************************/
+uint32_t MqttGetInflight(const MQTT_CLIENT * client);
+
+
+#endif /* SRC_MQTT_H_ */
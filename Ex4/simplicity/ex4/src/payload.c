@@ -0,0 +1,149 @@
+/******************************************************************************
+ * @payload.c
+ * @brief InfluxDB line protocol builder, without printf or temporaries.
+ * @version 0.0.1
+ *  **************************************************************************/
+#include <string.h>
+
+#include "payload.h"
+
+/******************************************************************************
+ * 								DEFS
+*****************************************************************************/
+#define MAX_UINT32_DIGITS 10
+
+
+/******************************************************************************
+ * @brief Appends one character, keeping room for the terminating NUL.
+ *****************************************************************************/
+static void putChar(PAYLOAD_BUILDER * builder, char c) {
+	if (builder->overflow || builder->len + 1 >= builder->size) {
+		builder->overflow = true;
+		return;
+	}
+	builder->buf[builder->len++] = c;
+	builder->buf[builder->len] = '\0';
+}
+
+/******************************************************************************
+ * @brief Appends text, escaping the characters that end a tag or measurement.
+ *****************************************************************************/
+static void putEscaped(PAYLOAD_BUILDER * builder, const char * text, bool escape_equals) {
+	for (; *text != '\0'; text++) {
+		if (*text == ',' || *text == ' ' || (escape_equals && *text == '=')) {
+			putChar(builder, '\\');
+		}
+		putChar(builder, *text);
+	}
+}
+
+/******************************************************************************
+ * @brief Appends value in decimal, at least min_digits digits.
+ *****************************************************************************/
+static void putUint(PAYLOAD_BUILDER * builder, uint32_t value, uint32_t min_digits) {
+	char digits[MAX_UINT32_DIGITS];
+	uint32_t num_digits = 0;
+	do {
+		digits[num_digits++] = '0' + value % 10;
+		value /= 10;
+	} while (value > 0 || num_digits < min_digits);
+	while (num_digits > 0) {
+		putChar(builder, digits[--num_digits]);
+	}
+}
+
+/******************************************************************************
+ * @brief Starts a field: a space before the first one, commas between them.
+ *****************************************************************************/
+static void putFieldKey(PAYLOAD_BUILDER * builder, const char * key) {
+	putChar(builder, (builder->num_fields++ == 0) ? ' ' : ',');
+	putEscaped(builder, key, true);
+	putChar(builder, '=');
+}
+
+void PayloadInit(PAYLOAD_BUILDER * builder, char * buf, uint32_t size) {
+	builder->buf = buf;
+	builder->size = size;
+	builder->len = 0;
+	builder->num_fields = 0;
+	builder->overflow = (size == 0);
+	if (size > 0) {
+		buf[0] = '\0';
+	}
+}
+
+void PayloadAppend(PAYLOAD_BUILDER * builder, const char * text) {
+	uint32_t len = strlen(text);
+	if (builder->overflow || builder->len + len >= builder->size) {
+		builder->overflow = true;
+		return;
+	}
+	memcpy(&builder->buf[builder->len], text, len + 1);
+	builder->len += len;
+}
+
+void PayloadLineStart(PAYLOAD_BUILDER * builder, const char * measurement) {
+	builder->num_fields = 0;
+	PayloadAppend(builder, PAYLOAD_DATA_PREFIX);
+	putEscaped(builder, measurement, false);
+}
+
+void PayloadTag(PAYLOAD_BUILDER * builder, const char * key, const char * value) {
+	putChar(builder, ',');
+	putEscaped(builder, key, true);
+	putChar(builder, '=');
+	putEscaped(builder, value, true);
+}
+
+void PayloadFieldInt(PAYLOAD_BUILDER * builder, const char * key, int32_t value) {
+	putFieldKey(builder, key);
+	if (value < 0) {
+		putChar(builder, '-');
+	}
+	putUint(builder, (value < 0) ? 0U - (uint32_t) value : (uint32_t) value, 1);
+}
+
+void PayloadFieldIndexedInt(PAYLOAD_BUILDER * builder, const char * prefix, uint32_t index, const char * suffix, int32_t value) {
+	putChar(builder, (builder->num_fields++ == 0) ? ' ' : ',');
+	putEscaped(builder, prefix, true);
+	putUint(builder, index, 1);
+	putEscaped(builder, suffix, true);
+	putChar(builder, '=');
+	if (value < 0) {
+		putChar(builder, '-');
+	}
+	putUint(builder, (value < 0) ? 0U - (uint32_t) value : (uint32_t) value, 1);
+}
+
+void PayloadFieldFixed(PAYLOAD_BUILDER * builder, const char * key, int32_t value, uint32_t decimals) {
+	uint32_t scale = 1;
+	for (uint32_t i = 0; i < decimals; i++) {
+		scale *= 10;
+	}
+	uint32_t magnitude = (value < 0) ? 0U - (uint32_t) value : (uint32_t) value;
+
+	putFieldKey(builder, key);
+	if (value < 0) {
+		putChar(builder, '-');
+	}
+	putUint(builder, magnitude / scale, 1);
+	if (decimals > 0) {
+		putChar(builder, '.');
+		putUint(builder, magnitude % scale, decimals);
+	}
+}
+
+void PayloadFieldRaw(PAYLOAD_BUILDER * builder, const char * key, const char * value) {
+	putFieldKey(builder, key);
+	PayloadAppend(builder, value);
+}
+
+void PayloadLineEnd(PAYLOAD_BUILDER * builder, const char * unix_time) {
+	putChar(builder, ' ');
+	PayloadAppend(builder, unix_time);
+	PayloadAppend(builder, PAYLOAD_TIME_SUFFIX);
+}
+
+int PayloadGetLength(const PAYLOAD_BUILDER * builder) {
+	return builder->overflow ? -1 : (int) builder->len;
+}
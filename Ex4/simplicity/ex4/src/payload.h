@@ -0,0 +1,89 @@
+/******************************************************************************
+ * @payload.h
+ * @brief Interface for building InfluxDB line protocol payloads in place.
+ * A builder is a write cursor over the caller's buffer. Lines are written in
+ * one pass, numbers are converted without printf and tag values are escaped.
+ * Running out of buffer is remembered and reported by PayloadGetLength.
+ * @version 0.0.1
+ *  **************************************************************************/
+#ifndef SRC_PAYLOAD_H_
+#define SRC_PAYLOAD_H_
+
+#include <stdbool.h>
+#include <stdint.h>
+
+/******************************************************************************
+ * 								DEFS
+*****************************************************************************/
+#define PAYLOAD_DATA_PREFIX "--data-binary "	// the endpoint takes curl style bodies
+#define PAYLOAD_TIME_SUFFIX "000000000"		// seconds to nanoseconds
+
+typedef struct _PAYLOAD_BUILDER {
+	char * buf;
+	uint32_t size;
+	uint32_t len;
+	uint32_t num_fields;	// fields of the current line
+	bool overflow;
+} PAYLOAD_BUILDER;
+
+
+/******************************************************************************
+ * @brief Starts building into buf.
+ * @param builder - the builder.
+ * @param buf - output buffer, kept NUL terminated.
+ * @param size - size of buf.
+ *****************************************************************************/
+void PayloadInit(PAYLOAD_BUILDER * builder, char * buf, uint32_t size);
+
+/******************************************************************************
+ * @brief Appends text as is.
+ *****************************************************************************/
+void PayloadAppend(PAYLOAD_BUILDER * builder, const char * text);
+
+/******************************************************************************
+ * @brief Starts a line: PAYLOAD_DATA_PREFIX and the measurement.
+ *****************************************************************************/
+void PayloadLineStart(PAYLOAD_BUILDER * builder, const char * measurement);
+
+/******************************************************************************
+ * @brief Appends a tag, commas, spaces and equal signs in value are escaped.
+ *****************************************************************************/
+void PayloadTag(PAYLOAD_BUILDER * builder, const char * key, const char * value);
+
+/******************************************************************************
+ * @brief Appends an integer field.
+ *****************************************************************************/
+void PayloadFieldInt(PAYLOAD_BUILDER * builder, const char * key, int32_t value);
+
+/******************************************************************************
+ * @brief Appends a fixed point field, e.g. 317498445 with 7 decimals is
+ * written as 31.7498445.
+ *****************************************************************************/
+void PayloadFieldFixed(PAYLOAD_BUILDER * builder, const char * key, int32_t value, uint32_t decimals);
+
+/******************************************************************************
+ * @brief Appends an integer field whose key is numbered, e.g. opt2csq.
+ * @param prefix - key before the number.
+ * @param index - the number.
+ * @param suffix - key after the number.
+ *****************************************************************************/
+void PayloadFieldIndexedInt(PAYLOAD_BUILDER * builder, const char * prefix, uint32_t index, const char * suffix, int32_t value);
+
+/******************************************************************************
+ * @brief Appends a field whose value is written as is, e.g. true.
+ *****************************************************************************/
+void PayloadFieldRaw(PAYLOAD_BUILDER * builder, const char * key, const char * value);
+
+/******************************************************************************
+ * @brief Ends a line with its timestamp.
+ * @param unix_time - seconds since 1970, as text.
+ *****************************************************************************/
+void PayloadLineEnd(PAYLOAD_BUILDER * builder, const char * unix_time);
+
+/******************************************************************************
+ * @return the length of the payload, -1 if the buffer was too small.
+ *****************************************************************************/
+int PayloadGetLength(const PAYLOAD_BUILDER * builder);
+
+
+#endif /* SRC_PAYLOAD_H_ */
@@ -0,0 +1,120 @@
+/******************************************************************************
+ * @scheduler.c
+ * @brief Run-to-completion event scheduler.
+ * Interrupts and timers post events into one ring per priority, the main loop
+ * runs their handlers one at a time, highest priority first, and sleeps in the
+ * deepest allowed energy mode when all queues are empty. Handlers must not
+ * block for long, work that takes longer is split into steps.
+ * @version 0.0.1
+ *  **************************************************************************/
+#include "em_device.h"
+#include "em_core.h"
+
+#include "scheduler.h"
+#include "energy.h"
+
+/******************************************************************************
+ * 								DEFS
+*****************************************************************************/
+#define QUEUE_MASK (SCHEDULER_QUEUE_SIZE - 1)
+
+typedef struct _EVENT_QUEUE {
+	EVENT events[SCHEDULER_QUEUE_SIZE];
+	volatile uint32_t head;		// next to dispatch
+	volatile uint32_t tail;		// next free
+} EVENT_QUEUE;
+
+/******************************************************************************
+ * 							GLOBAL VARIABLES
+*****************************************************************************/
+static EVENT_QUEUE queues[EVENT_NUM_PRIORITIES];
+static EVENT_HANDLER handlers[EVENT_NUM_TYPES] = {NULL};
+static volatile uint32_t dropped_events = 0;
+
+
+void SchedulerSetHandler(EVENT_TYPE type, EVENT_HANDLER handler) {
+	handlers[type] = handler;
+}
+
+bool SchedulerPost(EVENT_PRIORITY priority, EVENT_TYPE type, uint32_t data) {
+	EVENT_QUEUE * queue = &queues[priority];
+	bool queued = false;
+
+	CORE_DECLARE_IRQ_STATE;
+	CORE_ENTER_ATOMIC();
+	if (queue->tail - queue->head < SCHEDULER_QUEUE_SIZE) {
+		EVENT * event = &queue->events[queue->tail & QUEUE_MASK];
+		event->type = type;
+		event->data = data;
+		queue->tail++;
+		queued = true;
+	} else {
+		dropped_events++;
+	}
+	CORE_EXIT_ATOMIC();
+	return queued;
+}
+
+bool SchedulerPostOnce(EVENT_PRIORITY priority, EVENT_TYPE type, uint32_t data) {
+	EVENT_QUEUE * queue = &queues[priority];
+	bool queued = false;
+
+	CORE_DECLARE_IRQ_STATE;
+	CORE_ENTER_ATOMIC();
+	for (uint32_t i = queue->head; i != queue->tail; i++) {
+		EVENT * event = &queue->events[i & QUEUE_MASK];
+		if (event->type == type && event->data == data) {
+			queued = true;
+			break;
+		}
+	}
+	if (!queued) {
+		queued = SchedulerPost(priority, type, data);
+	}
+	CORE_EXIT_ATOMIC();
+	return queued;
+}
+
+bool SchedulerHasEvents(void) {
+	for (int i = 0; i < EVENT_NUM_PRIORITIES; i++) {
+		if (queues[i].tail != queues[i].head) {
+			return true;
+		}
+	}
+	return false;
+}
+
+bool SchedulerDispatchOne(void) {
+	for (int i = 0; i < EVENT_NUM_PRIORITIES; i++) {
+		EVENT_QUEUE * queue = &queues[i];
+		if (queue->tail == queue->head) {
+			continue;
+		}
+
+		// copy out first, the handler may post to the same queue
+		EVENT event;
+		CORE_DECLARE_IRQ_STATE;
+		CORE_ENTER_ATOMIC();
+		event = queue->events[queue->head & QUEUE_MASK];
+		queue->head++;
+		CORE_EXIT_ATOMIC();
+
+		if (handlers[event.type] != NULL) {
+			handlers[event.type](&event);
+		}
+		return true;
+	}
+	return false;
+}
+
+void SchedulerRun(void) {
+	while (true) {
+		// timers are processed while waiting and may post events
+		EnergyWaitFor(SchedulerHasEvents, UINT32_MAX);
+		SchedulerDispatchOne();
+	}
+}
+
+uint32_t SchedulerGetDroppedEvents(void) {
+	return dropped_events;
+}
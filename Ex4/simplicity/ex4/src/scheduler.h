@@ -0,0 +1,96 @@
+/******************************************************************************
+ * @scheduler.h
+ * @brief Interface for the run-to-completion event scheduler.
+ * @version 0.0.1
+ *  **************************************************************************/
+#ifndef SRC_SCHEDULER_H_
+#define SRC_SCHEDULER_H_
+
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdint.h>
+
+/******************************************************************************
+ * 								DEFS
+*****************************************************************************/
+#define SCHEDULER_QUEUE_SIZE 16		// events per priority, power of two
+
+typedef enum {EVENT_PRIORITY_HIGH, EVENT_PRIORITY_NORMAL, EVENT_PRIORITY_LOW, EVENT_NUM_PRIORITIES} EVENT_PRIORITY;
+
+typedef enum {
+	EVENT_BUTTON,		// data: button index
+	EVENT_GPS_FIX,		// new fixes were stored in the GPS track
+	EVENT_TIMER,		// data: job given to the timer
+	EVENT_STEP,			// data: run of the state machine to advance
+	EVENT_MQTT,			// the MQTT client has keepalive or retransmission work
+	EVENT_CELLULAR_RX,	// the modem sent something while nothing was reading, e.g. a URC
+	EVENT_NUM_TYPES
+} EVENT_TYPE;
+
+typedef struct _EVENT {
+	EVENT_TYPE type;
+	uint32_t data;
+} EVENT;
+
+typedef void (*EVENT_HANDLER)(const EVENT * event);
+
+extern bool DEBUG;
+
+
+/******************************************************************************
+ * @brief Sets the handler of an event type, events without one are dropped.
+ * @param type - the event type.
+ * @param handler - called from SchedulerRun for every event of type.
+ *****************************************************************************/
+void SchedulerSetHandler(EVENT_TYPE type, EVENT_HANDLER handler);
+
+
+/******************************************************************************
+ * @brief Queues an event. Safe to call from interrupts.
+ * @param priority - queue to put the event in.
+ * @param type - the event type.
+ * @param data - passed to the handler.
+ * @return true if queued, false if the queue is full.
+ *****************************************************************************/
+bool SchedulerPost(EVENT_PRIORITY priority, EVENT_TYPE type, uint32_t data);
+
+
+/******************************************************************************
+ * @brief Queues an event unless the same event is already waiting in the
+ * queue. For level-like events (new data, periodic jobs) that must not flood
+ * a queue while their handler cannot run. Safe to call from interrupts.
+ * @param priority - queue to put the event in.
+ * @param type - the event type.
+ * @param data - passed to the handler.
+ * @return true if the event is queued, false if the queue is full.
+ *****************************************************************************/
+bool SchedulerPostOnce(EVENT_PRIORITY priority, EVENT_TYPE type, uint32_t data);
+
+
+/******************************************************************************
+ * @return true if any event is queued.
+ *****************************************************************************/
+bool SchedulerHasEvents(void);
+
+
+/******************************************************************************
+ * @brief Runs the handler of the oldest event of the highest priority queue.
+ * @return true if an event was handled.
+ *****************************************************************************/
+bool SchedulerDispatchOne(void);
+
+
+/******************************************************************************
+ * @brief Dispatches events one at a time and sleeps while there are none.
+ * Never returns.
+ *****************************************************************************/
+void SchedulerRun(void);
+
+
+/******************************************************************************
+ * @return the number of events dropped because their queue was full.
+ *****************************************************************************/
+uint32_t SchedulerGetDroppedEvents(void);
+
+
+#endif /* SRC_SCHEDULER_H_ */
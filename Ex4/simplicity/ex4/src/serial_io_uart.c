@@ -6,12 +6,15 @@
 #include "em_chip.h"
 
 #include "serial_io_uart.h"
+#include "energy.h"
 
 /**************************************************************************//**
  * 							GLOBAL VARIABLES
 *****************************************************************************/
-static uint32_t rxDataReady = 0;      // Flag indicating receiver does not have data
-static char rxBuffer[RX_BUFFER_SIZE]; // Software receive buffer
+static char rxLines[RX_LINE_SLOTS][RX_BUFFER_SIZE]; // Software receive ring, one line per slot
+static volatile uint32_t rxLineHead = 0;      // Oldest complete line
+static volatile uint32_t rxLineTail = 0;      // Line the interrupt is writing, lines before it are complete
+static volatile uint32_t rxLineOverruns = 0;  // Lines dropped because the ring was full
 
 /**************************************************************************//**
  * @brief
@@ -48,8 +51,9 @@ void initLeuart(void)
  *
  * @details
  *    Keep receiving data while there is still data left in the hardware RX buffer.
- *    Store incoming data into rxBuffer and set rxDataReady when a linefeed '\n' is
- *    sent or if there is no more room in the buffer.
+ *    Store incoming data into the tail slot of rxLines and move on to the next
+ *    slot when a linefeed '\n' is sent or if there is no more room in the slot.
+ *    When the ring is full the line is dropped and counted in rxLineOverruns.
  *****************************************************************************/
 void LEUART0_IRQHandler(void)
 {
@@ -65,14 +69,19 @@ void LEUART0_IRQHandler(void)
   if (flags & LEUART_IF_RXDATAV) {
     while (LEUART0->STATUS & LEUART_STATUS_RXDATAV) { // While there is still incoming data
       char data = LEUART_Rx(LEUART0);
+      char * line = rxLines[rxLineTail % RX_LINE_SLOTS];
       if ((rxIndex < RX_BUFFER_SIZE - 2) && (data != '\n')) { // Save two spots for '\n' and '\0'
-        rxBuffer[rxIndex++] = data;
+        line[rxIndex++] = data;
       } else { // Done receiving
-        rxBuffer[rxIndex++] = '\n';
-        rxBuffer[rxIndex] = '\0';
-        rxDataReady = 1;
+        line[rxIndex++] = '\n';
+        line[rxIndex] = '\0';
         rxIndex = 0;
-        break;
+        // keep one slot free for the next line
+        if (rxLineTail - rxLineHead < RX_LINE_SLOTS - 1) {
+          rxLineTail++;
+        } else {
+          rxLineOverruns++;
+        }
       }
     }
   }
@@ -92,30 +101,30 @@ bool SerialInitGPS(char* port, unsigned int baud){
 	return true;
 }
 
+/**************************************************************************//**
+ * @brief Wake up condition for SerialRecvGPS.
+ *****************************************************************************/
+static bool gpsLineReady(void) {
+	return rxLineHead != rxLineTail;
+}
+
 /**************************************************************************//**
  * @brief
  * @param buf - to store result.
  * @param maxlen - the maximum length of result.
- * @param timeout_ms - timeout to receive.
+ * @param timeout_ms - timeout to receive, 0 to return at once.
  *****************************************************************************/
 unsigned int SerialRecvGPS(unsigned char *buf, unsigned int maxlen, unsigned int timeout_ms){
-	uint32_t i;
-	uint32_t curTicks;
-
-	curTicks = msTicks;
-	while ((msTicks - curTicks) < timeout_ms){
-
-		if (rxDataReady) {
-			  LEUART_IntDisable(LEUART0, LEUART_IEN_RXDATAV); // Disable interrupts
-
-			  for (i = 0; rxBuffer[i] != 0; i++) {
-				  buf[i] = rxBuffer[i]; // Copy rxBuffer into txBuffer
-			  }
-			  buf[i] = '\0';
-			  rxDataReady = 0; // Indicate that we need new data
-			  LEUART_IntEnable(LEUART0, LEUART_IEN_RXDATAV); // Re-enable interrupts
-			  return i;
+	uint32_t i = 0;
+
+	// sleep until the RX interrupt completed a line
+	if (gpsLineReady() || (timeout_ms > 0 && EnergyWaitFor(gpsLineReady, timeout_ms))) {
+		const char * line = rxLines[rxLineHead % RX_LINE_SLOTS];
+		for (i = 0; line[i] != 0 && i < maxlen - 1; i++) {
+			buf[i] = line[i]; // Copy the oldest line into buf
 		}
+		buf[i] = '\0';
+		rxLineHead++; // Release the slot to the interrupt
 	}
 	return i;
 }
@@ -124,7 +133,14 @@ unsigned int SerialRecvGPS(unsigned char *buf, unsigned int maxlen, unsigned int
  * @brief
  *****************************************************************************/
 void SerialFlushInputBuffGPS(void){
-	rxBuffer[0] = '\0';
+	rxLineHead = rxLineTail;
+}
+
+/**************************************************************************//**
+ * @brief
+ *****************************************************************************/
+uint32_t SerialGetOverrunsGPS(void){
+	return rxLineOverruns;
 }
 
 /**************************************************************************//**
@@ -139,13 +155,10 @@ void SerialDisableGPS(){
 }
 
 /***************************************************************************//**
- * @brief Delays number of msTick Systicks (typically 1 ms)
- * @param dlyTicks Number of ticks to delay
+ * @brief Sleeps for ms milliseconds.
+ * @param ms - time to sleep.
  ******************************************************************************/
 void DelayGPS(uint32_t ms)
 {
-  uint32_t curTicks;
-
-  curTicks = msTicks;
-  while ((msTicks - curTicks) < ms) ;
+  EnergyDelay(ms);
 }
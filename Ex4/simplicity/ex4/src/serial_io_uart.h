@@ -15,9 +15,9 @@
  * 								DEFS
 *****************************************************************************/
 #define SERIAL_TIMEOUT -1
-#define RX_BUFFER_SIZE 80             // Software receive buffer size
+#define RX_BUFFER_SIZE 80             // Software receive buffer size, per line
+#define RX_LINE_SLOTS 8               // Lines buffered by the RX interrupt, one is being written
 
-extern volatile uint32_t msTicks;
 extern bool DEBUG;
 
 
@@ -34,7 +34,8 @@ bool SerialInitGPS(char* port, unsigned int baud);
  * @brief Receive data from serial connection.
  * @param buf - buffer to be filled.
  * @param maxlen - maximum length of a line of data.
- * @param timeout_ms - length of the timeout in ms.
+ * @param timeout_ms - length of the timeout in ms, 0 to return at once.
+ * @return the length of the oldest buffered line, 0 if there is none.
  *****************************************************************************/
 unsigned int SerialRecvGPS(unsigned char* buf, unsigned int maxlen, unsigned int timeout_ms);
 
@@ -48,6 +49,12 @@ unsigned int SerialRecvGPS(unsigned char* buf, unsigned int maxlen, unsigned int
 void SerialFlushInputBuffGPS(void);
 
 
+/******************************************************************************
+ * @return the number of lines dropped because the RX ring was full.
+ *****************************************************************************/
+uint32_t SerialGetOverrunsGPS(void);
+
+
 /******************************************************************************
  * @brief Disable the serial connection.
  *****************************************************************************/
@@ -55,8 +62,8 @@ void SerialDisableGPS();
 
 
 /*******************************************************************************
- * @brief Delays number of msTick Systicks (typically 1 ms)
- * @param dlyTicks Number of ticks to delay
+ * @brief Sleeps for ms milliseconds.
+ * @param ms - time to sleep.
  ******************************************************************************/
 void DelayGPS(uint32_t ms);
 
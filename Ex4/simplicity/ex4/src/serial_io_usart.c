@@ -11,16 +11,30 @@
 #include "em_chip.h"
 
 #include "serial_io_usart.h"
+#include "cmux.h"
+#include "energy.h"
+#include "timebase.h"
+#include "scheduler.h"
 
 /**************************************************************************//**
  * 							GLOBAL VARIABLES
 *****************************************************************************/
 static uint32_t rxReadIndex = 0;
-static uint32_t rxWriteIndex = 0;
+static volatile uint32_t rxWriteIndex = 0;
 static char rxBuffer[RX_BUFFER_SIZE]; // Software receive buffer
+static uint8_t rxChannel = CMUX_CHANNEL_AT;	// channel the functions use while multiplexing
+static uint8_t openingChannel;
+static volatile bool rxStalled = false;	// RX interrupt off until the receive buffer has room
+static SERIAL_STATS stats;
 
+// rates SerialNegotiateBaudCellular steps up through, slowest first
+static const unsigned int BAUD_RATES[] = {115200, 230400, 460800, 921600};
+#define NUM_BAUD_RATES (sizeof(BAUD_RATES) / sizeof(BAUD_RATES[0]))
 
-void initUSART(void)
+static bool cellularDataAvailable(void);
+
+
+void initUSART(unsigned int baud, bool flow_control)
 {
 	// clear buffer
 	memset(rxBuffer, '\0', RX_BUFFER_SIZE);
@@ -33,6 +47,7 @@ void initUSART(void)
 	// Initialize the USART2 module
 	USART_InitAsync_TypeDef init = USART_INITASYNC_DEFAULT;
 	init.enable = usartDisable;
+	init.baudrate = baud;
 	USART_InitAsync(USART2, &init);
 
 	// Enable TX/RX
@@ -42,6 +57,13 @@ void initUSART(void)
 	USART2->ROUTEPEN = USART_ROUTEPEN_RXPEN | USART_ROUTEPEN_TXPEN;
 	USART2->ROUTELOC0 = USART_ROUTELOC0_RXLOC_LOC1 | USART_ROUTELOC0_TXLOC_LOC1;
 
+	if (flow_control) {
+		// TX waits while CTS is high, RTS goes high while the RX FIFO is full
+		USART2->CTRLX |= USART_CTRLX_CTSEN;
+		USART2->ROUTEPEN |= USART_ROUTEPEN_CTSPEN | USART_ROUTEPEN_RTSPEN;
+		USART2->ROUTELOC1 = USART_ROUTELOC1_CTSLOC_LOC1 | USART_ROUTELOC1_RTSLOC_LOC1;
+	}
+
 	/* Clear previous RX interrupts */
 	USART_IntClear(USART2 ,USART_IEN_RXDATAV);
 	NVIC_ClearPendingIRQ(USART2_RX_IRQn);
@@ -64,11 +86,36 @@ void USART2_RX_IRQHandler(void) {
 
 	// RX portion of the interrupt handler
 	if (flags & USART_IF_RXDATAV) {
+		bool full = (rxWriteIndex + 1) % RX_BUFFER_SIZE == rxReadIndex;
+		if (full && stats.flow_control && !CmuxIsActive()) {
+			// the byte stays in the USART, once its FIFO fills RTS holds the modem off
+			USART_IntDisable(USART2, USART_IEN_RXDATAV);
+			rxStalled = true;
+			stats.stalls++;
+			return;
+		}
+
+		bool was_empty = !cellularDataAvailable();
 		char data = USART2->RXDATA;
-		if (data != '\0') {
+		stats.rx_bytes++;
+		if (CmuxIsActive()) {
+			// frames are binary, they go to the channels as they arrive. Nothing
+			// stalls here, the reads ask for no more than a channel buffer holds
+			CmuxReceive((uint8_t) data);
+		} else {
+			// every byte is kept, socket data is binary and holds zeros
+			if (full) {
+				// written, it would make the whole ring read as empty
+				stats.overruns++;
+				return;
+			}
 			rxBuffer[rxWriteIndex++] = data;
 			rxWriteIndex = rxWriteIndex % RX_BUFFER_SIZE;
 		}
+		// the first unread byte lets a step that waits for a URC run
+		if (was_empty && cellularDataAvailable()) {
+			SchedulerPostOnce(EVENT_PRIORITY_NORMAL, EVENT_CELLULAR_RX, 0);
+		}
 	}
 }
 
@@ -77,8 +124,9 @@ void USART2_RX_IRQHandler(void) {
  * @brief
  * @param port - the serial port of the cellular modem module
  * @param baud - the baud rate of the cellular modem module.
+ * @param flow_control - true for RTS/CTS.
  *****************************************************************************/
-bool SerialInitCellular(char* port, unsigned int baud) {
+bool SerialInitCellular(char* port, unsigned int baud, bool flow_control) {
 	// Initialize USART2 RX pin
 	int num_port = atoi(port);
 
@@ -88,7 +136,18 @@ bool SerialInitCellular(char* port, unsigned int baud) {
 		// RX
 		// GPS PA6
 		GPIO_PinModeSet(gpioPortA, 6, gpioModePushPull, 1);    // TX
-		initUSART();
+		if (flow_control) {
+			GPIO_PinModeSet(gpioPortA, 8, gpioModeInput, 0);     // CTS, from the modem's RTS0
+			GPIO_PinModeSet(gpioPortA, 9, gpioModePushPull, 0);  // RTS, to the modem's CTS0
+		}
+		memset(&stats, 0, sizeof(stats));
+		stats.baud = baud;
+		stats.flow_control = flow_control;
+		rxStalled = false;
+		initUSART(baud, flow_control);
+
+		// USART2 needs the HF clock, which is off in EM2
+		EnergyBlockMode(ENERGY_EM2);
 
 	} else {
 		return false;
@@ -97,6 +156,68 @@ bool SerialInitCellular(char* port, unsigned int baud) {
 	return true;
 }
 
+/**************************************************************************//**
+ * @brief Wake up condition for the receive functions.
+ *****************************************************************************/
+static bool cellularDataAvailable(void) {
+	if (CmuxIsActive()) {
+		return CmuxAvailable(rxChannel) > 0;
+	}
+	return rxReadIndex != rxWriteIndex;
+}
+
+bool SerialDataAvailableCellular(void) {
+	return cellularDataAvailable();
+}
+
+/**************************************************************************//**
+ * @brief Turns the RX interrupt back on after a stall, the receive buffer
+ * has room again.
+ *****************************************************************************/
+static void resumeReceive(void) {
+	if (rxStalled) {
+		rxStalled = false;
+		USART_IntEnable(USART2, USART_IEN_RXDATAV);
+	}
+}
+
+/**************************************************************************//**
+ * @brief Takes the next received byte, call when cellularDataAvailable().
+ *****************************************************************************/
+static unsigned char takeByte(void) {
+	uint8_t byte;
+	if (CmuxIsActive()) {
+		CmuxRead(rxChannel, &byte, 1);
+		return byte;
+	}
+	byte = rxBuffer[rxReadIndex];
+	rxReadIndex = (rxReadIndex + 1) % RX_BUFFER_SIZE;
+	resumeReceive();
+	return byte;
+}
+
+/**************************************************************************//**
+ * @brief Adds a reception to the throughput counters.
+ * @param len - bytes received.
+ * @param first_ms, last_ms - when the first and the last of them were taken.
+ *****************************************************************************/
+static void countBurst(uint32_t len, uint32_t first_ms, uint32_t last_ms) {
+	if (len >= STATS_MIN_BURST) {
+		stats.burst_bytes += len;
+		stats.burst_ms += last_ms - first_ms;
+	}
+}
+
+/**************************************************************************//**
+ * @brief Writes bytes to USART2, bypassing the multiplexer.
+ *****************************************************************************/
+static void usartWrite(const uint8_t *data, uint32_t len) {
+	for (uint32_t index = 0; index < len; index++) {
+		USART_Tx(USART2, data[index]);
+	}
+	stats.tx_bytes += len;
+}
+
 /**************************************************************************//**
  * @brief
  * @param buf - to store result.
@@ -105,16 +226,96 @@ bool SerialInitCellular(char* port, unsigned int baud) {
  *****************************************************************************/
 unsigned int SerialRecvCellular(unsigned char *buf, unsigned int maxlen, unsigned int timeout_ms){
 	uint32_t i = 0;
-	uint32_t curTicks;
+	uint64_t start_ms;
+	uint32_t elapsed;
+	uint32_t first_ms = 0;
+	uint32_t last_ms = 0;
+
+	start_ms = TimebaseGetMs();
+
+	while ((elapsed = (uint32_t) (TimebaseGetMs() - start_ms)) < timeout_ms && i < maxlen) {
+		if (cellularDataAvailable()) {
+			first_ms = (i == 0) ? elapsed : first_ms;
+			last_ms = elapsed;
+			buf[i++] = takeByte();
+		} else {
+			EnergyWaitFor(cellularDataAvailable, timeout_ms - elapsed);
+		}
+	}
+	countBurst(i, first_ms, last_ms);
+	return i;
+}
+
+/**************************************************************************//**
+ * @brief Checks whether a received line ends the reception.
+ * @param line - start of the line.
+ * @param len - length of the line, including its "\r\n".
+ * @param terminators - line prefixes that end the reception, or NULL.
+ * @param num_terminators - number of items in terminators.
+ * @return true if the line is a terminating line.
+ *****************************************************************************/
+static bool isTerminatingLine(const unsigned char *line, uint32_t len, const char **terminators, int num_terminators) {
+	// strip "\r\n", empty lines never terminate
+	while (len > 0 && (line[len - 1] == '\n' || line[len - 1] == '\r')) {
+		len--;
+	}
+	if (len == 0) {
+		return false;
+	}
+	if (terminators == NULL) {
+		return true;
+	}
+	for (int i = 0; i < num_terminators; i++) {
+		size_t term_len = strlen(terminators[i]);
+		if (term_len <= len && memcmp(line, terminators[i], term_len) == 0) {
+			return true;
+		}
+	}
+	return false;
+}
+
+/**************************************************************************//**
+ * @brief
+ * @param buf - to store result.
+ * @param maxlen - size of buf.
+ * @param timeout_ms - in: timeout to receive. out: time left.
+ * @param terminators - line prefixes that end the reception, or NULL.
+ * @param num_terminators - number of items in terminators.
+ *****************************************************************************/
+unsigned int SerialRecvCellularUntil(unsigned char *buf, unsigned int maxlen, unsigned int *timeout_ms,
+		const char **terminators, int num_terminators) {
+	uint32_t i = 0;
+	uint32_t line_start = 0;
+	uint32_t elapsed = 0;
+	uint64_t start_ms;
+	uint32_t first_ms = 0;
+	uint32_t last_ms = 0;
+
+	if (maxlen == 0) {
+		return 0;
+	}
 
-	curTicks = msTicks;
+	start_ms = TimebaseGetMs();
+	while ((elapsed = (uint32_t) (TimebaseGetMs() - start_ms)) < *timeout_ms && i < maxlen - 1) {
+		if (cellularDataAvailable()) {
+			first_ms = (i == 0) ? elapsed : first_ms;
+			last_ms = elapsed;
+			buf[i++] = takeByte();
 
-	while ((msTicks - curTicks) < timeout_ms) {
-		if (rxReadIndex != rxWriteIndex) {
-			buf[i++] = rxBuffer[rxReadIndex];
-			rxReadIndex = (++rxReadIndex) % RX_BUFFER_SIZE;
+			if (buf[i - 1] == '\n') {
+				if (isTerminatingLine(&buf[line_start], i - line_start, terminators, num_terminators)) {
+					break;
+				}
+				line_start = i;
+			}
+		} else {
+			EnergyWaitFor(cellularDataAvailable, *timeout_ms - elapsed);
 		}
 	}
+	buf[i] = '\0';
+	countBurst(i, first_ms, last_ms);
+
+	*timeout_ms = (elapsed < *timeout_ms) ? *timeout_ms - elapsed : 0;
 	return i;
 }
 
@@ -125,39 +326,212 @@ unsigned int SerialRecvCellular(unsigned char *buf, unsigned int maxlen, unsigne
  * @return true on success
  */
 bool SerialSendCellular(unsigned char *buf, unsigned int size) {
-	for (unsigned int index = 0; index < size; index++) {
-		USART_Tx(USART2, buf[index]);
+	if (CmuxIsActive()) {
+		return CmuxWrite(rxChannel, buf, size);
 	}
+	usartWrite(buf, size);
 	return true;
 }
 
+/**************************************************************************//**
+ * @brief Wake up condition while a channel opens.
+ *****************************************************************************/
+static bool channelOpened(void) {
+	return CmuxIsOpen(openingChannel);
+}
+
+/**************************************************************************//**
+ * @brief Maps a baud rate to the <port_speed> of AT+CMUX.
+ * @return 1 (9600) to 6 (230400), 0 for other rates.
+ *****************************************************************************/
+static int cmuxPortSpeed(unsigned int baud) {
+	const unsigned int speeds[] = {9600, 19200, 38400, 57600, 115200, 230400};
+	for (int i = 0; i < (int) (sizeof(speeds) / sizeof(speeds[0])); i++) {
+		if (speeds[i] == baud) {
+			return i + 1;
+		}
+	}
+	return 0;
+}
+
+/**************************************************************************//**
+ * @brief Switches the modem to 27.010 multiplexing and opens the channels.
+ * @return true if all CMUX_NUM_CHANNELS channels are open.
+ *****************************************************************************/
+bool SerialMuxCellular(void) {
+	unsigned char response[MUX_RESPONSE_SIZE];
+	char command[MUX_RESPONSE_SIZE];
+	unsigned int time_left_ms = MUX_OPEN_TIMEOUT_MS;
+	const char * results[] = {"OK", "ERROR", "+CME ERROR"};
+	int port_speed = cmuxPortSpeed(stats.baud);
+
+	if (CmuxIsActive()) {
+		return true;
+	}
+	// the port speed field must match the rate the link runs at, left empty above 230400
+	if (port_speed > 0) {
+		snprintf(command, sizeof(command), "%s%d,%d\r\n", CMUX_AT_PREFIX, port_speed, CMUX_MAX_FRAME);
+	} else {
+		snprintf(command, sizeof(command), "%s,%d\r\n", CMUX_AT_PREFIX, CMUX_MAX_FRAME);
+	}
+	usartWrite((const uint8_t *) command, strlen(command));
+	SerialRecvCellularUntil(response, sizeof(response), &time_left_ms, results, 3);
+	if (strstr((char *) response, "OK") == NULL) {
+		return false;
+	}
+
+	// frames from here on, the control channel first
+	CmuxStart(usartWrite);
+	for (openingChannel = CMUX_CHANNEL_CONTROL; openingChannel < CMUX_NUM_CHANNELS; openingChannel++) {
+		uint64_t start_ms = TimebaseGetMs();
+		uint32_t elapsed;
+
+		CmuxOpenChannel(openingChannel);
+		while (!channelOpened() && (elapsed = (uint32_t) (TimebaseGetMs() - start_ms)) < MUX_OPEN_TIMEOUT_MS) {
+			EnergyWaitFor(channelOpened, MUX_OPEN_TIMEOUT_MS - elapsed);
+		}
+		if (!channelOpened()) {
+			if (DEBUG) { printf("mux channel %d did not open\n", openingChannel); }
+			CmuxStop();
+			return false;
+		}
+	}
+	rxChannel = CMUX_CHANNEL_AT;
+	return true;
+}
+
+/**************************************************************************//**
+ * @brief Selects the channel the send and receive functions use.
+ * @param channel - CMUX_CHANNEL_*, ignored while not multiplexing.
+ *****************************************************************************/
+void SerialSelectCellularChannel(uint8_t channel) {
+	if (channel > CMUX_CHANNEL_CONTROL && channel < CMUX_NUM_CHANNELS) {
+		rxChannel = channel;
+	}
+}
+
 
 /**************************************************************************//**
  * @brief
  *****************************************************************************/
 void SerialFlushInputBuffCellular(void){
+	uint8_t discard[16];
+	while (CmuxIsActive() && CmuxRead(rxChannel, discard, sizeof(discard)) > 0);
 	rxReadIndex = 0;
 	rxWriteIndex = 0;
 	memset(rxBuffer, '\0', RX_BUFFER_SIZE);
+	resumeReceive();
+}
+
+/**************************************************************************//**
+ * @brief Sends a command on the plain link and waits for its result.
+ * @param command - NUL terminated, with "\r\n".
+ * @param timeout_ms - for the result.
+ * @return true on OK.
+ *****************************************************************************/
+static bool commandOK(const char * command, unsigned int timeout_ms) {
+	unsigned char response[BAUD_RESPONSE_SIZE];
+	const char * results[] = {"OK", "ERROR", "+CME ERROR"};
+
+	SerialFlushInputBuffCellular();
+	usartWrite((const uint8_t *) command, strlen(command));
+	SerialRecvCellularUntil(response, sizeof(response), &timeout_ms, results, 3);
+	return strstr((char *) response, "OK") != NULL;
+}
+
+/**************************************************************************//**
+ * @brief Checks the modem answers at the current rate.
+ *****************************************************************************/
+static bool probeBaud(void) {
+	for (int i = 0; i < BAUD_PROBE_TRIES; i++) {
+		if (commandOK("AT\r\n", BAUD_PROBE_TIMEOUT_MS)) {
+			return true;
+		}
+	}
+	return false;
+}
+
+/**************************************************************************//**
+ * @brief Asks the modem to change its rate, it answers at the old one.
+ *****************************************************************************/
+static bool setModemBaud(unsigned int baud) {
+	char command[BAUD_RESPONSE_SIZE];
+	snprintf(command, sizeof(command), "AT+IPR=%u\r\n", baud);
+	return commandOK(command, BAUD_PROBE_TIMEOUT_MS);
+}
+
+unsigned int SerialFindBaudCellular(void) {
+	for (unsigned int i = 0; i < NUM_BAUD_RATES; i++) {
+		SerialSetBaudCellular(BAUD_RATES[i]);
+		if (probeBaud()) {
+			if (DEBUG) { printf("modem found at %u baud\n", BAUD_RATES[i]); }
+			return BAUD_RATES[i];
+		}
+	}
+	SerialSetBaudCellular(BAUD_RATES[0]);
+	return 0;
+}
+
+unsigned int SerialNegotiateBaudCellular(unsigned int max_baud) {
+	unsigned int good = stats.baud;
+
+	if (CmuxIsActive()) {
+		return good;
+	}
+	for (unsigned int i = 0; i < NUM_BAUD_RATES; i++) {
+		unsigned int baud = BAUD_RATES[i];
+		if (baud > max_baud || baud <= good || !setModemBaud(baud)) {
+			continue;
+		}
+		EnergyDelay(BAUD_SETTLE_MS);
+		SerialSetBaudCellular(baud);
+		if (probeBaud()) {
+			good = baud;
+			continue;
+		}
+
+		// an AT+IPR sent at a rate that does not answer is not understood either,
+		// the modem is only found again if it stayed at the last good rate
+		if (DEBUG) { printf("no answer at %u baud, stopping at %u\n", baud, good); }
+		SerialSetBaudCellular(good);
+		if (!probeBaud()) {
+			// it did move, the link stays where the modem is
+			if (DEBUG) { printf("modem lost at %u baud\n", baud); }
+			SerialSetBaudCellular(baud);
+		}
+		break;
+	}
+	if (DEBUG) { printf("modem link at %u baud\n", stats.baud); }
+	return stats.baud;
+}
+
+void SerialSetBaudCellular(unsigned int baud) {
+	USART_BaudrateAsyncSet(USART2, 0, baud, usartOVS16);
+	stats.baud = baud;
+	SerialFlushInputBuffCellular();
+}
+
+void SerialGetStatsCellular(SERIAL_STATS * out) {
+	*out = stats;
 }
 
 /**************************************************************************//**
  * @brief
  *****************************************************************************/
 void SerialDisableCellular(){
+	CmuxStop();
+	rxChannel = CMUX_CHANNEL_AT;
 	SerialFlushInputBuffCellular();
 	NVIC_DisableIRQ(USART2_RX_IRQn);
 	USART_IntDisable(USART2, USART_IEN_RXDATAV);
 	CMU_ClockEnable(cmuClock_USART2, false);
+	EnergyUnblockMode(ENERGY_EM2);
 }
 
 /***************************************************************************//**
- * @brief Delays number of msTick Systicks (typically 1 ms)
- * @param dlyTicks Number of ticks to delay
+ * @brief Sleeps for ms milliseconds.
+ * @param ms - time to sleep.
  ******************************************************************************/
 void DelayCellular(uint32_t ms) {
-	uint32_t curTicks;
-
-	curTicks = msTicks;
-	while ((msTicks - curTicks) < ms) ;
+	EnergyDelay(ms);
 }
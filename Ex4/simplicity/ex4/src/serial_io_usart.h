@@ -19,27 +19,106 @@
 *****************************************************************************/
 #define SERIAL_TIMEOUT -1
 #define RX_BUFFER_SIZE 1000             // Software receive buffer size
+#define MUX_OPEN_TIMEOUT_MS 2000        // for the AT+CMUX answer and for each channel to open
+#define MUX_RESPONSE_SIZE 64
+#define BAUD_SETTLE_MS 100              // after AT+IPR, before the first command at the new rate
+#define BAUD_PROBE_TIMEOUT_MS 300       // for the OK of an AT at a new rate
+#define BAUD_PROBE_TRIES 3
+#define BAUD_RESPONSE_SIZE 64
+#define STATS_MIN_BURST 256             // receptions at least this long count for the throughput
+
+/* Counters of the modem link since SerialInitCellular */
+typedef struct _SERIAL_STATS {
+	unsigned int baud;
+	bool flow_control;
+	uint32_t rx_bytes;
+	uint32_t tx_bytes;
+	uint32_t burst_bytes;	// bytes of receptions of STATS_MIN_BURST bytes or more
+	uint32_t burst_ms;		// time from the first to the last byte of those receptions
+	uint32_t stalls;		// times the receive buffer filled up and RTS held the modem off
+	uint32_t overruns;		// bytes that arrived with the receive buffer full, without flow control
+} SERIAL_STATS;
 
-extern volatile uint32_t msTicks;
 extern bool DEBUG;
 
 /**************************************************************************//**
  * @brief Initiates the serial connection.
  * @param port - input port.
  * @param baud - baud rate
+ * @param flow_control - true for RTS/CTS hardware flow control. The modem
+ * then holds off while the receive buffer is full instead of losing bytes.
  * @return true if successful.
  *****************************************************************************/
-bool SerialInitCellular(char* port, unsigned int baud);
+bool SerialInitCellular(char* port, unsigned int baud, bool flow_control);
 
+/**************************************************************************//**
+ * @brief Looks for the modem at each rate of SerialNegotiateBaudCellular,
+ * slowest first, with AT. The modem keeps the rate of AT+IPR over a reset
+ * of either side, so it is not always at the one it powers up with.
+ * Call while not multiplexing.
+ * @return the rate it answered at, the UART stays there. 0 if it did not
+ * answer at any, the UART is then back at the slowest rate.
+ *****************************************************************************/
+unsigned int SerialFindBaudCellular(void);
 
 /**************************************************************************//**
- * @brief Receive data from serial connection.
+ * @brief Moves the link to the fastest rate of up to max_baud both sides
+ * manage: the rates above the current one, slowest first, are each set with
+ * AT+IPR from the last rate that answered and checked with AT. The first
+ * rate the link does not carry ends the climb, the link goes back to the
+ * last good rate if the modem is still there. Call while not multiplexing.
+ * @param max_baud - highest rate to try, e.g. 921600.
+ * @return the rate the link runs at.
+ *****************************************************************************/
+unsigned int SerialNegotiateBaudCellular(unsigned int max_baud);
+
+/**************************************************************************//**
+ * @brief Changes the rate of the UART only, the modem has to be there
+ * already (AT+IPR).
+ * @param baud - baud rate.
+ *****************************************************************************/
+void SerialSetBaudCellular(unsigned int baud);
+
+/**************************************************************************//**
+ * @brief Gets the counters of the link.
+ * @param stats - to be filled.
+ *****************************************************************************/
+void SerialGetStatsCellular(SERIAL_STATS * stats);
+
+
+/**************************************************************************//**
+ * @brief Checks for received bytes nobody read yet, on the selected channel
+ * while multiplexing. The RX interrupt posts EVENT_CELLULAR_RX once the first
+ * of them arrived.
+ * @return true if there are any.
+ *****************************************************************************/
+bool SerialDataAvailableCellular(void);
+
+/**************************************************************************//**
+ * @brief Receive data from serial connection, returns once maxlen bytes
+ * arrived or the timeout passed. For binary data of a known length.
  * @param buf - buffer to be filled.
- * @param maxlen - maximum length of a line of data.
+ * @param maxlen - number of bytes to receive.
  * @param timeout_ms - length of the timeout in ms.
+ * @return number of bytes received.
  *****************************************************************************/
 unsigned int SerialRecvCellular(unsigned char* buf, unsigned int maxlen, unsigned int timeout_ms);
 
+/**************************************************************************//**
+ * @brief Receive data from serial connection until a terminating line arrives.
+ * A line is complete once its '\n' was received. Reception stops on the first
+ * complete line starting with one of the terminators, or on the first complete
+ * non-empty line when terminators is NULL.
+ * @param buf - buffer to be filled (NUL terminated on return).
+ * @param maxlen - size of buf.
+ * @param timeout_ms - in: length of the timeout in ms. out: time left in ms.
+ * @param terminators - line prefixes that end the reception, or NULL.
+ * @param num_terminators - number of items in terminators.
+ * @return number of bytes received.
+ *****************************************************************************/
+unsigned int SerialRecvCellularUntil(unsigned char* buf, unsigned int maxlen, unsigned int* timeout_ms,
+		const char** terminators, int num_terminators);
+
 /**
  * writing buf string to serial port
  * @param buf
@@ -49,6 +128,24 @@ unsigned int SerialRecvCellular(unsigned char* buf, unsigned int maxlen, unsigne
 bool SerialSendCellular(unsigned char *buf, unsigned int size);
 
 
+/**************************************************************************//**
+ * @brief Switches the modem link to 3GPP 27.010 multiplexing (AT+CMUX) and
+ * opens the control, AT, data and status channels. The send and receive
+ * functions then work on the selected channel, the AT channel at first.
+ * @return true if multiplexing, false if the modem refused or a channel did
+ * not open, the link then stays as it was.
+ *****************************************************************************/
+bool SerialMuxCellular(void);
+
+/**************************************************************************//**
+ * @brief Selects the channel the send and receive functions use while
+ * multiplexing. Each channel has its own receive buffer, what arrives on the
+ * others waits there.
+ * @param channel - CMUX_CHANNEL_AT, CMUX_CHANNEL_DATA or CMUX_CHANNEL_STATUS.
+ *****************************************************************************/
+void SerialSelectCellularChannel(uint8_t channel);
+
+
 /**************************************************************************//**
  * @brief Empties the input buffer.
  *****************************************************************************/
@@ -62,8 +159,8 @@ void SerialDisableCellular();
 
 
 /***************************************************************************//**
- * @brief Delays number of msTick Systicks (typically 1 ms)
- * @param dlyTicks Number of ticks to delay
+ * @brief Sleeps for ms milliseconds.
+ * @param ms - time to sleep.
  ******************************************************************************/
 void DelayCellular(uint32_t ms);
 
@@ -0,0 +1,71 @@
+/******************************************************************************
+ * @session.c
+ * @brief Records over a TCP socket kept open across uploads.
+ * @version 0.0.1
+ *  **************************************************************************/
+#include <stdio.h>
+#include <string.h>
+
+#include "session.h"
+#include "cellular.h"
+
+/******************************************************************************
+ * 							GLOBAL VARIABLES
+*****************************************************************************/
+static const char * session_address = NULL;
+static uint8_t record[SESSION_HEADER_SIZE + SESSION_MAX_RECORD];
+static SESSION_STATS stats = {0};
+
+
+void SessionInit(const char * address) {
+	session_address = address;
+	memset(&stats, 0, sizeof(stats));
+}
+
+/******************************************************************************
+ * @brief Opens the socket unless it is still connected.
+ *****************************************************************************/
+static bool sessionConnect(void) {
+	if (CellularSocketIsOpen(SESSION_SRV_PROFILE_ID)) {
+		return true;
+	}
+	if (!CellularSocketOpen(SESSION_SRV_PROFILE_ID, session_address)) {
+		return false;
+	}
+	stats.connects++;
+	if (DEBUG) { printf("session: connected to %s\n", session_address); }
+	return true;
+}
+
+bool SessionSend(uint8_t type, const uint8_t * data, uint32_t len) {
+	if (session_address == NULL || len > SESSION_MAX_RECORD) {
+		return false;
+	}
+
+	// header and payload in one buffer, one AT^SISW
+	record[0] = type;
+	record[1] = (uint8_t) (len >> 8);
+	record[2] = (uint8_t) len;
+	memcpy(&record[SESSION_HEADER_SIZE], data, len);
+
+	// the peer may have closed an idle connection, write again on a new one
+	for (int attempt = 0; attempt < 2; attempt++) {
+		if (!sessionConnect()) {
+			return false;
+		}
+		if (CellularSocketWrite(SESSION_SRV_PROFILE_ID, record, SESSION_HEADER_SIZE + len)) {
+			stats.records++;
+			stats.bytes += SESSION_HEADER_SIZE + len;
+			return true;
+		}
+	}
+	return false;
+}
+
+void SessionClose(void) {
+	CellularSocketClose(SESSION_SRV_PROFILE_ID);
+}
+
+void SessionGetStats(SESSION_STATS * output) {
+	*output = stats;
+}
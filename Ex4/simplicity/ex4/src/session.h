@@ -0,0 +1,68 @@
+/******************************************************************************
+ * @session.h
+ * @brief Interface for sending records over a TCP socket kept open across
+ * uploads. A record is a 3 byte header, the type and the big endian payload
+ * length, followed by the payload. Each record goes out with one AT^SISW.
+ * A connection that was lost is opened again on the next record.
+ * @version 0.0.1
+ *  **************************************************************************/
+#ifndef SRC_SESSION_H_
+#define SRC_SESSION_H_
+
+#include <stdbool.h>
+#include <stdint.h>
+
+extern bool DEBUG;
+
+/******************************************************************************
+ * 								DEFS
+*****************************************************************************/
+#define SESSION_SRV_PROFILE_ID 1
+#define SESSION_HEADER_SIZE 3
+#define SESSION_MAX_RECORD (1500 - SESSION_HEADER_SIZE)	// header and payload fit one AT^SISW
+
+/* Record types */
+#define SESSION_RECORD_LINES 1		// InfluxDB lines, as posted to TRANSMIT_URL
+#define SESSION_RECORD_TELEMETRY 2	// a telemetry batch
+#define SESSION_RECORD_CBOR 3		// a CBOR map
+#define SESSION_RECORD_LZ 0x80		// flag, the payload is LZ compressed
+#define SESSION_RECORD_TYPE_MASK 0x7F
+
+typedef struct _SESSION_STATS {
+	uint32_t records;
+	uint32_t bytes;			// headers included
+	uint32_t connects;		// the first one and every reconnect
+} SESSION_STATS;
+
+
+/******************************************************************************
+ * @brief Sets where the records go. The socket opens with the first record.
+ * @param address - e.g. "socktcp://host:port".
+ *****************************************************************************/
+void SessionInit(const char * address);
+
+
+/******************************************************************************
+ * @brief Sends a record, connecting first if the socket is not open. A write
+ * to a broken connection is tried once more on a new one.
+ * @param type - SESSION_RECORD_* type, may have SESSION_RECORD_LZ set.
+ * @param data - the payload.
+ * @param len - its length, at most SESSION_MAX_RECORD.
+ * @return true if the record was written.
+ *****************************************************************************/
+bool SessionSend(uint8_t type, const uint8_t * data, uint32_t len);
+
+
+/******************************************************************************
+ * @brief Closes the socket.
+ *****************************************************************************/
+void SessionClose(void);
+
+
+/******************************************************************************
+ * @brief Gets the counters since SessionInit.
+ *****************************************************************************/
+void SessionGetStats(SESSION_STATS * stats);
+
+
+#endif /* SRC_SESSION_H_ */
@@ -0,0 +1,179 @@
+/******************************************************************************
+ * @telemetry.c
+ * @brief Compact binary telemetry batches: encoder and decoder.
+ * Consecutive fixes are close in time and space, so their deltas fit in one
+ * or two varint bytes. A point costs about 9 bytes instead of the ~200 of a
+ * GPSGetPayload line.
+ * @version 0.0.1
+ *  **************************************************************************/
+#include <stdio.h>
+#include <string.h>
+
+#include "telemetry.h"
+
+/******************************************************************************
+ * 								DEFS
+*****************************************************************************/
+#define HEADER_FIXED_SIZE 2		// magic, version
+#define LINE_FORMAT "gps,name=%s,ICCID=%s latitude=%.7f,longitude=%.7f,altitude=%ld,hdop=%u,valid_fix=%u,num_sats=%u %lu000000000\n"
+#define LINE_SPEED_FORMAT "gps,name=%s,ICCID=%s latitude=%.7f,longitude=%.7f,altitude=%ld,hdop=%u,valid_fix=%u,num_sats=%u,speed=%u %lu000000000\n"
+
+
+/******************************************************************************
+ * @brief Maps small negative and positive values to small unsigned ones.
+ *****************************************************************************/
+static uint32_t zigZag(int32_t value) {
+	return ((uint32_t) value << 1) ^ (uint32_t) (value >> 31);
+}
+
+static int32_t unZigZag(uint32_t value) {
+	return (int32_t) (value >> 1) ^ -(int32_t) (value & 1);
+}
+
+/******************************************************************************
+ * @brief Writes value as a LEB128 varint, 7 bits per byte.
+ * @return number of bytes written.
+ *****************************************************************************/
+static uint32_t putVarint(uint8_t * out, uint32_t value) {
+	uint32_t len = 0;
+	while (value >= 0x80) {
+		out[len++] = (uint8_t) (value | 0x80);
+		value >>= 7;
+	}
+	out[len++] = (uint8_t) value;
+	return len;
+}
+
+/******************************************************************************
+ * @brief Reads a varint at decoder->pos.
+ * @return false if the data ends inside the varint.
+ *****************************************************************************/
+static bool getVarint(TELEMETRY_DECODER * decoder, uint32_t * value) {
+	*value = 0;
+	for (uint32_t shift = 0; shift < 35; shift += 7) {
+		if (decoder->pos >= decoder->len) {
+			return false;
+		}
+		uint8_t byte = decoder->data[decoder->pos++];
+		*value |= (uint32_t) (byte & 0x7F) << shift;
+		if (!(byte & 0x80)) {
+			return true;
+		}
+	}
+	return false;
+}
+
+/******************************************************************************
+ * @brief Reads a length prefixed string at decoder->pos.
+ *****************************************************************************/
+static bool getString(TELEMETRY_DECODER * decoder, char * str) {
+	if (decoder->pos >= decoder->len) {
+		return false;
+	}
+	uint32_t len = decoder->data[decoder->pos++];
+	if (len > TELEMETRY_MAX_ID_LEN || decoder->pos + len > decoder->len) {
+		return false;
+	}
+	memcpy(str, &decoder->data[decoder->pos], len);
+	str[len] = '\0';
+	decoder->pos += len;
+	return true;
+}
+
+bool TelemetryBegin(TELEMETRY_BATCH * batch, uint8_t * buf, uint32_t size, const char * name, const char * iccid) {
+	uint32_t name_len = strlen(name);
+	uint32_t iccid_len = strlen(iccid);
+
+	memset(batch, 0, sizeof(TELEMETRY_BATCH));
+	if (name_len > TELEMETRY_MAX_ID_LEN || iccid_len > TELEMETRY_MAX_ID_LEN
+			|| HEADER_FIXED_SIZE + 2 + name_len + iccid_len > size) {
+		return false;
+	}
+	batch->buf = buf;
+	batch->size = size;
+
+	buf[batch->len++] = TELEMETRY_MAGIC;
+	buf[batch->len++] = TELEMETRY_VERSION;
+	buf[batch->len++] = (uint8_t) name_len;
+	memcpy(&buf[batch->len], name, name_len);
+	batch->len += name_len;
+	buf[batch->len++] = (uint8_t) iccid_len;
+	memcpy(&buf[batch->len], iccid, iccid_len);
+	batch->len += iccid_len;
+	return true;
+}
+
+bool TelemetryAddPoint(TELEMETRY_BATCH * batch, const TELEMETRY_POINT * point) {
+	uint8_t encoded[TELEMETRY_MAX_POINT_SIZE];
+	uint32_t len = 0;
+	const TELEMETRY_POINT * last = &batch->last;
+
+	// the first point is a delta from all zeros
+	len += putVarint(&encoded[len], zigZag((int32_t) (point->unix_time - last->unix_time)));
+	len += putVarint(&encoded[len], zigZag(point->latitude - last->latitude));
+	len += putVarint(&encoded[len], zigZag(point->longitude - last->longitude));
+	len += putVarint(&encoded[len], zigZag(point->altitude - last->altitude));
+	len += putVarint(&encoded[len], zigZag((int32_t) point->speed - (int32_t) last->speed));
+	len += putVarint(&encoded[len], point->hdop);
+	encoded[len++] = point->sats_flags;
+
+	if (batch->buf == NULL || batch->len + len > batch->size) {
+		return false;
+	}
+	memcpy(&batch->buf[batch->len], encoded, len);
+	batch->len += len;
+	batch->num_points++;
+	batch->last = *point;
+	return true;
+}
+
+bool TelemetryDecodeBegin(TELEMETRY_DECODER * decoder, const uint8_t * data, uint32_t len) {
+	memset(decoder, 0, sizeof(TELEMETRY_DECODER));
+	decoder->data = data;
+	decoder->len = len;
+
+	if (len < HEADER_FIXED_SIZE || data[0] != TELEMETRY_MAGIC || data[1] != TELEMETRY_VERSION) {
+		return false;
+	}
+	decoder->pos = HEADER_FIXED_SIZE;
+	return getString(decoder, decoder->name) && getString(decoder, decoder->iccid);
+}
+
+bool TelemetryDecodeNext(TELEMETRY_DECODER * decoder, TELEMETRY_POINT * point) {
+	uint32_t time, latitude, longitude, altitude, speed, hdop;
+
+	if (decoder->pos >= decoder->len) {
+		return false;
+	}
+	if (!getVarint(decoder, &time) || !getVarint(decoder, &latitude) || !getVarint(decoder, &longitude)
+			|| !getVarint(decoder, &altitude) || !getVarint(decoder, &speed) || !getVarint(decoder, &hdop)
+			|| decoder->pos >= decoder->len) {
+		return false;
+	}
+
+	TELEMETRY_POINT * last = &decoder->last;
+	point->unix_time = last->unix_time + (uint32_t) unZigZag(time);
+	point->latitude = last->latitude + unZigZag(latitude);
+	point->longitude = last->longitude + unZigZag(longitude);
+	point->altitude = last->altitude + unZigZag(altitude);
+	point->speed = (uint16_t) (last->speed + unZigZag(speed));
+	point->hdop = (uint8_t) hdop;
+	point->sats_flags = decoder->data[decoder->pos++];
+	*last = *point;
+	return true;
+}
+
+int TelemetryFormatLine(const TELEMETRY_DECODER * decoder, const TELEMETRY_POINT * point, char * line, uint32_t maxlen) {
+	double lat_deg = point->latitude / 10000000.0;
+	double long_deg = point->longitude / 10000000.0;
+	long altitude = (long) point->altitude * TELEMETRY_LINE_ALT_FACTOR;
+	unsigned valid_fix = (point->sats_flags & TELEMETRY_VALID_FIX) ? 1 : 0;
+	unsigned num_sats = point->sats_flags & TELEMETRY_SATS_MASK;
+
+	if (point->sats_flags & TELEMETRY_HAS_SPEED) {
+		return snprintf(line, maxlen, LINE_SPEED_FORMAT, decoder->name, decoder->iccid, lat_deg, long_deg,
+						altitude, point->hdop, valid_fix, num_sats, point->speed, (unsigned long) point->unix_time);
+	}
+	return snprintf(line, maxlen, LINE_FORMAT, decoder->name, decoder->iccid, lat_deg, long_deg,
+					altitude, point->hdop, valid_fix, num_sats, (unsigned long) point->unix_time);
+}
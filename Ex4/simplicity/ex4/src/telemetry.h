@@ -0,0 +1,116 @@
+/******************************************************************************
+ * @telemetry.h
+ * @brief Interface for the compact binary telemetry batch format.
+ * A batch holds the device identity once and then every point as zig-zag
+ * varint deltas from the previous one:
+ *   header: magic, version, name length, name, ICCID length, ICCID
+ *   point:  time, latitude, longitude, altitude, speed (signed deltas),
+ *           hdop (unsigned), sats/flags byte
+ * Plain C without peripheral dependencies, the decoder builds on the host.
+ * @version 0.0.1
+ *  **************************************************************************/
+#ifndef SRC_TELEMETRY_H_
+#define SRC_TELEMETRY_H_
+
+#include <stdbool.h>
+#include <stdint.h>
+
+/******************************************************************************
+ * 								DEFS
+*****************************************************************************/
+#define TELEMETRY_DEVICE_NAME "NetanelFayoumi_SapirElyovitch"
+#define TELEMETRY_CONTENT_TYPE "application/octet-stream"
+#define TELEMETRY_MAGIC 0x54				// 'T'
+#define TELEMETRY_VERSION 1
+#define TELEMETRY_MAX_ID_LEN 63				// name and ICCID
+#define TELEMETRY_MAX_POINT_SIZE 28			// 5 deltas of up to 5 bytes, hdop, flags
+#define TELEMETRY_LINE_ALT_FACTOR 100		// altitude scale of the writeFixLine text line
+
+/* Same bits as the GPS_RECORD_* flags of a GPS_FIX_RECORD */
+#define TELEMETRY_SATS_MASK 0x0F
+#define TELEMETRY_VALID_FIX 0x10
+#define TELEMETRY_HAS_SPEED 0x20
+
+typedef struct _TELEMETRY_POINT {
+	uint32_t unix_time;
+	int32_t latitude;		// 1e-7 degrees
+	int32_t longitude;		// 1e-7 degrees
+	int32_t altitude;		// meters
+	uint16_t speed;			// cm/s
+	uint8_t hdop;
+	uint8_t sats_flags;		// TELEMETRY_SATS_MASK | TELEMETRY_* flags
+} TELEMETRY_POINT;
+
+/* Batch being encoded into a caller's buffer */
+typedef struct _TELEMETRY_BATCH {
+	uint8_t * buf;
+	uint32_t size;
+	uint32_t len;			// bytes used
+	uint32_t num_points;
+	TELEMETRY_POINT last;	// deltas are taken from it
+} TELEMETRY_BATCH;
+
+/* Batch being decoded */
+typedef struct _TELEMETRY_DECODER {
+	const uint8_t * data;
+	uint32_t len;
+	uint32_t pos;
+	char name[TELEMETRY_MAX_ID_LEN + 1];
+	char iccid[TELEMETRY_MAX_ID_LEN + 1];
+	TELEMETRY_POINT last;
+} TELEMETRY_DECODER;
+
+
+/******************************************************************************
+ * @brief Starts a batch with the device identity.
+ * @param batch - batch to be set up.
+ * @param buf - buffer for the encoded batch.
+ * @param size - size of buf.
+ * @param name - device name.
+ * @param iccid - SIM ICCID.
+ * @return false if the header does not fit.
+ *****************************************************************************/
+bool TelemetryBegin(TELEMETRY_BATCH * batch, uint8_t * buf, uint32_t size, const char * name, const char * iccid);
+
+
+/******************************************************************************
+ * @brief Appends a point.
+ * @param batch - batch from TelemetryBegin.
+ * @param point - the point.
+ * @return false if the point does not fit, the batch is left unchanged.
+ *****************************************************************************/
+bool TelemetryAddPoint(TELEMETRY_BATCH * batch, const TELEMETRY_POINT * point);
+
+
+/******************************************************************************
+ * @brief Reads the header of a batch.
+ * @param decoder - decoder to be set up, holds the identity afterwards.
+ * @param data - encoded batch.
+ * @param len - length of data.
+ * @return false if data is not a batch of this version.
+ *****************************************************************************/
+bool TelemetryDecodeBegin(TELEMETRY_DECODER * decoder, const uint8_t * data, uint32_t len);
+
+
+/******************************************************************************
+ * @brief Decodes the next point.
+ * @param decoder - decoder from TelemetryDecodeBegin.
+ * @param point - point to be filled.
+ * @return false at the end of the batch or on a truncated point.
+ *****************************************************************************/
+bool TelemetryDecodeNext(TELEMETRY_DECODER * decoder, TELEMETRY_POINT * point);
+
+
+/******************************************************************************
+ * @brief Formats a point as an InfluxDB line, like writeFixLine does with a
+ * text fix.
+ * @param decoder - decoder the point came from, gives the identity.
+ * @param point - the point.
+ * @param line - output buffer.
+ * @param maxlen - size of line.
+ * @return length of the line, as snprintf.
+ *****************************************************************************/
+int TelemetryFormatLine(const TELEMETRY_DECODER * decoder, const TELEMETRY_POINT * point, char * line, uint32_t maxlen);
+
+
+#endif /* SRC_TELEMETRY_H_ */
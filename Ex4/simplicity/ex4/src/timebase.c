@@ -0,0 +1,101 @@
+/******************************************************************************
+ * @timebase.c
+ * @brief Tickless 64 bit low energy timebase (RTCC).
+ * @version 0.0.1
+ *  **************************************************************************/
+#include "em_device.h"
+#include "em_cmu.h"
+#include "em_core.h"
+#include "em_rtcc.h"
+
+#include "timebase.h"
+
+/******************************************************************************
+ * 								DEFS
+*****************************************************************************/
+#define RTCC_WAKEUP_CHANNEL 1
+#define MIN_WAKEUP_TICKS 2				// the compare must lie in the future
+#define MAX_WAKEUP_TICKS 0xFFFF0000UL	// stay clear of a full counter wrap
+
+/******************************************************************************
+ * 							GLOBAL VARIABLES
+*****************************************************************************/
+static volatile uint32_t overflow_count = 0;	// upper 32 bits of the tick count
+
+
+/******************************************************************************
+ * @brief RTCC interrupt. Counts overflows, the compare only wakes the core.
+ *****************************************************************************/
+void RTCC_IRQHandler(void) {
+	uint32_t flags = RTCC_IntGet();
+	RTCC_IntClear(flags);
+
+	if (flags & RTCC_IF_OF) {
+		overflow_count++;
+	}
+	if (flags & RTCC_IF_CC1) {
+		RTCC_IntDisable(RTCC_IEN_CC1);
+	}
+}
+
+void TimebaseInit(void) {
+	// RTCC runs from LFXO, keeps counting in EM2
+	CMU_ClockEnable(cmuClock_HFLE, true);
+	CMU_ClockSelectSet(cmuClock_LFE, cmuSelect_LFXO);
+	CMU_ClockEnable(cmuClock_RTCC, true);
+
+	RTCC_Init_TypeDef init = RTCC_INIT_DEFAULT;
+	init.presc = rtccCntPresc_1;
+	RTCC_Init(&init);
+
+	RTCC_CCChConf_TypeDef compare = RTCC_CH_INIT_COMPARE_DEFAULT;
+	RTCC_ChannelInit(RTCC_WAKEUP_CHANNEL, &compare);
+
+	RTCC_IntClear(RTCC_IF_OF | RTCC_IF_CC1);
+	RTCC_IntEnable(RTCC_IEN_OF);
+	NVIC_ClearPendingIRQ(RTCC_IRQn);
+	NVIC_EnableIRQ(RTCC_IRQn);
+}
+
+uint64_t TimebaseGetTicks(void) {
+	CORE_DECLARE_IRQ_STATE;
+	CORE_ENTER_ATOMIC();
+	uint32_t cnt = RTCC_CounterGet();
+	uint32_t overflows = overflow_count;
+	// the counter wrapped but the interrupt did not run yet
+	if (RTCC_IntGet() & RTCC_IF_OF) {
+		cnt = RTCC_CounterGet();
+		overflows++;
+	}
+	CORE_EXIT_ATOMIC();
+	return ((uint64_t) overflows << 32) | cnt;
+}
+
+uint64_t TimebaseGetMs(void) {
+	return (TimebaseGetTicks() * 1000) / RTCC_FREQ_HZ;
+}
+
+void TimebaseSetWakeup(uint64_t deadline_ms) {
+	CORE_DECLARE_IRQ_STATE;
+	CORE_ENTER_ATOMIC();
+	uint64_t now = TimebaseGetTicks();
+	// round up, never wake before the deadline
+	uint64_t target = (deadline_ms * RTCC_FREQ_HZ + 999) / 1000;
+
+	if (target < now + MIN_WAKEUP_TICKS) {
+		target = now + MIN_WAKEUP_TICKS;
+	} else if (target - now > MAX_WAKEUP_TICKS) {
+		// too far for one compare, wake early and re-arm
+		target = now + MAX_WAKEUP_TICKS;
+	}
+
+	RTCC_ChannelCCVSet(RTCC_WAKEUP_CHANNEL, (uint32_t) target);
+	RTCC_IntClear(RTCC_IF_CC1);
+	RTCC_IntEnable(RTCC_IEN_CC1);
+	CORE_EXIT_ATOMIC();
+}
+
+void TimebaseCancelWakeup(void) {
+	RTCC_IntDisable(RTCC_IEN_CC1);
+	RTCC_IntClear(RTCC_IF_CC1);
+}
@@ -0,0 +1,54 @@
+/******************************************************************************
+ * @timebase.h
+ * @brief Interface for the tickless 64 bit low energy timebase (RTCC).
+ * @version 0.0.1
+ *  **************************************************************************/
+#ifndef SRC_TIMEBASE_H_
+#define SRC_TIMEBASE_H_
+
+#include <stdbool.h>
+#include <stdint.h>
+
+/******************************************************************************
+ * 								DEFS
+*****************************************************************************/
+#define RTCC_FREQ_HZ 32768
+#define TIMEBASE_NO_DEADLINE UINT64_MAX
+
+
+/******************************************************************************
+ * @brief Starts the RTCC from LFXO. It keeps counting in EM2 and only
+ * interrupts on overflow (every ~36 hours) and on the one-shot wake up.
+ *****************************************************************************/
+void TimebaseInit(void);
+
+
+/******************************************************************************
+ * @brief Gets the RTCC ticks (1/32768 s) since TimebaseInit.
+ * @return 64 bit tick count, never wraps.
+ *****************************************************************************/
+uint64_t TimebaseGetTicks(void);
+
+
+/******************************************************************************
+ * @brief Gets the milliseconds since TimebaseInit.
+ * @return 64 bit ms count, never wraps.
+ *****************************************************************************/
+uint64_t TimebaseGetMs(void);
+
+
+/******************************************************************************
+ * @brief Arms the one-shot compare to wake the core at deadline_ms.
+ * Replaces the previous wake up. Deadlines that already passed fire at once.
+ * @param deadline_ms - absolute time, as returned by TimebaseGetMs.
+ *****************************************************************************/
+void TimebaseSetWakeup(uint64_t deadline_ms);
+
+
+/******************************************************************************
+ * @brief Disarms the one-shot compare.
+ *****************************************************************************/
+void TimebaseCancelWakeup(void);
+
+
+#endif /* SRC_TIMEBASE_H_ */
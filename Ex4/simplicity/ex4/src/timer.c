@@ -0,0 +1,224 @@
+/******************************************************************************
+ * @timer.c
+ * @brief Software timers on top of the tickless timebase.
+ * Active timers are kept in a hierarchical timing wheel with 1ms resolution.
+ * Level k has 64 slots of 64^k ms each, a timer sits in the lowest level whose
+ * range reaches its expiry. When time passes a slot, its timers either fire or
+ * move down to a finer level. Start, stop and expiry are O(1) per timer, the
+ * work done by TimerProcess does not depend on the number of timers.
+ * @version 0.0.1
+ *  **************************************************************************/
+#include "em_device.h"
+#include "em_core.h"
+
+#include "timer.h"
+
+/******************************************************************************
+ * 								DEFS
+*****************************************************************************/
+#define SLOT_MASK (TIMER_WHEEL_SLOTS - 1)
+#define LEVEL_SHIFT(level) ((level) * TIMER_WHEEL_SLOT_BITS)
+#define EXPIRED_LEVEL TIMER_WHEEL_LEVELS	// timers already due
+
+/******************************************************************************
+ * 							GLOBAL VARIABLES
+*****************************************************************************/
+static TIMER * wheel[TIMER_WHEEL_LEVELS][TIMER_WHEEL_SLOTS];
+static uint64_t occupied[TIMER_WHEEL_LEVELS];	// bit per non-empty slot
+static TIMER * expired_list = NULL;
+static uint64_t wheel_time_ms = 0;				// time the wheel was processed up to
+static bool WHEEL_INITIALIZED = false;
+
+
+/******************************************************************************
+ * @brief Gets the list a timer at level/slot belongs to.
+ *****************************************************************************/
+static TIMER ** slotList(uint8_t level, uint8_t slot) {
+	return (level == EXPIRED_LEVEL) ? &expired_list : &wheel[level][slot];
+}
+
+/******************************************************************************
+ * @brief Puts a timer in the lowest level whose range reaches its expiry.
+ * Must be called atomically.
+ *****************************************************************************/
+static void insertTimer(TIMER * timer) {
+	uint8_t level = EXPIRED_LEVEL;
+	uint8_t slot = 0;
+
+	if (timer->expiry_ms > wheel_time_ms) {
+		for (level = 0; level < TIMER_WHEEL_LEVELS; level++) {
+			uint64_t distance = (timer->expiry_ms >> LEVEL_SHIFT(level)) - (wheel_time_ms >> LEVEL_SHIFT(level));
+			if (distance < TIMER_WHEEL_SLOTS) {
+				slot = (timer->expiry_ms >> LEVEL_SHIFT(level)) & SLOT_MASK;
+				break;
+			}
+		}
+		if (level == TIMER_WHEEL_LEVELS) {
+			// beyond the wheel, park in the farthest slot and re-insert from there
+			level = TIMER_WHEEL_LEVELS - 1;
+			slot = ((wheel_time_ms >> LEVEL_SHIFT(level)) + SLOT_MASK) & SLOT_MASK;
+		}
+		occupied[level] |= (1ULL << slot);
+	}
+
+	TIMER ** list = slotList(level, slot);
+	timer->level = level;
+	timer->slot = slot;
+	timer->prev = NULL;
+	timer->next = *list;
+	if (*list != NULL) {
+		(*list)->prev = timer;
+	}
+	*list = timer;
+	timer->active = true;
+}
+
+/******************************************************************************
+ * @brief Unlinks a timer from its slot. Must be called atomically.
+ *****************************************************************************/
+static void removeTimer(TIMER * timer) {
+	TIMER ** list = slotList(timer->level, timer->slot);
+	if (timer->prev != NULL) {
+		timer->prev->next = timer->next;
+	} else {
+		*list = timer->next;
+	}
+	if (timer->next != NULL) {
+		timer->next->prev = timer->prev;
+	}
+	if (timer->level != EXPIRED_LEVEL && *list == NULL) {
+		occupied[timer->level] &= ~(1ULL << timer->slot);
+	}
+	timer->next = NULL;
+	timer->prev = NULL;
+	timer->active = false;
+}
+
+/******************************************************************************
+ * @brief Moves the wheel forward to now. Timers of every slot passed on the
+ * way are re-inserted, which puts the due ones on the expired list.
+ * Must be called atomically.
+ *****************************************************************************/
+static void advanceWheel(uint64_t now) {
+	uint64_t old_time = wheel_time_ms;
+	if (now <= old_time) {
+		return;
+	}
+	wheel_time_ms = now;
+
+	for (int level = TIMER_WHEEL_LEVELS - 1; level >= 0; level--) {
+		uint64_t first = (old_time >> LEVEL_SHIFT(level)) + 1;
+		uint64_t last = now >> LEVEL_SHIFT(level);
+		if (first > last || occupied[level] == 0) {
+			continue;
+		}
+		uint32_t passed = (last - first >= SLOT_MASK) ? TIMER_WHEEL_SLOTS : (uint32_t) (last - first + 1);
+
+		for (uint32_t i = 0; i < passed; i++) {
+			uint8_t slot = (first + i) & SLOT_MASK;
+			if (!(occupied[level] & (1ULL << slot))) {
+				continue;
+			}
+			TIMER * timer = wheel[level][slot];
+			wheel[level][slot] = NULL;
+			occupied[level] &= ~(1ULL << slot);
+			while (timer != NULL) {
+				TIMER * next = timer->next;
+				insertTimer(timer);
+				timer = next;
+			}
+		}
+	}
+}
+
+void TimerStart(TIMER * timer, uint32_t delay_ms, uint32_t period_ms, TIMER_CALLBACK callback, void * arg) {
+	CORE_DECLARE_IRQ_STATE;
+	CORE_ENTER_ATOMIC();
+	if (!WHEEL_INITIALIZED) {
+		wheel_time_ms = TimebaseGetMs();
+		WHEEL_INITIALIZED = true;
+	}
+	if (timer->active) {
+		removeTimer(timer);
+	}
+	timer->expiry_ms = TimebaseGetMs() + delay_ms;
+	timer->period_ms = period_ms;
+	timer->callback = callback;
+	timer->arg = arg;
+	insertTimer(timer);
+	CORE_EXIT_ATOMIC();
+}
+
+void TimerStop(TIMER * timer) {
+	CORE_DECLARE_IRQ_STATE;
+	CORE_ENTER_ATOMIC();
+	if (timer->active) {
+		removeTimer(timer);
+	}
+	CORE_EXIT_ATOMIC();
+}
+
+bool TimerIsActive(TIMER * timer) {
+	return timer->active;
+}
+
+void TimerProcess(void) {
+	CORE_DECLARE_IRQ_STATE;
+	uint64_t now = TimebaseGetMs();
+
+	CORE_ENTER_ATOMIC();
+	advanceWheel(now);
+	CORE_EXIT_ATOMIC();
+
+	while (true) {
+		CORE_ENTER_ATOMIC();
+		TIMER * timer = expired_list;
+		if (timer == NULL) {
+			CORE_EXIT_ATOMIC();
+			break;
+		}
+		removeTimer(timer);
+		if (timer->period_ms > 0) {
+			// keep the period exact, skip beats that were missed entirely
+			timer->expiry_ms += timer->period_ms;
+			if (timer->expiry_ms <= now) {
+				timer->expiry_ms = now + timer->period_ms;
+			}
+			insertTimer(timer);
+		}
+		CORE_EXIT_ATOMIC();
+
+		if (timer->callback != NULL) {
+			timer->callback(timer->arg);
+		}
+	}
+}
+
+uint64_t TimerNextDeadline(void) {
+	CORE_DECLARE_IRQ_STATE;
+	uint64_t deadline = TIMEBASE_NO_DEADLINE;
+
+	CORE_ENTER_ATOMIC();
+	if (expired_list != NULL) {
+		deadline = wheel_time_ms;
+	} else {
+		// the first occupied slot of every level, wake up when it starts
+		for (int level = 0; level < TIMER_WHEEL_LEVELS; level++) {
+			if (occupied[level] == 0) {
+				continue;
+			}
+			uint64_t current = wheel_time_ms >> LEVEL_SHIFT(level);
+			for (uint32_t i = 1; i <= TIMER_WHEEL_SLOTS; i++) {
+				if (occupied[level] & (1ULL << ((current + i) & SLOT_MASK))) {
+					uint64_t slot_start = (current + i) << LEVEL_SHIFT(level);
+					if (slot_start < deadline) {
+						deadline = slot_start;
+					}
+					break;
+				}
+			}
+		}
+	}
+	CORE_EXIT_ATOMIC();
+	return deadline;
+}
@@ -0,0 +1,77 @@
+/******************************************************************************
+ * @timer.h
+ * @brief Interface for software timers on top of the tickless timebase.
+ * @version 0.0.1
+ *  **************************************************************************/
+#ifndef SRC_TIMER_H_
+#define SRC_TIMER_H_
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include "timebase.h"
+
+/******************************************************************************
+ * 								DEFS
+*****************************************************************************/
+typedef void (*TIMER_CALLBACK)(void * arg);
+
+#define TIMER_WHEEL_LEVELS 4
+#define TIMER_WHEEL_SLOT_BITS 6		// 64 slots per level, 1ms * 64^4 = 4.6 hours
+#define TIMER_WHEEL_SLOTS (1 << TIMER_WHEEL_SLOT_BITS)
+
+/* Timers are allocated by the caller and must stay valid while active. */
+typedef struct _TIMER {
+	uint64_t expiry_ms;		// absolute TimebaseGetMs time
+	uint32_t period_ms;		// 0 for a one-shot timer
+	TIMER_CALLBACK callback;
+	void * arg;
+	bool active;
+	uint8_t level;			// wheel position, valid while active
+	uint8_t slot;
+	struct _TIMER * next;
+	struct _TIMER * prev;
+} TIMER;
+
+
+/******************************************************************************
+ * @brief Starts (or restarts) a timer.
+ * @param timer - the timer.
+ * @param delay_ms - time until the first expiry.
+ * @param period_ms - time between expiries, 0 for a one-shot timer.
+ * @param callback - called from TimerProcess on expiry, may be NULL.
+ * @param arg - passed to callback.
+ *****************************************************************************/
+void TimerStart(TIMER * timer, uint32_t delay_ms, uint32_t period_ms, TIMER_CALLBACK callback, void * arg);
+
+
+/******************************************************************************
+ * @brief Stops a timer. Stopping an inactive timer does nothing.
+ * @param timer - the timer.
+ *****************************************************************************/
+void TimerStop(TIMER * timer);
+
+
+/******************************************************************************
+ * @param timer - the timer.
+ * @return true if the timer is running.
+ *****************************************************************************/
+bool TimerIsActive(TIMER * timer);
+
+
+/******************************************************************************
+ * @brief Runs the callbacks of all expired timers and restarts periodic ones.
+ * Must be called from thread context, not from an interrupt.
+ *****************************************************************************/
+void TimerProcess(void);
+
+
+/******************************************************************************
+ * @return the time the core has to wake up to process timers: the expiry of
+ * the nearest timer, or earlier when a timer is due to move down a wheel
+ * level. TIMEBASE_NO_DEADLINE if no timer is active.
+ *****************************************************************************/
+uint64_t TimerNextDeadline(void);
+
+
+#endif /* SRC_TIMER_H_ */